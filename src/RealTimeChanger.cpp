@@ -8,12 +8,14 @@
 #include "gui/vcombobox.h"
 #include "mengumath.h"
 #include "nanogui/common.h"
+#include "nanogui/label.h"
 #include "nanogui/layout.h"
 #include "nanogui/screen.h"
 #include "nanogui/slider.h"
 #include "nanogui/vector.h"
 #include "nanogui/widget.h"
 #include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <vector>
 
@@ -36,6 +38,8 @@ Mengu::RealTimeChanger::RealTimeChanger() :
     _raw_graph = new LinePlotGPU(_root, "Raw Mic");
     _raw_graph->get_values().resize(capture.raw_bufferf.size());
 
+    _loudness_label = new Label(_root, "");
+
     _effect_control_container = new Widget(_root);
     _effect_control_container->set_layout(new BoxLayout(
         Orientation::Vertical, 
@@ -70,6 +74,12 @@ void Mengu::RealTimeChanger::draw_all() {
     std::vector<float> &raw = _raw_graph->get_values();
     capture.raw_bufferf.to_array(raw.data(), raw.size());
 
+    char loudness[128];
+    std::snprintf(loudness, sizeof(loudness), "Output  M %.1f  S %.1f  I %.1f LUFS  LRA %.1f LU",
+        capture.output_meter.get_momentary(), capture.output_meter.get_short_term(),
+        capture.output_meter.get_integrated(), capture.output_meter.get_loudness_range());
+    _loudness_label->set_caption(loudness);
+
     nanogui::Screen::draw_all();
 }
 
@@ -10,6 +10,7 @@
 #include <nanogui/slider.h>
 #include <nanogui/layout.h>
 #include <nanogui/button.h>
+#include <nanogui/label.h>
 #include <string>
 
 #include "audioplayers/Microphoneaudiocapture.h"
@@ -29,6 +30,7 @@ public:
 private:
     MicrophoneAudioCapture capture;
     LinePlotGPU *_raw_graph;
+    nanogui::Label *_loudness_label;
 
     static inline const std::array<std::string, 5> EffectNames {
         "WSOLA Pitch Shifter",
@@ -31,72 +31,71 @@ Mengu::AudioPlayer::AudioPlayer() {
     pitch_shifter = pitch_shifters[0];
     left_buffer.resize(BufferSize);
     right_buffer.resize(BufferSize);
-    
+    _samples.resize(_worker.get_block_size());
 }
 
 Mengu::AudioPlayer::~AudioPlayer() {
     if (file_loaded) {
         ma_device_uninit(&_device);
-        ma_decoder_uninit(&_decoder);
     }
+    // the worker still has the pitch shifter, and reads what the reader decodes
+    _worker.stop();
+    _reader.stop();
+    delete _source;
     for (uint32_t i = 0; i < NPitchShifters; i++){
         delete pitch_shifters[i];
     }
 }
 
-static ma_encoding_format get_encoding_format(const fs::path &file_path) {
-    const fs::path ext = file_path.extension();
-    if ( ext == ".ogg") { return ma_encoding_format_vorbis; }
-    else if (ext == ".wav") { return ma_encoding_format_wav; }
-    else if (ext == ".mp3") { return ma_encoding_format_mp3; }
-    else { return ma_encoding_format_unknown; }
-}
-
 uint32_t Mengu::AudioPlayer::load_file(const fs::path &file_path) {
     if (file_loaded) {
         ma_device_uninit(&_device);
-        ma_decoder_uninit(&_decoder);
+        _worker.stop();
+        _reader.stop();
     }
-    ma_decoder_config decoder_config =  ma_decoder_config_init(ma_format_f32, 1, 44100);
-    decoder_config.encodingFormat = get_encoding_format(file_path);
-
-    ma_result result = ma_decoder_init_file(file_path.string().c_str(), &decoder_config, &_decoder);
-    if (result != MA_SUCCESS) {
-        std::string err_msg ("Could not load file with ");
-        err_msg += std::to_string(result);
-        file_loaded = false;
-
-        return result;
-        throw std::runtime_error(err_msg);
+    delete _source;
+    _source = nullptr;
+    file_loaded = false;
 
+    try {
+        // mono, at the file's own rate. Mono wavs are read straight from the file rather than decoded
+        _source = open_audio_source(file_path, 1);
+    }
+    catch (const std::runtime_error &) {
+        return MA_ERROR;
     }
-    else {
-        ma_device_config device_config = ma_device_config_init(ma_device_type_playback);
-        device_config.playback.format = _decoder.outputFormat;
-        device_config.playback.channels = _decoder.outputChannels;
-        device_config.sampleRate = _decoder.outputSampleRate;
-        device_config.dataCallback = _data_callback;
-        ddata = {this, &_decoder};
-        device_config.pUserData = &ddata;
-
-        if (ma_device_init(nullptr, &device_config, &_device) != MA_SUCCESS) {
-            throw std::runtime_error("Could not init audio device");
-        }
-
-        ma_device_set_master_volume(&_device, 0.5);
 
-        file_loaded = true;
-        return 0;
+    for (uint32_t i = 0; i < NPitchShifters; i++) {
+        pitch_shifters[i]->set_sample_rate(_source->get_sample_rate());
+    }
+    _decoded.resize(_worker.get_block_size() * _source->get_n_channels());
+
+    ma_device_config device_config = ma_device_config_init(ma_device_type_playback);
+    device_config.playback.format = ma_format_f32;
+    device_config.playback.channels = _source->get_n_channels();
+    device_config.sampleRate = _source->get_sample_rate();
+    device_config.dataCallback = _data_callback;
+    ddata = {this, _source};
+    device_config.pUserData = &ddata;
+
+    if (ma_device_init(nullptr, &device_config, &_device) != MA_SUCCESS) {
+        throw std::runtime_error("Could not init audio device");
     }
 
-    
+    ma_device_set_master_volume(&_device, 0.5);
+
+    file_loaded = true;
+    return 0;
 }
 
 void Mengu::AudioPlayer::play() {
     if (file_loaded) {
         stop();
 
-        ma_decoder_seek_to_pcm_frame(&_decoder, 0);
+        _reader.start(_source, 0);
+        _worker.start([this] (const float *, float *output, uint32_t n_frames) {
+            _render(output, n_frames);
+        }, 0, _device.playback.channels);
         if (ma_device_start(&_device) != MA_SUCCESS) {
             throw "could not play file";
         }
@@ -109,6 +108,9 @@ void Mengu::AudioPlayer::stop() {
             throw "could not stop file";
         }
     }
+    // what it ran ahead is dropped with the rest of what the pitch shifter had
+    _worker.stop();
+    _reader.stop();
 
     pitch_shifter->reset();
 }
@@ -119,42 +121,48 @@ void Mengu::AudioPlayer::set_pitch_shifter(uint32_t ind) {
     }
 }
 
+void Mengu::AudioPlayer::set_lookahead(uint32_t n_frames) {
+    _worker.set_lookahead(n_frames);
+}
+
+void Mengu::AudioPlayer::set_read_ahead(uint32_t n_frames) {
+    _reader.set_read_ahead(n_frames);
+}
+
+void Mengu::AudioPlayer::_render(float *output, uint32_t n_frames) {
+    const uint32_t input_channels = _source->get_n_channels();
+    const uint32_t output_channels = _device.playback.channels;
+
+    const uint32_t n_read = _reader.read(_decoded.data(), n_frames);
+    // silence past the end of the file, or where decoding has fallen behind
+    for (ma_uint32 i = 0; i < n_frames; i++) {
+        _samples[i] = i < n_read ? Complex(_decoded[input_channels * i]) : Complex(0.0f);
+    }
+
+    pitch_shifter->push_signal(_samples.data(), n_frames);
+    pitch_shifter->pop_transformed_signal(_samples.data(), n_frames);
+
+    for (ma_uint32 channel = 0; channel < output_channels; channel++) {
+        for (ma_uint32 i = 0; i < n_frames; i++) {
+            output[output_channels * i + channel] = 0.5 * _samples[i].real();
+        }
+    }
+}
+
 void Mengu::AudioPlayer::_data_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count) {
     DeviceData *ddata = (DeviceData *)device->pUserData;
     AudioPlayer *player = ddata->player;
     CycleQueue<float> &buffer = player->sample_buffer;
-    auto *pitch_shifter = player->pitch_shifter;
 
-    ma_decoder *decoder = ddata->decoder;
-    if (decoder == nullptr) {
+    AudioSource *source = ddata->source;
+    if (source == nullptr) {
         return;
     }
 
-
-    ma_uint32 input_channels = decoder->outputChannels;
-    ma_uint32 output_channels = device->playback.channels;
-
     float *outputf = (float *)output;
 
-    std::vector<Complex> left_samples(frame_count);
-
-    for (uint32_t j = 0; j < 1; j++) {
-        ma_decoder_read_pcm_frames(decoder, output, frame_count, nullptr);
-        
-        for (ma_uint32 i = 0; i < frame_count; i++) {
-            left_samples[i] = Complex(outputf[input_channels * i]);
-        }
-
-        pitch_shifter->push_signal(left_samples.data(), frame_count);
-    }
-    
-    pitch_shifter->pop_transformed_signal(left_samples.data(),frame_count);
-
-    for (ma_uint32 channel = 0; channel < output_channels; channel++) {
-        for (ma_uint32 i = 0; i < frame_count; i++) {
-            outputf[output_channels * i + channel] = 0.5* left_samples[i].real();
-        }
-    }
+    // the pitch shifter has already run on the worker
+    player->_worker.process(nullptr, outputf, frame_count);
 
     int sample_coeff = 8;
     for (ma_uint32 i = 0; i * sample_coeff < frame_count; i++) {
@@ -1,15 +1,19 @@
 #ifndef MENGA_AUDIO_PLAYER
 #define MENGA_AUDIO_PLAYER
 
+#include "audioplayers/Decodeaheadreader.h"
+#include "audioplayers/Realtimeworker.h"
 #include "dsp/effect.h"
 #include "dsp/fft.h"
 #include "miniaudio.h"
+#include "offline/audiofile.h"
 
 
 #include <cstdint>
 #include <templates/cyclequeue.h>
 #include <dsp/pitchshifter.h>
 #include <filesystem>
+#include <vector>
 
 namespace fs = std::filesystem;
 
@@ -39,16 +43,39 @@ public:
 
     void set_pitch_shifter(uint32_t ind);
 
+    // How many frames the pitch shifter runs ahead of the device, on a thread of its own.
+    // More rides out longer bursts of work, but changes to the effects take longer to be heard. Takes effect on the next play
+    void set_lookahead(uint32_t n_frames);
+    inline uint32_t get_lookahead() const {
+        return _worker.get_lookahead();
+    }
+
+    // How many frames of the file are decoded ahead of playing it, on a thread of its own.
+    // More rides out longer disk stalls. Takes effect on the next play
+    void set_read_ahead(uint32_t n_frames);
+    inline uint32_t get_read_ahead() const {
+        return _reader.get_read_ahead();
+    }
+
 
 private:
     struct DeviceData {
         Mengu::AudioPlayer *player;
-        ma_decoder *decoder;
+        AudioSource *source;
     };
     ma_device _device;
-    ma_decoder _decoder;
+    AudioSource *_source = nullptr;
     DeviceData ddata;
 
+    // decodes the file ahead of the worker, so the disk never holds it up
+    DecodeAheadReader _reader;
+    RealTimeWorker _worker;
+    // a block of the worker's, decoded and shifted
+    std::vector<float> _decoded;
+    std::vector<Complex> _samples;
+
+    // renders a block for the worker
+    void _render(float *output, uint32_t n_frames);
 
     static void _data_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count);
 
@@ -0,0 +1,126 @@
+#include "audioplayers/Decodeaheadreader.h"
+#include "mengumath.h"
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+using namespace Mengu;
+
+DecodeAheadReader::DecodeAheadReader() {}
+
+DecodeAheadReader::~DecodeAheadReader() {
+    stop();
+}
+
+void DecodeAheadReader::start(AudioSource *source, uint64_t from_frame) {
+    stop();
+
+    _source = source;
+    _n_channels = MAX(source->get_n_channels(), 1u);
+    _decoded.resize(MAX(_read_ahead, DecodeBlockSize) * _n_channels);
+    _block.resize(DecodeBlockSize * _n_channels);
+
+    _source->seek(from_frame);
+    const uint32_t generation = _seek_generation.load(std::memory_order_relaxed);
+    _decoded_generation.store(generation, std::memory_order_relaxed);
+    _read_generation.store(generation, std::memory_order_relaxed);
+    _source_at_end.store(false, std::memory_order_relaxed);
+    _n_underruns.store(0, std::memory_order_relaxed);
+
+    while (_decode_block()) {}
+
+    _stopping.store(false, std::memory_order_relaxed);
+    _thread = std::thread(&DecodeAheadReader::_run, this);
+}
+
+void DecodeAheadReader::stop() {
+    if (!_thread.joinable()) {
+        return;
+    }
+    _stopping.store(true, std::memory_order_release);
+    _n_reads.fetch_add(1, std::memory_order_release);
+    _n_reads.notify_one();
+    _thread.join();
+
+    _decoded.clear();
+    _source = nullptr;
+}
+
+void DecodeAheadReader::set_read_ahead(uint32_t n_frames) {
+    _read_ahead = n_frames;
+}
+
+uint32_t DecodeAheadReader::read(float *output, uint32_t n_frames) {
+    if (!_thread.joinable()) {
+        return 0;
+    }
+
+    uint32_t n_read = 0;
+    const uint32_t generation = _seek_generation.load(std::memory_order_acquire);
+    if (generation != _read_generation.load(std::memory_order_relaxed)) {
+        // Once decoding has moved, nothing from before the seek is pushed, so all that is left can be dropped.
+        // Until then, some may still be on its way
+        if (_decoded_generation.load(std::memory_order_acquire) == generation) {
+            _decoded.drop(_decoded.size());
+            _read_generation.store(generation, std::memory_order_release);
+        }
+    }
+    else {
+        n_read = _decoded.pop(output, n_frames * _n_channels) / _n_channels;
+        if (n_read < n_frames && !_source_at_end.load(std::memory_order_acquire)) {
+            _n_underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    _n_reads.fetch_add(1, std::memory_order_release);
+    _n_reads.notify_one();
+    return n_read;
+}
+
+void DecodeAheadReader::seek(uint64_t frame) {
+    _seek_frame.store(frame, std::memory_order_relaxed);
+    _seek_generation.fetch_add(1, std::memory_order_release);
+    _n_reads.fetch_add(1, std::memory_order_release);
+    _n_reads.notify_one();
+}
+
+bool DecodeAheadReader::is_at_end() const {
+    return _source_at_end.load(std::memory_order_acquire) && _decoded.size() == 0;
+}
+
+bool DecodeAheadReader::_decode_block() {
+    if (_source_at_end.load(std::memory_order_relaxed) || _decoded.space() < _block.size()) {
+        return false;
+    }
+    const uint32_t n_read = _source->read(_block.data(), DecodeBlockSize);
+    if (n_read == 0) {
+        _source_at_end.store(true, std::memory_order_release);
+        return false;
+    }
+    _decoded.push(_block.data(), n_read * _n_channels);
+    return true;
+}
+
+void DecodeAheadReader::_run() {
+    while (true) {
+        // read before checking, so a read, seek or stop in between is not missed
+        const uint32_t n_reads = _n_reads.load(std::memory_order_acquire);
+        if (_stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        const uint32_t generation = _seek_generation.load(std::memory_order_acquire);
+        if (generation != _decoded_generation.load(std::memory_order_relaxed)) {
+            _source->seek(_seek_frame.load(std::memory_order_relaxed));
+            _source_at_end.store(false, std::memory_order_relaxed);
+            _decoded_generation.store(generation, std::memory_order_release);
+            continue;
+        }
+
+        // nothing from the seek is pushed until reading has dropped what came before it
+        const bool caught_up = _read_generation.load(std::memory_order_acquire) == generation;
+        if (!caught_up || !_decode_block()) {
+            _n_reads.wait(n_reads, std::memory_order_acquire);
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef MENGA_DECODE_AHEAD_READER
+#define MENGA_DECODE_AHEAD_READER
+
+#include "offline/audiofile.h"
+#include "templates/spscqueue.h"
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace Mengu {
+
+// Decodes a source on a thread of its own, ahead of whoever plays it, so disk and codec stalls land on that thread
+// rather than the audio one. The thread runs at normal priority, as it waits on the disk more than it works
+class DecodeAheadReader {
+public:
+    // frames decoded ahead of reading, about 3/4 of a second at 44.1kHz
+    static constexpr uint32_t DefaultReadAhead = 1 << 15;
+    // frames decoded at a time
+    static constexpr uint32_t DecodeBlockSize = 1 << 12;
+
+    DecodeAheadReader();
+    // stops decoding
+    ~DecodeAheadReader();
+
+    DecodeAheadReader(const DecodeAheadReader &) = delete;
+    DecodeAheadReader &operator=(const DecodeAheadReader &) = delete;
+
+    // Starts decoding source from frame, stopping first if it was already. The read ahead is decoded before it returns,
+    // so reading starts with it full. The source is only touched by the decoding thread until stop
+    void start(AudioSource *source, uint64_t from_frame = 0);
+    // Joins the decoding thread and drops whatever it had decoded. Nothing may be reading
+    void stop();
+    inline bool is_running() const {
+        return _thread.joinable();
+    }
+
+    // Called from the audio thread. Reads up to n_frames decoded interleaved frames into output, returning how many.
+    // Fewer when the source has run out, or when decoding has fallen behind, which counts as an underrun.
+    // Never locks, allocates or waits. Only call from one thread at a time
+    uint32_t read(float *output, uint32_t n_frames);
+
+    // Moves reading to frame, from any thread. What was decoded ahead is dropped, and reads come up empty
+    // until decoding from frame has begun
+    void seek(uint64_t frame);
+
+    // in frames. Takes effect on the next start
+    void set_read_ahead(uint32_t n_frames);
+    inline uint32_t get_read_ahead() const {
+        return _read_ahead;
+    }
+
+    // whether the source has run out and all of it has been read
+    bool is_at_end() const;
+    // reads since the last start that came up short before the source ran out
+    inline uint64_t get_n_underruns() const {
+        return _n_underruns.load(std::memory_order_relaxed);
+    }
+
+private:
+    AudioSource *_source = nullptr;
+    uint32_t _n_channels = 1;
+    uint32_t _read_ahead = DefaultReadAhead;
+
+    SPSCQueue<float> _decoded;
+    // a block of the decoding thread's
+    std::vector<float> _block;
+
+    std::thread _thread;
+    std::atomic<bool> _stopping {false};
+    std::atomic<bool> _source_at_end {false};
+    std::atomic<uint64_t> _n_underruns {0};
+    // Counts reads and seeks, for the decoding thread to wait on when the read ahead is full.
+    // Waking it is a futex call at most, so reads never block on it
+    std::atomic<uint32_t> _n_reads {0};
+
+    // Seeks count up, and each end of the queue follows them in turn. The decoding thread moves the source and stops
+    // pushing what came before, then reading drops what is left of it, and only then is decoding from frame pushed
+    std::atomic<uint64_t> _seek_frame {0};
+    std::atomic<uint32_t> _seek_generation {0};
+    std::atomic<uint32_t> _decoded_generation {0};
+    std::atomic<uint32_t> _read_generation {0};
+
+    // decodes a block into the queue, if there is room for one. false if not, or the source has run out
+    bool _decode_block();
+    void _run();
+};
+
+}
+
+#endif
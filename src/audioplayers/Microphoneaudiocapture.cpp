@@ -47,14 +47,20 @@ MicrophoneAudioCapture::MicrophoneAudioCapture() {
 
 
     ma_device_init(nullptr, &config, &_device);
-    ma_device_start(&_device);
-
+    output_meter.set_sample_rate(_device.sampleRate);
     raw_bufferf.resize(1<<12);
+
+    _samples.resize(_worker.get_block_size());
+    _worker.set_lookahead(DefaultLookahead);
+    _start_worker();
+    ma_device_start(&_device);
 }
 
 MicrophoneAudioCapture::~MicrophoneAudioCapture() {
     ma_device_stop(&_device);
     ma_device_uninit(&_device);
+    // the worker still has the effects
+    _worker.stop();
 
     for (auto effect: _effects) {
         delete effect;
@@ -67,6 +73,7 @@ const std::vector<std::string> &MicrophoneAudioCapture::get_playback_devices() c
 }
 
 void MicrophoneAudioCapture::add_effect(dsp::Effect *effect) {
+    effect->set_sample_rate(_device.sampleRate);
     _effects.push_back(effect);
 }
 
@@ -94,26 +101,45 @@ void MicrophoneAudioCapture::refresh_context() {
     }
 }
 
-void MicrophoneAudioCapture::_data_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count) {
-    const float *inputf = (float *)input;
-    float *outputf = (float *)output;
-    DData *ddata = (DData *)device->pUserData;
-    MicrophoneAudioCapture *capture = ddata->capture;
+void MicrophoneAudioCapture::set_lookahead(uint32_t n_frames) {
+    ma_device_stop(&_device);
+    _worker.set_lookahead(n_frames);
+    _start_worker();
+    ma_device_start(&_device);
+}
 
-    std::vector<Complex> cbuffer(frame_count);
-    std::vector<Complex> cbufferout(frame_count);
+void MicrophoneAudioCapture::_start_worker() {
+    _worker.start([this] (const float *input, float *output, uint32_t n_frames) {
+        _render(input, output, n_frames);
+    }, _device.capture.channels, _device.playback.channels);
+}
+
+void MicrophoneAudioCapture::_render(const float *input, float *output, uint32_t n_frames) {
+    const uint32_t input_channels = _device.capture.channels;
+    const uint32_t output_channels = _device.playback.channels;
 
-    for (ma_uint32 frame = 0; frame < frame_count; frame++) {
-        cbuffer[frame] = inputf[frame];
+    for (uint32_t frame = 0; frame < n_frames; frame++) {
+        _samples[frame] = input[input_channels * frame];
     }
 
-    for (auto effect: capture->_effects) {
-        effect->push_signal(cbuffer.data(), frame_count);
-        effect->pop_transformed_signal(cbuffer.data(), frame_count);
+    for (auto effect: _effects) {
+        effect->push_signal(_samples.data(), n_frames);
+        effect->pop_transformed_signal(_samples.data(), n_frames);
     }
+    output_meter.push_signal(_samples.data(), n_frames);
 
-    for (ma_uint32 frame = 0; frame < frame_count; frame++) {
-        outputf[frame] = cbuffer[frame].real();
-        capture->raw_bufferf.push_back(cbuffer[frame].real());
+    for (uint32_t frame = 0; frame < n_frames; frame++) {
+        for (uint32_t channel = 0; channel < output_channels; channel++) {
+            output[output_channels * frame + channel] = _samples[frame].real();
+        }
+        raw_bufferf.push_back(_samples[frame].real());
     }
 }
+
+void MicrophoneAudioCapture::_data_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count) {
+    DData *ddata = (DData *)device->pUserData;
+    MicrophoneAudioCapture *capture = ddata->capture;
+
+    // the effects run on the worker, a lookahead behind
+    capture->_worker.process((const float *)input, (float *)output, frame_count);
+}
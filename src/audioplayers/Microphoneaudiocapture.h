@@ -1,6 +1,8 @@
 #ifndef MENGA_MICROPHONE_AUDIO_CAPTURE
 #define MENGA_MICROPHONE_AUDIO_CAPTURE
+#include "audioplayers/Realtimeworker.h"
 #include "dsp/effect.h"
+#include "dsp/loudness.h"
 #include "extras/miniaudio_split/miniaudio.h"
 #include "templates/cyclequeue.h"
 #include "templates/vecdeque.h"
@@ -19,6 +21,8 @@ public:
     ~MicrophoneAudioCapture();
 
     CycleQueue<float> raw_bufferf;
+    // loudness of what is played back, after the effects
+    dsp::LoudnessMeter output_meter;
 
     // Sets the active playback device
     void select_playback_device(int32_t device_ind);
@@ -31,6 +35,16 @@ public:
     std::vector<dsp::Effect *> &get_effects();
 
     void refresh_context();
+
+    // The effects run on a thread of their own, this many frames behind the microphone,
+    // which is how long they have for a burst of work before the output runs dry. Briefly stops the device
+    void set_lookahead(uint32_t n_frames);
+    inline uint32_t get_lookahead() const {
+        return _worker.get_lookahead();
+    }
+
+    // less than the players, as it is latency that is heard
+    static constexpr uint32_t DefaultLookahead = 1 << 10;
 private:
     struct DData {
         MicrophoneAudioCapture *capture;
@@ -44,6 +58,14 @@ private:
 
     std::vector<dsp::Effect *> _effects; 
 
+    RealTimeWorker _worker;
+    // a block of the worker's, through the effects
+    std::vector<Complex> _samples;
+
+    // renders a block for the worker
+    void _render(const float *input, float *output, uint32_t n_frames);
+    void _start_worker();
+
     static void _data_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count);
 };
 
@@ -0,0 +1,136 @@
+#include "audioplayers/Realtimeworker.h"
+#include "mengumath.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace Mengu;
+
+// raises the priority of the calling thread as far as the system lets it go. false if it would not
+static bool set_real_time_priority(int priority) {
+#ifdef _WIN32
+    return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#else
+    sched_param param {};
+    param.sched_priority = MIN(sched_get_priority_min(SCHED_FIFO) + priority, sched_get_priority_max(SCHED_FIFO));
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#endif
+}
+
+RealTimeWorker::RealTimeWorker(uint32_t block_size): _block_size(MAX(block_size, 1u)) {}
+
+RealTimeWorker::~RealTimeWorker() {
+    stop();
+}
+
+void RealTimeWorker::start(const Render &render, uint32_t n_input_channels, uint32_t n_output_channels) {
+    stop();
+
+    _render = render;
+    _n_input_channels = n_input_channels;
+    _n_output_channels = MAX(n_output_channels, 1u);
+    _input_block.resize(_block_size * _n_input_channels);
+    _output_block.resize(_block_size * _n_output_channels);
+
+    // Room for the lookahead and a block on top. Input only piles up when the worker falls behind,
+    // when it gets as much room again before the callback has to drop it
+    const uint32_t frames = MAX(_lookahead, _block_size) + _block_size;
+    _output.resize(frames * _n_output_channels);
+    _input.resize(2 * frames * _n_input_channels);
+    if (_n_input_channels > 0) {
+        std::vector<float> silence(_lookahead * _n_output_channels, 0.0f);
+        _output.push(silence.data(), silence.size());
+    }
+
+    _n_xruns.store(0, std::memory_order_relaxed);
+    _stopping.store(false, std::memory_order_relaxed);
+    _running.store(true, std::memory_order_release);
+    _thread = std::thread(&RealTimeWorker::_run, this);
+}
+
+void RealTimeWorker::stop() {
+    if (!_thread.joinable()) {
+        return;
+    }
+    _running.store(false, std::memory_order_release);
+    _stopping.store(true, std::memory_order_release);
+    _n_callbacks.fetch_add(1, std::memory_order_release);
+    _n_callbacks.notify_one();
+    _thread.join();
+
+    _input.clear();
+    _output.clear();
+}
+
+void RealTimeWorker::set_lookahead(uint32_t n_frames) {
+    _lookahead = n_frames;
+}
+
+void RealTimeWorker::process(const float *input, float *output, uint32_t n_frames) {
+    const uint32_t n_output = n_frames * _n_output_channels;
+    if (!_running.load(std::memory_order_acquire)) {
+        std::fill(output, output + n_output, 0.0f);
+        return;
+    }
+
+    bool xrun = false;
+    if (_n_input_channels > 0 && input != nullptr) {
+        const uint32_t n_input = n_frames * _n_input_channels;
+        // only whole frames, so the channels stay in line after input is dropped
+        const uint32_t n_fit = MIN(n_input, _input.space() / _n_input_channels * _n_input_channels);
+        xrun = _input.push(input, n_fit) < n_input;
+    }
+    const uint32_t n_popped = _output.pop(output, n_output);
+    if (n_popped < n_output) {
+        std::fill(output + n_popped, output + n_output, 0.0f);
+        xrun = true;
+    }
+    if (xrun) {
+        _n_xruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    _n_callbacks.fetch_add(1, std::memory_order_release);
+    _n_callbacks.notify_one();
+}
+
+bool RealTimeWorker::_can_render() const {
+    if (_output.space() < _block_size * _n_output_channels) {
+        return false;
+    }
+    if (_n_input_channels > 0) {
+        return _input.size() >= _block_size * _n_input_channels;
+    }
+    return _output.size() < _lookahead * _n_output_channels;
+}
+
+void RealTimeWorker::_run() {
+    _real_time.store(set_real_time_priority(RealTimePriority), std::memory_order_relaxed);
+
+    const float *input = _n_input_channels > 0 ? _input_block.data() : nullptr;
+    while (true) {
+        // read before checking, so a callback or stop in between is not missed
+        const uint32_t n_callbacks = _n_callbacks.load(std::memory_order_acquire);
+        if (_stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+        if (!_can_render()) {
+            _n_callbacks.wait(n_callbacks, std::memory_order_acquire);
+            continue;
+        }
+
+        if (_n_input_channels > 0) {
+            _input.pop(_input_block.data(), _input_block.size());
+        }
+        _render(input, _output_block.data(), _block_size);
+        _output.push(_output_block.data(), _output_block.size());
+    }
+}
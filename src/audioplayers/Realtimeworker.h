@@ -0,0 +1,97 @@
+#ifndef MENGA_REAL_TIME_WORKER
+#define MENGA_REAL_TIME_WORKER
+
+#include "templates/spscqueue.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace Mengu {
+
+// Runs the effects of an audio device on a thread of its own, ahead of the device's callback, so the callback only copies.
+// Effects that do a frame's work at once then nothing for a while can take as long as the lookahead to do it,
+// rather than having to within one callback. The thread runs at real time priority where the system allows it
+class RealTimeWorker {
+public:
+    // Makes n_frames of output from as many of input, if there is any, with the frames of their channels interleaved.
+    // Only ever called from the worker's thread, a block at a time
+    typedef std::function<void(const float *input, float *output, uint32_t n_frames)> Render;
+
+    // frames rendered by each call of the render
+    static constexpr uint32_t DefaultBlockSize = 1 << 8;
+    static constexpr uint32_t DefaultLookahead = 1 << 11;
+
+    RealTimeWorker(uint32_t block_size = DefaultBlockSize);
+    // stops the worker
+    ~RealTimeWorker();
+
+    RealTimeWorker(const RealTimeWorker &) = delete;
+    RealTimeWorker &operator=(const RealTimeWorker &) = delete;
+
+    // Starts rendering on the worker's thread, stopping it first if it was already.
+    // Without input channels, output is rendered until there are lookahead frames of it ahead of the callback.
+    // With them, input is rendered as it comes, and output starts with lookahead frames of silence so it has that long
+    void start(const Render &render, uint32_t n_input_channels, uint32_t n_output_channels);
+    // Joins the worker and drops whatever it had rendered. The device must not be calling process
+    void stop();
+    inline bool is_running() const {
+        return _thread.joinable();
+    }
+
+    // Called from the device callback. Hands over the input, and takes output the worker has rendered, with silence for
+    // whatever it has not. Never locks, allocates or waits. Silence when the worker is stopped
+    void process(const float *input, float *output, uint32_t n_frames);
+
+    // in frames. Takes effect on the next start
+    void set_lookahead(uint32_t n_frames);
+    inline uint32_t get_lookahead() const {
+        return _lookahead;
+    }
+    inline uint32_t get_block_size() const {
+        return _block_size;
+    }
+
+    // whether the worker got real time priority when last started
+    inline bool is_real_time() const {
+        return _real_time.load(std::memory_order_relaxed);
+    }
+    // callbacks since the last start that were short of output, or had to drop input
+    inline uint64_t get_n_xruns() const {
+        return _n_xruns.load(std::memory_order_relaxed);
+    }
+
+private:
+    // how far above the lowest real time priority the worker runs, leaving room above it for the device's own thread
+    static constexpr int RealTimePriority = 10;
+
+    uint32_t _block_size;
+    uint32_t _lookahead = DefaultLookahead;
+    uint32_t _n_input_channels = 0;
+    uint32_t _n_output_channels = 1;
+
+    Render _render;
+    SPSCQueue<float> _input;
+    SPSCQueue<float> _output;
+    // a block of each, for the worker
+    std::vector<float> _input_block;
+    std::vector<float> _output_block;
+
+    std::thread _thread;
+    std::atomic<bool> _running {false};
+    std::atomic<bool> _stopping {false};
+    std::atomic<bool> _real_time {false};
+    std::atomic<uint64_t> _n_xruns {0};
+    // Counts callbacks, for the worker to wait on when it has nothing to do.
+    // Waking it is a futex call at most, so the callback never blocks on it
+    std::atomic<uint32_t> _n_callbacks {0};
+
+    // whether the worker can render another block
+    bool _can_render() const;
+    void _run();
+};
+
+}
+
+#endif
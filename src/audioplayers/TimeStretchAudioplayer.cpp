@@ -30,70 +30,74 @@ Mengu::TimeStretchAudioPlayer::TimeStretchAudioPlayer() {
     
 
     time_stretcher = time_stretchers[0];
-    
+
+    _samples.resize(_worker.get_block_size());
+    _stretched.resize(_worker.get_block_size());
 }
 
 Mengu::TimeStretchAudioPlayer::~TimeStretchAudioPlayer() {
     if (file_loaded) {
         ma_device_uninit(&_device);
-        ma_decoder_uninit(&_decoder);
     }
+    // the worker still has the stretcher, and reads what the reader decodes
+    _worker.stop();
+    _reader.stop();
+    delete _source;
 
     for (uint32_t i = 0; i < NTimeStretcher; i++) {
         delete time_stretchers[i];
     }
 }
 
-static ma_encoding_format get_encoding_format(const fs::path &file_path) {
-    const fs::path ext = file_path.extension();
-    if ( ext == ".ogg") { return ma_encoding_format_vorbis; }
-    else if (ext == ".wav") { return ma_encoding_format_wav; }
-    else if (ext == ".mp3") { return ma_encoding_format_mp3; }
-    else { return ma_encoding_format_unknown; }
-}
-
 uint32_t Mengu::TimeStretchAudioPlayer::load_file(const fs::path &file_path) {
     if (file_loaded) {
         ma_device_uninit(&_device);
-        ma_decoder_uninit(&_decoder);
+        _worker.stop();
+        _reader.stop();
     }
+    delete _source;
+    _source = nullptr;
+    file_loaded = false;
 
-    ma_decoder_config decoder_config =  ma_decoder_config_init(ma_format_f32, 1, 44100);
-    decoder_config.encodingFormat = get_encoding_format(file_path);
-
-    ma_result result = ma_decoder_init_file(file_path.string().c_str(), &decoder_config, &_decoder);
-    if (result != MA_SUCCESS) {
-        std::string err_msg ("Could not load file with ");
-        err_msg += std::to_string(result);
-        file_loaded = false;
-
-        return result;
-        throw std::runtime_error(err_msg);
+    try {
+        // mono, at the file's own rate. Mono wavs are read straight from the file rather than decoded
+        _source = open_audio_source(file_path, 1);
+    }
+    catch (const std::runtime_error &) {
+        return MA_ERROR;
+    }
 
+    for (uint32_t i = 0; i < NTimeStretcher; i++) {
+        time_stretchers[i]->set_sample_rate(_source->get_sample_rate());
+    }
+    _decoded.resize(_worker.get_block_size() * _source->get_n_channels());
+
+    ma_device_config device_config = ma_device_config_init(ma_device_type_playback);
+    device_config.playback.format = ma_format_f32;
+    device_config.playback.channels = _source->get_n_channels();
+    device_config.sampleRate = _source->get_sample_rate();
+    device_config.dataCallback = _data_callback;
+    ddata = {this, _source};
+    device_config.pUserData = &ddata;
+
+    if (ma_device_init(nullptr, &device_config, &_device) != MA_SUCCESS) {
+        throw std::runtime_error("Could not init audio device");
     }
-    else {
-        ma_device_config device_config = ma_device_config_init(ma_device_type_playback);
-        device_config.playback.format = _decoder.outputFormat;
-        device_config.playback.channels = _decoder.outputChannels;
-        device_config.sampleRate = _decoder.outputSampleRate;
-        device_config.dataCallback = _data_callback;
-        ddata = {this, &_decoder};
-        device_config.pUserData = &ddata;
-
-        if (ma_device_init(nullptr, &device_config, &_device) != MA_SUCCESS) {
-            throw std::runtime_error("Could not init audio device");
-        }
 
-        ma_device_set_master_volume(&_device, 0.5);
+    ma_device_set_master_volume(&_device, 0.5);
 
-        file_loaded = true;
-        return 0;
-    }    
+    file_loaded = true;
+    return 0;
 }
 
 void Mengu::TimeStretchAudioPlayer::play() {
     if (file_loaded) {
-        ma_decoder_seek_to_pcm_frame(&_decoder, 0);
+        // the worker reads from the reader, so is stopped while it restarts
+        _worker.stop();
+        _reader.start(_source, 0);
+        _worker.start([this] (const float *, float *output, uint32_t n_frames) {
+            _render(output, n_frames);
+        }, 0, _device.playback.channels);
         if (ma_device_start(&_device) != MA_SUCCESS) {
             throw "could not play file";
         }
@@ -106,6 +110,9 @@ void Mengu::TimeStretchAudioPlayer::stop() {
             throw "could not stop file";
         }
     }
+    // what it ran ahead is dropped with the rest of what the stretcher had
+    _worker.stop();
+    _reader.stop();
 
     time_stretcher->reset();
 }
@@ -121,49 +128,51 @@ void Mengu::TimeStretchAudioPlayer::set_stretch_factor(float f) {
 }
 
 
-void Mengu::TimeStretchAudioPlayer::_data_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count) {
-    DeviceData *ddata = (DeviceData *)device->pUserData;
-    TimeStretchAudioPlayer *player = ddata->player;
-    CycleQueue<Complex> &sample_buffer = player->sample_buffer;
-    // std::vector<Complex> &left_buffer = player->left_buffer;
-    // std::vector<Complex> &right_buffer = player->right_buffer;
-    dsp::TimeStretcher *time_stretcher = player->time_stretcher;
-
-
-    ma_decoder *decoder = ddata->decoder;
-    if (decoder == nullptr) {
-        return;
-    }
-
-    ma_uint32 output_channels = device->playback.channels;
-    ma_uint32 input_channels = decoder->outputChannels;
+void Mengu::TimeStretchAudioPlayer::set_lookahead(uint32_t n_frames) {
+    _worker.set_lookahead(n_frames);
+}
 
+void Mengu::TimeStretchAudioPlayer::set_read_ahead(uint32_t n_frames) {
+    _reader.set_read_ahead(n_frames);
+}
 
-    float *outputf = (float *)output;
+void Mengu::TimeStretchAudioPlayer::_render(float *output, uint32_t n_frames) {
+    const uint32_t input_channels = _source->get_n_channels();
+    const uint32_t output_channels = _device.playback.channels;
 
-    std::vector<Complex> left_samples(frame_count);
-    std::vector<Complex> left_output(frame_count);
+    uint32_t n_outputted = time_stretcher->pop_transformed_signal(_stretched.data(), n_frames);
+    while (n_outputted < n_frames) {
+        const uint32_t n_read = _reader.read(_decoded.data(), n_frames);
+        // silence past the end of the file, or where decoding has fallen behind
+        for (uint32_t i = 0; i < n_frames; i++) {
+            _samples[i] = i < n_read ? Complex(_decoded[input_channels * i]) : Complex(0.0f);
+        }
 
-    ma_uint32 n_outputted = time_stretcher->pop_transformed_signal(left_output.data(), frame_count);
-    while (n_outputted < frame_count) {
-        ma_decoder_read_pcm_frames(decoder, output, frame_count, nullptr);
+        time_stretcher->push_signal(_samples.data(), n_frames);
+        n_outputted += time_stretcher->pop_transformed_signal(_stretched.data() + n_outputted, n_frames - n_outputted);
+    }
 
-        for (ma_uint32 i = 0; i < frame_count; i++) {
-            left_samples[i] = Complex(outputf[input_channels * i]);
+    for (uint32_t channel_num = 0; channel_num < output_channels; channel_num++) {
+        for (uint32_t i = 0; i < n_frames; i++) {
+            output[output_channels * i + channel_num] = _stretched[i].real();
         }
+    }
+}
 
-        time_stretcher->push_signal(left_samples.data(), frame_count);
-        n_outputted += time_stretcher->pop_transformed_signal(left_output.data() + n_outputted, frame_count - n_outputted);
+void Mengu::TimeStretchAudioPlayer::_data_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count) {
+    DeviceData *ddata = (DeviceData *)device->pUserData;
+    TimeStretchAudioPlayer *player = ddata->player;
+    CycleQueue<Complex> &sample_buffer = player->sample_buffer;
 
+    AudioSource *source = ddata->source;
+    if (source == nullptr) {
+        return;
     }
 
-    for (ma_uint32 channel_num = 0; channel_num < input_channels; channel_num++) {
-        for (ma_uint32 i = 0; i < frame_count; i++) {
-            // std::cout << "writing to speakers" << input_channels * i + channel_num << std::endl;
+    float *outputf = (float *)output;
 
-            outputf[output_channels * i + channel_num] = left_output[i].real();
-        }
-    }
+    // the stretcher has already run on the worker
+    player->_worker.process(nullptr, outputf, frame_count);
 
     const ma_uint32 sample_coeff = 2;
 
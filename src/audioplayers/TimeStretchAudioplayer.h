@@ -1,10 +1,13 @@
 #ifndef MENGA_TIME_STRETCH_AUDIO_PLAYER
 #define MENGA_TIME_STRETCH_AUDIO_PLAYER
 
+#include "audioplayers/Decodeaheadreader.h"
+#include "audioplayers/Realtimeworker.h"
 #include "dsp/common.h"
 #include "dsp/fft.h"
 #include "dsp/timestretcher.h"
 #include "miniaudio.h"
+#include "offline/audiofile.h"
 
 
 #include <cstdint>
@@ -30,6 +33,20 @@ public:
 
     void set_stretch_factor(float f);
 
+    // How many frames the stretcher runs ahead of the device, on a thread of its own.
+    // More rides out longer bursts of work, but changes to the stretch take longer to be heard. Takes effect on the next play
+    void set_lookahead(uint32_t n_frames);
+    inline uint32_t get_lookahead() const {
+        return _worker.get_lookahead();
+    }
+
+    // How many frames of the file are decoded ahead of stretching it, on a thread of its own.
+    // More rides out longer disk stalls. Takes effect on the next play
+    void set_read_ahead(uint32_t n_frames);
+    inline uint32_t get_read_ahead() const {
+        return _reader.get_read_ahead();
+    }
+
     CycleQueue<Complex> sample_buffer;
 
     std::vector<Complex> left_buffer;
@@ -46,13 +63,24 @@ public:
 private:
     struct DeviceData {
         Mengu::TimeStretchAudioPlayer *player;
-        ma_decoder *decoder;
+        AudioSource *source;
     };
 
     ma_device _device;
-    ma_decoder _decoder;
+    AudioSource *_source = nullptr;
     DeviceData ddata;
 
+    // decodes the file ahead of the worker, so the disk never holds it up
+    DecodeAheadReader _reader;
+    RealTimeWorker _worker;
+    // a block of the worker's, decoded, and in and out of the stretcher
+    std::vector<float> _decoded;
+    std::vector<Complex> _samples;
+    std::vector<Complex> _stretched;
+
+    // renders a block for the worker
+    void _render(float *output, uint32_t n_frames);
+
     static void _data_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count);
 
     bool file_loaded = false;
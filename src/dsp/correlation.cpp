@@ -2,12 +2,38 @@
 #include "dsp/common.h"
 #include "iostream"
 #include "mengumath.h"
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 
+// The real parts of the signals are packed into blocks this long so the SIMD kernels can run on them
+static constexpr int PackedBlockSize = 256;
+// Searches up to this long are packed onto the stack. Longer ones fall back to a lag-by-lag search
+static constexpr int MaxPackedSearchSize = 2048;
+
+static void _pack_real(const Complex *s, const int length, float *output) {
+    for (int i = 0; i < length; i++) {
+        output[i] = s[i].real();
+    }
+}
+
+// i * (length - i), scaled so the middle is 1
+static void fill_quad_weights(float *weights, const int length) {
+    const float scale = 4.0f / ((float) length * length);
+    for (int i = 0; i < length; i++) {
+        weights[i] = scale * i * (length - i);
+    }
+}
+
 float Mengu::dsp::correlation(const Complex *s1, const Complex *s2, const int length, const int n) {
     float total = 0;
-    for (uint32_t i = 0; i < length; i++) {
-        total += s1[i].real() * s2[n + i].real();
+    float s1_block[PackedBlockSize];
+    float s2_block[PackedBlockSize];
+    for (int i = 0; i < length; i += PackedBlockSize) {
+        const int block_size = MIN(PackedBlockSize, length - i);
+        _pack_real(s1 + i, block_size, s1_block);
+        _pack_real(s2 + n + i, block_size, s2_block);
+        total += dot((const float *) s1_block, (const float *) s2_block, block_size);
     }
 
     return total;
@@ -18,48 +44,71 @@ float Mengu::dsp::autocorrelation(const Complex *s, const int length, const int
 }
 
 int Mengu::dsp::find_max_correlation(const Complex *s1, const Complex *s2, const int length, const int search_window_size) {
-    float max_corr = correlation(s1, s2, length, 0);
-    int max_lag = 0;
+    const int span = length + search_window_size - 1;
+    if (search_window_size <= 0 || span > MaxPackedSearchSize) {
+        float max_corr = correlation(s1, s2, length, 0);
+        int max_lag = 0;
 
-    for (int i = 1; i < search_window_size; i++) {
-        float corr = correlation(s1, s2, length, i);
+        for (int i = 1; i < search_window_size; i++) {
+            float corr = correlation(s1, s2, length, i);
 
-        if (corr > max_corr) {
-            max_corr = corr;
-            max_lag = i;
+            if (corr > max_corr) {
+                max_corr = corr;
+                max_lag = i;
+            }
         }
+
+        return max_lag;
     }
 
-    return max_lag;
+    float packed_s1[MaxPackedSearchSize];
+    float packed_s2[MaxPackedSearchSize];
+    float corrs[MaxPackedSearchSize];
+    _pack_real(s1, length, packed_s1);
+    _pack_real(s2, span, packed_s2);
+    sliding_dot(packed_s1, packed_s2, length, search_window_size, corrs);
+
+    return std::max_element(corrs, corrs + search_window_size) - corrs;
 }
 
 int Mengu::dsp::find_max_correlation_quad(const Complex *s1, const Complex *s2, const int length, const int search_window_size) {
-    float max_corr = -1e10;
-    int max_lag = 0;
+    const int span = length + search_window_size - 1;
+    if (search_window_size <= 0 || span > MaxPackedSearchSize) {
+        float max_corr = -1e10;
+        int max_lag = 0;
 
-    float *scaled_s1 = new float[length];
+        std::vector<float> scaled_s1(length);
+        for (int i = 0; i < length; i++) {
+            scaled_s1[i] = s1[i].real() * i * (length - i);
+        }
 
-    for (int i = 0; i < length; i++) {
-        scaled_s1[i] = s1[i].real() * i * (length - i);
-    }
+        // do max iteration
+        for (int i = 0; i < search_window_size; i++) {
+            float corr = 0.0f; 
+            
+            for (int j = 0; j < length; j++) {
+                corr += scaled_s1[j] * s2[i + j].real();
+            }
 
-    // do max iteration
-    for (int i = 0; i < search_window_size; i++) {
-        float corr = 0.0f; 
-        
-        for (int j = 0; j < length; j++) {
-            corr += scaled_s1[j] * s2[i + j].real();
+            if (corr > max_corr) {
+                max_corr = corr;
+                max_lag = i;
+            }
         }
 
-        if (corr > max_corr) {
-            max_corr = corr;
-            max_lag = i;
-        }
+        return max_lag;
     }
 
-    delete[] scaled_s1;
+    float scaled_s1[MaxPackedSearchSize];
+    float packed_s2[MaxPackedSearchSize];
+    float corrs[MaxPackedSearchSize];
+    for (int i = 0; i < length; i++) {
+        scaled_s1[i] = s1[i].real() * i * (length - i);
+    }
+    _pack_real(s2, span, packed_s2);
+    sliding_dot(scaled_s1, packed_s2, length, search_window_size, corrs);
 
-    return max_lag;
+    return std::max_element(corrs, corrs + search_window_size) - corrs;
 }
 
 std::vector<float> Mengu::dsp::calc_srhs(const float *envelope,
@@ -90,3 +139,241 @@ float Mengu::dsp::calc_srh(const float *envelope, const int &size, const int &fr
 
     return pos_interference - neg_interference;
 }
+
+Mengu::dsp::CrossCorrelator::CrossCorrelator(uint32_t max_span):
+    _max_span(max_span),
+    _fft(is_pow_2(max_span) ? max_span : next_pow_2(max_span)),
+    _s1_real(max_span),
+    _s2_real(max_span),
+    _lags(max_span),
+    _s1_coarse(max_span),
+    _s2_coarse(max_span),
+    _weights(max_span),
+    _coarse_weights(max_span),
+    _weighted_s1(max_span),
+    _s2_squared(max_span),
+    _energies(max_span),
+    _packed(_fft.size()),
+    _spectrum(_fft.size()),
+    _product(_fft.size()) {}
+
+void Mengu::dsp::CrossCorrelator::correlate(const Complex *s1, const Complex *s2, const int length, const int n_lags, float *output) {
+    for (int i = 0; i < length; i++) {
+        _s1_real[i] = s1[i].real();
+    }
+    for (int i = 0; i < length + n_lags - 1; i++) {
+        _s2_real[i] = s2[i].real();
+    }
+
+    _correlate_packed(_s1_real.data(), _s2_real.data(), length, n_lags, output);
+}
+
+int Mengu::dsp::CrossCorrelator::find_max_correlation(const Complex *s1, const Complex *s2, const int length, const int search_window_size) {
+    return find_best_lag(s1, s2, length, search_window_size);
+}
+
+int Mengu::dsp::CrossCorrelator::find_max_correlation_quad(const Complex *s1, const Complex *s2, const int length, const int search_window_size) {
+    return find_best_lag(s1, s2, length, search_window_size, CrossCorrelation, 1, true);
+}
+
+int Mengu::dsp::CrossCorrelator::find_best_lag(const Complex *s1, 
+                                               const Complex *s2, 
+                                               const int length, 
+                                               const int n_lags, 
+                                               const SimilarityMeasure measure, 
+                                               const uint32_t decimation, 
+                                               const bool quad_weighted) {
+    const int s2_length = length + n_lags - 1;
+    for (int i = 0; i < length; i++) {
+        _s1_real[i] = s1[i].real();
+    }
+    for (int i = 0; i < s2_length; i++) {
+        _s2_real[i] = s2[i].real();
+    }
+    if (quad_weighted) {
+        fill_quad_weights(_weights.data(), length);
+    }
+    const float *weights = quad_weighted ? _weights.data() : nullptr;
+
+    const int d = decimation;
+    if (d <= 1 || length / d < MinDecimatedLength) {
+        return _best_scored_lag(_s1_real.data(), _s2_real.data(), length, 0, n_lags, measure, weights);
+    }
+
+    // decimate by averaging each block of d samples. Doubles as a crude anti-aliasing filter
+    const int coarse_length = length / d;
+    const int coarse_s2_length = s2_length / d;
+    const int coarse_lags = MIN((n_lags + d - 1) / d, coarse_s2_length - coarse_length + 1);
+    const float inv_d = 1.0f / d;
+    for (int i = 0; i < coarse_s2_length; i++) {
+        float s1_total = 0.0f;
+        float s2_total = 0.0f;
+        for (int j = i * d; j < (i + 1) * d; j++) {
+            s1_total += i < coarse_length ? _s1_real[j] : 0.0f;
+            s2_total += _s2_real[j];
+        }
+        _s1_coarse[i] = s1_total * inv_d;
+        _s2_coarse[i] = s2_total * inv_d;
+    }
+    if (quad_weighted) {
+        fill_quad_weights(_coarse_weights.data(), coarse_length);
+    }
+
+    const int coarse_lag = _best_scored_lag(_s1_coarse.data(), _s2_coarse.data(), coarse_length, 0, coarse_lags, measure,
+                                            quad_weighted ? _coarse_weights.data() : nullptr);
+
+    // refine around the coarse lag at the full rate
+    const int first_lag = MAX(0, (coarse_lag - 1) * d + 1);
+    const int last_lag = MIN(n_lags, (coarse_lag + 1) * d);
+    return _best_scored_lag(_s1_real.data(), _s2_real.data(), length, first_lag, last_lag, measure, weights);
+}
+
+bool Mengu::dsp::CrossCorrelator::uses_fft(const int length, const int n_lags) const {
+    switch (_method) {
+        case Direct:
+            return false;
+        case FFTBased:
+            return true;
+        default:
+            break;
+    }
+    const float n = _fft.size();
+    return (float) length * n_lags > FFTCostFactor * n * std::log2(n);
+}
+
+void Mengu::dsp::CrossCorrelator::_correlate_packed(const float *s1, const float *s2, const int length, const int n_lags, float *output) {
+    if (uses_fft(length, n_lags)) {
+        _correlate_fft(s1, s2, length, n_lags, output);
+    }
+    else {
+        _correlate_direct(s1, s2, length, n_lags, output);
+    }
+}
+
+void Mengu::dsp::CrossCorrelator::_correlate_direct(const float *s1, const float *s2, const int length, const int n_lags, float *output) const {
+    sliding_dot(s1, s2, length, n_lags, output);
+}
+
+void Mengu::dsp::CrossCorrelator::_correlate_fft(const float *s1, const float *s2, const int length, const int n_lags, float *output) {
+    const uint32_t n = _fft.size();
+    const int s2_length = length + n_lags - 1;
+
+    // Both signals are real, so transform them together as z = s1 + i * s2.
+    // The zero padding past length + n_lags makes sure the circular correlation does not wrap into the lags we want
+    for (uint32_t i = 0; i < n; i++) {
+        const float re = (int) i < length ? s1[i] : 0.0f;
+        const float im = (int) i < s2_length ? s2[i] : 0.0f;
+        _packed[i] = Complex(re, im);
+    }
+    _fft.transform(_packed.data(), _spectrum.data());
+
+    // Seperate the spectra with the symmetry of real signals, S1[k] = (Z[k] + Z*[-k]) / 2, S2[k] = (Z[k] - Z*[-k]) / 2i,
+    // then correlate by multiplying S1* by S2
+    for (uint32_t k = 0; k < n; k++) {
+        const Complex z = _spectrum[k];
+        const Complex z_neg = std::conj(_spectrum[(n - k) % n]);
+        const Complex f1 = 0.5f * (z + z_neg);
+        const Complex f2 = Complex(0.0f, -0.5f) * (z - z_neg);
+        _product[k] = std::conj(f1) * f2;
+    }
+    _fft.inverse_transform(_product.data(), _packed.data());
+
+    // The FFT is normalised by 1/sqrt(N) in both directions, so the product is missing a factor of sqrt(N)
+    const float scale = std::sqrt((float) n);
+    for (int k = 0; k < n_lags; k++) {
+        output[k] = _packed[k].real() * scale;
+    }
+}
+
+int Mengu::dsp::CrossCorrelator::_best_scored_lag(const float *s1, 
+                                                  const float *s2, 
+                                                  const int length, 
+                                                  const int first_lag, 
+                                                  const int last_lag, 
+                                                  const SimilarityMeasure measure,
+                                                  const float *weights) {
+    const int n_lags = last_lag - first_lag;
+    if (n_lags <= 1) {
+        return first_lag;
+    }
+    float *scores = _lags.data();
+
+    // a against b at every lag
+    const auto correlate_lags = [&] (const float *a, const float *b, float *output) {
+        if (first_lag == 0) {
+            _correlate_packed(a, b, length, n_lags, output);
+        }
+        else {
+            _correlate_direct(a, b + first_lag, length, n_lags, output);
+        }
+    };
+
+    switch (measure) {
+        case CrossCorrelation:
+        case NormalisedCrossCorrelation: {
+            // weighting s1 weights each term of the dot product
+            const float *weighted_s1 = s1;
+            if (weights != nullptr) {
+                for (int i = 0; i < length; i++) {
+                    _weighted_s1[i] = weights[i] * s1[i];
+                }
+                weighted_s1 = _weighted_s1.data();
+            }
+            correlate_lags(weighted_s1, s2, scores);
+
+            if (measure == NormalisedCrossCorrelation && weights != nullptr) {
+                // divided by the weighted energies of both, sum(w * s1^2) and sum(w * s2^2) over the overlap at each lag
+                const float s1_energy = dot(weighted_s1, s1, length);
+                for (int i = first_lag; i < last_lag + length - 1; i++) {
+                    _s2_squared[i] = s2[i] * s2[i];
+                }
+                correlate_lags(weights, _s2_squared.data(), _energies.data());
+                for (int k = 0; k < n_lags; k++) {
+                    scores[k] /= std::sqrt(s1_energy * MAX(0.0f, _energies[k])) + 1e-20f;
+                }
+            }
+            else if (measure == NormalisedCrossCorrelation) {
+                // slide the energy of the overlapped part of s2 along with the lag
+                const float s1_energy = sum_squares(s1, length);
+                float s2_energy = sum_squares(s2 + first_lag, length);
+                for (int k = 0; k < n_lags; k++) {
+                    scores[k] /= std::sqrt(s1_energy * s2_energy) + 1e-20f;
+
+                    if (k + 1 < n_lags) {
+                        const float leaving = s2[first_lag + k];
+                        const float entering = s2[first_lag + k + length];
+                        s2_energy = MAX(0.0f, s2_energy - leaving * leaving + entering * entering);
+                    }
+                }
+            }
+            break;
+        }
+        case AMDF: {
+            float weight_total = length;
+            if (weights != nullptr) {
+                weight_total = 0.0f;
+                for (int i = 0; i < length; i++) {
+                    weight_total += weights[i];
+                }
+            }
+            for (int k = 0; k < n_lags; k++) {
+                float total = 0.0f;
+                if (weights != nullptr) {
+                    for (int i = 0; i < length; i++) {
+                        total += weights[i] * std::abs(s1[i] - s2[first_lag + k + i]);
+                    }
+                }
+                else {
+                    for (int i = 0; i < length; i++) {
+                        total += std::abs(s1[i] - s2[first_lag + k + i]);
+                    }
+                }
+                // smaller differences are more similar
+                scores[k] = -total / (weight_total + 1e-20f);
+            }
+            break;
+        }
+    }
+
+    return first_lag + (std::max_element(scores, scores + n_lags) - scores);
+}
@@ -40,6 +40,104 @@ int find_max_correlation(const Complex *s1, const Complex *s2, const int length,
 // Max correlation where portions toward the center are weighted more
 int find_max_correlation_quad(const Complex *s1, const Complex *s2, const int length, const int search_window_size);
 
+// How similar two signals are considered at a lag when searching for the best overlap
+enum SimilarityMeasure {
+    CrossCorrelation = 0, // plain dot product. Favours louder parts of the searched signal
+    NormalisedCrossCorrelation = 1, // dot product divided by the energy of both overlapping parts
+    AMDF = 2, // average magnitude difference. Cheap and insensitive to loudness
+};
+
+// Finds the cross-correlation between two signals on every lag of a search window at once.
+// Picks between the direct O(length * n_lags) sum and an FFT method depending on the sizes.
+// All scratch space is allocated on construction, so nothing is allocated while searching
+class CrossCorrelator {
+public:
+    // max_span is the largest (length + n_lags) that will be correlated
+    CrossCorrelator(uint32_t max_span);
+
+    // the FFT owns its buffers
+    CrossCorrelator(const CrossCorrelator &) = delete;
+    CrossCorrelator &operator=(const CrossCorrelator &) = delete;
+
+    enum Method {
+        Auto,
+        Direct,
+        FFTBased,
+    };
+
+    // output[k] = correlation(s1, s2, length, k) for each 0 <= k < n_lags
+    // s2 is assumed to be at least length + n_lags - 1 long
+    void correlate(const Complex *s1, const Complex *s2, const int length, const int n_lags, float *output);
+
+    // Same as the free functions of the same name, but every lag is found in one go
+    int find_max_correlation(const Complex *s1, const Complex *s2, const int length, const int search_window_size);
+    int find_max_correlation_quad(const Complex *s1, const Complex *s2, const int length, const int search_window_size);
+
+    // Finds the lag in [0, n_lags) where s2 is most similar to s1.
+    // If decimation > 1, every lag is first compared on signals decimated by that factor, 
+    // then only the lags around the best coarse candidate are compared at the full rate.
+    // If quad_weighted, each term of the measure is weighted by i * (length - i), so the middle of s1 counts most
+    int find_best_lag(const Complex *s1, 
+                      const Complex *s2, 
+                      const int length, 
+                      const int n_lags, 
+                      const SimilarityMeasure measure = CrossCorrelation, 
+                      const uint32_t decimation = 1, 
+                      const bool quad_weighted = false);
+
+    // Whether correlate() would use the FFT for these sizes
+    bool uses_fft(const int length, const int n_lags) const;
+
+    // Force one method rather than choosing by size. Mostly useful for benchmarking
+    void set_method(Method method) { _method = method; }
+
+    uint32_t max_span() const { return _max_span; }
+
+private:
+    // The direct sum is faster until length * n_lags is about this many times N log2(N).
+    // High since the direct sum runs on the vectorised sliding_dot kernel
+    static constexpr float FFTCostFactor = 64.0f;
+    // Coarse searches shorter than this are not worth doing
+    static constexpr int MinDecimatedLength = 8;
+
+    uint32_t _max_span;
+    Method _method = Auto;
+
+    FFT _fft;
+
+    // real parts of each signal packed contiguously
+    std::vector<float> _s1_real;
+    std::vector<float> _s2_real;
+    std::vector<float> _lags;
+    // decimated copies of the packed signals
+    std::vector<float> _s1_coarse;
+    std::vector<float> _s2_coarse;
+    // quad weights of each term, at the full and decimated rates, and what they are applied to
+    std::vector<float> _weights;
+    std::vector<float> _coarse_weights;
+    std::vector<float> _weighted_s1;
+    std::vector<float> _s2_squared;
+    std::vector<float> _energies;
+
+    std::vector<Complex> _packed;
+    std::vector<Complex> _spectrum;
+    std::vector<Complex> _product;
+
+    void _correlate_packed(const float *s1, const float *s2, const int length, const int n_lags, float *output);
+    void _correlate_direct(const float *s1, const float *s2, const int length, const int n_lags, float *output) const;
+    void _correlate_fft(const float *s1, const float *s2, const int length, const int n_lags, float *output);
+
+    // Scores lags in [first_lag, last_lag) with a similarity measure so that higher is always more similar.
+    // Each term of the measure is weighted by weights, unless it is nullptr. Returns the lag with the best score
+    int _best_scored_lag(const float *s1, 
+                         const float *s2, 
+                         const int length, 
+                         const int first_lag, 
+                         const int last_lag, 
+                         const SimilarityMeasure measure,
+                         const float *weights);
+};
+
 // find the sr harmonics of (the positive half of) a frequency amplitude spectrum
 std::vector<float> calc_srhs(const float *envelope,
                              const int &size,
@@ -51,102 +149,107 @@ std::vector<float> calc_srhs(const float *envelope,
 // the srh of only one frequency
 float calc_srh(const float *envelope, const int &size, const int &freq_ind, const int &n_harm);
 
-// performs and stores results of LinearPredictiveCoding. expects a fixed process size so it can be put on the stack
-template<uint32_t SampleSize, uint32_t NParams>
-class LPC {
+// performs and stores results of LinearPredictiveCoding on samples of a size chosen at runtime.
+// Every buffer is allocated on construction, so load_sample does not allocate
+template<uint32_t NParams>
+class DynamicLPC {
 public:
-    LPC(): 
-        _fft(SampleSize),
-        // _b(NParams + 1),
-        // _autocovariance_slice(NParams + 1) {
+    DynamicLPC(uint32_t sample_size): 
+        _freq_spectrum(sample_size),
+        _autocovariance(sample_size),
+        _envelope(sample_size),
+        _residuals(sample_size),
+        _fft(sample_size),
+        _freq_squared(sample_size),
+        _scratch(sample_size),
         _b{0},
         _autocovariance_slice{0} {
         _b[0] = 1;
     }
 
-    // perform LPC on a sample and set up the intermediate variables
+    // load_sample can be done a step at a time, so that its work can be spread out
+    static constexpr uint32_t NLoadSteps = 3;
+
+    // perform LPC on a sample of sample_size() and set up the intermediate variables
     void load_sample(const Complex *sample) {
-        _fft.transform(sample, _freq_spectrum.data());
-
-        // assumes that sample are all real numbers; In general-purpose dsp this will cause bugs
-
-        // multiplication in the frequency domain is convolution (reversed correlation) in the real domain
-        std::array<Complex, SampleSize> freq_squared;
-        std::array<Complex, SampleSize> autocovariance_comp;
-        std::transform(
-            _freq_spectrum.cbegin(),
-            _freq_spectrum.cend(),
-            freq_squared.begin(),
-            [] (Complex f) { return std::norm(f); }
-        );
-        _fft.inverse_transform(freq_squared.data(), autocovariance_comp.data());
-        std::transform(
-            autocovariance_comp.cbegin(),
-            autocovariance_comp.cend(),
-            _autocovariance.begin(),
-            [] (Complex c) { return c.real(); }
-        );
-
-        std::copy(
-            _autocovariance.cbegin(),
-            _autocovariance.cbegin() + NParams + 1,
-            _autocovariance_slice.begin()
-        );
-
-        std::array<float, NParams + 1> a = solve_sym_toeplitz(_autocovariance_slice, _b);
-        std::array<Complex, SampleSize> a_comp{0};
-        const float a0 = a[0];
-        std::transform(a.cbegin(), a.cend(), a_comp.begin(),
-            [a0] (float f) { return Complex(f / a0); }
-        );
-        
-        std::array<Complex, SampleSize> A;
-        _fft.transform(a_comp.data(), A.data());
-
-        // calc envelope
-        std::transform(A.cbegin(), A.cend(), _envelope.begin(),
-            // try to prevent infs
-            [] (Complex c) { return 1.0f / (sqrt(std::norm(c))); }
-        );
-
-        // calce residuals
-        for (uint32_t i = 0; i < SampleSize; i++) {
-            _residuals[i] = std::sqrt(std::norm(_freq_spectrum[i] * A[i]));
+        for (uint32_t step = 0; step < NLoadSteps; step++) {
+            load_sample_step(sample, step);
+        }
+    }
+
+    // Does step of load_sample, which must follow the steps before it. Only the first reads sample.
+    // Results are only valid after the last step
+    void load_sample_step(const Complex *sample, uint32_t step) {
+        const uint32_t sample_size = _fft.size();
+        switch (step) {
+            case 0:
+                _fft.transform(sample, _freq_spectrum.data());
+                break;
+
+            case 1:
+                // autocovariance is the inverse transform of the power spectrum
+                std::transform(
+                    _freq_spectrum.cbegin(),
+                    _freq_spectrum.cend(),
+                    _freq_squared.begin(),
+                    [] (Complex f) { return std::norm(f); }
+                );
+                _fft.inverse_transform(_freq_squared.data(), _scratch.data());
+                std::transform(
+                    _scratch.cbegin(),
+                    _scratch.cend(),
+                    _autocovariance.begin(),
+                    [] (Complex c) { return c.real(); }
+                );
+                break;
+
+            default: {
+                std::copy(
+                    _autocovariance.cbegin(),
+                    _autocovariance.cbegin() + NParams + 1,
+                    _autocovariance_slice.begin()
+                );
+
+                std::array<float, NParams + 1> a = solve_sym_toeplitz(_autocovariance_slice, _b);
+                const float a0 = a[0];
+                std::fill(_freq_squared.begin(), _freq_squared.end(), Complex());
+                std::transform(a.cbegin(), a.cend(), _freq_squared.begin(),
+                    [a0] (float f) { return Complex(f / a0); }
+                );
+
+                // _scratch now holds A, the spectrum of the prediction filter
+                _fft.transform(_freq_squared.data(), _scratch.data());
+
+                for (uint32_t i = 0; i < sample_size; i++) {
+                    _envelope[i] = 1.0f / std::sqrt(std::norm(_scratch[i]));
+                    _residuals[i] = std::sqrt(std::norm(_freq_spectrum[i] * _scratch[i]));
+                }
+                break;
+            }
         }
-        // std::transform(_freq_spectrum.cbegin(), _freq_spectrum.cend(), A.cbegin(), _residuals.begin(),
-        //     [] (Complex x_val, Complex a_val) { return std::sqrt(std::norm(x_val * a_val)); }
-        // );
     }
-    
+
+    uint32_t sample_size() const {
+        return _fft.size();
+    }
+
     // The dft of the loaded samples
-    const std::array<Complex, SampleSize> &get_freq_spectrum() const {
+    const std::vector<Complex> &get_freq_spectrum() const {
         return _freq_spectrum;
     }
-    
+
     // The correlation of the signal with itself
-    const std::array<float, SampleSize> &get_autocovariance() const {
+    const std::vector<float> &get_autocovariance() const {
         return _autocovariance;
     }
-    
-    // Normalized copy of autocovariance
-    std::array<float, SampleSize> get_autocorrelation() const {
-        std::array<float, SampleSize> autocorrelation;
-        float max_cov = *std::max_element(_autocovariance);
-        std::transform(
-            _autocovariance.cbegin(),
-            _autocovariance.cend(),
-            autocorrelation.begin(),
-            [max_cov] (float cov) {return cov / max_cov;}
-        );
-    }
 
     // Envelope of the frequency spectrum
-    const std::array<float, SampleSize> &get_envelope() const {
+    const std::vector<float> &get_envelope() const {
         return _envelope;
     }
 
     // LCP residuals of the frequency
-    const std::array<float, SampleSize> &get_residuals() const {
+    const std::vector<float> &get_residuals() const {
         return _residuals;
     }
 
@@ -157,18 +260,24 @@ public:
 
 private:
     // results to be getted
-    std::array<Complex, SampleSize> _freq_spectrum;
-    std::array<float, SampleSize> _autocovariance;
-    std::array<float, SampleSize> _envelope;
-    std::array<float, SampleSize> _residuals; 
+    std::vector<Complex> _freq_spectrum;
+    std::vector<float> _autocovariance;
+    std::vector<float> _envelope;
+    std::vector<float> _residuals;
 
     // intermediates
     FFT _fft;
+    std::vector<Complex> _freq_squared;
+    std::vector<Complex> _scratch;
     std::array<float, NParams + 1> _b;
     std::array<float, NParams + 1> _autocovariance_slice;
-    // std::vector<float> _b;
-    // std::vector<float> _autocovariance_slice;
-    
+};
+
+// DynamicLPC with its sample size fixed at compile time
+template<uint32_t SampleSize, uint32_t NParams>
+class LPC: public DynamicLPC<NParams> {
+public:
+    LPC(): DynamicLPC<NParams>(SampleSize) {}
 };
 
 }
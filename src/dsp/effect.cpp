@@ -1,5 +1,6 @@
 #include <dsp/effect.h>
 #include <mengumath.h>
+#include <cmath>
 
 
 Mengu::dsp::EffectChain::EffectChain(uint32_t buffer_size) {
@@ -28,4 +29,23 @@ void Mengu::dsp::EffectChain::pop_transformed_signal(Complex *output, const uint
 
 void Mengu::dsp::EffectChain::append_effect(Effect *effect) {
     _effects.push_back(effect);
-}
\ No newline at end of file
+}
+
+void Mengu::dsp::EffectChain::set_sample_rate(uint32_t sample_rate) {
+    for (auto effect: _effects) {
+        effect->set_sample_rate(sample_rate);
+    }
+}
+
+void Mengu::dsp::Effect::set_sample_rate(uint32_t sample_rate) {
+    _sample_rate = sample_rate;
+}
+
+uint32_t Mengu::dsp::Effect::_scale_size(uint32_t size) const {
+    return (uint64_t) size * _sample_rate / DefaultSampleRate;
+}
+
+uint32_t Mengu::dsp::Effect::_scale_pow2_size(uint32_t size) const {
+    const int octaves = CLAMP((int) std::round(std::log2((double) _sample_rate / DefaultSampleRate)), -MaxSizeScaleLog2, MaxSizeScaleLog2);
+    return octaves >= 0 ? size << octaves : size >> -octaves;
+}
@@ -78,6 +78,38 @@ public:
     virtual void set_property(uint32_t id, EffectPropPayload data) = 0;
     // Gets the value of a property with the specified id
     virtual EffectPropPayload get_property(uint32_t id) const = 0;
+
+    // Effects that can share where they cut their input with copies of themselves on other channels, so that every
+    // channel is cut in the same places and stays in step, and only one copy has to analyse its input
+    virtual bool supports_alignment_sharing() const {
+        return false;
+    }
+    // Has the effect decide where to cut from this signal instead of the one it processes, such as a mix of channels.
+    // Pushed before each push_signal, by the same size
+    virtual void push_analysis_signal(const Complex *input, const uint32_t &size) {}
+    // Appends where the effect cuts its input to alignment as it is popped, or stops if nullptr
+    virtual void record_alignment(std::vector<uint32_t> *alignment) {}
+    // Cuts the input where alignment says instead of analysing it, reading it from the start, or analyses again if nullptr.
+    // The alignment must be recorded by a copy with the same settings, pushed and popped by the same sizes
+    virtual void follow_alignment(const std::vector<uint32_t> *alignment) {}
+
+    // Sizes in samples are tuned for signals at this rate
+    static constexpr uint32_t DefaultSampleRate = 44100;
+    // power-of-2 (fft) sizes are scaled by at most this many octaves either way, so buffers can be bounded
+    static constexpr int MaxSizeScaleLog2 = 2;
+
+    // Tells the effect the rate of the signals pushed to it, so that its sizes cover the same span of time as they
+    // would at DefaultSampleRate. May allocate and reset the effect, so it should be called before processing
+    virtual void set_sample_rate(uint32_t sample_rate);
+    uint32_t get_sample_rate() const { return _sample_rate; }
+
+protected:
+    uint32_t _sample_rate = DefaultSampleRate;
+
+    // a size tuned at DefaultSampleRate, scaled to _sample_rate
+    uint32_t _scale_size(uint32_t size) const;
+    // a power-of-2 size tuned at DefaultSampleRate, scaled by the power of 2 nearest to the ratio of the rates
+    uint32_t _scale_pow2_size(uint32_t size) const;
 };
 
 // Represents a series of effects chained consequtivly. Processed on demand
@@ -95,6 +127,9 @@ public:
     // add an Effect
     void append_effect(Effect *effect);
 
+    // sets the sample rate of every effect in the chain
+    void set_sample_rate(uint32_t sample_rate);
+
     // apply all effects
     void process();
 
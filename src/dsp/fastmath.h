@@ -2,6 +2,12 @@
 #define MENGA_FAST_MATH
 #include "mengumath.h"
 #include <cmath>
+#include <complex>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 namespace Mengu {
 namespace dsp {
@@ -34,6 +40,185 @@ FloatType tan(FloatType x) {
     return numerator / denominator;
 }
 
+// Polynomial approximations for the per-bin work of phase vocoders.
+// The array versions further down run 4 bins at a time with SSE2 where available, and give the same results
+
+// rounds to the nearest integer, halves away from zero. Only for |x| < 2^31
+inline int32_t fast_round(float x) {
+    return (int32_t) (x + (x >= 0.0f ? 0.5f : -0.5f));
+}
+
+// coefficients of atan(a) on [0, 1]
+static constexpr float AtanCoeffs[6] = {0.99997726f, -0.33262347f, 0.19354346f, -0.11643287f, 0.05265332f, -0.01172120f};
+// pi / 2 split into three parts, the first two exact in a few bits, so reducing large arguments keeps precision
+static constexpr float HalfPiParts[3] = {1.5703125f, 4.837512969970703125e-4f, 7.54978995489188216e-8f};
+// coefficients of sin(r) and cos(r) on [-pi/4, pi/4]
+static constexpr float SinCoeffs[3] = {-1.6666654611e-1f, 8.3321608736e-3f, -1.9515295891e-4f};
+static constexpr float CosCoeffs[3] = {4.166664568298827e-2f, -1.388731625493765e-3f, 2.443315711809948e-5f};
+// tau split so the first multiple is exact
+static constexpr float TauParts[2] = {6.28125f, 1.9353071795864769e-3f};
+
+// atan2 with an absolute error under 3e-6 radians. Returns 0 for (0, 0)
+inline float fast_atan2(float y, float x) {
+    const float ax = std::abs(x);
+    const float ay = std::abs(y);
+    // atan of a ratio in [0, 1], then reflected into the right octant
+    const float a = MIN(ax, ay) / (MAX(ax, ay) + 1e-30f);
+    const float a2 = a * a;
+    float r = a * (AtanCoeffs[0] + a2 * (AtanCoeffs[1] + a2 * (AtanCoeffs[2] + a2 * (AtanCoeffs[3] + a2 * (AtanCoeffs[4] + a2 * AtanCoeffs[5])))));
+    r = ay > ax ? (float) (MATH_PI / 2) - r : r;
+    r = x < 0.0f ? (float) MATH_PI - r : r;
+    return std::copysign(r, y);
+}
+
+// sin and cos together, with an absolute error under 2e-7 for |x| < 8192
+inline void fast_sincos(float x, float &sin_x, float &cos_x) {
+    // reduce to [-pi/4, pi/4] around the nearest multiple of pi/2
+    const int32_t quadrant = fast_round(x * (float) (2.0 / MATH_PI));
+    const float r = ((x - quadrant * HalfPiParts[0]) - quadrant * HalfPiParts[1]) - quadrant * HalfPiParts[2];
+    const float r2 = r * r;
+
+    const float s = r + r * r2 * (SinCoeffs[0] + r2 * (SinCoeffs[1] + r2 * SinCoeffs[2]));
+    const float c = 1.0f - 0.5f * r2 + r2 * r2 * (CosCoeffs[0] + r2 * (CosCoeffs[1] + r2 * CosCoeffs[2]));
+
+    const bool swap = quadrant & 1;
+    const float sin_r = swap ? c : s;
+    const float cos_r = swap ? s : c;
+    sin_x = (quadrant & 2) ? -sin_r : sin_r;
+    cos_x = ((quadrant + 1) & 2) ? -cos_r : cos_r;
+}
+
+// wraps a phase into [-pi, pi] (overshooting by at most 1e-3 around +-pi), 
+// with an absolute error under 1e-6 for |phase| < 8192
+inline float fast_wrap_phase(float phase) {
+    const int32_t turns = fast_round(phase * (float) (1.0 / MATH_TAU));
+    return (phase - turns * TauParts[0]) - turns * TauParts[1];
+}
+
+inline float fast_arg(const std::complex<float> z) {
+    return fast_atan2(z.imag(), z.real());
+}
+
+inline std::complex<float> fast_polar(const float mag, const float phase) {
+    float s, c;
+    fast_sincos(phase, s, c);
+    return std::complex<float>(mag * c, mag * s);
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+// 4 lane versions of the above. Same error bounds
+
+inline __m128 _blend_ps(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// fast_round. _mm_cvtps_epi32 rounds halves to even instead
+inline __m128i _round_ps(__m128 x) {
+    const __m128 half = _mm_or_ps(_mm_set1_ps(0.5f), _mm_and_ps(_mm_set1_ps(-0.0f), x));
+    return _mm_cvttps_epi32(_mm_add_ps(x, half));
+}
+
+inline __m128 _atan2_ps(__m128 y, __m128 x) {
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128 ax = _mm_andnot_ps(sign_mask, x);
+    const __m128 ay = _mm_andnot_ps(sign_mask, y);
+    const __m128 a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_add_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1e-30f)));
+    const __m128 a2 = _mm_mul_ps(a, a);
+
+    __m128 r = _mm_set1_ps(AtanCoeffs[5]);
+    for (int i = 4; i >= 0; i--) {
+        r = _mm_add_ps(_mm_set1_ps(AtanCoeffs[i]), _mm_mul_ps(a2, r));
+    }
+    r = _mm_mul_ps(a, r);
+
+    r = _blend_ps(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(MATH_PI / 2), r), r);
+    r = _blend_ps(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_sub_ps(_mm_set1_ps(MATH_PI), r), r);
+    return _mm_or_ps(r, _mm_and_ps(sign_mask, y));
+}
+
+inline void _sincos_ps(__m128 x, __m128 &sin_x, __m128 &cos_x) {
+    const __m128i quadrant = _round_ps(_mm_mul_ps(x, _mm_set1_ps(2.0 / MATH_PI)));
+    const __m128 q = _mm_cvtepi32_ps(quadrant);
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(HalfPiParts[0])));
+    r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(HalfPiParts[1])));
+    r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(HalfPiParts[2])));
+    const __m128 r2 = _mm_mul_ps(r, r);
+
+    __m128 s = _mm_add_ps(_mm_set1_ps(SinCoeffs[1]), _mm_mul_ps(r2, _mm_set1_ps(SinCoeffs[2])));
+    s = _mm_add_ps(_mm_set1_ps(SinCoeffs[0]), _mm_mul_ps(r2, s));
+    s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), s));
+
+    __m128 c = _mm_add_ps(_mm_set1_ps(CosCoeffs[1]), _mm_mul_ps(r2, _mm_set1_ps(CosCoeffs[2])));
+    c = _mm_add_ps(_mm_set1_ps(CosCoeffs[0]), _mm_mul_ps(r2, c));
+    c = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), r2)), _mm_mul_ps(_mm_mul_ps(r2, r2), c));
+
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i two = _mm_set1_epi32(2);
+    const __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, one), one));
+    // bit 1 of the quadrant shifted up into the sign bit
+    const __m128 sin_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, two), 30));
+    const __m128 cos_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, one), two), 30));
+    sin_x = _mm_xor_ps(_blend_ps(swap, c, s), sin_sign);
+    cos_x = _mm_xor_ps(_blend_ps(swap, s, c), cos_sign);
+}
+
+inline __m128 _wrap_phase_ps(__m128 phase) {
+    const __m128 turns = _mm_cvtepi32_ps(_round_ps(_mm_mul_ps(phase, _mm_set1_ps(1.0 / MATH_TAU))));
+    const __m128 wrapped = _mm_sub_ps(phase, _mm_mul_ps(turns, _mm_set1_ps(TauParts[0])));
+    return _mm_sub_ps(wrapped, _mm_mul_ps(turns, _mm_set1_ps(TauParts[1])));
+}
+#endif
+
+// array versions
+inline void fast_arg(const std::complex<float> *z, float *output, const uint32_t size) {
+    uint32_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    // std::complex is laid out as an array of (real, imag)
+    const float *packed = reinterpret_cast<const float *>(z);
+    for (; i + 4 <= size; i += 4) {
+        const __m128 lo = _mm_loadu_ps(packed + 2 * i);
+        const __m128 hi = _mm_loadu_ps(packed + 2 * i + 4);
+        const __m128 re = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 im = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(output + i, _atan2_ps(im, re));
+    }
+#endif
+    for (; i < size; i++) {
+        output[i] = fast_arg(z[i]);
+    }
+}
+
+inline void fast_polar(const float *mags, const float *phases, std::complex<float> *output, const uint32_t size) {
+    uint32_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    float *packed = reinterpret_cast<float *>(output);
+    for (; i + 4 <= size; i += 4) {
+        __m128 s, c;
+        _sincos_ps(_mm_loadu_ps(phases + i), s, c);
+        const __m128 mag = _mm_loadu_ps(mags + i);
+        const __m128 re = _mm_mul_ps(mag, c);
+        const __m128 im = _mm_mul_ps(mag, s);
+        _mm_storeu_ps(packed + 2 * i, _mm_unpacklo_ps(re, im));
+        _mm_storeu_ps(packed + 2 * i + 4, _mm_unpackhi_ps(re, im));
+    }
+#endif
+    for (; i < size; i++) {
+        output[i] = fast_polar(mags[i], phases[i]);
+    }
+}
+
+inline void fast_wrap_phase(const float *phases, float *output, const uint32_t size) {
+    uint32_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= size; i += 4) {
+        _mm_storeu_ps(output + i, _wrap_phase_ps(_mm_loadu_ps(phases + i)));
+    }
+#endif
+    for (; i < size; i++) {
+        output[i] = fast_wrap_phase(phases[i]);
+    }
+}
+
 } // namespace dsp
 } // namespace Mengu
 
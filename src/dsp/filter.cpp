@@ -1,7 +1,18 @@
 #include "dsp/filter.h"
 #include "dsp/common.h"
+#include "mengumath.h"
+#include <algorithm>
 #include <complex>
 #include <cstdint>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define MENGU_FILTER_SSE
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MENGU_FILTER_NEON
+#include <arm_neon.h>
+#endif
 
 using namespace Mengu;
 using namespace dsp;
@@ -29,3 +40,230 @@ void BiquadFilter::transform(const float *input, float *output, uint32_t size) {
 void BiquadFilter::reset() {
     _last_ms[0] = _last_ms[1] = 0.0f; 
 }
+
+//// Operations on BiquadCascade::Lanes floats at once
+
+#if defined(MENGU_FILTER_SSE)
+typedef __m128 LaneVec;
+static inline LaneVec _lanes_load(const float *p) { return _mm_loadu_ps(p); }
+static inline void _lanes_store(float *p, LaneVec v) { _mm_storeu_ps(p, v); }
+static inline LaneVec _lanes_set1(float x) { return _mm_set1_ps(x); }
+static inline LaneVec _lanes_add(LaneVec a, LaneVec b) { return _mm_add_ps(a, b); }
+static inline LaneVec _lanes_sub(LaneVec a, LaneVec b) { return _mm_sub_ps(a, b); }
+static inline LaneVec _lanes_mul(LaneVec a, LaneVec b) { return _mm_mul_ps(a, b); }
+template<int K>
+static inline LaneVec _lanes_broadcast(LaneVec v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(K, K, K, K)); }
+#elif defined(MENGU_FILTER_NEON)
+typedef float32x4_t LaneVec;
+static inline LaneVec _lanes_load(const float *p) { return vld1q_f32(p); }
+static inline void _lanes_store(float *p, LaneVec v) { vst1q_f32(p, v); }
+static inline LaneVec _lanes_set1(float x) { return vdupq_n_f32(x); }
+static inline LaneVec _lanes_add(LaneVec a, LaneVec b) { return vaddq_f32(a, b); }
+static inline LaneVec _lanes_sub(LaneVec a, LaneVec b) { return vsubq_f32(a, b); }
+static inline LaneVec _lanes_mul(LaneVec a, LaneVec b) { return vmulq_f32(a, b); }
+template<int K>
+static inline LaneVec _lanes_broadcast(LaneVec v) { return vdupq_n_f32(vgetq_lane_f32(v, K)); }
+#else
+struct LaneVec {
+    float v[BiquadCascade::Lanes];
+};
+static inline LaneVec _lanes_load(const float *p) {
+    LaneVec r;
+    for (uint32_t i = 0; i < BiquadCascade::Lanes; i++) r.v[i] = p[i];
+    return r;
+}
+static inline void _lanes_store(float *p, LaneVec v) {
+    for (uint32_t i = 0; i < BiquadCascade::Lanes; i++) p[i] = v.v[i];
+}
+static inline LaneVec _lanes_set1(float x) {
+    LaneVec r;
+    for (uint32_t i = 0; i < BiquadCascade::Lanes; i++) r.v[i] = x;
+    return r;
+}
+static inline LaneVec _lanes_add(LaneVec a, LaneVec b) {
+    for (uint32_t i = 0; i < BiquadCascade::Lanes; i++) a.v[i] += b.v[i];
+    return a;
+}
+static inline LaneVec _lanes_sub(LaneVec a, LaneVec b) {
+    for (uint32_t i = 0; i < BiquadCascade::Lanes; i++) a.v[i] -= b.v[i];
+    return a;
+}
+static inline LaneVec _lanes_mul(LaneVec a, LaneVec b) {
+    for (uint32_t i = 0; i < BiquadCascade::Lanes; i++) a.v[i] *= b.v[i];
+    return a;
+}
+template<int K>
+static inline LaneVec _lanes_broadcast(LaneVec v) { return _lanes_set1(v.v[K]); }
+#endif
+
+// a + b * c
+static inline LaneVec _lanes_mul_add(LaneVec a, LaneVec b, LaneVec c) {
+    return _lanes_add(a, _lanes_mul(b, c));
+}
+
+static_assert(BiquadCascade::BlockSize == BiquadCascade::Lanes, "a block is filtered in one register");
+
+BiquadCascade::BiquadCascade(uint32_t n_channels) {
+    _n_channels = MAX(n_channels, 1u);
+    _n_padded_channels = (_n_channels + Lanes - 1) / Lanes * Lanes;
+    _state.resize(2 * MaxStages * _n_padded_channels, 0.0f);
+}
+
+void BiquadCascade::set_stages(const BiquadCoefficients *stages, uint32_t n_stages) {
+    if (n_stages > MaxStages) {
+        throw std::runtime_error("BiquadCascade: too many stages");
+    }
+    _n_stages = n_stages;
+    for (uint32_t s = 0; s < n_stages; s++) {
+        const BiquadCoefficients &c = stages[s];
+        _stages[s] = c;
+
+        // find the block form by running the recurrence on each input, and on each m before the block, alone
+        BlockStage &block = _block_stages[s];
+        for (uint32_t j = 0; j < BlockSize + 2; j++) {
+            double x[BlockSize] = {0.0};
+            if (j < BlockSize) {
+                x[j] = 1.0;
+            }
+            double m1 = j == BlockSize ? 1.0 : 0.0;
+            double m2 = j == BlockSize + 1 ? 1.0 : 0.0;
+            float *y_col = j < BlockSize ? block.y_from_x[j] : (j == BlockSize ? block.y_from_m1 : block.y_from_m2);
+            float *m_col = j < BlockSize ? block.m_from_x[j] : (j == BlockSize ? block.m_from_m1 : block.m_from_m2);
+            for (uint32_t k = 0; k < BlockSize; k++) {
+                const double m = x[k] - c.a1 * m1 - c.a2 * m2;
+                y_col[k] = c.b0 * m + c.b1 * m1 + c.b2 * m2;
+                m_col[k] = m;
+                m2 = m1;
+                m1 = m;
+            }
+        }
+    }
+    reset();
+}
+
+void BiquadCascade::transform(const float *const *inputs, float *const *outputs, uint32_t size) {
+    for (uint32_t c = 0; c < _n_channels; c += Lanes) {
+        _transform_lanes(inputs, outputs, c, size);
+    }
+}
+
+void BiquadCascade::_transform_lanes(const float *const *inputs, float *const *outputs, uint32_t first_channel, uint32_t size) {
+    const uint32_t n_lanes = MIN(Lanes, _n_channels - first_channel);
+    // unused lanes filter silence
+    float chunk[ChunkSize * Lanes] = {0.0f};
+
+    LaneVec a1s[MaxStages], a2s[MaxStages], b0s[MaxStages], b1s[MaxStages], b2s[MaxStages];
+    LaneVec m1s[MaxStages], m2s[MaxStages];
+    for (uint32_t s = 0; s < _n_stages; s++) {
+        const BiquadCoefficients &c = _stages[s];
+        a1s[s] = _lanes_set1(c.a1);
+        a2s[s] = _lanes_set1(c.a2);
+        b0s[s] = _lanes_set1(c.b0);
+        b1s[s] = _lanes_set1(c.b1);
+        b2s[s] = _lanes_set1(c.b2);
+        m1s[s] = _lanes_load(_stage_state(s, 0) + first_channel);
+        m2s[s] = _lanes_load(_stage_state(s, 1) + first_channel);
+    }
+
+    for (uint32_t start = 0; start < size; start += ChunkSize) {
+        const uint32_t n = MIN(ChunkSize, size - start);
+        for (uint32_t l = 0; l < n_lanes; l++) {
+            const float *input = inputs[first_channel + l] + start;
+            for (uint32_t i = 0; i < n; i++) {
+                chunk[i * Lanes + l] = input[i];
+            }
+        }
+
+        // stages are stepped together a sample at a time, so each one's recurrence overlaps the others'
+        for (uint32_t i = 0; i < n; i++) {
+            LaneVec x = _lanes_load(chunk + i * Lanes);
+            for (uint32_t s = 0; s < _n_stages; s++) {
+                const LaneVec m = _lanes_sub(_lanes_sub(x, _lanes_mul(a1s[s], m1s[s])), _lanes_mul(a2s[s], m2s[s]));
+                x = _lanes_mul_add(_lanes_mul_add(_lanes_mul(b0s[s], m), b1s[s], m1s[s]), b2s[s], m2s[s]);
+                m2s[s] = m1s[s];
+                m1s[s] = m;
+            }
+            _lanes_store(chunk + i * Lanes, x);
+        }
+
+        for (uint32_t l = 0; l < n_lanes; l++) {
+            float *output = outputs[first_channel + l] + start;
+            for (uint32_t i = 0; i < n; i++) {
+                output[i] = chunk[i * Lanes + l];
+            }
+        }
+    }
+
+    for (uint32_t s = 0; s < _n_stages; s++) {
+        _lanes_store(_stage_state(s, 0) + first_channel, m1s[s]);
+        _lanes_store(_stage_state(s, 1) + first_channel, m2s[s]);
+    }
+}
+
+void BiquadCascade::transform(const float *input, float *output, uint32_t size) {
+    // the last two ms of each stage, in every lane
+    LaneVec m1s[MaxStages];
+    LaneVec m2s[MaxStages];
+    for (uint32_t s = 0; s < _n_stages; s++) {
+        m1s[s] = _lanes_set1(_stage_state(s, 0)[0]);
+        m2s[s] = _lanes_set1(_stage_state(s, 1)[0]);
+    }
+
+    uint32_t i = 0;
+    for (; i + BlockSize <= size; i += BlockSize) {
+        LaneVec block = _lanes_load(input + i);
+        for (uint32_t s = 0; s < _n_stages; s++) {
+            const BlockStage &stage = _block_stages[s];
+            const LaneVec xs[BlockSize] = {
+                _lanes_broadcast<0>(block), _lanes_broadcast<1>(block),
+                _lanes_broadcast<2>(block), _lanes_broadcast<3>(block)
+            };
+
+            // the inputs are summed in pairs and the state is added last, so each block waits on the last as little as possible
+            const LaneVec y_x = _lanes_add(
+                _lanes_mul_add(_lanes_mul(xs[0], _lanes_load(stage.y_from_x[0])), xs[1], _lanes_load(stage.y_from_x[1])),
+                _lanes_mul_add(_lanes_mul(xs[2], _lanes_load(stage.y_from_x[2])), xs[3], _lanes_load(stage.y_from_x[3]))
+            );
+            const LaneVec m_x = _lanes_add(
+                _lanes_mul_add(_lanes_mul(xs[0], _lanes_load(stage.m_from_x[0])), xs[1], _lanes_load(stage.m_from_x[1])),
+                _lanes_mul_add(_lanes_mul(xs[2], _lanes_load(stage.m_from_x[2])), xs[3], _lanes_load(stage.m_from_x[3]))
+            );
+            const LaneVec y = _lanes_add(y_x, _lanes_mul_add(_lanes_mul(m1s[s], _lanes_load(stage.y_from_m1)), m2s[s], _lanes_load(stage.y_from_m2)));
+            const LaneVec m = _lanes_add(m_x, _lanes_mul_add(_lanes_mul(m1s[s], _lanes_load(stage.m_from_m1)), m2s[s], _lanes_load(stage.m_from_m2)));
+
+            m1s[s] = _lanes_broadcast<BlockSize - 1>(m);
+            m2s[s] = _lanes_broadcast<BlockSize - 2>(m);
+            block = y;
+        }
+        _lanes_store(output + i, block);
+    }
+
+    float m1_last[MaxStages][Lanes];
+    float m2_last[MaxStages][Lanes];
+    for (uint32_t s = 0; s < _n_stages; s++) {
+        _lanes_store(m1_last[s], m1s[s]);
+        _lanes_store(m2_last[s], m2s[s]);
+    }
+
+    // what is left of the block runs the recurrence directly
+    for (; i < size; i++) {
+        float x = input[i];
+        for (uint32_t s = 0; s < _n_stages; s++) {
+            const BiquadCoefficients &c = _stages[s];
+            const float m = x - c.a1 * m1_last[s][0] - c.a2 * m2_last[s][0];
+            x = c.b0 * m + c.b1 * m1_last[s][0] + c.b2 * m2_last[s][0];
+            m2_last[s][0] = m1_last[s][0];
+            m1_last[s][0] = m;
+        }
+        output[i] = x;
+    }
+
+    for (uint32_t s = 0; s < _n_stages; s++) {
+        _stage_state(s, 0)[0] = m1_last[s][0];
+        _stage_state(s, 1)[0] = m2_last[s][0];
+    }
+}
+
+void BiquadCascade::reset() {
+    std::fill(_state.begin(), _state.end(), 0.0f);
+}
@@ -12,7 +12,9 @@
 #define MENGU_FILTER
 
 #include "dsp/common.h"
+#include <array>
 #include <cstdint>
+#include <vector>
 namespace Mengu {
 namespace dsp {
 // the transfer function for a quadratic filter with denominator coefficients a1, a2 and numerator cofficients b0, b1, b2
@@ -39,6 +41,79 @@ private:
     uint32_t _last_offset = 0;
 };
 
+// Coefficients of one biquad, named as in BiquadFilter
+struct BiquadCoefficients {
+    float a1;
+    float a2;
+    float b0;
+    float b1;
+    float b2;
+};
+
+// A chain of biquads, run on several independent channels at once with a channel in each lane of a vector register.
+// Every channel goes through the same stages, but keeps its own state.
+// A lone channel is instead filtered a block at a time, with each stage's recurrence unrolled over the block
+class BiquadCascade {
+public:
+    static constexpr uint32_t MaxStages = 4;
+    // channels filtered together
+    static constexpr uint32_t Lanes = 4;
+    // samples of a lone channel filtered together
+    static constexpr uint32_t BlockSize = 4;
+
+    BiquadCascade(uint32_t n_channels = 1);
+
+    // at most MaxStages, applied in order. Resets the cascade
+    void set_stages(const BiquadCoefficients *stages, uint32_t n_stages);
+    inline uint32_t get_n_stages() const {
+        return _n_stages;
+    }
+    inline uint32_t get_n_channels() const {
+        return _n_channels;
+    }
+
+    // filters size samples of each channel's input into its output. An output may be its input
+    void transform(const float *const *inputs, float *const *outputs, uint32_t size);
+    // filters size samples of the first channel. The output may be the input
+    void transform(const float *input, float *output, uint32_t size);
+
+    void reset();
+
+private:
+    // channels are interleaved into chunks of this many samples to be filtered
+    static constexpr uint32_t ChunkSize = 64;
+
+    uint32_t _n_channels;
+    // channels rounded up to a multiple of Lanes
+    uint32_t _n_padded_channels;
+    uint32_t _n_stages = 0;
+    std::array<BiquadCoefficients, MaxStages> _stages;
+
+    // A stage over a block, with m the intermediaries as in BiquadFilter.
+    // Each output is what every input of the block adds to it, plus what the last two ms before the block add.
+    // The last two ms of the block are the state for the next
+    struct BlockStage {
+        // y_from_x[j][k] is how much input j adds to output k
+        float y_from_x[BlockSize][BlockSize];
+        float y_from_m1[BlockSize];
+        float y_from_m2[BlockSize];
+        // the same for the ms of the block
+        float m_from_x[BlockSize][BlockSize];
+        float m_from_m1[BlockSize];
+        float m_from_m2[BlockSize];
+    };
+    std::array<BlockStage, MaxStages> _block_stages;
+
+    // the last two ms of each stage and channel, as [stage][last m, the one before][channel]
+    std::vector<float> _state;
+
+    inline float *_stage_state(uint32_t stage, uint32_t ind) {
+        return _state.data() + (2 * stage + ind) * _n_padded_channels;
+    }
+
+    void _transform_lanes(const float *const *inputs, float *const *outputs, uint32_t first_channel, uint32_t size);
+};
+
 }
 }
 #endif
\ No newline at end of file
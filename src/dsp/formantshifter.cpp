@@ -5,12 +5,14 @@
 #include "dsp/effect.h"
 #include "dsp/interpolation.h"
 #include "dsp/loudness.h"
+#include "dsp/singletons.h"
 #include "mengumath.h"
 #include <algorithm>
 #include <array>
 #include <cmath>
 #include <complex>
 #include <cstdint>
+#include <memory>
 
 using namespace Mengu;
 using namespace dsp;
@@ -18,7 +20,40 @@ using namespace dsp;
 
 
 LPCFormantShifter::LPCFormantShifter() {
-    _transformed_buffer.resize(OverlapSize);
+    _resize_frames();
+}
+
+void LPCFormantShifter::set_sample_rate(uint32_t sample_rate) {
+    Effect::set_sample_rate(sample_rate);
+    _resize_frames();
+}
+
+void LPCFormantShifter::_resize_frames() {
+    _proc_size = _scale_pow2_size(ProcSize);
+    _hop_size = _proc_size * 4 / 5;
+    _overlap_size = _proc_size - _hop_size;
+    _overlap_window = &Singletons::get_singleton()->get_window_table(hamming_window, _overlap_size);
+
+    _lpc = std::make_unique<DynamicLPC<LPCParams>>(_proc_size);
+
+    _samples.resize(_proc_size);
+    _freq_shifted.resize(_proc_size);
+    _shifted_samples.resize(_proc_size);
+
+    _loudness_norm.set_format(_proc_size, _sample_rate);
+
+    _clear_buffers();
+}
+
+void LPCFormantShifter::_clear_buffers() {
+    _raw_buffer.resize(0);
+    // Spread out, output starts a frame and a hop ahead. The frame keeps it from running dry waiting for the first
+    // frame's input, which would leave each frame needed as soon as its input is in, and the hop is what each has to be done in
+    _transformed_buffer.resize(0);
+    _transformed_buffer.resize(_overlap_size + (_spread_work ? _proc_size + _hop_size : 0), 0);
+
+    _n_slices_done = NFrameSlices;
+    _slice_credit = 0.0f;
 }
 
 Effect::InputDomain LPCFormantShifter::get_input_domain() {
@@ -33,42 +68,86 @@ void LPCFormantShifter::push_signal(const Complex *input, const uint32_t &size)
 
 // Last value of transformed signal
 uint32_t LPCFormantShifter::pop_transformed_signal(Complex *output, const uint32_t &size) {    
-    std::array<Complex, ProcSize> freq_shifted {0};
-    std::array<Complex, ProcSize> samples {0};
-    std::array<Complex, ProcSize> shifted_samples {0};
+    if (_spread_work) {
+        _slice_credit += (float) size * NFrameSlices / _hop_size;
+        while (true) {
+            if (_n_slices_done == NFrameSlices && _raw_buffer.size() < _proc_size) {
+                // credit does not pile up waiting for input, or the next frame would be done at once
+                _slice_credit = MIN(_slice_credit, 1.0f);
+                break;
+            }
+            // anything still needed is done now, whatever the credit
+            if (_slice_credit < 1.0f && _transformed_buffer.size() >= size + _overlap_size) {
+                break;
+            }
+            _do_slice();
+            _slice_credit = MAX(_slice_credit - 1.0f, 0.0f);
+        }
+    }
+    else {
+        while (_raw_buffer.size() >= _proc_size && _transformed_buffer.size() < size + _overlap_size) {
+            for (uint32_t slice = 0; slice < NFrameSlices; slice++) {
+                _do_slice();
+            }
+        }
+    }
+
+    if (_transformed_buffer.size() < size + _overlap_size) {
+        // Not enough samples to output anything
+        return 0;
+    }
+    else {
+        return _transformed_buffer.pop_front_many(output, size);
+    }
+}
 
-    while (_raw_buffer.size() >= ProcSize && _transformed_buffer.size() < size + OverlapSize) {
-        
-        // Load sample segment. 0 unused frames
-        _raw_buffer.to_array(samples.data(), ProcSize);
+void LPCFormantShifter::_do_slice() {
+    if (_n_slices_done == NFrameSlices) {
+        _n_slices_done = 0;
+    }
 
+    const uint32_t slice = _n_slices_done;
+    if (slice < ShiftSlice) {
+        if (slice == 0) {
+            // Load sample segment. 0 unused frames
+            _raw_buffer.to_array(_samples.data(), _proc_size);
+        }
+        _lpc->load_sample_step(_samples.data(), slice);
+    }
+    else if (slice == ShiftSlice) {
         // do the shifty
-        _lpc.load_sample(samples.data());
         _shift_by_env(
-            _lpc.get_freq_spectrum().data(), 
-            freq_shifted.data(), 
-            _lpc.get_envelope().data(),
+            _lpc->get_freq_spectrum().data(), 
+            _freq_shifted.data(), 
+            _lpc->get_envelope().data(),
             _shift_factor
         );
-        _lpc.get_fft().inverse_transform(freq_shifted.data(), shifted_samples.data());
-
-        // Make downward shifts not quieter and upward shifts not louder
-        // Automatically adjusts for the fact that only half of the frequency spectrum is used
-        _loudness_norm.normalize(shifted_samples.data(), samples.data(), shifted_samples.data());
 
+        // Make downward shifts not quieter and upward shifts not louder.
+        // Only half of the frequency spectrum is used, which comes out at half the amplitude, so it is doubled
+        const float gain = 2.0f * _loudness_norm.get_correction(
+            _freq_shifted.data(), _lpc->get_freq_spectrum().data(), _proc_size / 2
+        );
+        for (uint32_t i = 0; i < _proc_size / 2; i++) {
+            _freq_shifted[i] *= gain;
+        }
+    }
+    else if (slice == InverseSlice) {
+        _lpc->get_fft().inverse_transform(_freq_shifted.data(), _shifted_samples.data());
+    }
+    else {
         // copy to output
-        mix_and_extend(_transformed_buffer, shifted_samples, OverlapSize, hamming_window);
-
-        _raw_buffer.pop_front_many(nullptr, HopSize);
+        mix_and_extend(_transformed_buffer, _shifted_samples, _overlap_size, *_overlap_window);
 
+        _raw_buffer.pop_front_many(nullptr, _hop_size);
     }
+    _n_slices_done++;
+}
 
-    if (_transformed_buffer.size() < size + OverlapSize) {
-        // Not enough samples to output anything
-        return 0;
-    }
-    else {
-        return _transformed_buffer.pop_front_many(output, size);
+void LPCFormantShifter::set_spread_work(bool spread) {
+    if (spread != _spread_work) {
+        _spread_work = spread;
+        _clear_buffers();
     }
 }
 
@@ -79,8 +158,7 @@ uint32_t LPCFormantShifter::n_transformed_ready() const {
 
 // resets state of effect to make it reading to take in a new sample
 void LPCFormantShifter::reset() {
-    _raw_sample_filter.reset();
-    _shifted_sample_filter.reset();
+    _clear_buffers();
 }
 
 // The properties that this Effect exposes to be changed by GUI. 
@@ -96,7 +174,12 @@ std::vector<EffectPropDesc> LPCFormantShifter::get_property_descs() const {
                 .max_value = 2,
                 .scale = Exp,
             }
-        }
+        },
+        EffectPropDesc {
+            .type = EffectPropType::Toggle,
+            .name = "spread_work",
+            .desc = "Spreads the work of each frame over the pops before it, so no pop costs much more than the rest. Adds a hop of latency",
+        },
     };
 }
 
@@ -108,6 +191,11 @@ void LPCFormantShifter::set_property(uint32_t id, EffectPropPayload data) {
                 _shift_factor = data.value;
             }
             break;
+        case 1:
+            if (data.type == Toggle) {
+                set_spread_work(data.on);
+            }
+            break;
         default:
             break;
     }
@@ -116,6 +204,12 @@ void LPCFormantShifter::set_property(uint32_t id, EffectPropPayload data) {
 
 // Gets the value of a property with the specified id
 EffectPropPayload LPCFormantShifter::get_property(uint32_t id) const {
+    if (id == 1) {
+        return EffectPropPayload {
+            .type = Toggle,
+            .on = _spread_work,
+        };
+    }
     return EffectPropPayload {
         .type = Slider,
         .value = _shift_factor,
@@ -127,9 +221,9 @@ void LPCFormantShifter::_shift_by_env(const Complex *input,
                           Complex *output, 
                           const float *envelope, 
                           const float shift_factor) {
-    for (uint32_t i = 0; i < ProcSize / 2; i++) {
+    for (uint32_t i = 0; i < _proc_size / 2; i++) {
         uint32_t shifted_ind =  i / shift_factor;
-        if (shifted_ind < ProcSize / 2) {
+        if (shifted_ind < _proc_size / 2) {
             float correction = envelope[shifted_ind] / envelope[i];
             if (!std::isfinite(correction)) {
                 output[i] = Complex(0.0f);
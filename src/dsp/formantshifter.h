@@ -11,9 +11,12 @@
 #include "dsp/common.h"
 #include "dsp/correlation.h"
 #include "dsp/effect.h"
+#include "dsp/interpolation.h"
 #include "dsp/loudness.h"
 #include "templates/vecdeque.h"
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 namespace Mengu {
 namespace dsp {
@@ -46,15 +49,59 @@ public:
 
     // Gets the value of a property with the specified id
     virtual EffectPropPayload get_property(uint32_t id) const override;
+
+    // the frame size doubles each octave the rate is above DefaultSampleRate. Clears pushed signals
+    virtual void set_sample_rate(uint32_t sample_rate) override;
+
+    // Spreads the work of each frame over the pops before its output is needed, rather than doing it all in the pop
+    // that needs it, so no pop costs much more than the rest. Output comes about a hop later for it.
+    // Clears pushed signals, as output moves
+    void set_spread_work(bool spread);
+    inline bool get_spread_work() const {
+        return _spread_work;
+    }
 private:
     VecDeque<Complex> _raw_buffer;
     VecDeque<Complex> _transformed_buffer;
 
+    // at DefaultSampleRate
     static constexpr uint32_t ProcSize = 1 << 11;
-    static constexpr uint32_t HopSize = ProcSize * 4 / 5;
-    static constexpr uint32_t OverlapSize = ProcSize - HopSize;
 
-    LPC<ProcSize, 60> _lpc;
+    uint32_t _proc_size;
+    uint32_t _hop_size;
+    uint32_t _overlap_size;
+    const WindowTable *_overlap_window;
+
+    static constexpr uint32_t LPCParams = 60;
+    // remade when the frame is resized
+    std::unique_ptr<DynamicLPC<LPCParams>> _lpc;
+
+    // per-frame intermediates
+    std::vector<Complex> _samples;
+    std::vector<Complex> _freq_shifted;
+    std::vector<Complex> _shifted_samples;
+
+    // The work of a frame in the order it is done, first the steps of the lpc, then shifting the envelope,
+    // transforming back and adding to the output
+    static constexpr uint32_t ShiftSlice = DynamicLPC<LPCParams>::NLoadSteps;
+    static constexpr uint32_t InverseSlice = ShiftSlice + 1;
+    static constexpr uint32_t AddSlice = InverseSlice + 1;
+    static constexpr uint32_t NFrameSlices = AddSlice + 1;
+
+    bool _spread_work = false;
+    // slices of the frame in progress that are done. NFrameSlices when none is
+    uint32_t _n_slices_done = NFrameSlices;
+    // Slices that pops have earned, at a frame's worth for every hop popped. That is how fast frames are
+    // needed, so each is done by the time the extra hop of output ahead of it runs out
+    float _slice_credit = 0.0f;
+
+    // does the next slice of the frame in progress, which is started if there is none
+    void _do_slice();
+
+    // sizes frames for the current sample rate
+    void _resize_frames();
+    // empties the input, and leaves output with the silence it starts with
+    void _clear_buffers();
 
     void _shift_by_env(const Complex *input, 
                           Complex *output, 
@@ -64,10 +111,7 @@ private:
     float _shift_factor = 1.0f;
 
     // Amplifies the formant_shifted samples so they have the same LUFS loudness as the raw_sample
-    LoudnessNormalizer<Complex, ProcSize, 2> _loudness_norm;
-
-    LUFSFilter _raw_sample_filter;
-    LUFSFilter _shifted_sample_filter;
+    SpectralLoudnessNormalizer _loudness_norm;
 };
 
 }
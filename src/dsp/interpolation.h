@@ -2,9 +2,13 @@
 #define MENGA_INTERPOLATION
 
 #include "mengumath.h"
+#include "dsp/common.h"
 #include "dsp/fastmath.h"
+#include "dsp/linalg.h"
+#include <array>
 #include <cmath>
 #include <cstdint>
+#include <vector>
 // Helper functions for various interpolation and windowing methods
 
 namespace Mengu {
@@ -45,6 +49,96 @@ inline float hann_window_root(float x) {
     return std::sin(0.5 * MATH_PI * x);
 }
 
+// cos that can be worked out at compile time, for tables of a fixed size. About double precision
+constexpr double constexpr_cos(double x) {
+    // into [-pi, pi]
+    const double turns = x / MATH_TAU;
+    x -= MATH_TAU * (double) (int64_t) (turns < 0.0 ? turns - 0.5 : turns + 0.5);
+
+    double term = 1.0;
+    double total = 1.0;
+    for (int n = 1; n <= 14; n++) {
+        term *= -x * x / ((2 * n - 1) * (2 * n));
+        total += term;
+    }
+    return total;
+}
+
+// hann(a0, 0.5 * x) at Size + 1 points from 0 to 1, i.e. hann_window (a0 = 0.5) or hamming_window (a0 = 25 / 46)
+// for windows of a size fixed at compile time
+template<uint32_t Size>
+constexpr std::array<float, Size + 1> make_hann_window_table(double a0) {
+    std::array<float, Size + 1> table {};
+    for (uint32_t i = 0; i <= Size; i++) {
+        table[i] = a0 - (1.0 - a0) * constexpr_cos(MATH_PI * i / Size);
+    }
+    return table;
+}
+
+// A window function sampled at size + 1 points from 0 to 1, so windows of that size can be applied without evaluating it.
+// Windows of other sizes are interpolated from the samples. Shared tables are kept by Singletons
+class WindowTable {
+public:
+    WindowTable(float window_f (float), uint32_t size): _values(size + 1) {
+        for (uint32_t i = 0; i <= size; i++) {
+            _values[i] = window_f((float) i / size);
+        }
+    }
+
+    inline uint32_t size() const {
+        return _values.size() - 1;
+    }
+
+    // weights of a window of size()
+    inline const float *data() const {
+        return _values.data();
+    }
+
+    // the window at x, from 0 to 1
+    inline float at(float x) const {
+        const float pos = x * size();
+        const uint32_t i = MIN((uint32_t) pos, size() - 1);
+        return _values[i] + (_values[i + 1] - _values[i]) * (pos - i);
+    }
+
+    // weights [start, start + n) of a window of window_size
+    inline void fill(float *weights, uint32_t start, uint32_t n, uint32_t window_size) const {
+        const float step = (float) size() / window_size;
+        for (uint32_t i = 0; i < n; i++) {
+            const float pos = (start + i) * step;
+            const uint32_t ind = MIN((uint32_t) pos, size() - 1);
+            weights[i] = _values[ind] + (_values[ind + 1] - _values[ind]) * (pos - ind);
+        }
+    }
+
+private:
+    std::vector<float> _values;
+};
+
+// weights for windows the table was not made for are interpolated into chunks this long on the stack
+static constexpr uint32_t WindowChunkSize = 1 << 8;
+
+// calls f(start, weights, n) over a window of window_size, in chunks, with exact weights when the table is for that size
+template<class F>
+inline void for_window_chunks(const WindowTable &window, uint32_t window_size, uint32_t n_weights, F f) {
+    if (window.size() == window_size) {
+        f(0, window.data(), n_weights);
+        return;
+    }
+    float weights[WindowChunkSize];
+    for (uint32_t start = 0; start < n_weights; start += WindowChunkSize) {
+        const uint32_t n = MIN(WindowChunkSize, n_weights - start);
+        window.fill(weights, start, n, window_size);
+        f(start, weights, n);
+    }
+}
+
+// crossfade from linalg, on complex numbers. Each weight applies to a whole number
+inline void crossfade(const Complex *a, const Complex *b, const float *weights, Complex *output, const int size) {
+    crossfade_pairs(reinterpret_cast<const float *>(a), reinterpret_cast<const float *>(b), weights,
+                    reinterpret_cast<float *>(output), size);
+}
+
 // does windowing to both ends of a sequence, in place
 template<class T>
 inline void window_ends(T* a, uint32_t a_size, uint32_t window_size, float window_f (float)) {
@@ -57,6 +151,17 @@ inline void window_ends(T* a, uint32_t a_size, uint32_t window_size, float windo
     }
 }
 
+template<class T>
+inline void window_ends(T* a, uint32_t a_size, uint32_t window_size, const WindowTable &window) {
+    window_size = MIN(a_size / 2, window_size);
+    for_window_chunks(window, window_size, window_size, [&] (uint32_t start, const float *weights, uint32_t n) {
+        for (uint32_t i = 0; i < n; i++) {
+            a[start + i] *= weights[i];
+            a[a_size - 1 - start - i] *= weights[i];
+        }
+    });
+}
+
 // added the tail and head of an array after applying a window function to bothe sides
 template<class T>
 inline void overlap_add(const T *prev, const T *next, T *output, uint32_t size, float window_f (float)) {
@@ -67,6 +172,26 @@ inline void overlap_add(const T *prev, const T *next, T *output, uint32_t size,
     }
 }
 
+// same, with the window's weights given
+template<class T>
+inline void overlap_add(const T *prev, const T *next, T *output, uint32_t size, const float *weights) {
+    if constexpr (requires { crossfade(prev, next, weights, output, (int) size); }) {
+        crossfade(prev, next, weights, output, size);
+    }
+    else {
+        for (uint32_t i = 0; i < size; i++) {
+            output[i] = prev[i] + weights[i] * (next[i] - prev[i]);
+        }
+    }
+}
+
+template<class T>
+inline void overlap_add(const T *prev, const T *next, T *output, uint32_t size, const WindowTable &window) {
+    for_window_chunks(window, size, size, [&] (uint32_t start, const float *weights, uint32_t n) {
+        overlap_add(prev + start, next + start, output + start, n, weights);
+    });
+}
+
 // overlap and extend after applying a window function first
 // overlap_size may be larger than new_data.size(), in which case only new_data.size() is added. the offset is the same
 template<class T, class NewT>
@@ -75,12 +200,9 @@ inline void mix_and_extend(T &array, const NewT &new_data, const uint32_t &overl
     uint32_t i = 0;
 
     for(; i < MIN(overlap_size, new_data.size()); i++) {
-        float w = (float) i / overlap_size;
-        float w1 = window_f(w);
-        float w2 = window_f(1.0-w);
-        w2 = 1.0f - w1;
+        const float w = window_f((float) i / overlap_size);
         uint32_t ind = array.size() - overlap_size + i;
-        array[ind] = array[ind] * w2 + new_data[i] * w1;
+        array[ind] = array[ind] * (1.0f - w) + new_data[i] * w;
     }
 
     for (; i < new_data.size(); i++) {
@@ -89,6 +211,62 @@ inline void mix_and_extend(T &array, const NewT &new_data, const uint32_t &overl
 
 }
 
+// mixes n of new_data, from new_start, into array from array_start with the window's weights
+template<class T, class NewT>
+inline void mix_into(T &array, uint32_t array_start, const NewT &new_data, uint32_t new_start, uint32_t n, const float *weights) {
+    // queues hand over runs of their storage, so the same type of data can be crossfaded vectorised
+    if constexpr (requires (uint32_t n_contiguous) { 
+            crossfade(array.contiguous_from(0, n_contiguous), new_data.data(), weights, array.contiguous_from(0, n_contiguous), 0); }) {
+        uint32_t i = 0;
+        while (i < n) {
+            uint32_t n_contiguous;
+            auto *mixed = array.contiguous_from(array_start + i, n_contiguous);
+            n_contiguous = MIN(n_contiguous, n - i);
+            crossfade(mixed, new_data.data() + new_start + i, weights + i, mixed, n_contiguous);
+            i += n_contiguous;
+        }
+    }
+    else {
+        for (uint32_t i = 0; i < n; i++) {
+            const uint32_t ind = array_start + i;
+            array[ind] = array[ind] + weights[i] * (new_data[new_start + i] - array[ind]);
+        }
+    }
+}
+
+// pushes new_data from start on to the back of array
+template<class T, class NewT>
+inline void extend_from(T &array, const NewT &new_data, uint32_t start) {
+    if constexpr (requires { array.extend_back(new_data.data(), 0); }) {
+        array.extend_back(new_data.data() + start, new_data.size() - start);
+    }
+    else {
+        for (uint32_t i = start; i < new_data.size(); i++) {
+            array.push_back(new_data[i]);
+        }
+    }
+}
+
+// mix_and_extend with the window's weights given
+template<class T, class NewT>
+inline void mix_and_extend(T &array, const NewT &new_data, const uint32_t &overlap_size, const float *weights) {
+    const uint32_t n_mixed = MIN(overlap_size, new_data.size());
+    mix_into(array, array.size() - overlap_size, new_data, 0, n_mixed, weights);
+
+    extend_from(array, new_data, n_mixed);
+}
+
+template<class T, class NewT>
+inline void mix_and_extend(T &array, const NewT &new_data, const uint32_t &overlap_size, const WindowTable &window) {
+    const uint32_t n_mixed = MIN(overlap_size, new_data.size());
+    const uint32_t overlap_start = array.size() - overlap_size;
+    for_window_chunks(window, overlap_size, n_mixed, [&] (uint32_t start, const float *weights, uint32_t n) {
+        mix_into(array, overlap_start + start, new_data, start, n, weights);
+    });
+
+    extend_from(array, new_data, n_mixed);
+}
+
 }
 }
 
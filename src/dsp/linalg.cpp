@@ -3,6 +3,381 @@
 #include <array>
 #include <vector>
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MENGU_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC lets intrinsics be used anywhere without enabling the instruction set for the whole file
+#define MENGU_TARGET_AVX2
+#else
+#define MENGU_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MENGU_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace Mengu;
+using namespace dsp;
+
+//// Scalar kernels, used when no vector instruction set is available
+
+static float _dot_scalar(const float *a, const float *b, const int size) {
+    float total = 0.0f;
+    for (int i = 0; i < size; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+[[maybe_unused]] static float _sum_squares_scalar(const float *a, const int size) {
+    return _dot_scalar(a, a, size);
+}
+
+[[maybe_unused]] static void _sliding_dot_scalar(const float *a, const float *b, const int size, const int n_lags, float *output) {
+    for (int k = 0; k < n_lags; k++) {
+        output[k] = _dot_scalar(a, b + k, size);
+    }
+}
+
+static void _crossfade_scalar(const float *a, const float *b, const float *weights, float *output, const int size) {
+    for (int i = 0; i < size; i++) {
+        output[i] = a[i] + weights[i] * (b[i] - a[i]);
+    }
+}
+
+static void _crossfade_pairs_scalar(const float *a, const float *b, const float *weights, float *output, const int size) {
+    for (int i = 0; i < size; i++) {
+        output[2 * i] = a[2 * i] + weights[i] * (b[2 * i] - a[2 * i]);
+        output[2 * i + 1] = a[2 * i + 1] + weights[i] * (b[2 * i + 1] - a[2 * i + 1]);
+    }
+}
+
+#ifdef MENGU_SIMD_X86
+//// SSE kernels. Always available on x86-64
+
+static inline float _hsum_sse(__m128 v) {
+    __m128 high = _mm_movehl_ps(v, v);
+    __m128 sums = _mm_add_ps(v, high);
+    high = _mm_shuffle_ps(sums, sums, 1);
+    sums = _mm_add_ss(sums, high);
+    return _mm_cvtss_f32(sums);
+}
+
+static float _dot_sse(const float *a, const float *b, const int size) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    for (; i + 4 <= size; i += 4) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    float total = _hsum_sse(_mm_add_ps(acc0, acc1));
+    for (; i < size; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+static float _sum_squares_sse(const float *a, const int size) {
+    return _dot_sse(a, a, size);
+}
+
+// 4 lags at a time, so each load of a is shared between them
+static void _sliding_dot_sse(const float *a, const float *b, const int size, const int n_lags, float *output) {
+    int k = 0;
+    for (; k + 4 <= n_lags; k += 4) {
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        __m128 acc2 = _mm_setzero_ps();
+        __m128 acc3 = _mm_setzero_ps();
+        int i = 0;
+        for (; i + 4 <= size; i += 4) {
+            const __m128 va = _mm_loadu_ps(a + i);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(va, _mm_loadu_ps(b + k + i)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(va, _mm_loadu_ps(b + k + i + 1)));
+            acc2 = _mm_add_ps(acc2, _mm_mul_ps(va, _mm_loadu_ps(b + k + i + 2)));
+            acc3 = _mm_add_ps(acc3, _mm_mul_ps(va, _mm_loadu_ps(b + k + i + 3)));
+        }
+        float totals[4] = {_hsum_sse(acc0), _hsum_sse(acc1), _hsum_sse(acc2), _hsum_sse(acc3)};
+        for (; i < size; i++) {
+            for (int j = 0; j < 4; j++) {
+                totals[j] += a[i] * b[k + j + i];
+            }
+        }
+        std::copy(totals, totals + 4, output + k);
+    }
+    for (; k < n_lags; k++) {
+        output[k] = _dot_sse(a, b + k, size);
+    }
+}
+
+static void _crossfade_sse(const float *a, const float *b, const float *weights, float *output, const int size) {
+    int i = 0;
+    for (; i + 4 <= size; i += 4) {
+        const __m128 va = _mm_loadu_ps(a + i);
+        const __m128 diff = _mm_sub_ps(_mm_loadu_ps(b + i), va);
+        _mm_storeu_ps(output + i, _mm_add_ps(va, _mm_mul_ps(_mm_loadu_ps(weights + i), diff)));
+    }
+    _crossfade_scalar(a + i, b + i, weights + i, output + i, size - i);
+}
+
+// weights are loaded 2 at a time and each duplicated over its pair
+static void _crossfade_pairs_sse(const float *a, const float *b, const float *weights, float *output, const int size) {
+    int i = 0;
+    for (; i + 2 <= size; i += 2) {
+        const __m128 w = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i *) (weights + i)));
+        const __m128 pair_w = _mm_unpacklo_ps(w, w);
+        const __m128 va = _mm_loadu_ps(a + 2 * i);
+        const __m128 diff = _mm_sub_ps(_mm_loadu_ps(b + 2 * i), va);
+        _mm_storeu_ps(output + 2 * i, _mm_add_ps(va, _mm_mul_ps(pair_w, diff)));
+    }
+    _crossfade_pairs_scalar(a + 2 * i, b + 2 * i, weights + i, output + 2 * i, size - i);
+}
+
+//// AVX2 kernels
+
+MENGU_TARGET_AVX2 static inline float _hsum_avx(__m256 v) {
+    return _hsum_sse(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+MENGU_TARGET_AVX2 static float _dot_avx2(const float *a, const float *b, const int size) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= size; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float total = _hsum_avx(_mm256_add_ps(acc0, acc1));
+    for (; i < size; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+MENGU_TARGET_AVX2 static float _sum_squares_avx2(const float *a, const int size) {
+    return _dot_avx2(a, a, size);
+}
+
+MENGU_TARGET_AVX2 static void _sliding_dot_avx2(const float *a, const float *b, const int size, const int n_lags, float *output) {
+    int k = 0;
+    for (; k + 4 <= n_lags; k += 4) {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        int i = 0;
+        for (; i + 8 <= size; i += 8) {
+            const __m256 va = _mm256_loadu_ps(a + i);
+            acc0 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b + k + i), acc0);
+            acc1 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b + k + i + 1), acc1);
+            acc2 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b + k + i + 2), acc2);
+            acc3 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b + k + i + 3), acc3);
+        }
+        float totals[4] = {_hsum_avx(acc0), _hsum_avx(acc1), _hsum_avx(acc2), _hsum_avx(acc3)};
+        for (; i < size; i++) {
+            for (int j = 0; j < 4; j++) {
+                totals[j] += a[i] * b[k + j + i];
+            }
+        }
+        std::copy(totals, totals + 4, output + k);
+    }
+    for (; k < n_lags; k++) {
+        output[k] = _dot_avx2(a, b + k, size);
+    }
+}
+
+MENGU_TARGET_AVX2 static void _crossfade_avx2(const float *a, const float *b, const float *weights, float *output, const int size) {
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        const __m256 va = _mm256_loadu_ps(a + i);
+        const __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(b + i), va);
+        _mm256_storeu_ps(output + i, _mm256_fmadd_ps(_mm256_loadu_ps(weights + i), diff, va));
+    }
+    _crossfade_sse(a + i, b + i, weights + i, output + i, size - i);
+}
+
+MENGU_TARGET_AVX2 static void _crossfade_pairs_avx2(const float *a, const float *b, const float *weights, float *output, const int size) {
+    int i = 0;
+    for (; i + 4 <= size; i += 4) {
+        const __m128 w = _mm_loadu_ps(weights + i);
+        // w0 w0 w1 w1 | w2 w2 w3 w3
+        const __m256 pair_w = _mm256_set_m128(_mm_unpackhi_ps(w, w), _mm_unpacklo_ps(w, w));
+        const __m256 va = _mm256_loadu_ps(a + 2 * i);
+        const __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(b + 2 * i), va);
+        _mm256_storeu_ps(output + 2 * i, _mm256_fmadd_ps(pair_w, diff, va));
+    }
+    _crossfade_pairs_sse(a + 2 * i, b + 2 * i, weights + i, output + 2 * i, size - i);
+}
+
+static bool _cpu_has_avx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool has_fma = (info[2] & (1 << 12)) != 0;
+    const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+    if (!has_fma || !has_osxsave || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
+
+#ifdef MENGU_SIMD_NEON
+//// NEON kernels
+
+static inline float _hsum_neon(float32x4_t v) {
+#ifdef __aarch64__
+    return vaddvq_f32(v);
+#else
+    float32x2_t sums = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(sums, sums), 0);
+#endif
+}
+
+static float _dot_neon(const float *a, const float *b, const int size) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    for (; i + 4 <= size; i += 4) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float total = _hsum_neon(vaddq_f32(acc0, acc1));
+    for (; i < size; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+static float _sum_squares_neon(const float *a, const int size) {
+    return _dot_neon(a, a, size);
+}
+
+static void _crossfade_neon(const float *a, const float *b, const float *weights, float *output, const int size) {
+    int i = 0;
+    for (; i + 4 <= size; i += 4) {
+        const float32x4_t va = vld1q_f32(a + i);
+        const float32x4_t diff = vsubq_f32(vld1q_f32(b + i), va);
+        vst1q_f32(output + i, vmlaq_f32(va, vld1q_f32(weights + i), diff));
+    }
+    _crossfade_scalar(a + i, b + i, weights + i, output + i, size - i);
+}
+
+static void _crossfade_pairs_neon(const float *a, const float *b, const float *weights, float *output, const int size) {
+    int i = 0;
+    for (; i + 2 <= size; i += 2) {
+        const float32x2_t w = vld1_f32(weights + i);
+        // w0 w0 w1 w1
+        const float32x4_t pair_w = vcombine_f32(vdup_lane_f32(w, 0), vdup_lane_f32(w, 1));
+        const float32x4_t va = vld1q_f32(a + 2 * i);
+        const float32x4_t diff = vsubq_f32(vld1q_f32(b + 2 * i), va);
+        vst1q_f32(output + 2 * i, vmlaq_f32(va, pair_w, diff));
+    }
+    _crossfade_pairs_scalar(a + 2 * i, b + 2 * i, weights + i, output + 2 * i, size - i);
+}
+
+static void _sliding_dot_neon(const float *a, const float *b, const int size, const int n_lags, float *output) {
+    int k = 0;
+    for (; k + 4 <= n_lags; k += 4) {
+        float32x4_t acc0 = vdupq_n_f32(0.0f);
+        float32x4_t acc1 = vdupq_n_f32(0.0f);
+        float32x4_t acc2 = vdupq_n_f32(0.0f);
+        float32x4_t acc3 = vdupq_n_f32(0.0f);
+        int i = 0;
+        for (; i + 4 <= size; i += 4) {
+            const float32x4_t va = vld1q_f32(a + i);
+            acc0 = vmlaq_f32(acc0, va, vld1q_f32(b + k + i));
+            acc1 = vmlaq_f32(acc1, va, vld1q_f32(b + k + i + 1));
+            acc2 = vmlaq_f32(acc2, va, vld1q_f32(b + k + i + 2));
+            acc3 = vmlaq_f32(acc3, va, vld1q_f32(b + k + i + 3));
+        }
+        float totals[4] = {_hsum_neon(acc0), _hsum_neon(acc1), _hsum_neon(acc2), _hsum_neon(acc3)};
+        for (; i < size; i++) {
+            for (int j = 0; j < 4; j++) {
+                totals[j] += a[i] * b[k + j + i];
+            }
+        }
+        std::copy(totals, totals + 4, output + k);
+    }
+    for (; k < n_lags; k++) {
+        output[k] = _dot_neon(a, b + k, size);
+    }
+}
+#endif
+
+//// Dispatch
+
+struct SIMDKernels {
+    const char *name;
+    float (*dot)(const float *a, const float *b, const int size);
+    float (*sum_squares)(const float *a, const int size);
+    void (*sliding_dot)(const float *a, const float *b, const int size, const int n_lags, float *output);
+    void (*crossfade)(const float *a, const float *b, const float *weights, float *output, const int size);
+    void (*crossfade_pairs)(const float *a, const float *b, const float *weights, float *output, const int size);
+};
+
+static SIMDKernels _select_kernels() {
+#if defined(MENGU_SIMD_X86)
+    if (_cpu_has_avx2()) {
+        return {"AVX2", _dot_avx2, _sum_squares_avx2, _sliding_dot_avx2, _crossfade_avx2, _crossfade_pairs_avx2};
+    }
+    return {"SSE", _dot_sse, _sum_squares_sse, _sliding_dot_sse, _crossfade_sse, _crossfade_pairs_sse};
+#elif defined(MENGU_SIMD_NEON)
+    return {"NEON", _dot_neon, _sum_squares_neon, _sliding_dot_neon, _crossfade_neon, _crossfade_pairs_neon};
+#else
+    return {"Scalar", _dot_scalar, _sum_squares_scalar, _sliding_dot_scalar, _crossfade_scalar, _crossfade_pairs_scalar};
+#endif
+}
+
+static const SIMDKernels &_kernels() {
+    static const SIMDKernels kernels = _select_kernels();
+    return kernels;
+}
+
+float Mengu::dsp::dot(const float *a, const float *b, const int size) {
+    return _kernels().dot(a, b, size);
+}
+
+float Mengu::dsp::sum_squares(const float *a, const int size) {
+    return _kernels().sum_squares(a, size);
+}
+
+void Mengu::dsp::sliding_dot(const float *a, const float *b, const int size, const int n_lags, float *output) {
+    _kernels().sliding_dot(a, b, size, n_lags, output);
+}
+
+void Mengu::dsp::crossfade(const float *a, const float *b, const float *weights, float *output, const int size) {
+    _kernels().crossfade(a, b, weights, output, size);
+}
+
+void Mengu::dsp::crossfade_pairs(const float *a, const float *b, const float *weights, float *output, const int size) {
+    _kernels().crossfade_pairs(a, b, weights, output, size);
+}
+
+const char *Mengu::dsp::simd_kernel_name() {
+    return _kernels().name;
+}
+
 
 
 std::vector<float> Mengu::dsp::solve_sym_toeplitz(const std::vector<float> &cols, const std::vector<float> &y) {
@@ -35,6 +35,27 @@ inline T dot(const T *a, const T *b, const int size) {
     return total;
 }
 
+// Vectorised kernels on packed (contiguous) float data.
+// The widest instruction set the cpu supports (AVX2, SSE or NEON) is picked on the first call
+
+// dot product. Preferred over the template for float pointers
+float dot(const float *a, const float *b, const int size);
+
+// dot product of a with itself
+float sum_squares(const float *a, const int size);
+
+// output[k] = dot(a, b + k, size) for each 0 <= k < n_lags. b must be at least size + n_lags - 1 long
+void sliding_dot(const float *a, const float *b, const int size, const int n_lags, float *output);
+
+// output[i] = a[i] + weights[i] * (b[i] - a[i]), fading from a to b. output may be a or b
+void crossfade(const float *a, const float *b, const float *weights, float *output, const int size);
+
+// same, on interleaved pairs (like complex numbers) that share a weight. a, b and output hold 2 * size floats
+void crossfade_pairs(const float *a, const float *b, const float *weights, float *output, const int size);
+
+// name of the instruction set the kernels above are using
+const char *simd_kernel_name();
+
 // do product on iterator
 template<class InputIt1, class InputIt2>
 inline float dot(InputIt1 afirst, InputIt1 alast, InputIt2 bfirst) {
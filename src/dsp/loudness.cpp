@@ -1,9 +1,14 @@
 #include "dsp/loudness.h"
 #include "dsp/filter.h"
 #include "dsp/common.h"
+#include "dsp/linalg.h"
+#include "dsp/singletons.h"
 #include "mengumath.h"
+#include <algorithm>
+#include <cmath>
 #include <complex>
 #include <cstdint>
+#include <stdexcept>
 
 // Coefficients for LUFS_freq filteters
 // High shelf filter stage
@@ -24,25 +29,46 @@
 using namespace Mengu;
 using namespace dsp;
 
-float Mengu::dsp::LUFS_freq(Complex *freqs, uint32_t size, uint32_t sample_rate) {
+std::vector<float> Mengu::dsp::LUFS_freq_weights(uint32_t size, uint32_t sample_rate) {
     // Adjust to the custum sample rate
     float sample_rate_correction = (float) sample_rate / LUFS_DEFAULT_SAMPLE_RATE * 2;
 
-    float total_amp2 = 0.0f; // total squared amplitude of each freq bin
+    std::vector<float> weights(size);
     for (uint32_t i = 0; i < size; i++) {
         // argument for the transfer functions
         float omega = (float) MATH_PI * i / size * sample_rate_correction;
         Complex z = std::polar(1.0f, omega);
 
-        // filtered frequency
-        Complex y = freqs[i] * quad_filter_trans(z, S1_A1, S1_A2, S1_B0, S1_B1, S1_B2);
-        y = y * quad_filter_trans(z, S2_A1, S2_A2, S2_B0, S2_B1, S2_B2);
+        Complex h = quad_filter_trans(z, S1_A1, S1_A2, S1_B0, S1_B1, S1_B2);
+        h = h * quad_filter_trans(z, S2_A1, S2_A2, S2_B0, S2_B1, S2_B2);
+        weights[i] = std::norm(h);
+    }
+    return weights;
+}
 
-        total_amp2 += std::norm(y);
+// total squared amplitude of each freq bin, weighted.
+// Kept in separate sums so that each add does not wait on the last.
+// Squares are written out, since std::norm can go through std::abs
+static float _weighted_power(const Complex *freqs, const float *weights, uint32_t size) {
+    float totals[4] = {0.0f};
+    const Complex *end = freqs + size / 4 * 4;
+    for (; freqs < end; freqs += 4, weights += 4) {
+        for (uint32_t j = 0; j < 4; j++) {
+            totals[j] += weights[j] * (freqs[j].real() * freqs[j].real() + freqs[j].imag() * freqs[j].imag());
+        }
+    }
+    for (uint32_t j = 0; j < size % 4; j++) {
+        totals[j] += weights[j] * (freqs[j].real() * freqs[j].real() + freqs[j].imag() * freqs[j].imag());
     }
+    return (totals[0] + totals[1]) + (totals[2] + totals[3]);
+}
 
-    return -0.691 + 10 * Mengu::log10(total_amp2 / size);
+float Mengu::dsp::LUFS_freq(const Complex *freqs, uint32_t size, uint32_t sample_rate) {
+    return LUFS_freq(freqs, Singletons::get_singleton()->get_lufs_weights(size, sample_rate).data(), size);
+}
 
+float Mengu::dsp::LUFS_freq(const Complex *freqs, const float *weights, uint32_t size) {
+    return -0.691 + 10 * Mengu::log10(_weighted_power(freqs, weights, size) / size);
 }
 
 Complex Mengu::dsp::LUFS_filter_transfer(float freq) {
@@ -52,16 +78,293 @@ Complex Mengu::dsp::LUFS_filter_transfer(float freq) {
     return y * quad_filter_trans(z, S2_A1, S2_A2, S2_B0, S2_B1, S2_B2);
 }
 
-LUFSFilter::LUFSFilter(): 
-    _high_shelf_filter(S1_A1, S1_A2, S1_B0, S1_B1, S1_B2),
-    _high_pass_filter(S2_A1, S2_A2, S2_B0, S2_B1, S2_B2) {}
+LUFSFilter::LUFSFilter(uint32_t sample_rate, uint32_t n_channels): _stages(n_channels) {
+    if (sample_rate != LUFS_DEFAULT_SAMPLE_RATE) {
+        set_sample_rate(sample_rate);
+    }
+    else {
+        const BiquadCoefficients stages[2] = {
+            {S1_A1, S1_A2, S1_B0, S1_B1, S1_B2},
+            {S2_A1, S2_A2, S2_B0, S2_B1, S2_B2},
+        };
+        _stages.set_stages(stages, 2);
+    }
+}
+
+void LUFSFilter::set_sample_rate(uint32_t sample_rate) {
+    // The analog K-weighting stages of ITU-R BS.1770, mapped with the bilinear transform.
+    // Gives back the coefficients above at 48kHz
+    BiquadCoefficients stages[2];
+    const double shelf_k = std::tan(MATH_PI * 1681.974450955533 / sample_rate);
+    const double shelf_q = 0.7071752369554196;
+    const double shelf_vh = std::pow(10.0, 3.999843853973347 / 20.0);
+    const double shelf_vb = std::pow(shelf_vh, 0.4996667741545416);
+    const double shelf_a0 = 1.0 + shelf_k / shelf_q + shelf_k * shelf_k;
+    stages[0].a1 = 2.0 * (shelf_k * shelf_k - 1.0) / shelf_a0;
+    stages[0].a2 = (1.0 - shelf_k / shelf_q + shelf_k * shelf_k) / shelf_a0;
+    stages[0].b0 = (shelf_vh + shelf_vb * shelf_k / shelf_q + shelf_k * shelf_k) / shelf_a0;
+    stages[0].b1 = 2.0 * (shelf_k * shelf_k - shelf_vh) / shelf_a0;
+    stages[0].b2 = (shelf_vh - shelf_vb * shelf_k / shelf_q + shelf_k * shelf_k) / shelf_a0;
+
+    const double pass_k = std::tan(MATH_PI * 38.13547087602444 / sample_rate);
+    const double pass_q = 0.5003270373238773;
+    const double pass_a0 = 1.0 + pass_k / pass_q + pass_k * pass_k;
+    stages[1].a1 = 2.0 * (pass_k * pass_k - 1.0) / pass_a0;
+    stages[1].a2 = (1.0 - pass_k / pass_q + pass_k * pass_k) / pass_a0;
+    stages[1].b0 = S2_B0;
+    stages[1].b1 = S2_B1;
+    stages[1].b2 = S2_B2;
+
+    // also resets
+    _stages.set_stages(stages, 2);
+}
 
 void LUFSFilter::transform(const float *input, float *output, uint32_t size) {
-    _high_shelf_filter.transform(input, output, size);
-    _high_pass_filter.transform(output, output, size);
+    _stages.transform(input, output, size);
+}
+
+void LUFSFilter::transform(const float *const *inputs, float *const *outputs, uint32_t size) {
+    _stages.transform(inputs, outputs, size);
 }
 
 void LUFSFilter::reset() {
-    _high_shelf_filter.reset();
-    _high_pass_filter.reset();
-}
\ No newline at end of file
+    _stages.reset();
+}
+
+void SpectralLoudnessNormalizer::set_format(uint32_t size, uint32_t sample_rate) {
+    _weights = Singletons::get_singleton()->get_lufs_weights(size, sample_rate).data();
+}
+
+float SpectralLoudnessNormalizer::get_correction(const Complex *raw_freqs, const Complex *reference_freqs, uint32_t n_bins,
+        float default_correction) const {
+    const float raw_power = _weighted_power(raw_freqs, _weights, n_bins);
+    const float reference_power = _weighted_power(reference_freqs, _weights, n_bins);
+    const float correction = std::sqrt(reference_power / raw_power);
+    if (!std::isfinite(correction) || correction == 0.0f) {
+        return default_correction;
+    }
+    return correction;
+}
+
+// loudness of a K-weighted mean power
+static float _power_loudness(double power) {
+    return -0.691 + 10.0 * std::log10(power);
+}
+
+LoudnessMeter::LoudnessMeter(uint32_t sample_rate, uint32_t n_channels):
+    _n_channels(MAX(n_channels, 1u)),
+    _filter(sample_rate, MAX(n_channels, 1u)) {
+    _channel_weights.resize(_n_channels, 1.0f);
+    _filtered.resize(_n_channels * ChunkSize, 0.0f);
+    for (uint32_t c = 0; c < _n_channels; c++) {
+        _filtered_channels.push_back(_filtered.data() + c * ChunkSize);
+    }
+    for (Histogram *histogram: {&_gating_blocks, &_range_blocks}) {
+        histogram->counts.resize(NBins);
+        histogram->powers.resize(NBins);
+    }
+    set_sample_rate(sample_rate);
+}
+
+void LoudnessMeter::set_sample_rate(uint32_t sample_rate) {
+    _sample_rate = sample_rate;
+    _step_size = MAX((uint32_t) std::round(sample_rate * StepSeconds), 1u);
+    _filter.set_sample_rate(sample_rate);
+    reset();
+}
+
+void LoudnessMeter::set_channel_weight(uint32_t channel, float weight) {
+    if (channel >= _n_channels) {
+        throw std::runtime_error("LoudnessMeter: no such channel");
+    }
+    _channel_weights[channel] = weight;
+}
+
+void LoudnessMeter::push_signal(const float *const *inputs, uint32_t size) {
+    for (uint32_t start = 0; start < size; start += ChunkSize) {
+        const uint32_t n = MIN(ChunkSize, size - start);
+        for (uint32_t c = 0; c < _n_channels; c++) {
+            std::copy(inputs[c] + start, inputs[c] + start + n, _filtered_channels[c]);
+        }
+        _measure_filtered(n);
+    }
+}
+
+void LoudnessMeter::push_signal(const float *input, uint32_t size) {
+    for (uint32_t start = 0; start < size; start += ChunkSize) {
+        const uint32_t n = MIN(ChunkSize, size - start);
+        std::copy(input + start, input + start + n, _filtered_channels[0]);
+        for (uint32_t c = 1; c < _n_channels; c++) {
+            std::fill(_filtered_channels[c], _filtered_channels[c] + n, 0.0f);
+        }
+        _measure_filtered(n);
+    }
+}
+
+void LoudnessMeter::push_signal(const Complex *input, uint32_t size) {
+    for (uint32_t start = 0; start < size; start += ChunkSize) {
+        const uint32_t n = MIN(ChunkSize, size - start);
+        for (uint32_t i = 0; i < n; i++) {
+            _filtered_channels[0][i] = input[start + i].real();
+        }
+        for (uint32_t c = 1; c < _n_channels; c++) {
+            std::fill(_filtered_channels[c], _filtered_channels[c] + n, 0.0f);
+        }
+        _measure_filtered(n);
+    }
+}
+
+void LoudnessMeter::reset() {
+    _filter.reset();
+    _step_fill = 0;
+    _step_energy = 0.0;
+    _n_steps = 0;
+    _step_powers.fill(0.0);
+    _momentary_sum = 0.0;
+    _short_term_sum = 0.0;
+
+    _reset_histogram(_gating_blocks, {&_integrated_gate});
+    _reset_histogram(_range_blocks, {&_range_gate, &_range_low, &_range_high});
+
+    _momentary.store(-INFINITY, std::memory_order_relaxed);
+    _short_term.store(-INFINITY, std::memory_order_relaxed);
+    _integrated.store(-INFINITY, std::memory_order_relaxed);
+    _loudness_range.store(0.0f, std::memory_order_relaxed);
+}
+
+float LoudnessMeter::get_gain_to(float target_lufs) const {
+    float loudness = get_short_term();
+    if (!(loudness > AbsoluteGate)) {
+        loudness = get_momentary();
+    }
+    if (!(loudness > AbsoluteGate)) {
+        return 1.0f;
+    }
+    return std::pow(10.0f, (target_lufs - loudness) / 20.0f);
+}
+
+void LoudnessMeter::_measure_filtered(uint32_t n) {
+    if (_n_channels == 1) {
+        _filter.transform(_filtered.data(), _filtered.data(), n);
+    }
+    else {
+        _filter.transform(_filtered_channels.data(), _filtered_channels.data(), n);
+    }
+
+    uint32_t i = 0;
+    while (i < n) {
+        const uint32_t n_step = MIN(n - i, _step_size - _step_fill);
+        for (uint32_t c = 0; c < _n_channels; c++) {
+            _step_energy += _channel_weights[c] * sum_squares(_filtered_channels[c] + i, (int) n_step);
+        }
+        _step_fill += n_step;
+        i += n_step;
+        if (_step_fill == _step_size) {
+            _end_step();
+        }
+    }
+}
+
+void LoudnessMeter::_end_step() {
+    const double power = _step_energy / _step_size;
+    _step_energy = 0.0;
+    _step_fill = 0;
+
+    // the windows gain this step and lose the one that fell out of them
+    const uint32_t ind = _n_steps % ShortTermSteps;
+    _momentary_sum = MAX(_momentary_sum + power - _step_powers[(ind + ShortTermSteps - MomentarySteps) % ShortTermSteps], 0.0);
+    _short_term_sum = MAX(_short_term_sum + power - _step_powers[ind], 0.0);
+    _step_powers[ind] = power;
+    _n_steps++;
+
+    if (_n_steps >= MomentarySteps) {
+        const double momentary_power = _momentary_sum / MomentarySteps;
+        const float momentary = _power_loudness(momentary_power);
+        _momentary.store(momentary, std::memory_order_relaxed);
+
+        if (momentary > AbsoluteGate) {
+            _add_to_histogram(_gating_blocks, momentary, momentary_power, {&_integrated_gate});
+            const float gate = _power_loudness(_gating_blocks.total_power / _gating_blocks.total_count) + IntegratedRelativeGate;
+            _integrated_gate.move_to_loudness(_gating_blocks, gate);
+
+            // the loudest window is always above the gate
+            const uint64_t n_gated = _gating_blocks.total_count - _integrated_gate.count_below;
+            const double gated_power = _gating_blocks.total_power - _integrated_gate.power_below;
+            _integrated.store(_power_loudness(gated_power / n_gated), std::memory_order_relaxed);
+        }
+    }
+
+    if (_n_steps >= ShortTermSteps) {
+        const double short_term_power = _short_term_sum / ShortTermSteps;
+        const float short_term = _power_loudness(short_term_power);
+        _short_term.store(short_term, std::memory_order_relaxed);
+
+        if (short_term > AbsoluteGate) {
+            _add_to_histogram(_range_blocks, short_term, short_term_power, {&_range_gate, &_range_low, &_range_high});
+            const float gate = _power_loudness(_range_blocks.total_power / _range_blocks.total_count) + RangeRelativeGate;
+            _range_gate.move_to_loudness(_range_blocks, gate);
+
+            // EBU Tech 3342. The spread between the 10th and 95th percentiles of what passes the gate
+            const uint64_t n_gated = _range_blocks.total_count - _range_gate.count_below;
+            _range_low.move_to_rank(_range_blocks, _range_gate.count_below + (uint64_t) (0.10 * (n_gated - 1)));
+            _range_high.move_to_rank(_range_blocks, _range_gate.count_below + (uint64_t) (0.95 * (n_gated - 1)));
+            _loudness_range.store((_range_high.bin - _range_low.bin) * BinWidth, std::memory_order_relaxed);
+        }
+    }
+}
+
+void LoudnessMeter::_add_to_histogram(Histogram &histogram, float loudness, double power,
+        std::initializer_list<HistogramCursor *> cursors) {
+    const uint32_t bin = MIN((uint32_t) ((loudness - AbsoluteGate) / BinWidth), NBins - 1);
+    histogram.counts[bin]++;
+    histogram.powers[bin] += power;
+    histogram.total_count++;
+    histogram.total_power += power;
+    for (HistogramCursor *cursor: cursors) {
+        if (bin < cursor->bin) {
+            cursor->count_below++;
+            cursor->power_below += power;
+        }
+    }
+}
+
+void LoudnessMeter::_reset_histogram(Histogram &histogram, std::initializer_list<HistogramCursor *> cursors) {
+    std::fill(histogram.counts.begin(), histogram.counts.end(), 0);
+    std::fill(histogram.powers.begin(), histogram.powers.end(), 0.0);
+    histogram.total_count = 0;
+    histogram.total_power = 0.0;
+    for (HistogramCursor *cursor: cursors) {
+        *cursor = {0, 0, 0.0};
+    }
+}
+
+void LoudnessMeter::HistogramCursor::move_to_loudness(const Histogram &histogram, float loudness) {
+    const uint32_t target = loudness <= AbsoluteGate ? 0 : MIN((uint32_t) ((loudness - AbsoluteGate) / BinWidth), NBins);
+    while (bin < target) {
+        count_below += histogram.counts[bin];
+        power_below += histogram.powers[bin];
+        bin++;
+    }
+    while (bin > target) {
+        bin--;
+        count_below -= histogram.counts[bin];
+        power_below -= histogram.powers[bin];
+    }
+    // so that rounding does not build up
+    if (bin == 0) {
+        power_below = 0.0;
+    }
+}
+
+void LoudnessMeter::HistogramCursor::move_to_rank(const Histogram &histogram, uint64_t rank) {
+    while (count_below > rank) {
+        bin--;
+        count_below -= histogram.counts[bin];
+        power_below -= histogram.powers[bin];
+    }
+    while (count_below + histogram.counts[bin] <= rank) {
+        count_below += histogram.counts[bin];
+        power_below += histogram.powers[bin];
+        bin++;
+    }
+}
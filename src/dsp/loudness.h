@@ -13,17 +13,28 @@
 #define MENGU_LOUDNESS
 
 #include "dsp/common.h"
+#include "dsp/effect.h"
 #include "dsp/filter.h"
+#include "dsp/linalg.h"
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <initializer_list>
 #include <stdint.h>
+#include <vector>
 
 namespace Mengu {
 namespace dsp {
 
 // Loudness Units relative to Full Scale of a sample in the frequency domain
 // first (positive) half of the frequency spectrum only
-// Only supports 1 channel
-float LUFS_freq(Complex *freqs, uint32_t size, uint32_t sample_rate = 48000);
+// Only supports 1 channel. The weights are cached per size and rate, so the first call for each allocates
+float LUFS_freq(const Complex *freqs, uint32_t size, uint32_t sample_rate = 48000);
+// the same, with weights from LUFS_freq_weights
+float LUFS_freq(const Complex *freqs, const float *weights, uint32_t size);
+
+// The squared magnitude of the K-weighting that LUFS_freq puts on each of the size bins it is given
+std::vector<float> LUFS_freq_weights(uint32_t size, uint32_t sample_rate = 48000);
 
 // The value of the transfer function associated with the described frequency bin
 Complex LUFS_filter_transfer(float freq);
@@ -31,15 +42,145 @@ Complex LUFS_filter_transfer(float freq);
 // Performs the filter step associated with LUFS
 class LUFSFilter {
 public:
-    LUFSFilter();
+    // the filter is designed for signals at sample_rate. Channels are filtered independently
+    LUFSFilter(uint32_t sample_rate = Effect::DefaultSampleRate, uint32_t n_channels = 1);
+
+    // redesigns the filter for another rate. Resets it
+    void set_sample_rate(uint32_t sample_rate);
 
+    // filters the first channel
     void transform(const float *input, float *output, uint32_t size);
+    // filters every channel together
+    void transform(const float *const *inputs, float *const *outputs, uint32_t size);
 
     void reset();
 
 private:
-    BiquadFilter _high_shelf_filter; // Stage 1 filter
-    BiquadFilter _high_pass_filter; // Stage 2 filter
+    // the high shelf stage, then the high pass stage
+    BiquadCascade _stages;
+};
+
+// EBU R128 loudness of a stream, fed as it plays.
+// The K-weighted power of each 100ms step is kept, so the momentary (400ms) and short-term (3s) windows are running sums.
+// Gated integrated loudness and the loudness range come from histograms of the window loudnesses, read through
+// cursors that follow the gates and percentiles a bin at a time. Nothing already measured is rescanned.
+// Readings are atomic, so another thread, like the GUI's, can read them while the audio thread feeds the meter
+class LoudnessMeter {
+public:
+    // readings below this are not counted towards the integrated loudness or range, in LUFS
+    static constexpr float AbsoluteGate = -70.0f;
+    // the integrated loudness leaves out momentary windows this far below the mean of the rest, in LU
+    static constexpr float IntegratedRelativeGate = -10.0f;
+    // the loudness range leaves out short-term windows this far below the mean of the rest, in LU
+    static constexpr float RangeRelativeGate = -20.0f;
+
+    LoudnessMeter(uint32_t sample_rate = Effect::DefaultSampleRate, uint32_t n_channels = 1);
+
+    // Resets the meter
+    void set_sample_rate(uint32_t sample_rate);
+    inline uint32_t get_n_channels() const {
+        return _n_channels;
+    }
+
+    // how much each channel's power counts. 1 by default; ITU-R BS.1770 gives surround channels about 1.41
+    void set_channel_weight(uint32_t channel, float weight);
+
+    // one input per channel
+    void push_signal(const float *const *inputs, uint32_t size);
+    // the first channel only
+    void push_signal(const float *input, uint32_t size);
+    // the real parts, into the first channel only
+    void push_signal(const Complex *input, uint32_t size);
+
+    void reset();
+
+    // in LUFS, -INFINITY until there is a whole window
+    inline float get_momentary() const {
+        return _momentary.load(std::memory_order_relaxed);
+    }
+    inline float get_short_term() const {
+        return _short_term.load(std::memory_order_relaxed);
+    }
+    // in LUFS, -INFINITY until a window passes the absolute gate
+    inline float get_integrated() const {
+        return _integrated.load(std::memory_order_relaxed);
+    }
+    // in LU
+    inline float get_loudness_range() const {
+        return _loudness_range.load(std::memory_order_relaxed);
+    }
+
+    // What to scale the stream by to bring it to target_lufs, from the short-term loudness
+    // (the momentary until there is a short-term window). 1 while nothing has been measured
+    float get_gain_to(float target_lufs) const;
+
+private:
+    static constexpr float StepSeconds = 0.1f;
+    static constexpr uint32_t MomentarySteps = 4;
+    static constexpr uint32_t ShortTermSteps = 30;
+    // inputs are filtered this many samples at a time
+    static constexpr uint32_t ChunkSize = 1 << 10;
+
+    // Window loudnesses from the absolute gate up, in bins of BinWidth LU. Louder windows go in the last bin
+    static constexpr float BinWidth = 0.1f;
+    static constexpr uint32_t NBins = 1000;
+    struct Histogram {
+        std::vector<uint32_t> counts;
+        // the power of the windows in each bin
+        std::vector<double> powers;
+        uint64_t total_count;
+        double total_power;
+    };
+    // a bin of a histogram, with the count and power of the bins before it
+    struct HistogramCursor {
+        uint32_t bin;
+        uint64_t count_below;
+        double power_below;
+
+        // moves to the first bin with values at least loudness
+        void move_to_loudness(const Histogram &histogram, float loudness);
+        // moves to the bin holding the rank-th lowest value
+        void move_to_rank(const Histogram &histogram, uint64_t rank);
+    };
+
+    uint32_t _n_channels;
+    uint32_t _sample_rate;
+    LUFSFilter _filter;
+    std::vector<float> _channel_weights;
+    // a chunk of filtered input per channel
+    std::vector<float> _filtered;
+    std::vector<float *> _filtered_channels;
+
+    uint32_t _step_size;
+    uint32_t _step_fill = 0;
+    double _step_energy = 0.0;
+    uint64_t _n_steps = 0;
+    // the mean powers of the last steps, by step number
+    std::array<double, ShortTermSteps> _step_powers;
+    double _momentary_sum = 0.0;
+    double _short_term_sum = 0.0;
+
+    // momentary windows, one ending at each step
+    Histogram _gating_blocks;
+    HistogramCursor _integrated_gate;
+    // short-term windows, one ending at each step
+    Histogram _range_blocks;
+    HistogramCursor _range_gate;
+    HistogramCursor _range_low;
+    HistogramCursor _range_high;
+
+    std::atomic<float> _momentary;
+    std::atomic<float> _short_term;
+    std::atomic<float> _integrated;
+    std::atomic<float> _loudness_range;
+
+    // measures the first n samples of each channel in _filtered
+    void _measure_filtered(uint32_t n);
+    void _end_step();
+    // adds a window's loudness and power to a histogram, telling the cursors over it
+    static void _add_to_histogram(Histogram &histogram, float loudness, double power,
+            std::initializer_list<HistogramCursor *> cursors);
+    static void _reset_histogram(Histogram &histogram, std::initializer_list<HistogramCursor *> cursors);
 };
 
 // Scales a raw sample to have the same Loudness (in LUFS) as a reference sample
@@ -48,35 +189,36 @@ template<typename T, uint32_t N, int DefCorrection = 1>
 class LoudnessNormalizer {
 public:
     void normalize(const T *raw_sample, const T *reference_sample, T *output) {
-        float filtered_raw[N];
-        float filtered_reference[N];
-        for (uint32_t i = 0; i < N; i++) {
+        normalize(raw_sample, reference_sample, output, N);
+    }
+
+    // normalise samples shorter than N. size must not be larger than N
+    void normalize(const T *raw_sample, const T *reference_sample, T *output, const uint32_t size) {
+        float *filtered_raw = _filtered_raw.data();
+        float *filtered_reference = _filtered_reference.data();
+        for (uint32_t i = 0; i < size; i++) {
             filtered_raw[i] = _as_float(raw_sample[i]);
             filtered_reference[i] = _as_float(reference_sample[i]); 
         }
 
-        // perform filter
-        _raw_sample_filter.transform(filtered_raw, filtered_raw, N);
-        _reference_sample_filter.transform(filtered_reference, filtered_reference, N);
+        // perform filter on both at once
+        float *const filtered[2] = {filtered_raw, filtered_reference};
+        _filter.transform(filtered, filtered, size);
 
         // Get the (unormalized) power of each filtered sample
-        float raw_power = 0.0f;
-        float reference_power = 0.0f;
-        for(uint32_t i = 0; i < N; i++) {
-            raw_power += filtered_raw[i] * filtered_raw[i];
-            reference_power += filtered_reference[i] * filtered_reference[i];
-        }
+        float raw_power = sum_squares(filtered_raw, size);
+        float reference_power = sum_squares(filtered_reference, size);
         float correction = sqrt(reference_power / raw_power);
         // std::cout << correction << ", " << raw_power << ", " << shifted_power << std::endl;
         if (!std::isfinite(correction)) {
             // just correct for 1/2 freq spectrum sampling if correction is not real
-            for (uint32_t i = 0; i < N; i++) {
+            for (uint32_t i = 0; i < size; i++) {
                 output[i] = raw_sample[i] * (float) DefCorrection;
             }
         }
         else {
             // otherwise scale the shifted by the correction
-            for (uint32_t i = 0; i < N; i++) {
+            for (uint32_t i = 0; i < size; i++) {
                 output[i] = raw_sample[i] * correction;
             }
         }
@@ -84,12 +226,20 @@ public:
     }
     // resets memory on previous raw and reference samples
     void reset() {
-        _raw_sample_filter.reset();
-        _reference_sample_filter.reset();
+        _filter.reset();
+    }
+
+    // weights loudness for signals at this rate. Resets the normalizer
+    void set_sample_rate(uint32_t sample_rate) {
+        _filter.set_sample_rate(sample_rate);
     }
 private:
-    LUFSFilter _raw_sample_filter;
-    LUFSFilter _reference_sample_filter;
+    // the raw sample is the first channel, the reference the second
+    LUFSFilter _filter {48000, 2};
+
+    // kept off the stack, since N can be large
+    std::array<float, N> _filtered_raw;
+    std::array<float, N> _filtered_reference;
 
 
     static float _as_float(T v) {
@@ -97,6 +247,23 @@ private:
     }
 };
 
+// Scales a raw signal to have the same loudness (in LUFS) as a reference, measured from their spectra with the
+// cached K-weighting instead of filtering both in time. For effects that already hold both spectra.
+// Each spectrum is measured on its own, with nothing carried over from the last
+class SpectralLoudnessNormalizer {
+public:
+    // spectra come from size point FFTs of signals at sample_rate. Fetches the weights, so set up before processing
+    void set_format(uint32_t size, uint32_t sample_rate);
+
+    // What to scale raw_freqs by to be as loud as reference_freqs, from the first n_bins of each.
+    // default_correction if either is silent
+    float get_correction(const Complex *raw_freqs, const Complex *reference_freqs, uint32_t n_bins,
+            float default_correction = 1.0f) const;
+
+private:
+    const float *_weights = nullptr;
+};
+
 
 }
 }
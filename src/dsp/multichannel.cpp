@@ -0,0 +1,193 @@
+#include "dsp/multichannel.h"
+#include "dsp/common.h"
+#include "dsp/effect.h"
+#include "mengumath.h"
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace Mengu;
+using namespace dsp;
+
+MultichannelEffect::MultichannelEffect(uint32_t n_channels, const EffectMaker &make_effect, bool link_channels) {
+    n_channels = MAX(n_channels, 1u);
+    for (uint32_t c = 0; c < n_channels; c++) {
+        _channels.push_back(make_effect());
+    }
+    _n_popped.resize(n_channels, 0);
+
+    _linked = link_channels && n_channels > 1 && _channels[0]->supports_alignment_sharing();
+    if (_linked) {
+        _channels[0]->record_alignment(&_alignment);
+    }
+}
+
+MultichannelEffect::~MultichannelEffect() {
+    _stop_threads();
+    for (Effect *channel: _channels) {
+        delete channel;
+    }
+}
+
+void MultichannelEffect::push_signal(const Complex *const *inputs, uint32_t size) {
+    if (_linked) {
+        if (_mix.size() < size) {
+            _mix.resize(size);
+        }
+        const float scale = 1.0f / _channels.size();
+        for (uint32_t i = 0; i < size; i++) {
+            Complex sum = 0.0f;
+            for (uint32_t c = 0; c < _channels.size(); c++) {
+                sum += inputs[c][i];
+            }
+            _mix[i] = scale * sum;
+        }
+        _channels[0]->push_analysis_signal(_mix.data(), size);
+    }
+
+    _operation = PushOperation;
+    _inputs = inputs;
+    _size = size;
+    _process(0);
+}
+
+uint32_t MultichannelEffect::pop_transformed_signal(Complex *const *outputs, uint32_t size) {
+    _operation = PopOperation;
+    _outputs = outputs;
+    _size = size;
+
+    if (_linked) {
+        // the first channel decides where the rest are cut, so it goes first
+        _alignment.resize(0);
+        _process_channel(0);
+        for (uint32_t c = 1; c < _channels.size(); c++) {
+            _channels[c]->follow_alignment(&_alignment);
+        }
+        _process(1);
+    }
+    else {
+        _process(0);
+    }
+
+    uint32_t n_popped = size;
+    for (uint32_t n: _n_popped) {
+        n_popped = MIN(n_popped, n);
+    }
+    return n_popped;
+}
+
+void MultichannelEffect::reset() {
+    for (Effect *channel: _channels) {
+        channel->reset();
+    }
+    _alignment.resize(0);
+}
+
+void MultichannelEffect::set_sample_rate(uint32_t sample_rate) {
+    for (Effect *channel: _channels) {
+        channel->set_sample_rate(sample_rate);
+    }
+    _alignment.resize(0);
+}
+
+std::vector<EffectPropDesc> MultichannelEffect::get_property_descs() const {
+    return _channels[0]->get_property_descs();
+}
+
+void MultichannelEffect::set_property(uint32_t id, EffectPropPayload data) {
+    for (Effect *channel: _channels) {
+        channel->set_property(id, data);
+    }
+}
+
+EffectPropPayload MultichannelEffect::get_property(uint32_t id) const {
+    return _channels[0]->get_property(id);
+}
+
+void MultichannelEffect::_process_channel(uint32_t channel) {
+    if (_operation == PushOperation) {
+        _channels[channel]->push_signal(_inputs[channel], _size);
+    }
+    else {
+        _n_popped[channel] = _channels[channel]->pop_transformed_signal(_outputs[channel], _size);
+    }
+}
+
+void MultichannelEffect::_process_channels(uint32_t thread_ind) {
+    for (uint32_t c = _first_channel + thread_ind; c < _channels.size(); c += _n_threads) {
+        _process_channel(c);
+    }
+}
+
+void MultichannelEffect::_process(uint32_t first_channel) {
+    _first_channel = first_channel;
+    if (_threads.empty()) {
+        _process_channels(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _generation++;
+        _n_threads_busy = _threads.size();
+    }
+    _work_ready.notify_all();
+
+    _process_channels(0);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _work_done.wait(lock, [this] () { return _n_threads_busy == 0; });
+}
+
+void MultichannelEffect::set_n_threads(uint32_t n_threads) {
+    n_threads = CLAMP(n_threads, 1u, (uint32_t) _channels.size());
+    if (n_threads == get_n_threads()) {
+        return;
+    }
+
+    _stop_threads();
+    _n_threads = n_threads;
+    for (uint32_t t = 1; t < n_threads; t++) {
+        _threads.emplace_back(&MultichannelEffect::_run_thread, this, t, _generation);
+    }
+}
+
+void MultichannelEffect::_run_thread(uint32_t thread_ind, uint64_t generation) {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _work_ready.wait(lock, [this, generation] () { return _generation != generation || _stopping; });
+            if (_stopping) {
+                return;
+            }
+            generation = _generation;
+        }
+
+        _process_channels(thread_ind);
+
+        bool all_done;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _n_threads_busy--;
+            all_done = _n_threads_busy == 0;
+        }
+        if (all_done) {
+            _work_done.notify_one();
+        }
+    }
+}
+
+void MultichannelEffect::_stop_threads() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _work_ready.notify_all();
+    for (std::thread &thread: _threads) {
+        thread.join();
+    }
+    _threads.clear();
+    _n_threads = 1;
+    _stopping = false;
+}
@@ -0,0 +1,114 @@
+/*
+* Runs a mono effect over several channels
+*/
+#ifndef MENGA_MULTICHANNEL
+#define MENGA_MULTICHANNEL
+
+#include "dsp/common.h"
+#include "dsp/effect.h"
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Mengu {
+namespace dsp {
+
+// A copy of an effect for each channel, pushed and popped together.
+// Copies of effects that can share their alignment are linked: the first channel's copy decides where to cut from
+// the channels mixed together, and the others cut where it does, so the channels stay in step, keeping the stereo
+// image, and the analysis is only done once. Channels can be processed on threads of their own
+class MultichannelEffect {
+public:
+    typedef std::function<Effect *()> EffectMaker;
+
+    // make_effect is called for each channel. Takes ownership of the effects.
+    // Channels are only linked if link_channels is set, there are several of them, and the effect supports it
+    MultichannelEffect(uint32_t n_channels, const EffectMaker &make_effect, bool link_channels = true);
+    ~MultichannelEffect();
+
+    MultichannelEffect(const MultichannelEffect &) = delete;
+    MultichannelEffect &operator=(const MultichannelEffect &) = delete;
+
+    inline uint32_t get_n_channels() const {
+        return _channels.size();
+    }
+    inline bool is_linked() const {
+        return _linked;
+    }
+    inline Effect *get_channel(uint32_t channel) const {
+        return _channels[channel];
+    }
+
+    // inputs and outputs have a signal for each channel
+    void push_signal(const Complex *const *inputs, uint32_t size);
+    // Pops size samples of each channel, padding with silence like the effect does.
+    // Returns the fewest real samples any channel had, which is all of them when linked
+    uint32_t pop_transformed_signal(Complex *const *outputs, uint32_t size);
+
+    void reset();
+    void set_sample_rate(uint32_t sample_rate);
+
+    // the properties of the effect, set on every copy
+    std::vector<EffectPropDesc> get_property_descs() const;
+    void set_property(uint32_t id, EffectPropPayload data);
+    EffectPropPayload get_property(uint32_t id) const;
+
+    // Processes the channels on up to n_threads threads, this one included, waiting for them all on each push and pop.
+    // Only worth it for effects that do a lot of work per sample. 1 keeps every channel on this thread
+    void set_n_threads(uint32_t n_threads);
+    inline uint32_t get_n_threads() const {
+        return _n_threads;
+    }
+
+private:
+    std::vector<Effect *> _channels;
+
+    // the first channel analyses the mix for the others to follow
+    bool _linked = false;
+    // where the first channel was cut in the last pop
+    std::vector<uint32_t> _alignment;
+    // the mix the first channel analyses. Only ever grows
+    std::vector<Complex> _mix;
+
+    // what every channel is doing on this push or pop
+    enum Operation {
+        PushOperation,
+        PopOperation,
+    };
+    Operation _operation;
+    const Complex *const *_inputs = nullptr;
+    Complex *const *_outputs = nullptr;
+    uint32_t _size = 0;
+    std::vector<uint32_t> _n_popped;
+
+    // channels before this are done before the operation is handed to the threads
+    uint32_t _first_channel = 0;
+
+    void _process_channel(uint32_t channel);
+    // the channels of a thread are those from _first_channel that are thread_ind more than a multiple of the number of threads
+    void _process_channels(uint32_t thread_ind);
+    // does the current operation on every channel from first_channel, on every thread
+    void _process(uint32_t first_channel);
+
+    uint32_t _n_threads = 1;
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _work_ready;
+    std::condition_variable _work_done;
+    // counts operations, so threads can tell a new one from the one they just did
+    uint64_t _generation = 0;
+    uint32_t _n_threads_busy = 0;
+    bool _stopping = false;
+
+    // generation is the last operation before the thread started
+    void _run_thread(uint32_t thread_ind, uint64_t generation);
+    void _stop_threads();
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,297 @@
+#include "dsp/pitchdetector.h"
+#include "dsp/interpolation.h"
+#include "dsp/linalg.h"
+#include "dsp/singletons.h"
+#include "mengumath.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace Mengu;
+using namespace dsp;
+
+PitchDetector::PitchDetector(uint32_t window_size, uint32_t min_period, uint32_t max_period):
+    _window_size(window_size),
+    _min_period(min_period),
+    _max_period(max_period),
+    _history_size(window_size + window_size / 4),
+    _history(2 * _history_size, 0.0f) {
+    if (min_period < 1 || min_period > max_period || window_size <= 2 * max_period) {
+        throw std::runtime_error("PitchDetector: window must be more than twice the max period, and 0 < min period <= max period");
+    }
+}
+
+void PitchDetector::push_signal(const Complex *input, const uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        const float x = input[i].real();
+        _history[_write_pos] = x;
+        _history[_write_pos + _history_size] = x;
+        _write_pos = (_write_pos + 1) % _history_size;
+    }
+    _n_new_samples = MIN(_n_new_samples + size, _history_size);
+}
+
+void PitchDetector::reset() {
+    std::fill(_history.begin(), _history.end(), 0.0f);
+    _write_pos = 0;
+    _n_new_samples = 0;
+}
+
+LagPitchDetector::LagPitchDetector(uint32_t window_size, uint32_t min_period, uint32_t max_period):
+    PitchDetector(window_size, min_period, max_period),
+    _integration_size(window_size - max_period - 1),
+    _n_lags(max_period + 2),
+    _lag_products(max_period + 2, 0.0f),
+    _lag_energies(max_period + 2, 0.0f),
+    _scratch(max_period + 2) {}
+
+void LagPitchDetector::reset() {
+    PitchDetector::reset();
+    std::fill(_lag_products.begin(), _lag_products.end(), 0.0f);
+    std::fill(_lag_energies.begin(), _lag_energies.end(), 0.0f);
+    _n_incremental_samples = 0;
+}
+
+void LagPitchDetector::_update_lag_sums() {
+    const uint32_t n_new = _n_new_samples;
+    if (n_new == 0) {
+        return;
+    }
+    _n_new_samples = 0;
+
+    // Sliding the window over n_new samples costs 2 * n_new * n_lags against integration_size * n_lags for starting over.
+    // Only samples still in the history can be slid out of the window
+    const bool can_slide = n_new <= _history_size - _window_size;
+    if (can_slide && 2 * n_new < _integration_size && _n_incremental_samples + n_new <= _integration_size) {
+        _slide_lag_products(n_new);
+        _n_incremental_samples += n_new;
+    }
+    else {
+        _recompute_lag_products();
+        _n_incremental_samples = 0;
+    }
+
+    _recompute_lag_energies();
+}
+
+void LagPitchDetector::_recompute_lag_products() {
+    // the window is the last _window_size samples. The newest _integration_size are lagged against all of it
+    const float *window = _latest() + _history_size - _window_size;
+    const float *integrated = window + _n_lags - 1;
+
+    // _scratch[k] is the product at lag n_lags - 1 - k
+    sliding_dot(integrated, window, _integration_size, _n_lags, _scratch.data());
+    std::reverse_copy(_scratch.cbegin(), _scratch.cend(), _lag_products.begin());
+}
+
+void LagPitchDetector::_slide_lag_products(const uint32_t n_new) {
+    // the products of the samples that entered the window are added, and those of the samples that left are taken away
+    const float *entered = _latest() + _history_size - n_new;
+    const float *left = entered - _integration_size;
+
+    sliding_dot(entered, entered - _n_lags + 1, n_new, _n_lags, _scratch.data());
+    for (uint32_t lag = 0; lag < _n_lags; lag++) {
+        _lag_products[lag] += _scratch[_n_lags - 1 - lag];
+    }
+    sliding_dot(left, left - _n_lags + 1, n_new, _n_lags, _scratch.data());
+    for (uint32_t lag = 0; lag < _n_lags; lag++) {
+        _lag_products[lag] -= _scratch[_n_lags - 1 - lag];
+    }
+}
+
+void LagPitchDetector::_recompute_lag_energies() {
+    const float *integrated = _latest() + _history_size - _integration_size;
+
+    // the energy of each lagged copy, found by sliding it back one sample at a time
+    const double energy = sum_squares(integrated, _integration_size);
+    double lagged_energy = energy;
+    for (uint32_t lag = 0; lag < _n_lags; lag++) {
+        _lag_energies[lag] = energy + lagged_energy;
+
+        const float entering = integrated[-(int) lag - 1];
+        const float leaving = integrated[_integration_size - lag - 1];
+        lagged_energy += (double) entering * entering - (double) leaving * leaving;
+    }
+}
+
+float LagPitchDetector::_interpolate_lag(const float *values, uint32_t lag) const {
+    if (lag == 0 || lag + 1 >= _n_lags) {
+        return lag;
+    }
+    const float left = values[lag - 1];
+    const float centre = values[lag];
+    const float right = values[lag + 1];
+    const float curvature = left - 2.0f * centre + right;
+    if (curvature == 0.0f) {
+        return lag;
+    }
+    const float offset = 0.5f * (left - right) / curvature;
+    return lag + CLAMP(offset, -1.0f, 1.0f);
+}
+
+YINDetector::YINDetector(uint32_t window_size, uint32_t min_period, uint32_t max_period, float threshold):
+    LagPitchDetector(window_size, min_period, max_period),
+    _threshold(threshold),
+    _differences(max_period + 2) {}
+
+PitchEstimate YINDetector::estimate() {
+    _update_lag_sums();
+    if (_lag_energies[0] <= 0.0f) {
+        return PitchEstimate {0.0f, 0.0f};
+    }
+
+    // cumulative mean normalised difference. The plain difference is m - 2r
+    _differences[0] = 1.0f;
+    float total_difference = 0.0f;
+    for (uint32_t lag = 1; lag < _n_lags; lag++) {
+        const float difference = MAX(_lag_energies[lag] - 2.0f * _lag_products[lag], 0.0f);
+        total_difference += difference;
+        _differences[lag] = total_difference > 0.0f ? difference * lag / total_difference : 1.0f;
+    }
+
+    // the first dip under the threshold, or the deepest one if there are none
+    uint32_t best_lag = _min_period;
+    for (uint32_t lag = _min_period; lag <= _max_period; lag++) {
+        if (_differences[lag] < _threshold) {
+            best_lag = lag;
+            while (best_lag < _max_period && _differences[best_lag + 1] < _differences[best_lag]) {
+                best_lag++;
+            }
+            break;
+        }
+        if (_differences[lag] < _differences[best_lag]) {
+            best_lag = lag;
+        }
+    }
+
+    return PitchEstimate {
+        .period = _interpolate_lag(_differences.data(), best_lag),
+        .confidence = CLAMP(1.0f - _differences[best_lag], 0.0f, 1.0f),
+    };
+}
+
+MPMDetector::MPMDetector(uint32_t window_size, uint32_t min_period, uint32_t max_period, float peak_ratio):
+    LagPitchDetector(window_size, min_period, max_period),
+    _peak_ratio(peak_ratio),
+    _nsdf(max_period + 2) {
+    _key_maxima.reserve(max_period / 2 + 1);
+}
+
+PitchEstimate MPMDetector::estimate() {
+    _update_lag_sums();
+    if (_lag_energies[0] <= 0.0f) {
+        return PitchEstimate {0.0f, 0.0f};
+    }
+
+    for (uint32_t lag = 0; lag < _n_lags; lag++) {
+        _nsdf[lag] = _lag_energies[lag] > 0.0f ? 2.0f * _lag_products[lag] / _lag_energies[lag] : 0.0f;
+    }
+
+    // the highest point of each positive lobe, skipping the one around lag 0
+    _key_maxima.clear();
+    uint32_t lag = 1;
+    while (lag < _n_lags && _nsdf[lag] > 0.0f) {
+        lag++;
+    }
+    float highest = 0.0f;
+    while (lag < _n_lags) {
+        while (lag < _n_lags && _nsdf[lag] <= 0.0f) {
+            lag++;
+        }
+        uint32_t lobe_max = lag;
+        while (lag < _n_lags && _nsdf[lag] > 0.0f) {
+            if (_nsdf[lag] > _nsdf[lobe_max]) {
+                lobe_max = lag;
+            }
+            lag++;
+        }
+        // a lobe cut off by the end of the window may not have peaked yet
+        if (lobe_max >= _min_period && lobe_max <= _max_period && lobe_max + 1 < _n_lags) {
+            _key_maxima.push_back(lobe_max);
+            highest = MAX(highest, _nsdf[lobe_max]);
+        }
+    }
+
+    for (uint32_t key_max: _key_maxima) {
+        if (_nsdf[key_max] >= _peak_ratio * highest) {
+            return PitchEstimate {
+                .period = _interpolate_lag(_nsdf.data(), key_max),
+                .confidence = CLAMP(_nsdf[key_max], 0.0f, 1.0f),
+            };
+        }
+    }
+    return PitchEstimate {0.0f, 0.0f};
+}
+
+SRHDetector::SRHDetector(uint32_t window_size, uint32_t min_period, uint32_t max_period):
+    PitchDetector(window_size, min_period, max_period),
+    _min_freq_ind(MAX(window_size / max_period, 2)),
+    _max_freq_ind(MAX(window_size / min_period, 2 * _min_freq_ind)),
+    _lpc(window_size),
+    _windowed(window_size),
+    _srhs(_max_freq_ind + 1),
+    _end_window(&Singletons::get_singleton()->get_window_table(hann_window, window_size / 10)) {}
+
+PitchEstimate SRHDetector::estimate() {
+    _n_new_samples = 0;
+
+    const float *window = _latest() + _history_size - _window_size;
+    if (sum_squares(window, _window_size) <= 0.0f) {
+        return PitchEstimate {0.0f, 0.0f};
+    }
+    std::copy(window, window + _window_size, _windowed.begin());
+    window_ends(_windowed.data(), _window_size, _window_size / 10, *_end_window);
+
+    _lpc.load_sample(_windowed.data());
+    // only the positive half of the spectrum
+    const float *residuals = _lpc.get_residuals().data();
+    const int n_freqs = _window_size / 2;
+
+    uint32_t best_ind = 0;
+    float best_srh = -INFINITY;
+    for (uint32_t freq_ind = _min_freq_ind; freq_ind < _max_freq_ind; freq_ind++) {
+        _srhs[freq_ind] = calc_srh(residuals, n_freqs, freq_ind, NHarmonics);
+        if (_srhs[freq_ind] > best_srh) {
+            best_ind = freq_ind;
+            best_srh = _srhs[freq_ind];
+        }
+    }
+    if (best_ind == 0) {
+        return PitchEstimate {0.0f, 0.0f};
+    }
+
+    // the share of the energy at the harmonics that was not cancelled by the subharmonics
+    float harmonics = 0.0f;
+    const int n_harm = MIN((int) NHarmonics, n_freqs / (int) best_ind);
+    for (int k = 1; k < n_harm; k++) {
+        harmonics += residuals[best_ind * k];
+    }
+
+    // refine the frequency between bins when both neighbours were searched
+    float freq = best_ind;
+    if (best_ind > _min_freq_ind && best_ind + 1 < _max_freq_ind) {
+        const float left = _srhs[best_ind - 1];
+        const float right = _srhs[best_ind + 1];
+        const float curvature = left - 2.0f * best_srh + right;
+        if (curvature < 0.0f) {
+            freq += CLAMP(0.5f * (left - right) / curvature, -0.5f, 0.5f);
+        }
+    }
+
+    return PitchEstimate {
+        .period = _window_size / freq,
+        .confidence = harmonics > 0.0f ? CLAMP(best_srh / harmonics, 0.0f, 1.0f) : 0.0f,
+    };
+}
+
+PitchDetector *Mengu::dsp::make_pitch_detector(PitchDetectorType type, uint32_t window_size, uint32_t min_period, uint32_t max_period) {
+    switch (type) {
+        case MPMPitchDetector:
+            return new MPMDetector(window_size, min_period, max_period);
+        case YINPitchDetector:
+            return new YINDetector(window_size, min_period, max_period);
+        case SRHPitchDetector:
+            return new SRHDetector(window_size, min_period, max_period);
+    }
+    throw std::runtime_error("make_pitch_detector: unknown detector type");
+}
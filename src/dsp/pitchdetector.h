@@ -0,0 +1,184 @@
+/**
+ * @file pitchdetector.h
+ * @brief Estimators of the fundamental period of a signal, fed sample by sample
+ */
+#ifndef MENGA_PITCH_DETECTOR
+#define MENGA_PITCH_DETECTOR
+
+#include "dsp/common.h"
+#include "dsp/correlation.h"
+#include "dsp/interpolation.h"
+#include <cstdint>
+#include <vector>
+
+namespace Mengu {
+namespace dsp {
+
+struct PitchEstimate {
+    // in samples. Fractional because the detectors interpolate between lags
+    float period;
+    // how periodic the analysed window is, from 0 (noise) to 1 (perfectly periodic)
+    float confidence;
+};
+
+// Roughly in order of cost per estimate. Every detector looks at the same window so they are interchangeable
+enum PitchDetectorType {
+    // McLeod pitch method. Normalised autocorrelation, takes the first peak close to the highest one.
+    // Cheapest, and the most accurate on clean voiced signals
+    MPMPitchDetector = 0,
+    // YIN. Cumulative mean normalised difference, takes the first dip under a threshold.
+    // About the same cost as MPM, fewer octave errors on breathy or noisy input
+    YINPitchDetector = 1,
+    // Subharmonic-to-harmonic ratio of the LPC residual spectrum. What PSOLATimeStretcher first used.
+    // An FFT and an LPC fit per estimate, and prone to octave errors below ~150Hz where there are few bins per octave
+    SRHPitchDetector = 2,
+};
+static constexpr uint32_t NPitchDetectorTypes = 3;
+
+// Keeps the most recent window_size() samples pushed to it, and estimates the period of the latest window.
+// Samples can be pushed in any block size, and estimates can be requested at any time.
+// Nothing is allocated after construction
+class PitchDetector {
+public:
+    // periods are searched in [min_period, max_period]. window_size must be more than 2 * max_period
+    PitchDetector(uint32_t window_size, uint32_t min_period, uint32_t max_period);
+    virtual ~PitchDetector() {}
+
+    // appends samples (real parts only) to the analysed window
+    void push_signal(const Complex *input, const uint32_t size);
+
+    // the period of the latest window. period is 0 if the window is silent or no candidate period was found
+    virtual PitchEstimate estimate() = 0;
+
+    // clears pushed samples. The window is filled with silence
+    virtual void reset();
+
+    inline uint32_t window_size() const {
+        return _window_size;
+    }
+
+    inline uint32_t min_period() const {
+        return _min_period;
+    }
+
+    inline uint32_t max_period() const {
+        return _max_period;
+    }
+
+protected:
+    const uint32_t _window_size;
+    const uint32_t _min_period;
+    const uint32_t _max_period;
+
+    // The ring buffer is written twice, _history_size apart, so the latest samples are always contiguous.
+    // Keeps a quarter window more than the window so that samples leaving it can be undone by incremental updates
+    uint32_t _history_size;
+    std::vector<float> _history;
+    uint32_t _write_pos = 0;
+
+    // samples pushed since the derived class last caught up. At most _history_size
+    uint32_t _n_new_samples = 0;
+
+    // the latest _history_size samples, oldest first
+    inline const float *_latest() const {
+        return _history.data() + _write_pos;
+    }
+};
+
+// Base of detectors that compare the window with lagged copies of itself.
+// Keeps r(lag) = sum(x[i] * x[i - lag]) over the latest integration window for every lag up to max_period + 1.
+// When only a few samples arrived since the last estimate, just their products are added (and those of the samples
+// that left the window removed), otherwise r is computed from scratch
+class LagPitchDetector: public PitchDetector {
+public:
+    LagPitchDetector(uint32_t window_size, uint32_t min_period, uint32_t max_period);
+
+    virtual void reset() override;
+
+protected:
+    // number of samples summed per lag. The rest of the window are the lagged samples
+    const uint32_t _integration_size;
+    // lags 0 to max_period + 1, so a peak at max_period can be interpolated
+    const uint32_t _n_lags;
+
+    // r(lag)
+    std::vector<float> _lag_products;
+    // m(lag) = sum(x[i]^2 + x[i - lag]^2) over the same window. r(lag) is at most half of it
+    std::vector<float> _lag_energies;
+
+    // brings _lag_products and _lag_energies up to date with the pushed samples
+    void _update_lag_sums();
+
+    // parabolic interpolation of the extremum around values[lag]
+    float _interpolate_lag(const float *values, uint32_t lag) const;
+
+private:
+    // incremental sums gather rounding error, so they are recomputed once a whole integration window was slid over
+    uint32_t _n_incremental_samples = 0;
+    std::vector<float> _scratch;
+
+    void _recompute_lag_products();
+    // moves the integration window forward over the newest n_new samples
+    void _slide_lag_products(const uint32_t n_new);
+    // cheap enough to always do from scratch
+    void _recompute_lag_energies();
+};
+
+// YIN (de Cheveigne and Kawahara, 2002)
+class YINDetector: public LagPitchDetector {
+public:
+    // the cumulative mean normalised difference must dip below threshold to count as a period
+    YINDetector(uint32_t window_size, uint32_t min_period, uint32_t max_period, float threshold = 0.15f);
+
+    virtual PitchEstimate estimate() override;
+
+private:
+    const float _threshold;
+    std::vector<float> _differences;
+};
+
+// McLeod pitch method (McLeod and Wyvill, 2005), with a fixed-size window rather than a shrinking one
+class MPMDetector: public LagPitchDetector {
+public:
+    // the first key maximum of the normalised square difference that is at least peak_ratio times the highest is picked
+    MPMDetector(uint32_t window_size, uint32_t min_period, uint32_t max_period, float peak_ratio = 0.9f);
+
+    virtual PitchEstimate estimate() override;
+
+private:
+    const float _peak_ratio;
+    std::vector<float> _nsdf;
+    // lags of the highest point of each positive lobe of the nsdf
+    std::vector<uint32_t> _key_maxima;
+};
+
+// Subharmonic summation on the residuals of an LPC fit of the whole window (Drugman and Alwan, 2011)
+class SRHDetector: public PitchDetector {
+public:
+    // window_size must be a power of 2
+    SRHDetector(uint32_t window_size, uint32_t min_period, uint32_t max_period);
+
+    virtual PitchEstimate estimate() override;
+
+private:
+    static constexpr uint32_t LPCParams = 16;
+    static constexpr uint32_t NHarmonics = 10;
+
+    // candidate frequencies, as bins of an fft of the window
+    const uint32_t _min_freq_ind;
+    const uint32_t _max_freq_ind;
+
+    DynamicLPC<LPCParams> _lpc;
+    std::vector<Complex> _windowed;
+    std::vector<float> _srhs;
+    // tapers the tenth at each end of the window
+    const WindowTable *_end_window;
+};
+
+// Constructs a detector of the given type. The caller owns it
+PitchDetector *make_pitch_detector(PitchDetectorType type, uint32_t window_size, uint32_t min_period, uint32_t max_period);
+
+}
+}
+
+#endif
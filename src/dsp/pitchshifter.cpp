@@ -78,9 +78,9 @@ uint32_t PhaseVocoderPitchShifterV2::pop_transformed_signal(Complex *output, con
 
 
         _lpc.load_sample(samples.data());
-        const std::array<float, ProcSize> &envelope = _lpc.get_envelope();
-        const std::array<float, ProcSize> &residuals = _lpc.get_residuals();
-        const std::array<Complex, ProcSize> &frequencies = _lpc.get_freq_spectrum();
+        const std::vector<float> &envelope = _lpc.get_envelope();
+        const std::vector<float> &residuals = _lpc.get_residuals();
+        const std::vector<Complex> &frequencies = _lpc.get_freq_spectrum();
 
         
         // std::array<float, ProcSize / 2> log_envelope{};
@@ -191,7 +191,7 @@ uint32_t PhaseVocoderPitchShifterV2::pop_transformed_signal(Complex *output, con
 
         _lpc.get_fft().inverse_transform(new_freq.data(), samples.data());
 
-        mix_and_extend(_transformed_buffer, samples, OverlapSize, hann_window);
+        mix_and_extend(_transformed_buffer, samples, OverlapSize, OverlapWindow.data());
         
         _samples_processed += ProcSize - OverlapSize;
         _raw_buffer.pop_front_many(nullptr, ProcSize - OverlapSize);
@@ -210,10 +210,11 @@ void PhaseVocoderPitchShifterV2::reset() {
 }
 
 TimeStretchPitchShifter::TimeStretchPitchShifter(TimeStretcher *stretcher, uint32_t nchannels):
-    _stretcher(stretcher),
-    _resampler(nchannels, 1.0f) {
+    _resampler(1.0f),
+    _stretcher(stretcher) {
     _stretcher->set_stretch_factor(1.0f);
     _shift_factor = 1.0f;
+    _reset_drift();
 
     // Complex zeros[MinResampleInputSize] = {Complex()};
     // _stretcher.push_signal(zeros, MinResampleInputSize);
@@ -235,36 +236,43 @@ void TimeStretchPitchShifter::push_signal(const Complex *input, const uint32_t &
 }
 
 uint32_t TimeStretchPitchShifter::pop_transformed_signal(Complex *output, const uint32_t &size) {
+    if (_direct_pitch_shift) {
+        // already at pitch, so straight through
+        const uint32_t n = _stretcher->pop_transformed_signal(output, size);
+        _compensate_drift(size, n);
+
+        for (uint32_t i = n; i < size; i++) {
+            output[i] = 0;
+        }
+        return n;
+    }
+
     // do transform, eagerly
     // resample the time-stretch pitch shifted samples
     // while (_pitch_shifting_stretcher.n_transformed_ready() >= MinResampleInputSize) {
     bool can_still_process = true;
     while (can_still_process && n_transformed_ready() < size) {
         const uint32_t desired_stretched_size = size * _shift_factor;
-        std::vector<Complex> stretched(desired_stretched_size);
+        if (_stretched.size() < desired_stretched_size) {
+            _stretched.resize(desired_stretched_size);
+        }
 
-        const uint32_t actually_stretched = _stretcher->pop_transformed_signal(stretched.data(), desired_stretched_size);
-        stretched.resize(actually_stretched);
+        const uint32_t actually_stretched = _stretcher->pop_transformed_signal(_stretched.data(), desired_stretched_size);
         
         can_still_process = actually_stretched > 0;
 
-        std::vector<Complex> unstretched = _resampler.resample(stretched);
+        const uint32_t max_unstretched = _resampler.max_output_size(actually_stretched);
+        if (_unstretched.size() < max_unstretched) {
+            _unstretched.resize(max_unstretched);
+        }
+        const uint32_t n_unstretched = _resampler.process(_stretched.data(), actually_stretched, _unstretched.data());
 
-        _transformed_buffer.extend_back(unstretched.data(), unstretched.size());
+        _transformed_buffer.extend_back(_unstretched.data(), n_unstretched);
     }
     uint32_t n = _transformed_buffer.pop_front_many(output, size);
     // std::cout << "n " << n << std::endl; 
 
-    // compensate for drift
-    if (n_transformed_ready() > IncreaseResampleThreshold) {
-        static constexpr float ResampleHalflife = IncreaseResampleThreshold * 1.5;
-        float resample_factor = exp2(-(int)(n_transformed_ready() - IncreaseResampleThreshold) / ResampleHalflife);
-        _stretcher->set_stretch_factor(_shift_factor * resample_factor);
-    }
-
-    else if (n_transformed_ready() < StandardResampleThreshold) {
-        _stretcher->set_stretch_factor(_shift_factor);
-    }
+    _compensate_drift(size, n);
 
     for (uint32_t i = n; i < size; i++) {
         output[i] = 0;
@@ -281,12 +289,118 @@ void TimeStretchPitchShifter::reset() {
     _transformed_buffer.resize(0);
 
     _stretcher->reset();
+    _resampler.reset();
+    _reset_drift();
+    // the stretcher was left at the last correction
+    _stretcher->set_stretch_factor(_stretch_for_correction(_drift_metrics.correction));
+}
+
+void TimeStretchPitchShifter::set_target_fill(uint32_t target_fill) {
+    _target_fill = MAX(target_fill, 1u);
+}
+
+void TimeStretchPitchShifter::_compensate_drift(uint32_t size, uint32_t n) {
+    DriftMetrics &metrics = _drift_metrics;
+
+    // stretched samples come out 1 / shift_factor as long, unless the stretcher shifted them itself.
+    // Input the stretcher is sitting on will come out corrected as long
+    const float stretched_per_output = _direct_pitch_shift ? 1.0f : _shift_factor;
+    metrics.fill = n_transformed_ready()
+        + _stretcher->n_transformed_ready() / stretched_per_output
+        + _stretcher->n_input_backlog() * metrics.correction;
+    if (n < size) {
+        metrics.fill -= size - n;
+        metrics.n_underruns += 1;
+    }
+
+    _current_span_low_water = MIN(_current_span_low_water, metrics.fill);
+    _current_span_size += size;
+    metrics.low_water_fill = _current_span_low_water;
+    for (float span_low_water: _span_low_waters) {
+        metrics.low_water_fill = MIN(metrics.low_water_fill, span_low_water);
+    }
+    if (_current_span_size >= _low_water_span_size) {
+        _span_low_waters[_span_ind] = _current_span_low_water;
+        _span_ind = (_span_ind + 1) % LowWaterSpans;
+        _current_span_low_water = INFINITY;
+        _current_span_size = 0;
+    }
+
+    // positive when too much is queued
+    const float error = (metrics.low_water_fill - _target_fill) / _target_fill;
+    const float integral = _drift_integral + error * size / _sample_rate;
+    const float correction = 1.0f - DriftProportionalGain * error - DriftIntegralGain * integral;
+
+    // stop integrating while saturated, so the correction comes back as soon as the error turns
+    metrics.correction = CLAMP(correction, 1.0f - MaxDriftCorrection, 1.0f + MaxDriftCorrection);
+    if (metrics.correction == correction) {
+        _drift_integral = integral;
+    }
+
+    _stretcher->set_stretch_factor(_stretch_for_correction(metrics.correction));
+}
 
+float TimeStretchPitchShifter::_stretch_for_correction(float correction) const {
+    return _direct_pitch_shift ? correction : _shift_factor * correction;
+}
+
+void TimeStretchPitchShifter::set_direct_pitch_shift(bool direct) {
+    _direct_pitch_shift = direct && _stretcher->supports_pitch_shift();
+    _stretcher->set_pitch_shift(_direct_pitch_shift ? _shift_factor : 1.0f);
+    reset();
+    _stretcher->set_stretch_factor(_stretch_for_correction(_drift_metrics.correction));
+}
+
+void TimeStretchPitchShifter::_reset_drift() {
+    _drift_integral = 0.0f;
+    _drift_metrics = DriftMetrics {0.0f, 0.0f, 1.0f, 0};
+
+    // the first spans do not hold anything back
+    _span_low_waters.fill(INFINITY);
+    _span_ind = 0;
+    _current_span_low_water = INFINITY;
+    _current_span_size = 0;
+}
+
+void TimeStretchPitchShifter::set_sample_rate(uint32_t sample_rate) {
+    PitchShifter::set_sample_rate(sample_rate);
+    _stretcher->set_sample_rate(sample_rate);
+
+    _target_fill = _scale_size(DefaultTargetFill);
+    _low_water_span_size = _scale_size(LowWaterSpanSize);
+    _transformed_buffer.resize(0);
+    _reset_drift();
 }
 
 void TimeStretchPitchShifter::set_shift_factor(const float &shift_factor) {
     _shift_factor = shift_factor;
-    _stretcher->set_stretch_factor(shift_factor);
+    if (_direct_pitch_shift) {
+        _stretcher->set_pitch_shift(shift_factor);
+    }
+    _stretcher->set_stretch_factor(_stretch_for_correction(_drift_metrics.correction));
+
+    _resampler.set_stretch_factor(shift_factor, ShiftGlideSize);
+}
+
+std::vector<EffectPropDesc> TimeStretchPitchShifter::get_property_descs() const {
+    std::vector<EffectPropDesc> descs = PitchShifter::get_property_descs();
+    std::vector<EffectPropDesc> stretcher_descs = _stretcher->get_property_descs();
+    descs.insert(descs.end(), stretcher_descs.begin() + 1, stretcher_descs.end());
+    return descs;
+}
 
-    _resampler.set_stretch_factor(shift_factor);
-}
\ No newline at end of file
+void TimeStretchPitchShifter::set_property(uint32_t id, EffectPropPayload data) {
+    if (id == 0) {
+        PitchShifter::set_property(id, data);
+    }
+    else {
+        _stretcher->set_property(id, data);
+    }
+}
+
+EffectPropPayload TimeStretchPitchShifter::get_property(uint32_t id) const {
+    if (id == 0) {
+        return PitchShifter::get_property(id);
+    }
+    return _stretcher->get_property(id);
+}
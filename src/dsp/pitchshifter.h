@@ -6,9 +6,11 @@
 
 #include "dsp/correlation.h"
 #include "dsp/effect.h"
+#include "dsp/interpolation.h"
 #include "dsp/sampling.h"
 #include "dsp/timestretcher.h"
 #include "fft.h"
+#include <array>
 #include <cstdint>
 #include <dsp/common.h>
 #include <dsp/fft.h>
@@ -60,6 +62,7 @@ private:
 
     static constexpr uint32_t ProcSize = 1 << 9;
     static constexpr uint32_t OverlapSize = 1 << 6;
+    static constexpr std::array<float, OverlapSize + 1> OverlapWindow = make_hann_window_table<OverlapSize>(0.5);
 
     LPC<ProcSize, 30> _lpc;
 
@@ -69,6 +72,7 @@ private:
 // Shifts by resampling a time stretcher
 class TimeStretchPitchShifter: public PitchShifter {
 public:
+    // signals are mono. nchannels is unused and kept for existing callers
     TimeStretchPitchShifter(TimeStretcher *stretcher, uint32_t nchannels);
     ~TimeStretchPitchShifter();
 
@@ -81,21 +85,111 @@ public:
     
     virtual void set_shift_factor(const float &factor) override;
 
+    // The stretchers own properties are exposed after the pitch shift, with the same ids.
+    // The stretch factor (id 0) is managed by the pitch shifter, so it is not exposed
+    virtual std::vector<EffectPropDesc> get_property_descs() const override;
+    virtual void set_property(uint32_t id, EffectPropPayload data) override;
+    virtual EffectPropPayload get_property(uint32_t id) const override;
+
+    // shares the alignment of the stretcher, if it can
+    virtual bool supports_alignment_sharing() const override {
+        return _stretcher->supports_alignment_sharing();
+    }
+    virtual void push_analysis_signal(const Complex *input, const uint32_t &size) override {
+        _stretcher->push_analysis_signal(input, size);
+    }
+    virtual void record_alignment(std::vector<uint32_t> *alignment) override {
+        _stretcher->record_alignment(alignment);
+    }
+    virtual void follow_alignment(const std::vector<uint32_t> *alignment) override {
+        _stretcher->follow_alignment(alignment);
+    }
+
+    // also prepares the stretcher. The resampler only depends on the shift factor.
+    // Resets the target fill to the default for the rate
+    virtual void set_sample_rate(uint32_t sample_rate) override;
+
+    // Has stretchers that support it shift the pitch themselves, instead of their stretched output being resampled here.
+    // Ignored for other stretchers. Resets the shifter
+    void set_direct_pitch_shift(bool direct);
+    inline bool get_direct_pitch_shift() const {
+        return _direct_pitch_shift;
+    }
+
+    // How many output samples the controller tries to keep queued at the lowest point between stretcher blocks.
+    // Lower means less latency, but more risk of running dry when the stretcher falls behind
+    void set_target_fill(uint32_t target_fill);
+    inline uint32_t get_target_fill() const {
+        return _target_fill;
+    }
+
+    struct DriftMetrics {
+        // output samples queued after the last pop, in this shifter and the stretcher, counting the stretcher's input backlog.
+        // Negative by how much the last pop came up short
+        float fill;
+        // what the controller sees. The lowest fill of about the last tenth of a second
+        float low_water_fill;
+        // the stretch factor is the shift factor times this
+        float correction;
+        // pops that had to be padded with silence
+        uint32_t n_underruns;
+    };
+    inline DriftMetrics get_drift_metrics() const {
+        return _drift_metrics;
+    }
+
 protected:
     float _formant_shift = 1.0f;
 private:
     static constexpr uint32_t MinResampleInputSize = 1 << 10;
-    // Size of transformed buffer before we increase resampling to compensate for drift
-    static constexpr uint32_t IncreaseResampleThreshold = 5000;
-    static constexpr uint32_t StandardResampleThreshold = 3000;
+
+    // Drift compensation. A PI controller on the low water mark of the queued output nudges the stretch factor,
+    // so that the stretcher makes up for rounding in its block sizes without building up latency.
+    // Stretchers produce in blocks, so the fill saws up and down; its lowest point is what guards against underruns
+    static constexpr uint32_t DefaultTargetFill = 512;
+    // per unit of error relative to the target
+    static constexpr float DriftProportionalGain = 0.02f;
+    // per unit of error relative to the target, per second
+    static constexpr float DriftIntegralGain = 0.02f;
+    // stretch factor corrections are kept this small so the stretchers barely notice
+    static constexpr float MaxDriftCorrection = 0.1f;
+    // The low water mark is the lowest fill of the last LowWaterSpans spans of output, plus the current one.
+    // About a tenth of a second, longer than a stretcher block but shorter than the controller reacts
+    static constexpr uint32_t LowWaterSpans = 4;
+    static constexpr uint32_t LowWaterSpanSize = 1 << 10;
+
+    uint32_t _target_fill = DefaultTargetFill;
+    uint32_t _low_water_span_size = LowWaterSpanSize;
+    float _drift_integral = 0.0f;
+
+    std::array<float, LowWaterSpans> _span_low_waters;
+    uint32_t _span_ind = 0;
+    float _current_span_low_water = 0.0f;
+    uint32_t _current_span_size = 0;
+    DriftMetrics _drift_metrics {0.0f, 0.0f, 1.0f, 0};
+
+    // after each pop of size samples, of which n were real
+    void _compensate_drift(uint32_t size, uint32_t n);
+    void _reset_drift();
+
+    // shift factor changes are glided over this many output samples, so the pitch does not jump
+    static constexpr uint32_t ShiftGlideSize = 1 << 9;
+
+    // the stretcher shifts the pitch, and stretches only by the drift correction
+    bool _direct_pitch_shift = false;
+    // what the stretcher is set to stretch by for a drift correction
+    float _stretch_for_correction(float correction) const;
 
     // raw time-domain data
     VecDeque<Complex> _raw_buffer;
     // time domain data after pitch_shift
     VecDeque<Complex> _transformed_buffer;
     
+    // stretcher output before and after resampling. Only ever grow
+    std::vector<Complex> _stretched;
+    std::vector<Complex> _unstretched;
 
-    LinearResampler _resampler;
+    PolyphaseResampler _resampler;
     TimeStretcher *_stretcher;
 
 
@@ -1,14 +1,17 @@
 #include "dsp/sampling.h"
 #include "dsp/common.h"
+#include "dsp/linalg.h"
 #include "mengumath.h"
 #include "extras/miniaudio_split/miniaudio.h"
 #include <algorithm>
+#include <bit>
 #include <cmath>
 #include <cstdint>
 #include <iterator>
 #include <math.h>
 #include <vector>
 #include <iostream>
+#include <stdexcept>
 
 using namespace Mengu;
 using namespace dsp;
@@ -75,4 +78,274 @@ std::vector<Complex> LinearResampler::resample(const std::vector<Complex> &sampl
     );
     
     return output;
-}
\ No newline at end of file
+}
+
+// zeroth order modified bessel function of the first kind, for the kaiser window
+static double bessel_i0(double x) {
+    double total = 1.0;
+    double term = 1.0;
+    const double quarter_sq = x * x / 4.0;
+    for (int k = 1; k < 50 && term > 1e-12 * total; k++) {
+        term *= quarter_sq / (k * k);
+        total += term;
+    }
+    return total;
+}
+
+PolyphaseResampler::PolyphaseResampler(float stretch_factor, uint32_t n_taps, uint32_t n_phases):
+    _n_taps(n_taps),
+    _n_phases(n_phases),
+    _window((n_phases + 1) * n_taps),
+    _stretch_factor(stretch_factor),
+    _glide_target(stretch_factor),
+    _staged(n_taps - 1 + BlockSize) {
+    if (n_taps < 2 || n_taps % 2 != 0 || n_phases < 1) {
+        throw std::runtime_error("PolyphaseResampler: n_taps must be even and at least 2, and n_phases at least 1");
+    }
+    if (stretch_factor <= 0.0f) {
+        throw std::runtime_error("PolyphaseResampler: stretch factor must be positive");
+    }
+
+    const double half_width = n_taps / 2;
+    const double window_norm = 1.0 / bessel_i0(KaiserBeta);
+    for (uint32_t p = 0; p <= n_phases; p++) {
+        for (uint32_t k = 0; k < n_taps; k++) {
+            const double x = (k - _tap_offset(p)) / half_width;
+            _window[p * n_taps + k] = std::abs(x) < 1.0 ? bessel_i0(KaiserBeta * std::sqrt(1.0 - x * x)) * window_norm : 0.0;
+        }
+    }
+    for (std::vector<float> &table: _tables) {
+        table.resize((n_phases + 1) * n_taps);
+    }
+
+    _design_table(_cutoff_for(stretch_factor));
+    _take_latest_table();
+    reset();
+}
+
+double PolyphaseResampler::_tap_offset(uint32_t phase) const {
+    // the output of row p lies between taps n_taps / 2 - 1 and n_taps / 2
+    return _n_taps / 2 - 1.0 + (double) phase / _n_phases;
+}
+
+float PolyphaseResampler::_cutoff_for(float stretch_factor) {
+    return Rolloff * 0.5f / MAX(stretch_factor, 1.0f);
+}
+
+void PolyphaseResampler::_design_table(float cutoff) {
+    _cutoff = cutoff;
+
+    std::vector<float> &table = _tables[_design_ind];
+    for (uint32_t p = 0; p <= _n_phases; p++) {
+        float *row = table.data() + p * _n_taps;
+        const float *window = _window.data() + p * _n_taps;
+        const double offset = _tap_offset(p);
+
+        double row_total = 0.0;
+        for (uint32_t k = 0; k < _n_taps; k++) {
+            const double t = k - offset;
+            const double arg = MATH_PI * 2.0 * cutoff * t;
+            const double sinc = t == 0.0 ? 1.0 : std::sin(arg) / arg;
+
+            row[k] = 2.0 * cutoff * sinc * window[k];
+            row_total += row[k];
+        }
+
+        // unity gain at dc for every phase, so a constant signal does not ripple with the fractional position
+        for (uint32_t k = 0; k < _n_taps; k++) {
+            row[k] /= row_total;
+        }
+    }
+
+    // the table left over from the last hand-off is designed into next
+    _design_ind = _latest_table_ind.exchange(_design_ind | FreshTable, std::memory_order_acq_rel) & ~FreshTable;
+}
+
+void PolyphaseResampler::_take_latest_table() {
+    if (_latest_table_ind.load(std::memory_order_relaxed) & FreshTable) {
+        _table_ind = _latest_table_ind.exchange(_table_ind, std::memory_order_acq_rel) & ~FreshTable;
+    }
+}
+
+void PolyphaseResampler::set_stretch_factor(float stretch_factor, uint32_t glide_size) {
+    if (!(stretch_factor > 0.0f) || !std::isfinite(stretch_factor)) {
+        return;
+    }
+
+    // designed for where the glide ends up, and handed over before the factor so it is there when the factor is taken
+    const float cutoff = _cutoff_for(stretch_factor);
+    if (std::abs(cutoff - _cutoff) > CutoffTolerance * _cutoff) {
+        _design_table(cutoff);
+    }
+
+    // a positive factor never has all zero bits
+    _pending_factor.store(((uint64_t) std::bit_cast<uint32_t>(stretch_factor) << 32) | glide_size, std::memory_order_release);
+}
+
+void PolyphaseResampler::_take_pending_factor() {
+    const uint64_t pending = _pending_factor.exchange(0, std::memory_order_acquire);
+    if (pending == 0) {
+        return;
+    }
+    const float stretch_factor = std::bit_cast<float>((uint32_t) (pending >> 32));
+    const uint32_t glide_size = (uint32_t) pending;
+
+    _glide_target = stretch_factor;
+    if (glide_size == 0) {
+        _stretch_factor = stretch_factor;
+        _n_glide_samples = 0;
+    }
+    else {
+        _glide_step = (stretch_factor - _stretch_factor) / glide_size;
+        _n_glide_samples = glide_size;
+    }
+}
+
+uint32_t PolyphaseResampler::max_output_size(uint32_t input_size) {
+    _take_pending_factor();
+    _factor_taken = true;
+
+    const float final_factor = _stretch_factor + _glide_step * _n_glide_samples;
+    const float min_factor = MIN(_stretch_factor, final_factor);
+    return (uint32_t) (input_size / min_factor) + 2;
+}
+
+void PolyphaseResampler::reset() {
+    _take_pending_factor();
+    std::fill(_staged.begin(), _staged.end(), 0.0f);
+    // a history of silence
+    _n_staged = _n_taps - 1;
+    _position = 0.0;
+
+    if (_n_glide_samples > 0) {
+        _stretch_factor = _glide_target;
+        _n_glide_samples = 0;
+    }
+}
+
+template<class T>
+uint32_t PolyphaseResampler::_process_staged(T *output) {
+    uint32_t n_output = 0;
+    bool passes_through = _passes_through();
+    while ((uint32_t) _position + _n_taps <= _n_staged) {
+        const uint32_t start = (uint32_t) _position;
+        if (passes_through) {
+            // the output of the first row is on this tap
+            output[n_output] = _staged[start + _n_taps / 2 - 1];
+            n_output++;
+            _position += 1.0;
+            continue;
+        }
+
+        const float phase = (_position - start) * _n_phases;
+        const uint32_t row = MIN((uint32_t) phase, _n_phases - 1);
+        const float row_weight = phase - row;
+
+        const float *taps = _staged.data() + start;
+        const float *coeffs = _tables[_table_ind].data() + row * _n_taps;
+        const float lower = dot(taps, coeffs, (int) _n_taps);
+        const float upper = dot(taps, coeffs + _n_taps, (int) _n_taps);
+        output[n_output] = lower + (upper - lower) * row_weight;
+        n_output++;
+
+        _position += _stretch_factor;
+        if (_n_glide_samples > 0) {
+            _stretch_factor += _glide_step;
+            _n_glide_samples--;
+            if (_n_glide_samples == 0) {
+                _stretch_factor = _glide_target;
+                // a glide back to 1 moves on to the next whole sample, so it can pass through.
+                // Never back, which could make more outputs than max_output_size allows for
+                if (_stretch_factor == 1.0f) {
+                    _position = std::ceil(_position);
+                }
+                passes_through = _passes_through();
+            }
+        }
+    }
+
+    // keep the samples the next outputs still need
+    const uint32_t n_used = MIN((uint32_t) _position, _n_staged);
+    std::copy(_staged.cbegin() + n_used, _staged.cbegin() + _n_staged, _staged.begin());
+    _n_staged -= n_used;
+    _position -= n_used;
+
+    return n_output;
+}
+
+uint32_t PolyphaseResampler::process(const float *input, uint32_t input_size, float *output) {
+    if (!_factor_taken) {
+        _take_pending_factor();
+    }
+    _factor_taken = false;
+    _take_latest_table();
+    uint32_t n_output = 0;
+    uint32_t n_input = 0;
+    while (n_input < input_size) {
+        const uint32_t n_copied = MIN(input_size - n_input, (uint32_t) _staged.size() - _n_staged);
+        std::copy(input + n_input, input + n_input + n_copied, _staged.begin() + _n_staged);
+        _n_staged += n_copied;
+        n_input += n_copied;
+
+        n_output += _process_staged(output + n_output);
+    }
+    return n_output;
+}
+
+uint32_t PolyphaseResampler::process(const Complex *input, uint32_t input_size, Complex *output) {
+    if (!_factor_taken) {
+        _take_pending_factor();
+    }
+    _factor_taken = false;
+    _take_latest_table();
+    uint32_t n_output = 0;
+    uint32_t n_input = 0;
+    while (n_input < input_size) {
+        const uint32_t n_copied = MIN(input_size - n_input, (uint32_t) _staged.size() - _n_staged);
+        for (uint32_t i = 0; i < n_copied; i++) {
+            _staged[_n_staged + i] = input[n_input + i].real();
+        }
+        _n_staged += n_copied;
+        n_input += n_copied;
+
+        n_output += _process_staged(output + n_output);
+    }
+    return n_output;
+}
+
+void PolyphaseResampler::resample_periodic(const float *input, uint32_t period, float *output, uint32_t output_size) {
+    _take_pending_factor();
+    if (_stretch_factor == 1.0f) {
+        for (uint32_t m = 0; m < output_size; m++) {
+            output[m] = input[m % period];
+        }
+        return;
+    }
+
+    _take_latest_table();
+    for (uint32_t m = 0; m < output_size; m++) {
+        const double position = m * (double) _stretch_factor;
+        const double floor_position = std::floor(position);
+        const int start = (int) floor_position - (int) (_n_taps / 2 - 1);
+        const float phase = (position - floor_position) * _n_phases;
+        const uint32_t row = MIN((uint32_t) phase, _n_phases - 1);
+        const float row_weight = phase - row;
+
+        const float *coeffs = _tables[_table_ind].data() + row * _n_taps;
+        float lower = 0.0f;
+        float upper = 0.0f;
+        if (start >= 0 && start + _n_taps <= period) {
+            lower = dot(input + start, coeffs, (int) _n_taps);
+            upper = dot(input + start, coeffs + _n_taps, (int) _n_taps);
+        }
+        else {
+            uint32_t ind = ((start % (int) period) + period) % period;
+            for (uint32_t k = 0; k < _n_taps; k++) {
+                lower += input[ind] * coeffs[k];
+                upper += input[ind] * coeffs[_n_taps + k];
+                ind = ind + 1 == period ? 0 : ind + 1;
+            }
+        }
+        output[m] = lower + (upper - lower) * row_weight;
+    }
+}
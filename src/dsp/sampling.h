@@ -16,6 +16,7 @@
 #include "mengumath.h"
 #include "dsp/common.h"
 
+#include <atomic>
 #include <cstdint>
 #include <vector>
 
@@ -80,6 +81,114 @@ private:
 
 };
 
+// Band-limited resampling of a mono stream with a windowed-sinc FIR.
+// The filter is tabulated at n_phases fractional offsets and linearly interpolated between them, so any
+// ratio (and a ratio that changes every sample) costs the same two n_taps-long dot products per output.
+// When shrinking the signal the cutoff is lowered with the ratio so that nothing aliases.
+// Nothing is allocated after construction
+class PolyphaseResampler {
+public:
+    // the stretch factor is input samples consumed per output sample, same as LinearResampler
+    PolyphaseResampler(float stretch_factor = 1.0f, uint32_t n_taps = DefaultTaps, uint32_t n_phases = DefaultPhases);
+
+    // moves the stretch factor to stretch_factor linearly over the next glide_size output samples.
+    // Factors that are not positive are ignored.
+    // The filter is only redesigned when the cutoff needs to drop (or may rise) by more than a few percent. It is designed
+    // into a spare table, and the factor left for the processing thread to pick up, so it can be called from another thread
+    void set_stretch_factor(float stretch_factor, uint32_t glide_size = 0);
+
+    // the factor being resampled at. A factor that has been set is not picked up until the next max_output_size or process
+    inline float get_stretch_factor() const {
+        return _stretch_factor;
+    }
+
+    // the most samples process() can output for input_size new samples. Picks up the factor last set,
+    // which the next process keeps to so that its output fits
+    uint32_t max_output_size(uint32_t input_size);
+
+    // consumes all of input and writes the resampled samples to output, which must fit max_output_size(input_size).
+    // Picks up the factor last set, unless max_output_size already has. Returns the number written
+    uint32_t process(const float *input, uint32_t input_size, float *output);
+    // same, on the real parts
+    uint32_t process(const Complex *input, uint32_t input_size, Complex *output);
+
+    // resamples one period of a periodic signal, like a frame from an inverse FFT, so the filter wraps around
+    // instead of running into silence at the ends. Output m is centred on input m * stretch factor.
+    // Independent of the stream, and ignores any glide
+    void resample_periodic(const float *input, uint32_t period, float *output, uint32_t output_size);
+
+    // forgets past input. The next output starts from silence
+    void reset();
+
+    // input samples between an input entering and the output that is centred on it
+    inline uint32_t latency() const {
+        return _n_taps / 2;
+    }
+
+private:
+    static constexpr uint32_t DefaultTaps = 64;
+    static constexpr uint32_t DefaultPhases = 256;
+    // Kaiser window shape. ~70dB stopband
+    static constexpr float KaiserBeta = 7.0f;
+    // cutoff as a portion of the lower nyquist frequency, leaving room for the transition band
+    static constexpr float Rolloff = 0.92f;
+    // relative change of the cutoff tolerated before the table is redesigned
+    static constexpr float CutoffTolerance = 0.05f;
+    // input is staged in blocks of this many samples after the filter history
+    static constexpr uint32_t BlockSize = 512;
+
+    const uint32_t _n_taps;
+    const uint32_t _n_phases;
+
+    // Each n_phases + 1 rows of n_taps. Row p is the filter for an output p / n_phases samples after the first tap.
+    // One is filtered with, one is designed into and one holds the last designed, waiting to be filtered with
+    std::vector<float> _tables[3];
+    uint32_t _table_ind = 0;
+    uint32_t _design_ind = 1;
+    // the index of the last designed table, flagged with FreshTable until it is filtered with
+    std::atomic<uint32_t> _latest_table_ind {2};
+    static constexpr uint32_t FreshTable = 1 << 31;
+    // the kaiser window at every tap of every row. Does not depend on the cutoff, so redesigns skip it
+    std::vector<float> _window;
+    // of the last designed table, in cycles per input sample
+    float _cutoff = 0.0f;
+
+    float _stretch_factor;
+    float _glide_step = 0.0f;
+    uint32_t _n_glide_samples = 0;
+    // where the glide ends, so rounding does not leave the factor just off it
+    float _glide_target = 1.0f;
+    // the bits of the factor last set and the glide size, for the processing thread to pick up. 0 when there is none
+    std::atomic<uint64_t> _pending_factor {0};
+    // picked up by max_output_size since the last process
+    bool _factor_taken = false;
+
+    // the last n_taps - 1 samples followed by the current block
+    std::vector<float> _staged;
+    uint32_t _n_staged = 0;
+    // position of the first tap of the next output in _staged
+    double _position = 0.0;
+
+    // the cutoff needed to not alias at a stretch factor
+    static float _cutoff_for(float stretch_factor);
+    // position of the output of a row, relative to its first tap
+    double _tap_offset(uint32_t phase) const;
+    // designs the filter into the spare table and hands it to process
+    void _design_table(float cutoff);
+    // swaps in the last designed table, if it is not already used
+    void _take_latest_table();
+    // starts moving to the factor last set, if there is a new one
+    void _take_pending_factor();
+    // at a factor of exactly 1 and a whole sample position, every output lies on an input sample,
+    // which is passed through rather than filtered
+    inline bool _passes_through() const {
+        return _stretch_factor == 1.0f && _n_glide_samples == 0 && _position == (uint64_t) _position;
+    }
+    // outputs every sample whose taps are all staged, then keeps the tail as history
+    template<class T>
+    uint32_t _process_staged(T *output);
+};
+
 }
 }
 
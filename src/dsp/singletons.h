@@ -5,33 +5,70 @@
 #ifndef MENGA_SINGLETONS
 #define MENGA_SINGLETONS
 
+#include <cstdint>
+#include <map>
+#include <mutex>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include <dsp/common.h>
 #include <dsp/fft.h>
+#include <dsp/interpolation.h>
+#include <dsp/loudness.h>
 
 namespace Mengu {
 namespace dsp {
 
 struct Singletons {
 private:
-    static Singletons *_singleton;
+    // getters may be called from any effect's thread
+    std::mutex _mutex;
     std::unordered_map<uint32_t, FFT> _ffts;
+    // keyed by the window function's address and the window size
+    std::map<std::pair<uintptr_t, uint32_t>, WindowTable> _window_tables;
+    // keyed by the spectrum size and the sample rate
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<float>> _lufs_weights;
 public:
     static Singletons *get_singleton() {
-        if (_singleton = nullptr) {
-            _singleton = new Singletons();
-        }
-        return _singleton;
+        // made on first use
+        static Singletons singleton;
+        return &singleton;
     }
-    // getters are gaurenteed to return a valid object. If none exists one will be created
+    // getters are gaurenteed to return a valid object. If none exists one will be created.
+    // Creating one allocates, so get them while setting up rather than while processing.
+    // References stay valid for the life of the program
 
     // ffts initialized to process predetermined length of signal
     const FFT &get_fft(uint32_t size) {
-        
-        if (_ffts.find(size) != _ffts.end()) {
-            _ffts.emplace(size, FFT(size));
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto found = _ffts.find(size);
+        if (found == _ffts.end()) {
+            // made in place, since FFTs own their buffers and cannot be copied
+            found = _ffts.try_emplace(size, size).first;
+        }
+        return found->second;
+    }
+
+    // window_f tabulated for windows of size
+    const WindowTable &get_window_table(float window_f (float), uint32_t size) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const std::pair<uintptr_t, uint32_t> key((uintptr_t) window_f, size);
+        auto found = _window_tables.find(key);
+        if (found == _window_tables.end()) {
+            found = _window_tables.emplace(key, WindowTable(window_f, size)).first;
+        }
+        return found->second;
+    }
+
+    // the K-weighting of LUFS_freq for spectra of size at sample_rate
+    const std::vector<float> &get_lufs_weights(uint32_t size, uint32_t sample_rate) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const std::pair<uint32_t, uint32_t> key(size, sample_rate);
+        auto found = _lufs_weights.find(key);
+        if (found == _lufs_weights.end()) {
+            found = _lufs_weights.emplace(key, LUFS_freq_weights(size, sample_rate)).first;
         }
-        return _ffts.at(size);
+        return found->second;
     }
 };
 
@@ -39,4 +76,4 @@ public:
 }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -2,9 +2,12 @@
 #include "dsp/common.h"
 #include "dsp/correlation.h"
 #include "dsp/effect.h"
+#include "dsp/fastmath.h"
 #include "dsp/interpolation.h"
 #include "dsp/linalg.h"
+#include "dsp/singletons.h"
 #include "mengumath.h"
+#include "templates/bucketqueue.h"
 #include "templates/vecdeque.h"
 
 #include <algorithm>
@@ -13,6 +16,7 @@
 #include <cmath>
 #include <complex>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <numeric>
 #include <vector>
@@ -24,6 +28,17 @@ void TimeStretcher::set_stretch_factor(const float &scale) {
     _stretch_factor = scale;
 }
 
+const Complex *TimeStretcher::_samples_to_analyse(const Complex *samples, uint32_t size) {
+    if (_analysis_buffer.size() < size) {
+        return samples;
+    }
+    if (_analysis_samples.size() < size) {
+        _analysis_samples.resize(size);
+    }
+    _analysis_buffer.to_array(_analysis_samples.data(), size);
+    return _analysis_samples.data();
+}
+
 Effect::InputDomain TimeStretcher::get_input_domain() {
     return InputDomain::Time;
 }
@@ -67,7 +82,7 @@ EffectPropPayload TimeStretcher::get_property(uint32_t id) const {
 
 
 static float _wrap_phase(float phase) {
-    return fposmod(phase + MATH_PI, MATH_TAU) - MATH_PI;
+    return fast_wrap_phase(phase);
 }
 
 // difference between 2 unwrapped phases. since, phases are preiodic, picks the closest one to the estimate
@@ -75,25 +90,95 @@ static float _phase_diff(float next, float prev, float est = 0.0f) {
     return _wrap_phase(next - prev - est) + est;
 }
 
-PhaseVocoderTimeStretcher::PhaseVocoderTimeStretcher(bool preserve_formants) {
+PhaseVocoderTimeStretcher::PhaseVocoderTimeStretcher(bool preserve_formants, WindowPreset preset) {
     _preserve_formants = preserve_formants;
+    _allocate_windows();
+
+    set_window_preset(preset);
+}
+
+PhaseVocoderTimeStretcher::~PhaseVocoderTimeStretcher() {}
+
+void PhaseVocoderTimeStretcher::_allocate_windows() {
+    // sized for the old rate, so they are remade as they are selected
+    for (uint32_t i = 0; i < NWindowPresets; i++) {
+        _lpcs[i].reset();
+    }
+
+    // reserve for the largest window so that changing presets only resizes within capacity
+    const uint32_t max_window_size = _scale_pow2_size(MaxWindowSize);
+    for (std::vector<float> *half_window: {&_prev_raw_mag2s, &_prev_raw_phases, &_last_scaled_phases, 
+                                           &_curr_mag2s, &_curr_phases, &_amplitudes, &_new_phases}) {
+        half_window->reserve(max_window_size / 2);
+    }
+    for (std::vector<Complex> *window: {&_sample, &_curr_freqs, &_freqs, &_new_samples}) {
+        window->reserve(max_window_size);
+    }
+    _frame_reals.reserve(max_window_size);
+    // shifting down an octave doubles the frame
+    _shifted_frame.reserve(max_window_size * 2 + 1);
+}
+
+void PhaseVocoderTimeStretcher::set_sample_rate(uint32_t sample_rate) {
+    TimeStretcher::set_sample_rate(sample_rate);
+    _allocate_windows();
+    set_window_preset(_window_preset);
+}
+
+void PhaseVocoderTimeStretcher::set_window_preset(WindowPreset preset) {
+    _window_preset = (WindowPreset) CLAMP((int) preset, (int) VoiceWindow, (int) MusicWindow);
+    _window_size = _scale_pow2_size(WindowPresetSizes[_window_preset].window_size);
+    _synthesis_hop_size = _scale_pow2_size(WindowPresetSizes[_window_preset].synthesis_hop_size);
+    if (!_lpcs[_window_preset]) {
+        _lpcs[_window_preset].reset(new DynamicLPC<LPCParams>(_window_size));
+    }
+    _lpc = _lpcs[_window_preset].get();
+
+    for (std::vector<float> *half_window: {&_prev_raw_mag2s, &_prev_raw_phases, &_last_scaled_phases, 
+                                           &_curr_mag2s, &_curr_phases, &_amplitudes, &_new_phases}) {
+        half_window->resize(_window_size / 2);
+    }
+    _sample.resize(_window_size);
+    _curr_freqs.resize(_window_size / 2);
+    _freqs.resize(_window_size);
+    _new_samples.resize(_window_size);
+    _frame_reals.resize(_window_size);
+    _overlap_window = &Singletons::get_singleton()->get_window_table(hann_window, _window_size - _synthesis_hop_size);
+    _loudness_norm.set_format(_window_size, _sample_rate);
+    _update_output_reserve();
+
     reset();
 }
 
+void PhaseVocoderTimeStretcher::set_pitch_shift(float shift) {
+    _pitch_shift = shift;
+    _frame_resampler.set_stretch_factor(shift);
+    _update_output_reserve();
+}
+
+void PhaseVocoderTimeStretcher::_update_output_reserve() {
+    if (_pitch_shift == 1.0f) {
+        _output_reserve = _synthesis_hop_size;
+        return;
+    }
+    // the next hop, or the tail of the last frame past it, whichever is longer
+    const uint32_t frame_size = _window_size / _pitch_shift;
+    const uint32_t hop_size = _synthesis_hop_size / _pitch_shift;
+    _output_reserve = MAX(hop_size + 1, frame_size - hop_size);
+}
+
 void PhaseVocoderTimeStretcher::push_signal(const Complex *input, const uint32_t &size) {
     _raw_buffer.extend_back(input, size);
 }
 
 uint32_t PhaseVocoderTimeStretcher::pop_transformed_signal(Complex *output, const uint32_t &size) {
-    while (n_transformed_ready() < size && _raw_buffer.size() >= WindowSize) {
-        std::array<Complex, WindowSize> sample;
-        _raw_buffer.to_array(sample.data(), WindowSize);
-        _load_new_freq_window(sample);
+    while (n_transformed_ready() < size && _raw_buffer.size() >= _window_size) {
+        _raw_buffer.to_array(_sample.data(), _window_size);
+        _load_new_freq_window(_sample.data());
 
-        std::array<Complex, WindowSize / 2> curr_freqs;
-        std::copy(_lpc.get_freq_spectrum().cbegin(), _lpc.get_freq_spectrum().cbegin() + WindowSize / 2, curr_freqs.begin());
+        std::copy(_lpc->get_freq_spectrum().cbegin(), _lpc->get_freq_spectrum().cbegin() + _window_size / 2, _curr_freqs.begin());
 
-        float analysis_hop_sizef = SynthesisHopSize / _stretch_factor;
+        float analysis_hop_sizef = _synthesis_hop_size / (_stretch_factor * _pitch_shift);
         _stretched_sample_truncated += std::modf(analysis_hop_sizef, &analysis_hop_sizef);
         uint32_t analysis_hop_size = (uint32_t) analysis_hop_sizef;
         if (_stretched_sample_truncated) {
@@ -101,18 +186,20 @@ uint32_t PhaseVocoderTimeStretcher::pop_transformed_signal(Complex *output, cons
             _stretched_sample_truncated -= 1;
         }
         
-        std::array<float, WindowSize / 2> amplitudes = _calc_scaled_magnitudes();
-        std::array<float, WindowSize / 2> new_phases = _calc_scaled_phases(curr_freqs, analysis_hop_size);
+        _calc_scaled_magnitudes(_amplitudes.data());
+        _calc_scaled_phases(_curr_freqs.data(), analysis_hop_size, _new_phases.data());
 
-        // std::array<Complex, WindowSize> new_samples = _calc_new_samples(amplitudes.data(), curr_raw_phases.data()); 
-        std::array<Complex, WindowSize> new_samples = _calc_new_samples(sample, amplitudes.data(), new_phases.data()); 
+        _calc_new_samples(_lpc->get_freq_spectrum().data(), _amplitudes.data(), _new_phases.data(), _new_samples.data()); 
         
-        mix_and_extend(_transformed_buffer, new_samples, WindowSize - SynthesisHopSize, hann_window);
+        if (_pitch_shift == 1.0f) {
+            mix_and_extend(_transformed_buffer, _new_samples, _window_size - _synthesis_hop_size, *_overlap_window);
+        }
+        else {
+            _shift_and_add_frame();
+        }
         // _transformed_buffer.extend_back(new_samples.data(), WindowSize);
 
-        std::transform(new_phases.cbegin(), new_phases.cend(), _last_scaled_phases.begin(), 
-            [] (float unwrapped) { return _wrap_phase(unwrapped); }
-        );
+        fast_wrap_phase(_new_phases.data(), _last_scaled_phases.data(), _window_size / 2);
 
         _raw_buffer.pop_front_many(nullptr, analysis_hop_size);
 
@@ -121,19 +208,86 @@ uint32_t PhaseVocoderTimeStretcher::pop_transformed_signal(Complex *output, cons
     return _transformed_buffer.pop_front_many(output, MIN(n_transformed_ready(), size));
 }
 
+void PhaseVocoderTimeStretcher::_shift_and_add_frame() {
+    // the inverse FFT gives one period of the frame, so it is resampled as one
+    for (uint32_t i = 0; i < _window_size; i++) {
+        _frame_reals[i] = _new_samples[i].real();
+    }
+    _shifted_frame.resize(_window_size / _pitch_shift);
+    _frame_resampler.resample_periodic(_frame_reals.data(), _window_size, _shifted_frame.data(), _shifted_frame.size());
+
+    float output_hop_sizef = _synthesis_hop_size / _pitch_shift;
+    _output_hop_truncated += std::modf(output_hop_sizef, &output_hop_sizef);
+    uint32_t output_hop_size = (uint32_t) output_hop_sizef;
+    if (_output_hop_truncated >= 1.0) {
+        output_hop_size += 1;
+        _output_hop_truncated -= 1.0;
+    }
+
+    // the shift may have grown the overlap past what was held back for it
+    const uint32_t overlap_size = MIN((uint32_t) _shifted_frame.size() - output_hop_size, _transformed_buffer.size());
+    mix_and_extend(_transformed_buffer, _shifted_frame, overlap_size, *_overlap_window);
+}
+
 uint32_t PhaseVocoderTimeStretcher::n_transformed_ready() const {
-    return MAX(SynthesisHopSize, _transformed_buffer.size()) - (SynthesisHopSize);
+    return MAX(_output_reserve, _transformed_buffer.size()) - _output_reserve;
+}
+
+uint32_t PhaseVocoderTimeStretcher::n_input_backlog() const {
+    return _raw_buffer.size() > _window_size ? _raw_buffer.size() - _window_size : 0;
 }
 
 void PhaseVocoderTimeStretcher::reset() {
-    _prev_raw_mag2s.fill(0.0f);
-    _prev_raw_phases.fill(0.0f);
+    std::fill(_prev_raw_mag2s.begin(), _prev_raw_mag2s.end(), 0.0f);
+    std::fill(_prev_raw_phases.begin(), _prev_raw_phases.end(), 0.0f);
 
-    _last_scaled_phases.fill(0.0);
+    std::fill(_last_scaled_phases.begin(), _last_scaled_phases.end(), 0.0f);
 
     _raw_buffer.resize(0);
-    _transformed_buffer.resize(SynthesisHopSize, 0);
+    _transformed_buffer.resize(_output_reserve, 0);
     _stretched_sample_truncated = 0.0;
+    _output_hop_truncated = 0.0;
+}
+
+static constexpr uint32_t WindowPresetPropId = 1;
+
+std::vector<EffectPropDesc> PhaseVocoderTimeStretcher::get_property_descs() const {
+    std::vector<EffectPropDesc> descs = TimeStretcher::get_property_descs();
+    descs.push_back(EffectPropDesc {
+        .type = EffectPropType::Counter,
+        .name = "window_preset",
+        .desc = "Window and hop size. 0 = voice (256, low latency), 1 = standard (512), 2 = music (2048, high quality)",
+        .slider_data = {
+            .min_value = VoiceWindow,
+            .max_value = MusicWindow,
+            .step_size = 1,
+            .scale = Linear,
+        }
+    });
+    return descs;
+}
+
+void PhaseVocoderTimeStretcher::set_property(uint32_t id, EffectPropPayload data) {
+    if (id == WindowPresetPropId) {
+        if (data.type == Counter || data.type == Slider) {
+            const WindowPreset preset = (WindowPreset) std::round(data.value);
+            if (preset != _window_preset) {
+                set_window_preset(preset);
+            }
+        }
+        return;
+    }
+    TimeStretcher::set_property(id, data);
+}
+
+EffectPropPayload PhaseVocoderTimeStretcher::get_property(uint32_t id) const {
+    if (id == WindowPresetPropId) {
+        return EffectPropPayload {
+            .type = Counter,
+            .value = (float) _window_preset,
+        };
+    }
+    return TimeStretcher::get_property(id);
 }
 
 // void PhaseVocoderTimeStretcher::set_stretch_factor(const float &stretch_factor) {
@@ -141,16 +295,16 @@ void PhaseVocoderTimeStretcher::reset() {
 //     // _last_scaled_phases.fill(0.0f);
 // };
 
-std::array<float, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderTimeStretcher::_calc_scaled_magnitudes() {
-    std::array<float, WindowSize / 2> mags;
-    
+void PhaseVocoderTimeStretcher::_calc_scaled_magnitudes(float *mags) {
     if (_preserve_formants) {
-        const std::array<float, WindowSize> &envelope = _lpc.get_envelope();
-        const std::array<float, WindowSize> &residuals = _lpc.get_residuals();
-
-        for (uint32_t i = 0; i < WindowSize / 2; i++) {
-            const uint32_t stretched_ind = i * _stretch_factor;
-            if (stretched_ind < WindowSize / 2 && std::isfinite(residuals[i] * envelope[stretched_ind])) {
+        const std::vector<float> &envelope = _lpc->get_envelope();
+        const std::vector<float> &residuals = _lpc->get_residuals();
+
+        // the frame is resampled by the pitch shift afterwards, which would move the envelope too
+        const float frame_stretch_factor = _stretch_factor * _pitch_shift;
+        for (uint32_t i = 0; i < _window_size / 2; i++) {
+            const uint32_t stretched_ind = i * frame_stretch_factor;
+            if (stretched_ind < _window_size / 2 && std::isfinite(residuals[i] * envelope[stretched_ind])) {
                 mags[i] = residuals[i] * envelope[stretched_ind];
             }
             else {
@@ -159,115 +313,159 @@ std::array<float, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderTimeStr
         }
     }
     else {
-        const std::array<Complex, WindowSize> &freqs = _lpc.get_freq_spectrum();
-        for (uint32_t i = 0; i < WindowSize / 2; i++) {
+        const std::vector<Complex> &freqs = _lpc->get_freq_spectrum();
+        for (uint32_t i = 0; i < _window_size / 2; i++) {
             mags[i] = sqrt(std::norm(freqs[i]));
         }
     }
-    
-    return mags;
 }
 
-std::array<float, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderTimeStretcher::_calc_scaled_phases(
-        const std::array<Complex, WindowSize / 2> &curr_freqs,
-        const uint32_t hopsize) {
-    std::array<float, WindowSize / 2> curr_mag2s;
-    std::array<float, WindowSize / 2> curr_phases;
-    std::transform(curr_freqs.cbegin(), curr_freqs.cend(), curr_mag2s.begin(), 
+void PhaseVocoderTimeStretcher::_split_freqs(const Complex *curr_freqs) {
+    std::transform(curr_freqs, curr_freqs + _window_size / 2, _curr_mag2s.begin(), 
         [] (Complex freq) { return std::norm(freq); }
     );
-    std::transform(curr_freqs.cbegin(), curr_freqs.cend(), curr_phases.begin(), 
-        [] (Complex freq) { return std::arg(freq); }
-    );
-
+    fast_arg(curr_freqs, _curr_phases.data(), _window_size / 2);
+}
 
-    std::array<float, WindowSize / 2> phase_deltas;
-    float stretch_factor = (float) SynthesisHopSize / hopsize;
-    for (int i = 0; i < WindowSize / 2; i++) {
-        const float est = i * MATH_TAU * ((float) hopsize / WindowSize);// / stretch_factor;
-        phase_deltas[i] = _phase_diff(curr_phases[i], _prev_raw_phases[i], est);
+void PhaseVocoderTimeStretcher::_calc_scaled_phases(
+        const Complex *curr_freqs,
+        const uint32_t hopsize,
+        float *new_phases) {
+    _split_freqs(curr_freqs);
+
+    float stretch_factor = (float) _synthesis_hop_size / hopsize;
+    for (uint32_t i = 0; i < _window_size / 2; i++) {
+        const float est = i * MATH_TAU * ((float) hopsize / _window_size);// / stretch_factor;
+        const float phase_delta = _phase_diff(_curr_phases[i], _prev_raw_phases[i], est);
+        new_phases[i] = _last_scaled_phases[i] + (phase_delta * stretch_factor);
     }
-    std::array<float, WindowSize / 2> new_phases;
-    for (int i = 0; i < WindowSize / 2; i++) {
-        new_phases[i] = _last_scaled_phases[i] + (phase_deltas[i] * stretch_factor);
-    }
-
-    _replace_prev_freqs(curr_mag2s, curr_phases);
 
-    return new_phases;
+    _replace_prev_freqs(_curr_mag2s.data(), _curr_phases.data());
 }
 
-std::array<Complex, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderTimeStretcher::_load_new_freq_window(const std::array<Complex, WindowSize> &sample) {
-    _lpc.load_sample(sample.data());
-    
-    std::array<Complex, WindowSize / 2> new_freqs;
-    for (uint32_t i = 0; i < WindowSize / 2; i++) {
-        new_freqs[i] = _lpc.get_freq_spectrum()[i];
-    }
-
-    return new_freqs;
+void PhaseVocoderTimeStretcher::_load_new_freq_window(const Complex *sample) {
+    _lpc->load_sample(sample);
 }
 
-void PhaseVocoderTimeStretcher::_replace_prev_freqs(const std::array<float, WindowSize / 2> &curr_mag2s, const std::array<float, WindowSize / 2> &curr_phases) {
-    std::copy(curr_mag2s.cbegin(), curr_mag2s.cend(), _prev_raw_mag2s.begin());
-    std::copy(curr_phases.cbegin(), curr_phases.cend(), _prev_raw_phases.begin());
+void PhaseVocoderTimeStretcher::_replace_prev_freqs(const float *curr_mag2s, const float *curr_phases) {
+    std::copy(curr_mag2s, curr_mag2s + _window_size / 2, _prev_raw_mag2s.begin());
+    std::copy(curr_phases, curr_phases + _window_size / 2, _prev_raw_phases.begin());
 }
 
-std::array<Complex, PhaseVocoderTimeStretcher::WindowSize> PhaseVocoderTimeStretcher::_calc_new_samples(
-            const std::array<Complex, WindowSize> &raw_samples,
+void PhaseVocoderTimeStretcher::_calc_new_samples(
+            const Complex *raw_freqs,
             const float *amplitudes, 
-            const float *phases) {
-    std::array<Complex, WindowSize> freqs = {0.0};
-    for (uint32_t i = 0; i < WindowSize / 2; i++) {
-        freqs[i] = 2.0f * std::polar(amplitudes[i], phases[i]);
+            const float *phases,
+            Complex *output) {
+    std::fill(_freqs.begin() + _window_size / 2, _freqs.end(), Complex());
+    fast_polar(amplitudes, phases, _freqs.data(), _window_size / 2);
+
+    // Make shifted as loud as raw samples. Only the real part of the inverse is kept, 
+    // which has half of each bin, so they are doubled
+    const float gain = 2.0f * _loudness_norm.get_correction(_freqs.data(), raw_freqs, _window_size / 2);
+    for (uint32_t i = 0; i < _window_size / 2; i++) {
+        _freqs[i] *= gain;
     }
 
-    std::array<Complex, WindowSize> new_samples;
-    _lpc.get_fft().inverse_transform(freqs.data(), new_samples.data());
+    _lpc->get_fft().inverse_transform(_freqs.data(), output);
+}
 
-    // Make shifted as loud as raw samples
-    _loudness_norm.normalize(new_samples.data(), raw_samples.data(), new_samples.data());
+PhaseVocoderDoneRightTimeStretcher::PhaseVocoderDoneRightTimeStretcher(bool preserve_formants, WindowPreset preset, PropagationQueue queue): 
+    PhaseVocoderTimeStretcher(preserve_formants, preset),
+    _propagation_queue_type(queue),
+    _time_phase_deltas(MaxWindowSize / 2),
+    _freq_phase_deltas(MaxWindowSize / 2),
+    // every bin is pushed at most once from each frame
+    _propagation_queue(MaxWindowSize),
+    _bucket_queue(NMagBuckets, MaxWindowSize),
+    _can_recieve_propagation(MaxWindowSize / 2) {}
+
+void PhaseVocoderDoneRightTimeStretcher::set_sample_rate(uint32_t sample_rate) {
+    PhaseVocoderTimeStretcher::set_sample_rate(sample_rate);
+
+    const uint32_t max_window_size = _scale_pow2_size(MaxWindowSize);
+    _time_phase_deltas.resize(max_window_size / 2);
+    _freq_phase_deltas.resize(max_window_size / 2);
+    _propagation_queue.resize(max_window_size);
+    _bucket_queue.resize(NMagBuckets, max_window_size);
+    _can_recieve_propagation.resize(max_window_size / 2);
+}
 
-    return new_samples;
+uint32_t PhaseVocoderDoneRightTimeStretcher::_mag_bucket_key(float mag) {
+    // the bits of a positive float increase with its value, so the exponent and top mantissa bits
+    // are a logarithmic quantisation of it
+    uint32_t bits;
+    std::memcpy(&bits, &mag, sizeof(bits));
+    return bits >> (23 - MagBucketsPerOctaveLog2);
 }
 
-PhaseVocoderDoneRightTimeStretcher::PhaseVocoderDoneRightTimeStretcher(bool preserve_formants) : PhaseVocoderTimeStretcher(preserve_formants) {}
+static constexpr uint32_t PropagationQueuePropId = 2;
+
+std::vector<EffectPropDesc> PhaseVocoderDoneRightTimeStretcher::get_property_descs() const {
+    std::vector<EffectPropDesc> descs = PhaseVocoderTimeStretcher::get_property_descs();
+    descs.push_back(EffectPropDesc {
+        .type = EffectPropType::Counter,
+        .name = "propagation_queue",
+        .desc = "Queue ordering phase propagation. 0 = heap, 1 = magnitude buckets (same result above -120 dB, faster)",
+        .slider_data = {
+            .min_value = HeapPropagationQueue,
+            .max_value = BucketPropagationQueue,
+            .step_size = 1,
+            .scale = Linear,
+        }
+    });
+    return descs;
+}
 
-std::array<float, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderDoneRightTimeStretcher::_calc_scaled_phases(
-        const std::array<Complex, WindowSize / 2> &curr_freqs,
-        const uint32_t hopsize) {
-    std::array<float, WindowSize / 2> curr_mag2s;
-    std::array<float, WindowSize / 2> curr_phases;
-    std::transform(curr_freqs.cbegin(), curr_freqs.cend(), curr_mag2s.begin(), 
-        [] (Complex freq) { return std::norm(freq); }
-    );
-    std::transform(curr_freqs.cbegin(), curr_freqs.cend(), curr_phases.begin(), 
-        [] (Complex freq) { return std::arg(freq); }
-    );
+void PhaseVocoderDoneRightTimeStretcher::set_property(uint32_t id, EffectPropPayload data) {
+    if (id == PropagationQueuePropId) {
+        if (data.type == Counter || data.type == Slider) {
+            set_propagation_queue((PropagationQueue) CLAMP((int) std::round(data.value), (int) HeapPropagationQueue, (int) BucketPropagationQueue));
+        }
+        return;
+    }
+    PhaseVocoderTimeStretcher::set_property(id, data);
+}
 
-    float stretch_factor = (float) SynthesisHopSize / hopsize;
-    std::array<float, WindowSize / 2> time_phase_deltas;
-    for (int i = 0; i < WindowSize / 2; i++) {
-        const float est = i * MATH_TAU * ((float) hopsize / WindowSize);
-        time_phase_deltas[i] = _phase_diff(curr_phases[i], _prev_raw_phases[i], est);
+EffectPropPayload PhaseVocoderDoneRightTimeStretcher::get_property(uint32_t id) const {
+    if (id == PropagationQueuePropId) {
+        return EffectPropPayload {
+            .type = Counter,
+            .value = (float) _propagation_queue_type,
+        };
     }
+    return PhaseVocoderTimeStretcher::get_property(id);
+}
 
-    std::array<float, WindowSize / 2> freq_phase_deltas;
-    for (uint32_t i = 1; i < WindowSize / 2 - 1; i++) {
-        const float up_delta = _wrap_phase(curr_phases[i + 1] - curr_phases[i]);
-        const float down_delta = _wrap_phase(curr_phases[i] - curr_phases[i - 1]);
-        freq_phase_deltas[i] = 0.5f * (up_delta + down_delta);
+void PhaseVocoderDoneRightTimeStretcher::_calc_scaled_phases(
+        const Complex *curr_freqs,
+        const uint32_t hopsize,
+        float *new_phases) {
+    _split_freqs(curr_freqs);
+    const uint32_t n_bins = _window_size / 2;
+
+    float stretch_factor = (float) _synthesis_hop_size / hopsize;
+    for (uint32_t i = 0; i < n_bins; i++) {
+        const float est = i * MATH_TAU * ((float) hopsize / _window_size);
+        _time_phase_deltas[i] = _phase_diff(_curr_phases[i], _prev_raw_phases[i], est);
     }
-    freq_phase_deltas[0] = _wrap_phase(curr_phases[1] - curr_phases[0]);
-    freq_phase_deltas[WindowSize / 2 - 1] = _wrap_phase(curr_phases[WindowSize / 2 - 1] - curr_phases[WindowSize / 2 - 2]);
 
-    std::array<float, WindowSize / 2> new_phases = _propagate_phase_gradients (
-        time_phase_deltas,
-        freq_phase_deltas,
-        _last_scaled_phases,
-        _prev_raw_mag2s,
-        curr_mag2s,
+    for (uint32_t i = 1; i < n_bins - 1; i++) {
+        const float up_delta = _wrap_phase(_curr_phases[i + 1] - _curr_phases[i]);
+        const float down_delta = _wrap_phase(_curr_phases[i] - _curr_phases[i - 1]);
+        _freq_phase_deltas[i] = 0.5f * (up_delta + down_delta);
+    }
+    _freq_phase_deltas[0] = _wrap_phase(_curr_phases[1] - _curr_phases[0]);
+    _freq_phase_deltas[n_bins - 1] = _wrap_phase(_curr_phases[n_bins - 1] - _curr_phases[n_bins - 2]);
+
+    _propagate_phase_gradients(
+        _time_phase_deltas.data(),
+        _freq_phase_deltas.data(),
+        _last_scaled_phases.data(),
+        _prev_raw_mag2s.data(),
+        _curr_mag2s.data(),
         stretch_factor,
+        new_phases,
         1e-3f
     );
 
@@ -275,53 +473,99 @@ std::array<float, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderDoneRig
     //     new_phases[i] = _last_scaled_phases[i] + (time_phase_deltas[i] * stretch_factor);
     // }
 
-    _replace_prev_freqs(curr_mag2s, curr_phases);
-    return new_phases;
+    _replace_prev_freqs(_curr_mag2s.data(), _curr_phases.data());
 }
 
-std::array<float, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderDoneRightTimeStretcher::_propagate_phase_gradients(
-        const std::array<float, WindowSize / 2> &phase_time_deltas, 
-        const std::array<float, WindowSize / 2> &phase_freq_deltas, 
-        const std::array<float, WindowSize / 2> &last_stretched_phases, 
-        const std::array<float, WindowSize / 2> &prev_freq_mags,
-        const std::array<float, WindowSize / 2> &next_freq_mags,
+void PhaseVocoderDoneRightTimeStretcher::_propagate_phase_gradients(
+        const float *phase_time_deltas, 
+        const float *phase_freq_deltas, 
+        const float *last_stretched_phases, 
+        const float *prev_freq_mags,
+        const float *next_freq_mags,
         const float stretch_factor,
+        float *new_phases,
         const float tolerance) {
+    const uint32_t n_bins = _window_size / 2;
+
     // sort indexes to the next frequencies based on the magnitude of that bin, in descending order
     // also, bins with magnitude under the threshold do not propagate in the frequency domain
     float max_mag = 0.0f;
-    for (uint32_t i = 0; i < WindowSize / 2; i++) {
+    for (uint32_t i = 0; i < n_bins; i++) {
         max_mag = MAX(MAX(max_mag, prev_freq_mags[i]), next_freq_mags[i]);
     }
     const float abs_tol = max_mag * (tolerance * tolerance);
 
-    // Used to store indexs to each frequencing in the propagation_queue
-    struct FreqBin {
-        enum {
-            Prev,
-            Next,
-        };
-        uint8_t frame;
-        uint32_t bin; 
-    };
-    const auto freq_bin_cmp = [&prev_freq_mags, &next_freq_mags] (FreqBin a, FreqBin b) { 
+    const auto freq_bin_cmp = [prev_freq_mags, next_freq_mags] (FreqBin a, FreqBin b) { 
         float a_mag = (a.frame == FreqBin::Prev) ? prev_freq_mags[a.bin] : next_freq_mags[a.bin];
         float b_mag = (b.frame == FreqBin::Prev) ? prev_freq_mags[b.bin] : next_freq_mags[b.bin];
-        return a_mag < b_mag;
+        // ties (e.g. the silent first frame) are broken by position so that both queues agree
+        if (a_mag != b_mag) {
+            return a_mag < b_mag;
+        }
+        return a.frame != b.frame ? a.frame < b.frame : a.bin < b.bin;
     };
     
     // Max Heap of the frequency bins to propagate. (Listen I REALLY don't want allocate dynamically)
-    std::array<FreqBin, WindowSize * 3> propagation_queue;
-    uint32_t propagation_queue_size = WindowSize / 2;
-    for (uint32_t i = 0; i < WindowSize / 2; i++) {
-        propagation_queue[i] = FreqBin { .frame = FreqBin::Prev, .bin = i };
+    std::vector<FreqBin> &propagation_queue = _propagation_queue;
+    uint32_t propagation_queue_size = 0;
+
+    // Bucket queue alternative. Bins are bucketed by quantised magnitude and only compared with the few in the same bucket
+    const bool use_buckets = _propagation_queue_type == BucketPropagationQueue;
+    const uint32_t max_mag_key = _mag_bucket_key(max_mag);
+    const auto bucket_of = [max_mag_key] (float mag) {
+        const uint32_t below_max = max_mag_key - MIN(_mag_bucket_key(mag), max_mag_key);
+        return NMagBuckets - 1 - MIN(below_max, NMagBuckets - 1);
+    };
+
+    // The lowest bucket takes every bin too quiet for the rest, which in a near silent frame is most of them, so it is
+    // left unsorted to keep pushing to it constant time. The order of bins that quiet barely changes the output
+    const auto push_to_bucket = [&] (FreqBin freq_bin, float mag) {
+        const uint32_t bucket = bucket_of(mag);
+        if (bucket == 0) {
+            _bucket_queue.push(freq_bin, bucket);
+        }
+        else {
+            _bucket_queue.push(freq_bin, bucket, freq_bin_cmp);
+        }
+    };
+
+    const auto push_bin = [&] (FreqBin freq_bin) {
+        if (use_buckets) {
+            push_to_bucket(freq_bin, (freq_bin.frame == FreqBin::Prev) ? prev_freq_mags[freq_bin.bin] : next_freq_mags[freq_bin.bin]);
+        }
+        else {
+            propagation_queue[propagation_queue_size] = freq_bin;
+            propagation_queue_size += 1;
+            std::push_heap(propagation_queue.begin(), propagation_queue.begin() + propagation_queue_size, freq_bin_cmp);
+        }
+    };
+    const auto pop_bin = [&] () {
+        if (use_buckets) {
+            return _bucket_queue.pop();
+        }
+        std::pop_heap(propagation_queue.begin(), propagation_queue.begin() + propagation_queue_size, freq_bin_cmp);
+        propagation_queue_size -= 1;
+        return propagation_queue[propagation_queue_size];
+    };
+
+    if (use_buckets) {
+        _bucket_queue.clear();
+        for (uint32_t i = 0; i < n_bins; i++) {
+            push_to_bucket(FreqBin { .frame = FreqBin::Prev, .bin = i }, prev_freq_mags[i]);
+        }
+    }
+    else {
+        propagation_queue_size = n_bins;
+        for (uint32_t i = 0; i < n_bins; i++) {
+            propagation_queue[i] = FreqBin { .frame = FreqBin::Prev, .bin = i };
+        }
+        std::make_heap(propagation_queue.begin(), propagation_queue.begin() + propagation_queue_size, freq_bin_cmp);
     }
-    std::make_heap(propagation_queue.begin(), propagation_queue.begin() + propagation_queue_size, freq_bin_cmp);
 
     // Set of frequency bins to propagate to
-    bool can_recieve_propagation[WindowSize / 2];
-    uint32_t n_can_recieve_propagation = WindowSize / 2;
-    for (uint32_t i = 0; i < WindowSize / 2; i++) {
+    std::vector<uint8_t> &can_recieve_propagation = _can_recieve_propagation;
+    uint32_t n_can_recieve_propagation = n_bins;
+    for (uint32_t i = 0; i < n_bins; i++) {
         if ((next_freq_mags[i] < abs_tol)) {
             can_recieve_propagation[i] = false;
             n_can_recieve_propagation -= 1;
@@ -332,11 +576,9 @@ std::array<float, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderDoneRig
     }
 
     // perform propagation in all dimension
-    std::array<float, WindowSize / 2> new_phases {0};
+    std::fill(new_phases, new_phases + n_bins, 0.0f);
     while (n_can_recieve_propagation > 0) {
-        std::pop_heap(propagation_queue.begin(), propagation_queue.begin() + propagation_queue_size, freq_bin_cmp);
-        FreqBin next_bin = propagation_queue[propagation_queue_size - 1];
-        propagation_queue_size -= 1;
+        FreqBin next_bin = pop_bin();
 
         const uint32_t freq_ind = next_bin.bin;
         if (next_bin.frame == FreqBin::Prev) {
@@ -347,10 +589,7 @@ std::array<float, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderDoneRig
                 can_recieve_propagation[freq_ind] = false;
                 n_can_recieve_propagation -= 1;
 
-                // push to the heap
-                propagation_queue[propagation_queue_size] = FreqBin {.frame = FreqBin::Next, .bin = freq_ind};
-                propagation_queue_size += 1;
-                std::push_heap(propagation_queue.begin(), propagation_queue.begin() + propagation_queue_size, freq_bin_cmp);
+                push_bin(FreqBin {.frame = FreqBin::Next, .bin = freq_ind});
             }
         }
         else {
@@ -363,12 +602,9 @@ std::array<float, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderDoneRig
                 can_recieve_propagation[freq_down] = false;
                 n_can_recieve_propagation -= 1;
 
-                // push to the heap
-                propagation_queue[propagation_queue_size] = FreqBin {.frame = FreqBin::Next, .bin = freq_down};
-                propagation_queue_size += 1;
-                std::push_heap(propagation_queue.begin(), propagation_queue.begin() + propagation_queue_size, freq_bin_cmp);
+                push_bin(FreqBin {.frame = FreqBin::Next, .bin = freq_down});
             }
-            if ((freq_ind < WindowSize / 2 - 1) && can_recieve_propagation[freq_ind + 1]) {
+            if ((freq_ind < n_bins - 1) && can_recieve_propagation[freq_ind + 1]) {
                 const uint32_t freq_up = freq_ind + 1;
                 new_phases[freq_up] = new_phases[freq_ind] + (0.5 * (phase_freq_deltas[freq_up] + phase_freq_deltas[freq_ind]) * stretch_factor);
 
@@ -376,10 +612,7 @@ std::array<float, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderDoneRig
                 can_recieve_propagation[freq_up] = false;
                 n_can_recieve_propagation -= 1;
 
-                // push to the heap
-                propagation_queue[propagation_queue_size] = FreqBin {.frame = FreqBin::Next, .bin = freq_up};
-                propagation_queue_size += 1;
-                std::push_heap(propagation_queue.begin(), propagation_queue.begin() + propagation_queue_size, freq_bin_cmp);
+                push_bin(FreqBin {.frame = FreqBin::Next, .bin = freq_up});
             }
         }
     }
@@ -411,27 +644,95 @@ std::array<float, PhaseVocoderTimeStretcher::WindowSize / 2> PhaseVocoderDoneRig
 
     //     prop_source_mag[freq_ind] = 2e10;
     // }
+}
 
-    return new_phases;   
+// Properties shared by the stretchers that search for the best overlap point
+static constexpr uint32_t SearchDecimationPropId = 1;
+static constexpr uint32_t SimilarityMeasurePropId = 2;
+static constexpr uint32_t MaxSearchDecimation = 8;
+
+static void _append_search_property_descs(std::vector<EffectPropDesc> &descs) {
+    descs.push_back(EffectPropDesc {
+        .type = EffectPropType::Counter,
+        .name = "search_decimation",
+        .desc = "Searches for the best overlap on signals decimated by this factor before refining it. Higher is faster but less accurate",
+        .slider_data = {
+            .min_value = 1,
+            .max_value = MaxSearchDecimation,
+            .step_size = 1,
+            .scale = Linear,
+        }
+    });
+    descs.push_back(EffectPropDesc {
+        .type = EffectPropType::Counter,
+        .name = "similarity_measure",
+        .desc = "How overlaps are compared. 0 = cross-correlation, 1 = normalised cross-correlation, 2 = AMDF",
+        .slider_data = {
+            .min_value = 0,
+            .max_value = AMDF,
+            .step_size = 1,
+            .scale = Linear,
+        }
+    });
+}
+
+// returns true if the id was one of the search properties
+static bool _set_search_property(uint32_t id, EffectPropPayload data, uint32_t &decimation, SimilarityMeasure &measure) {
+    if (data.type != Counter && data.type != Slider) {
+        return false;
+    }
+    switch (id) {
+        case SearchDecimationPropId:
+            decimation = CLAMP((uint32_t) std::round(data.value), 1u, MaxSearchDecimation);
+            return true;
+        case SimilarityMeasurePropId:
+            measure = (SimilarityMeasure) CLAMP((int) std::round(data.value), (int) CrossCorrelation, (int) AMDF);
+            return true;
+        default:
+            return false;
+    }
+}
+
+static EffectPropPayload _get_search_property(uint32_t id, uint32_t decimation, SimilarityMeasure measure) {
+    return EffectPropPayload {
+        .type = Counter,
+        .value = (float) (id == SearchDecimationPropId ? decimation : measure),
+    };
 }
 
 OLATimeStretcher::OLATimeStretcher(uint32_t w_size) {
-    _window_size = w_size;
+    _base_window_size = w_size;
+    _resize_window();
+}
+
+OLATimeStretcher::~OLATimeStretcher() {}
+
+void OLATimeStretcher::set_sample_rate(uint32_t sample_rate) {
+    TimeStretcher::set_sample_rate(sample_rate);
+    _resize_window();
+}
+
+void OLATimeStretcher::_resize_window() {
+    _window_size = _scale_size(_base_window_size);
     _overlap = _window_size / 5;
     _selection_window = _window_size / 2;
+    _overlap_window = &Singletons::get_singleton()->get_window_table(hann_window, _overlap);
+
+    _correlator.reset(new CrossCorrelator(_overlap + _selection_window));
 
-    _transformed_buffer.resize(_window_size);
+    reset();
 }
 
 template<class T>
 static void mix_into_extend_by_pointer(const Complex *new_data,
                                        T &output,
                                        const uint32_t &window_size,
-                                       const uint32_t &overlap_size) {
+                                       const uint32_t &overlap_size,
+                                       const WindowTable &window) {
     uint32_t i = 0;
     
     for (; i < overlap_size; i++) {
-        const float w = hann_window((float) i / overlap_size);
+        const float w = window.data()[i];
         const uint32_t output_ind = output.size() - overlap_size + i;
 
         output[output_ind] = lerp(new_data[i], output[output_ind], w);
@@ -464,9 +765,17 @@ uint32_t OLATimeStretcher::pop_transformed_signal(Complex *output, const uint32_
         _transformed_buffer.pop_back_many(prev_tail.data(), _overlap);
 
         // find best start for overlap
-        uint32_t overlap_ind = find_max_correlation_quad(prev_tail.data(), new_data.data(), _overlap, _selection_window);
+        uint32_t overlap_ind = _correlator->find_best_lag(
+            prev_tail.data(), 
+            new_data.data(), 
+            _overlap, 
+            _selection_window, 
+            _similarity_measure, 
+            _search_decimation, 
+            true
+        );
 
-        mix_into_extend_by_pointer(new_data.data() + overlap_ind, prev_tail, _window_size, _overlap);
+        mix_into_extend_by_pointer(new_data.data() + overlap_ind, prev_tail, _window_size, _overlap, *_overlap_window);
 
         for (auto v: prev_tail) {
             _transformed_buffer.push_back(v);
@@ -494,8 +803,52 @@ void OLATimeStretcher::reset() {
     _transformed_buffer.resize(_window_size, 0);
 }
 
+std::vector<EffectPropDesc> OLATimeStretcher::get_property_descs() const {
+    std::vector<EffectPropDesc> descs = TimeStretcher::get_property_descs();
+    _append_search_property_descs(descs);
+    return descs;
+}
+
+void OLATimeStretcher::set_property(uint32_t id, EffectPropPayload data) {
+    if (!_set_search_property(id, data, _search_decimation, _similarity_measure)) {
+        TimeStretcher::set_property(id, data);
+    }
+}
+
+EffectPropPayload OLATimeStretcher::get_property(uint32_t id) const {
+    if (id == SearchDecimationPropId || id == SimilarityMeasurePropId) {
+        return _get_search_property(id, _search_decimation, _similarity_measure);
+    }
+    return TimeStretcher::get_property(id);
+}
+
 WSOLATimeStretcher::WSOLATimeStretcher() {
     // _transformed_buffer.resize(MaxBackWindowOverlap);
+    _resize_windows();
+}
+
+WSOLATimeStretcher::~WSOLATimeStretcher() {}
+
+void WSOLATimeStretcher::set_sample_rate(uint32_t sample_rate) {
+    TimeStretcher::set_sample_rate(sample_rate);
+    _resize_windows();
+}
+
+void WSOLATimeStretcher::_resize_windows() {
+    _sample_proc_size = _scale_size(SampleProcSize);
+    _window_size = _scale_size(WindowSize);
+    _overlap_size = _window_size / 4;
+    _search_window_size = _window_size / 5;
+    _overlap_window = &Singletons::get_singleton()->get_window_table(hamming_window, _overlap_size);
+
+    _samples.resize(_sample_proc_size);
+    _overlap_buffer.resize(_sample_proc_size / 2);
+    _resampled.resize(0);
+    _fit_resampled();
+
+    _correlator.reset(new CrossCorrelator(_overlap_size + _search_window_size));
+
+    reset();
 }
 
 void WSOLATimeStretcher::push_signal(const Complex *input, const uint32_t &size) {
@@ -521,16 +874,15 @@ void WSOLATimeStretcher::push_signal(const Complex *input, const uint32_t &size)
 
 uint32_t WSOLATimeStretcher::pop_transformed_signal(Complex *output, const uint32_t &size) {
     // lazily perform the stretchy
-    while ((_raw_buffer.size() > SampleProcSize) && (n_transformed_ready() < size)) {
-        std::array<Complex, SampleProcSize> samples;
-
-        _raw_buffer.to_array(samples.data(), SampleProcSize);
+    while ((_raw_buffer.size() > _sample_proc_size) && (n_transformed_ready() < size)) {
+        _raw_buffer.to_array(_samples.data(), _sample_proc_size);
 
         // do the stretchy
-        uint32_t frames_used = _stretch_sample_and_add(samples.data());
+        uint32_t frames_used = _stretch_sample_and_add(_samples.data(), _samples_to_analyse(_samples.data(), _sample_proc_size));
 
         // delete everything used
         _raw_buffer.pop_front_many(nullptr, frames_used);
+        _analysis_buffer.pop_front_many(nullptr, MIN(frames_used, (uint32_t) _analysis_buffer.size()));
         _last_overlap_start -= frames_used;
         _next_overlap_start -= frames_used;
     }
@@ -546,52 +898,110 @@ uint32_t WSOLATimeStretcher::n_transformed_ready() const {
     return _transformed_buffer.size();
 }
 
+uint32_t WSOLATimeStretcher::n_input_backlog() const {
+    return _raw_buffer.size() > _sample_proc_size ? _raw_buffer.size() - _sample_proc_size : 0;
+}
+
 void WSOLATimeStretcher::reset() {
     _raw_buffer.resize(0);
+    _analysis_buffer.resize(0);
     _transformed_buffer.resize(0);
+    _last_overlap_start = 0;
+    _next_overlap_start = 0;
+    _stretched_sample_truncated = 0.0;
+
+    _pitch_resampler.reset();
+    _resampling_output = _pitch_shift != 1.0f;
+}
+
+void WSOLATimeStretcher::set_pitch_shift(float shift) {
+    _pitch_shift = shift;
+    _pitch_resampler.set_stretch_factor(shift);
+    _resampling_output = _resampling_output || shift != 1.0f;
+    _fit_resampled();
+}
 
+void WSOLATimeStretcher::_fit_resampled() {
+    // the longest part of a window added at once. Its flat middle, unless the overlap or search window is longer
+    const uint32_t max_part = MAX(_window_size - 2 * _overlap_size, MAX(_overlap_size, _search_window_size));
+    const uint32_t max_resampled = _pitch_resampler.max_output_size(max_part);
+    if (_resampled.size() < max_resampled) {
+        _resampled.resize(max_resampled);
+    }
 }
 
-uint32_t WSOLATimeStretcher::_stretch_sample_and_add(const Complex *sample) {
-    // base overlap
-    const uint32_t overlap_size = WindowSize / 4;
-    // search forward for better overlap point
-    const uint32_t search_window = WindowSize / 5;
-    const uint32_t flat_duration = WindowSize - 2 * overlap_size;
+void WSOLATimeStretcher::_add_output(const Complex *output, uint32_t size) {
+    if (!_resampling_output) {
+        _transformed_buffer.extend_back(output, size);
+        return;
+    }
+    const uint32_t n_resampled = _pitch_resampler.process(output, size, _resampled.data());
+    _transformed_buffer.extend_back(_resampled.data(), n_resampled);
+}
+
+std::vector<EffectPropDesc> WSOLATimeStretcher::get_property_descs() const {
+    std::vector<EffectPropDesc> descs = TimeStretcher::get_property_descs();
+    _append_search_property_descs(descs);
+    return descs;
+}
+
+void WSOLATimeStretcher::set_property(uint32_t id, EffectPropPayload data) {
+    if (!_set_search_property(id, data, _search_decimation, _similarity_measure)) {
+        TimeStretcher::set_property(id, data);
+    }
+}
+
+EffectPropPayload WSOLATimeStretcher::get_property(uint32_t id) const {
+    if (id == SearchDecimationPropId || id == SimilarityMeasurePropId) {
+        return _get_search_property(id, _search_decimation, _similarity_measure);
+    }
+    return TimeStretcher::get_property(id);
+}
+
+uint32_t WSOLATimeStretcher::_stretch_sample_and_add(const Complex *sample, const Complex *analysed) {
+    const uint32_t overlap_size = _overlap_size;
+    const uint32_t search_window = _search_window_size;
+    const uint32_t flat_duration = _window_size - 2 * overlap_size;
 
     // consider te amount of frames skiped through truncation
     double sample_skipd;
-    double dropped_per_window = std::modf((WindowSize - overlap_size) / _stretch_factor, &sample_skipd);
+    double dropped_per_window = std::modf((_window_size - overlap_size) / (_stretch_factor * _pitch_shift), &sample_skipd);
 
     const uint32_t sample_skip = sample_skipd;
     
-    while (_next_overlap_start + WindowSize < SampleProcSize) {
+    while (_next_overlap_start + _window_size < _sample_proc_size) {
         // Find insertion that best fits the new sample
-        uint32_t prev_not_overlapped = find_max_correlation(
-            sample + _next_overlap_start, 
-            sample + _last_overlap_start, 
-            overlap_size, 
-            search_window
-        );
+        uint32_t prev_not_overlapped;
+        if (!_follow(prev_not_overlapped)) {
+            prev_not_overlapped = _correlator->find_best_lag(
+                analysed + _next_overlap_start, 
+                analysed + _last_overlap_start, 
+                overlap_size, 
+                search_window,
+                _similarity_measure,
+                _search_decimation
+            );
+        }
+        _record(prev_not_overlapped);
 
         uint32_t actual_last_overlap = _last_overlap_start + prev_not_overlapped;
         const uint32_t actually_overlapped = overlap_size - prev_not_overlapped;
 
-        Complex overlap_buffer[SampleProcSize / 2];
+        Complex *overlap_buffer = _overlap_buffer.data();
         
         overlap_add(
             sample + actual_last_overlap, 
             sample + _next_overlap_start,
             overlap_buffer,
             actually_overlapped,
-            hamming_window
+            *_overlap_window
         );
 
         // append new data
-        _transformed_buffer.extend_back(sample + _last_overlap_start, prev_not_overlapped);
-        _transformed_buffer.extend_back(overlap_buffer, actually_overlapped);
+        _add_output(sample + _last_overlap_start, prev_not_overlapped);
+        _add_output(overlap_buffer, actually_overlapped);
         // take 2 * prev_not_overlapped from both sides of the flat duration
-        _transformed_buffer.extend_back(sample + _next_overlap_start + actually_overlapped, flat_duration);
+        _add_output(sample + _next_overlap_start + actually_overlapped, flat_duration);
 
         // set for next cycle
         _last_overlap_start = _next_overlap_start + actually_overlapped + flat_duration;
@@ -608,10 +1018,47 @@ uint32_t WSOLATimeStretcher::_stretch_sample_and_add(const Complex *sample) {
     return MIN(_last_overlap_start, _next_overlap_start);
 }
 
-PSOLATimeStretcher::PSOLATimeStretcher() {
-    _transformed_buffer.resize(MaxBackWindowOverlap);
+PSOLATimeStretcher::PSOLATimeStretcher(PitchDetectorType pitch_detector) {
+    _pitch_detector_type = pitch_detector;
+    _resize_for_rate();
 }
 
+void PSOLATimeStretcher::set_sample_rate(uint32_t sample_rate) {
+    TimeStretcher::set_sample_rate(sample_rate);
+    _resize_for_rate();
+}
+
+void PSOLATimeStretcher::_resize_for_rate() {
+    _min_period = _sample_rate / MaxFreqHz;
+    _max_period = _sample_rate / MinFreqHz;
+    _default_period = _sample_rate / DefaultFreqHz;
+    _max_back_window_overlap = _max_period * 3 / 2 + 1;
+    _grain_window = &Singletons::get_singleton()->get_window_table(hann_window, _max_period);
+
+    // the detectors need more than two periods in a block
+    _sample_proc_size = _scale_pow2_size(SampleProcSize);
+    while (_sample_proc_size <= 2 * _max_period) {
+        _sample_proc_size *= 2;
+    }
+    _samples.resize(_sample_proc_size);
+
+    _max_pitch_marks = _sample_proc_size / (_min_period * 4 / 5) + 2;
+    _pitch_marks.resize(_max_pitch_marks);
+
+    for (uint32_t i = 0; i < NPitchDetectorTypes; i++) {
+        delete _pitch_detectors[i];
+        _pitch_detectors[i] = make_pitch_detector((PitchDetectorType) i, _sample_proc_size, _min_period, _max_period);
+    }
+    _pitch_detector = _pitch_detectors[_pitch_detector_type];
+
+    reset();
+}
+
+PSOLATimeStretcher::~PSOLATimeStretcher() {
+    for (uint32_t i = 0; i < NPitchDetectorTypes; i++) {
+        delete _pitch_detectors[i];
+    }
+}
 
 void PSOLATimeStretcher::push_signal(const Complex *input, const uint32_t &size) {
     _raw_buffer.extend_back(input, size);
@@ -619,25 +1066,30 @@ void PSOLATimeStretcher::push_signal(const Complex *input, const uint32_t &size)
 
 uint32_t PSOLATimeStretcher::pop_transformed_signal(Complex *output, const uint32_t &size) {
     // lazily perform the stretchy
-    while ((_raw_buffer.size() > SampleProcSize) && (size > n_transformed_ready())) {
-        std::array<Complex, SampleProcSize> samples;
-        std::array<Complex, SampleProcSize> windowed_samples;
+    while ((_raw_buffer.size() > _sample_proc_size) && (size > n_transformed_ready())) {
+        _raw_buffer.to_array(_samples.data(), _sample_proc_size);
 
-        _raw_buffer.to_array(samples.data(), SampleProcSize);
-        _raw_buffer.to_array(windowed_samples.data(), SampleProcSize);
+        if (!_follow_pitch_marks()) {
+            const Complex *analysed = _samples_to_analyse(_samples.data(), _sample_proc_size);
+            // blocks overlap, so only the part of this one the detector has not seen is pushed
+            _pitch_detector->push_signal(analysed + _n_detected, _sample_proc_size - _n_detected);
 
-        window_ends(windowed_samples.data(), SampleProcSize, SampleProcSize / 10, hann_window);
+            const uint32_t est_period = _est_period();
 
-        int est_freq = _est_fund_frequency(windowed_samples.data());
-        
-        uint32_t est_period = (1.0 / est_freq) * SampleProcSize / 2;
-        
-        std::vector<uint32_t> est_peaks = _find_upcoming_peaks(samples.data(), est_period);
+            _find_upcoming_peaks(analysed, est_period);
+        }
+        _record(_n_pitch_marks);
+        for (uint32_t i = 0; i < _n_pitch_marks; i++) {
+            _record(_pitch_marks[i]);
+        }
 
-        _stretch_peaks_and_add(samples.data(), est_peaks);
+        _stretch_peaks_and_add(_samples.data(), _pitch_marks.data(), _n_pitch_marks);
 
         // delete everything used
-        _raw_buffer.pop_front_many(nullptr, est_peaks.back() + 1); // +1 because est_peaks are the INDEX of the peaks, not the num of frames used
+        const uint32_t n_used = _pitch_marks[_n_pitch_marks - 1] + 1; // +1 because pitch marks are the INDEX of the peaks, not the num of frames used
+        _raw_buffer.pop_front_many(nullptr, n_used);
+        _analysis_buffer.pop_front_many(nullptr, MIN(n_used, (uint32_t) _analysis_buffer.size()));
+        _n_detected = _sample_proc_size - n_used;
     }
     
     uint32_t n = _transformed_buffer.pop_front_many(output, MIN(size, n_transformed_ready()));
@@ -650,119 +1102,174 @@ uint32_t PSOLATimeStretcher::pop_transformed_signal(Complex *output, const uint3
 }
 
 uint32_t PSOLATimeStretcher::n_transformed_ready() const {
-    return _transformed_buffer.size() - MaxBackWindowOverlap;
+    return _transformed_buffer.size() - _max_back_window_overlap;
+}
+
+uint32_t PSOLATimeStretcher::n_input_backlog() const {
+    return _raw_buffer.size() > _sample_proc_size ? _raw_buffer.size() - _sample_proc_size : 0;
 }
 
 void PSOLATimeStretcher::reset() {
-    _transformed_buffer.resize(MaxBackWindowOverlap, 0);
+    _transformed_buffer.resize(_max_back_window_overlap, 0);
     _raw_buffer.resize(0);
+    _analysis_buffer.resize(0);
 
+    _pitch_detector->reset();
+    _n_detected = 0;
+    _last_periods.resize(0);
+    _stretched_sample_truncated = 0.0;
 }
 
-int PSOLATimeStretcher::_est_fund_frequency(const Complex *samples) {
-    // Todo: move all this to a PitchDetecter object or something
-    
-    _lpc.load_sample(samples);
-    const std::array<float, SampleProcSize> residuals = _lpc.get_residuals();
+void PSOLATimeStretcher::set_pitch_detector(PitchDetectorType type) {
+    if (type == _pitch_detector_type) {
+        return;
+    }
+    _pitch_detector_type = type;
+    _pitch_detector = _pitch_detectors[type];
 
-    // find candidate from residual peaks (only use positive half of the spectrum)
-    std::vector<float> srhs = calc_srhs(residuals.data(), residuals.size() / 2, MinFreqInd, MaxFreqInd, 10);
+    // the new detector has not heard any of the current block
+    _pitch_detector->reset();
+    _n_detected = 0;
+}
 
-    float max_srhs = -10e32;
-    int max_pitch_ind = MaxFreqInd;
-    for (int i = 0; i < srhs.size(); i++) {
-        if (srhs[i] > max_srhs) {
-            max_pitch_ind = MinFreqInd + i;
-            max_srhs = srhs[i];
+static constexpr uint32_t PitchDetectorPropId = 1;
+
+std::vector<EffectPropDesc> PSOLATimeStretcher::get_property_descs() const {
+    std::vector<EffectPropDesc> descs = TimeStretcher::get_property_descs();
+    descs.push_back(EffectPropDesc {
+        .type = EffectPropType::Counter,
+        .name = "pitch_detector",
+        .desc = "How pitch marks are spaced. 0 = MPM (cheapest), 1 = YIN (steadier on noisy input), 2 = SRH (LPC residual harmonics)",
+        .slider_data = {
+            .min_value = MPMPitchDetector,
+            .max_value = SRHPitchDetector,
+            .step_size = 1,
+            .scale = Linear,
         }
+    });
+    return descs;
+}
+
+void PSOLATimeStretcher::set_property(uint32_t id, EffectPropPayload data) {
+    if (id == PitchDetectorPropId) {
+        if (data.type == Counter || data.type == Slider) {
+            set_pitch_detector((PitchDetectorType) CLAMP((int) std::round(data.value), (int) MPMPitchDetector, (int) SRHPitchDetector));
+        }
+        return;
     }
+    TimeStretcher::set_property(id, data);
+}
 
-    return max_pitch_ind;
+EffectPropPayload PSOLATimeStretcher::get_property(uint32_t id) const {
+    if (id == PitchDetectorPropId) {
+        return EffectPropPayload {
+            .type = Counter,
+            .value = (float) _pitch_detector_type,
+        };
+    }
+    return TimeStretcher::get_property(id);
 }
 
-std::vector<uint32_t> PSOLATimeStretcher::_find_upcoming_peaks(const Complex *samples, const uint32_t est_period) {
+uint32_t PSOLATimeStretcher::_est_period() {
+    const PitchEstimate estimate = _pitch_detector->estimate();
+
+    // a median of the last few confident estimates rides over octave errors and unvoiced blocks
+    if (estimate.period > 0.0f && estimate.confidence >= MinVoicedConfidence) {
+        _last_periods.push_back(std::round(estimate.period));
+        if (_last_periods.size() > NSmoothedPeriods) {
+            _last_periods.pop_front_many(nullptr, 1);
+        }
+    }
+
+    if (_last_periods.size() == 0) {
+        return estimate.period > 0.0f ? CLAMP((uint32_t) std::round(estimate.period), _min_period, _max_period) : _default_period;
+    }
+
+    std::array<int, NSmoothedPeriods> periods;
+    const uint32_t n_periods = _last_periods.size();
+    for (uint32_t i = 0; i < n_periods; i++) {
+        periods[i] = _last_periods[i];
+    }
+    std::nth_element(periods.begin(), periods.begin() + n_periods / 2, periods.begin() + n_periods);
+
+    return CLAMP((uint32_t) periods[n_periods / 2], _min_period, _max_period);
+}
+
+void PSOLATimeStretcher::_find_upcoming_peaks(const Complex *samples, const uint32_t est_period) {
     // assume that peaks are around est_period apart, but give some sllack as pitches change slightly
     const uint32_t search_start = 0.8 * est_period;
     const uint32_t search_end = 1.2 * est_period;
 
-    std::vector<uint32_t> peaks; 
+    _n_pitch_marks = 0;
     uint32_t last_peak = 0;
 
-    while ((last_peak + est_period) < SampleProcSize) {
+    while ((last_peak + est_period) < _sample_proc_size && _n_pitch_marks < _max_pitch_marks) {
         uint32_t peak = last_peak + search_start;
         float peak_size = 0.0f;
 
-        for (uint32_t i = last_peak + search_start; i < MIN(SampleProcSize, last_peak + search_end); i++) {
+        for (uint32_t i = last_peak + search_start; i < MIN(_sample_proc_size, last_peak + search_end); i++) {
             if (samples[i].real() > peak_size) {
                 peak_size = samples[i].real();
                 peak = i;
             }
         }
 
-        peaks.push_back(peak);
+        _pitch_marks[_n_pitch_marks] = peak;
+        _n_pitch_marks += 1;
         last_peak = peak;
     }
-    
-    return peaks;
 }
 
-// // overlap and extend without applying a window function first
-// // overlap_size may be larger than new_data.size(), in which case only new_data.size() is added. the offset is the same
-template<class T, class NewT>
-static void _mix_and_extend_no_window(T &array, const NewT new_data, const uint32_t &overlap_size) {
-    
-    uint32_t i = 0;
-
-    for(; i < MIN(overlap_size, new_data.size()); i++) {
-        uint32_t ind = array.size() - overlap_size + i;
-        array[ind] = array[ind] + new_data[i];
+bool PSOLATimeStretcher::_follow_pitch_marks() {
+    uint32_t n_pitch_marks;
+    if (!_follow(n_pitch_marks) || n_pitch_marks == 0) {
+        return false;
     }
-
-    for (; i < new_data.size(); i++) {
-        array.push_back(new_data[i]);
+    // kept within the block, so an alignment from a stretcher set up differently cannot read past it
+    _n_pitch_marks = MIN(n_pitch_marks, _max_pitch_marks);
+    uint32_t mark = 0;
+    for (uint32_t i = 0; i < _n_pitch_marks; i++) {
+        _follow(mark);
+        _pitch_marks[i] = MIN(mark, _sample_proc_size - 1);
     }
-
+    return true;
 }
 
-void PSOLATimeStretcher::_stretch_peaks_and_add(const Complex *samples, const std::vector<uint32_t> &est_peaks) {
-
-    // accumulate by collecting the left halves and right halves if each peak sepeartly
-    std::vector<std::vector<Complex>> right_windows;
-    std::vector<std::vector<Complex>> left_windows;
-
-    uint32_t last_peak = 0;
-    for (uint32_t next_peak: est_peaks) {
-        std::vector<Complex> left_window;
-        std::vector<Complex> right_window;
-
-        for (uint32_t i = last_peak; i < next_peak; i++) {
-            float w = (float) (i - last_peak) / (next_peak - last_peak);
-            w = hann_window(w);
-
-            left_window.emplace_back(w * samples[i]);
-            right_window.emplace_back((1.0f - w) * samples[i]);
+void PSOLATimeStretcher::_add_grain(const Complex *samples, 
+                                    const uint32_t start, 
+                                    const uint32_t end, 
+                                    const bool rising, 
+                                    const uint32_t overlap_size) {
+    // same as mixing and extending by a grain without a window, but the grain is never stored
+    const uint32_t grain_size = end - start;
+    const uint32_t overlap_start = _transformed_buffer.size() - overlap_size;
+    for (uint32_t i = 0; i < grain_size; i++) {
+        float w = _grain_window->at((float) i / grain_size);
+        w = rising ? w : 1.0f - w;
+
+        if (i < overlap_size) {
+            _transformed_buffer[overlap_start + i] += w * samples[start + i];
+        }
+        else {
+            _transformed_buffer.push_back(w * samples[start + i]);
         }
-
-        left_windows.push_back(std::move(left_window));
-        right_windows.push_back(std::move(right_window));
-
-        last_peak = next_peak;
     }
+}
 
-    // arrange the peaks together
-    last_peak = 0;
-
+void PSOLATimeStretcher::_stretch_peaks_and_add(const Complex *samples, const uint32_t *pitch_marks, const uint32_t n_pitch_marks) {
+    // each period between peaks is split into a falling (right) half of the previous grain and a rising (left) half of the next,
+    // which are overlapped at the stretched distance between peaks
+    uint32_t last_peak = 0;
     
-    for (uint32_t i = 0; i < left_windows.size(); i++) {
-        const std::vector<Complex> left_window = std::move(left_windows[i]);
-        const std::vector<Complex> right_window = std::move(right_windows[i]);
+    for (uint32_t i = 0; i < n_pitch_marks; i++) {
+        const uint32_t next_peak = pitch_marks[i];
 
         // use overlapsize of previous period to make the right window continuous with the previous left window
-        _mix_and_extend_no_window(_transformed_buffer, right_window, _next_right_window_overlap);
+        _add_grain(samples, last_peak, next_peak, false, _next_right_window_overlap);
 
 
         // calculate the frames overlap taking the truncated part of previous processes into account
-        int curr_period = est_peaks[i] - last_peak;
+        int curr_period = next_peak - last_peak;
         double overlap_sized;
         _stretched_sample_truncated += std::abs(std::modf((2.0 - _stretch_factor) * curr_period, &overlap_sized));
         
@@ -783,12 +1290,12 @@ void PSOLATimeStretcher::_stretch_peaks_and_add(const Complex *samples, const st
                     _transformed_buffer.push_back(0);
                 }
 
-                _transformed_buffer.extend_back(left_window.data(), left_window.size());
+                _add_grain(samples, last_peak, next_peak, true, 0);
             }
             else {
                 // some parts are overlapped
                 // mix it with the left window of the next
-                _mix_and_extend_no_window(_transformed_buffer, left_window, overlap_size);
+                _add_grain(samples, last_peak, next_peak, true, overlap_size);
 
             }
 
@@ -797,13 +1304,13 @@ void PSOLATimeStretcher::_stretch_peaks_and_add(const Complex *samples, const st
         }
         else {
             // since the left peak ends before the right peak ends, we have to overlap both the right and left peaks into the transformed data
-            _mix_and_extend_no_window(_transformed_buffer, left_window, overlap_size);
+            _add_grain(samples, last_peak, next_peak, true, overlap_size);
             
             _next_right_window_overlap = overlap_size - curr_period;
         }
 
 
 
-        last_peak = est_peaks[i];
+        last_peak = next_peak;
     }
-}
\ No newline at end of file
+}
@@ -5,10 +5,15 @@
 #include "dsp/correlation.h"
 #include "dsp/effect.h"
 #include "dsp/fft.h"
+#include "dsp/interpolation.h"
 #include "dsp/loudness.h"
+#include "dsp/pitchdetector.h"
+#include "dsp/sampling.h"
+#include "templates/bucketqueue.h"
 #include "templates/vecdeque.h"
 #include <array>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 namespace Mengu {
@@ -21,6 +26,37 @@ public:
 
     virtual void set_stretch_factor(const float &scale);
 
+    // Input samples held beyond what the next block of stretching needs.
+    // Stretchers that only stretch on demand build this up when they produce more than is asked of them
+    virtual uint32_t n_input_backlog() const {
+        return 0;
+    }
+
+    // Stretchers that can also scale the pitch of what they output, without it being resampled afterwards.
+    // The stretch factor still scales the length
+    virtual bool supports_pitch_shift() const {
+        return false;
+    }
+    // ignored by stretchers that do not support it
+    virtual void set_pitch_shift(float shift) {}
+    inline float get_pitch_shift() const {
+        return _pitch_shift;
+    }
+
+    // only stretchers that support sharing alignment analyse another signal, or record or follow alignment
+    virtual void push_analysis_signal(const Complex *input, const uint32_t &size) override {
+        if (supports_alignment_sharing()) {
+            _analysis_buffer.extend_back(input, size);
+        }
+    }
+    virtual void record_alignment(std::vector<uint32_t> *alignment) override {
+        _recorded_alignment = alignment;
+    }
+    virtual void follow_alignment(const std::vector<uint32_t> *alignment) override {
+        _followed_alignment = alignment;
+        _n_followed = 0;
+    }
+
     virtual std::vector<EffectPropDesc> get_property_descs() const override;
 
     virtual void set_property(uint32_t id, EffectPropPayload data) override;
@@ -29,82 +65,236 @@ public:
 
 protected:
     float _stretch_factor = 1.0f;
-
+    float _pitch_shift = 1.0f;
+
+    // the next value of the followed alignment. false when there is none left, and the stretcher has to decide itself
+    inline bool _follow(uint32_t &value) {
+        if (_followed_alignment == nullptr || _n_followed >= _followed_alignment->size()) {
+            return false;
+        }
+        value = (*_followed_alignment)[_n_followed++];
+        return true;
+    }
+    inline void _record(uint32_t value) {
+        if (_recorded_alignment != nullptr) {
+            _recorded_alignment->push_back(value);
+        }
+    }
+
+    // Input pushed by push_analysis_signal, kept in step with the stretcher's own.
+    // Empty unless some has been pushed since the last reset
+    VecDeque<Complex> _analysis_buffer;
+    std::vector<Complex> _analysis_samples;
+    // the first size samples that should be analysed, which are samples unless there is an analysis signal
+    const Complex *_samples_to_analyse(const Complex *samples, uint32_t size);
 
     // keep track of resampled size error due to rounding errors
     double _stretched_sample_truncated = 0.0;
+
+private:
+    std::vector<uint32_t> *_recorded_alignment = nullptr;
+    const std::vector<uint32_t> *_followed_alignment = nullptr;
+    uint32_t _n_followed = 0;
 };
 
 // Classic timeshifter be scale the phases of frequency bins in the time dimension
 class PhaseVocoderTimeStretcher: public TimeStretcher {
 public:
-    PhaseVocoderTimeStretcher(bool _preserve_formants = false);
+    // Window and hop sizes, trading latency for frequency resolution
+    enum WindowPreset {
+        VoiceWindow = 0, // 256 window, 200 hop. Lowest latency
+        StandardWindow = 1, // 512 window, 400 hop
+        MusicWindow = 2, // 2048 window, 1024 hop. Resolves low and sustained notes best
+    };
+
+    PhaseVocoderTimeStretcher(bool _preserve_formants = false, WindowPreset preset = StandardWindow);
+    virtual ~PhaseVocoderTimeStretcher();
 
     virtual void push_signal(const Complex *input, const uint32_t &size) override;
     virtual uint32_t pop_transformed_signal(Complex *output, const uint32_t &size) override;
 
     virtual uint32_t n_transformed_ready() const override;
+    virtual uint32_t n_input_backlog() const override;
 
     // virtual void set_stretch_factor(const float &stretch_factor) override;
 
+    // each synthesised frame is resampled to 1 / shift as long, and overlapped 1 / shift hops apart
+    virtual bool supports_pitch_shift() const override {
+        return true;
+    }
+    virtual void set_pitch_shift(float shift) override;
+
     virtual void reset() override;
-protected:
 
-    static constexpr uint32_t WindowSize = 1 << 9;
-    static constexpr uint32_t SynthesisHopSize = 400;
+    // Changes the window and hop size. Resets the stretcher
+    void set_window_preset(WindowPreset preset);
+
+    // window and hop sizes double each octave the rate is above DefaultSampleRate
+    virtual void set_sample_rate(uint32_t sample_rate) override;
+    WindowPreset get_window_preset() const { return _window_preset; }
+
+    uint32_t get_window_size() const { return _window_size; }
+    uint32_t get_synthesis_hop_size() const { return _synthesis_hop_size; }
+
+    virtual std::vector<EffectPropDesc> get_property_descs() const override;
+    virtual void set_property(uint32_t id, EffectPropPayload data) override;
+    virtual EffectPropPayload get_property(uint32_t id) const override;
+protected:
+    struct WindowSizes {
+        uint32_t window_size;
+        uint32_t synthesis_hop_size;
+    };
+    static constexpr uint32_t NWindowPresets = 3;
+    static constexpr WindowSizes WindowPresetSizes[NWindowPresets] = {
+        {1 << 8, 200},
+        {1 << 9, 400},
+        {1 << 11, 1024},
+    };
+    // buffers are allocated for the largest preset, so switching presets only allocates the LPC of one not used yet
+    static constexpr uint32_t MaxWindowSize = 1 << 11;
+    // the largest preset at the highest sample rate
+    static constexpr uint32_t MaxScaledWindowSize = MaxWindowSize << MaxSizeScaleLog2;
 
     static constexpr uint32_t NStoredWindows = 2;
 
-    std::array<float, WindowSize / 2> _prev_raw_mag2s;
-    std::array<float, WindowSize / 2> _prev_raw_phases;
+    uint32_t _window_size;
+    uint32_t _synthesis_hop_size;
+
+    // each have _window_size / 2 elements
+    std::vector<float> _prev_raw_mag2s;
+    std::vector<float> _prev_raw_phases;
     // phases of the last transformed samples
-    std::array<float, WindowSize / 2> _last_scaled_phases;
+    std::vector<float> _last_scaled_phases;
 
     VecDeque<Complex> _raw_buffer;
     VecDeque<Complex> _transformed_buffer;
 
-    virtual std::array<float, WindowSize / 2> _calc_scaled_magnitudes();
+    virtual void _calc_scaled_magnitudes(float *mags);
     // expects time_deltas to be scaled
-    virtual std::array<float, WindowSize / 2> _calc_scaled_phases(const std::array<Complex, WindowSize / 2> &curr_freqs, const uint32_t hopsize);
+    virtual void _calc_scaled_phases(const Complex *curr_freqs, const uint32_t hopsize, float *new_phases);
 
-    std::array<Complex, WindowSize / 2> _load_new_freq_window(const std::array<Complex, WindowSize> &sample);
-    void _replace_prev_freqs(const std::array<float, WindowSize / 2> &curr_mags, const std::array<float, WindowSize / 2> &curr_phases);
+    void _load_new_freq_window(const Complex *sample);
+    void _replace_prev_freqs(const float *curr_mags, const float *curr_phases);
+
+    // magnitudes and phases of the current window, split by _split_freqs
+    std::vector<float> _curr_mag2s;
+    std::vector<float> _curr_phases;
+    void _split_freqs(const Complex *curr_freqs);
 private:
+    static constexpr uint32_t LPCParams = 50;
 
     // FFT _fft;
-    // for finding the envelope and doing fft
-    LPC<WindowSize, 50> _lpc;
+    // for finding the envelope and doing fft. One for each preset, made the first time it is selected
+    std::unique_ptr<DynamicLPC<LPCParams>> _lpcs[NWindowPresets];
+    // the selected preset's
+    DynamicLPC<LPCParams> *_lpc;
 
     bool _preserve_formants = false;
+    WindowPreset _window_preset;
+
+    // crossfades each frame into the last
+    const WindowTable *_overlap_window;
 
     // Used to make sure the percieved loudness of the sample is preserved
-    LoudnessNormalizer<Complex, WindowSize, 1> _loudness_norm;
+    SpectralLoudnessNormalizer _loudness_norm;
+
+    // per-window intermediates
+    std::vector<Complex> _sample;
+    std::vector<Complex> _curr_freqs;
+    std::vector<Complex> _freqs;
+    std::vector<Complex> _new_samples;
+    std::vector<float> _amplitudes;
+    std::vector<float> _new_phases;
     
-    std::array<Complex, WindowSize> _calc_new_samples(const std::array<Complex, WindowSize> &raw_samples, const float *amplitudes, const float *phase_deltas);
+    // raw_freqs is the spectrum of the raw window, which the new samples are made as loud as
+    void _calc_new_samples(const Complex *raw_freqs, const float *amplitudes, const float *phase_deltas, Complex *output);
+
+    // pitch shifting. Frames are synthesised stretched by the stretch factor times the pitch shift,
+    // then resampled on their own before being overlapped
+    PolyphaseResampler _frame_resampler;
+    std::vector<float> _frame_reals;
+    std::vector<float> _shifted_frame;
+    double _output_hop_truncated = 0.0;
+
+    // the end of _transformed_buffer that later frames may still overlap
+    uint32_t _output_reserve;
+    void _update_output_reserve();
+
+    // resamples _new_samples by the pitch shift and overlaps it onto _transformed_buffer
+    void _shift_and_add_frame();
 
+    // (re)makes the per-preset LPCs and reserves the per-window buffers for the current sample rate
+    void _allocate_windows();
 };
 
 // 'Phase vocoder done right' implementation
 class PhaseVocoderDoneRightTimeStretcher: public PhaseVocoderTimeStretcher {
 public:
-    PhaseVocoderDoneRightTimeStretcher(bool _preserve_formants = false);
+    // How the bins to propagate phases from are ordered
+    enum PropagationQueue {
+        HeapPropagationQueue = 0, // binary heap on magnitude
+        BucketPropagationQueue = 1, // same order down to 120 dB below the loudest bin, but bins are first bucketed by quantised magnitude. Linear time
+    };
+
+    PhaseVocoderDoneRightTimeStretcher(bool _preserve_formants = false, 
+                                       WindowPreset preset = StandardWindow, 
+                                       PropagationQueue queue = BucketPropagationQueue);
+
+    void set_propagation_queue(PropagationQueue queue) { _propagation_queue_type = queue; }
+    PropagationQueue get_propagation_queue() const { return _propagation_queue_type; }
+
+    virtual void set_sample_rate(uint32_t sample_rate) override;
+
+    virtual std::vector<EffectPropDesc> get_property_descs() const override;
+    virtual void set_property(uint32_t id, EffectPropPayload data) override;
+    virtual EffectPropPayload get_property(uint32_t id) const override;
 protected:
-    virtual std::array<float, WindowSize / 2> _calc_scaled_phases(const std::array<Complex, WindowSize / 2> &curr_phases, const uint32_t hopsize) override;
+    virtual void _calc_scaled_phases(const Complex *curr_freqs, const uint32_t hopsize, float *new_phases) override;
 private:
+    // Used to store indexs to each frequencing in the propagation_queue
+    struct FreqBin {
+        enum {
+            Prev,
+            Next,
+        };
+        uint8_t frame;
+        uint32_t bin; 
+    };
+
+    // magnitudes are squared, so each bucket spans 1/8 of an octave in power, about 0.4 dB
+    static constexpr uint32_t MagBucketsPerOctaveLog2 = 3;
+    // covers 40 octaves, or 120 dB, below the loudest bin. Quieter bins share the lowest bucket, unsorted
+    static constexpr uint32_t NMagBuckets = 40 << MagBucketsPerOctaveLog2;
+
+    // larger keys for larger magnitudes. Only for non-negative magnitudes
+    static uint32_t _mag_bucket_key(float mag);
+
+    PropagationQueue _propagation_queue_type;
+
+    // intermediates, allocated for the largest window
+    std::vector<float> _time_phase_deltas;
+    std::vector<float> _freq_phase_deltas;
+    std::vector<FreqBin> _propagation_queue;
+    BucketQueue<FreqBin> _bucket_queue;
+    std::vector<uint8_t> _can_recieve_propagation;
+
     // Phase propagation algorithm as described in the paper
-    std::array<float, WindowSize / 2> _propagate_phase_gradients(const std::array<float, WindowSize / 2> &phase_time_deltas, 
-                                                             const std::array<float, WindowSize / 2> &phase_freq_deltas, 
-                                                             const std::array<float, WindowSize / 2> &last_stretched_phases, 
-                                                             const std::array<float, WindowSize / 2> &prev_mag2s,
-                                                             const std::array<float, WindowSize / 2> &next_mag2s,
-                                                             const float stretch_factor,
-                                                             const float tolerance = 1e-5f);
+    void _propagate_phase_gradients(const float *phase_time_deltas, 
+                                    const float *phase_freq_deltas, 
+                                    const float *last_stretched_phases, 
+                                    const float *prev_mag2s,
+                                    const float *next_mag2s,
+                                    const float stretch_factor,
+                                    float *new_phases,
+                                    const float tolerance = 1e-5f);
 };
 
 // Syncronised OverLap and Add time stretcher with fixed window size
 class OLATimeStretcher: public TimeStretcher {
 public:
+    // w_size is the window size at DefaultSampleRate
     OLATimeStretcher(uint32_t w_size);
+    virtual ~OLATimeStretcher();
 
     static inline const float MinScale = 0.05;
 
@@ -116,13 +306,30 @@ public:
     virtual uint32_t n_transformed_ready() const override;
 
     virtual void reset() override;
+
+    virtual std::vector<EffectPropDesc> get_property_descs() const override;
+    virtual void set_property(uint32_t id, EffectPropPayload data) override;
+    virtual EffectPropPayload get_property(uint32_t id) const override;
+
+    // scales the window. Resets the stretcher
+    virtual void set_sample_rate(uint32_t sample_rate) override;
     
 private:
+    uint32_t _base_window_size;
     uint32_t _window_size;
 
     uint32_t _overlap;
     uint32_t _selection_window;
     // uint32_t _sample_skip;
+    const WindowTable *_overlap_window;
+
+    // finds the best overlap point in the selection window. Remade when the window is resized
+    std::unique_ptr<CrossCorrelator> _correlator;
+
+    // sizes everything from _base_window_size at the current sample rate
+    void _resize_window();
+    SimilarityMeasure _similarity_measure = CrossCorrelation;
+    uint32_t _search_decimation = 1;
 
     float _desired_extension = 0.0f;
 
@@ -135,26 +342,82 @@ private:
 class WSOLATimeStretcher: public TimeStretcher {
 public:
     WSOLATimeStretcher();
+    virtual ~WSOLATimeStretcher();
 
     virtual void push_signal(const Complex *input, const uint32_t &size) override;
     virtual uint32_t pop_transformed_signal(Complex *output, const uint32_t &size) override;
 
     virtual uint32_t n_transformed_ready() const override;
+    virtual uint32_t n_input_backlog() const override;
     
     virtual void reset() override;
+
+    // windows are chosen as if stretching by the stretch factor times the shift,
+    // and resampled by the shift on their way to the output
+    virtual bool supports_pitch_shift() const override {
+        return true;
+    }
+    virtual void set_pitch_shift(float shift) override;
+
+    // shares the lag each window is overlapped at
+    virtual bool supports_alignment_sharing() const override {
+        return true;
+    }
+
+    virtual std::vector<EffectPropDesc> get_property_descs() const override;
+    virtual void set_property(uint32_t id, EffectPropPayload data) override;
+    virtual EffectPropPayload get_property(uint32_t id) const override;
+
+    // scales the windows and search. Resets the stretcher
+    virtual void set_sample_rate(uint32_t sample_rate) override;
 private:
     VecDeque<Complex> _raw_buffer;
     VecDeque<Complex> _transformed_buffer;
 
+    // Sizes at DefaultSampleRate. The ones in use are scaled to the sample rate
+
     // length of the the input buffer must be before transforming and size of arrays in intermediate calculations. Should catch up to 1000hz
     static constexpr uint32_t SampleProcSize = 1 << 11;
 
     // length of a window
     static constexpr uint32_t WindowSize = 1 << 9;
+    // base overlap
+    static constexpr uint32_t OverlapSize = WindowSize / 4;
+    // search forward for better overlap point
+    static constexpr uint32_t SearchWindowSize = WindowSize / 5;
+
+    uint32_t _sample_proc_size;
+    uint32_t _window_size;
+    uint32_t _overlap_size;
+    uint32_t _search_window_size;
+
+    // for the full overlap. Overlaps cut short by the search are interpolated from it
+    const WindowTable *_overlap_window;
+
+    // the block being processed, and the overlap being mixed
+    std::vector<Complex> _samples;
+    std::vector<Complex> _overlap_buffer;
+
+    // finds the best overlap point in the search window. Remade when the windows are resized
+    std::unique_ptr<CrossCorrelator> _correlator;
+
+    void _resize_windows();
+    SimilarityMeasure _similarity_measure = CrossCorrelation;
+    uint32_t _search_decimation = 1;
 
     // stretches the sample, and adds it to the transform buffer, tje position of each window is based on the autocorrelation
-    // returns how many frames were used and can be discarded
-    uint32_t _stretch_sample_and_add(const Complex *sample);
+    // of analysed, which is the sample or the analysis signal alongside it. returns how many frames were used and can be discarded
+    uint32_t _stretch_sample_and_add(const Complex *sample, const Complex *analysed);
+
+    // output passes through the resampler from the first shift other than 1 until the stretcher is reset,
+    // so its latency does not come and go as the shift passes through 1
+    PolyphaseResampler _pitch_resampler;
+    bool _resampling_output = false;
+    // resampler output for one part of a window
+    std::vector<Complex> _resampled;
+    // grows _resampled to hold the most any part of a window can resample to at the current shift
+    void _fit_resampled();
+    void _add_output(const Complex *output, uint32_t size);
 
     // Basically, the beginning of the next overlap(_left_tail_start) can be before the beggining of the last overlap(_right_tail_start)
     // and the size of the overlap can change on each process. So store both.
@@ -168,55 +431,105 @@ private:
 // Inherits a lot of algorithmic functionality from SOLA
 class PSOLATimeStretcher: public TimeStretcher {
 public:
-    PSOLATimeStretcher();
+    PSOLATimeStretcher(PitchDetectorType pitch_detector = MPMPitchDetector);
+    virtual ~PSOLATimeStretcher();
 
     virtual void push_signal(const Complex *input, const uint32_t &size) override;
     virtual uint32_t pop_transformed_signal(Complex *output, const uint32_t &size) override;
 
     virtual uint32_t n_transformed_ready() const override;
+    virtual uint32_t n_input_backlog() const override;
 
     virtual void reset() override;
+
+    // shares the pitch marks of each block, so followers skip pitch detection
+    virtual bool supports_alignment_sharing() const override {
+        return true;
+    }
+
+    // how the spacing of pitch marks is found
+    void set_pitch_detector(PitchDetectorType type);
+    inline PitchDetectorType get_pitch_detector() const {
+        return _pitch_detector_type;
+    }
+
+    virtual std::vector<EffectPropDesc> get_property_descs() const override;
+    virtual void set_property(uint32_t id, EffectPropPayload data) override;
+    virtual EffectPropPayload get_property(uint32_t id) const override;
+
+    // pitch periods are found in samples, so the block and period range follow the rate. Resets the stretcher
+    virtual void set_sample_rate(uint32_t sample_rate) override;
 private:
 
     VecDeque<Complex> _raw_buffer;
     VecDeque<Complex> _transformed_buffer;
 
+    // at DefaultSampleRate
     static constexpr uint32_t SampleProcSize = 1 << 11;
 
-    // basically how accurate the reconstruction will be. Assumes ~44kHz input, good for operation in up to 16kHz
-    static constexpr uint32_t LPCSize = (uint32_t) 1.25 * 16;
-
     static constexpr uint32_t MinFreqHz = 50;
     static constexpr uint32_t MaxFreqHz = 800;
+    // used until something periodic has been heard
+    static constexpr uint32_t DefaultFreqHz = 200;
+
+    // the block size, scaled so that it still fits two of the longest periods
+    uint32_t _sample_proc_size;
+
+    uint32_t _min_period;
+    uint32_t _max_period;
+    uint32_t _default_period;
+
+    // the amount of frames in _transformed_buffer that need to remain in case of overlapping future samples.
+    // Grains overlap by up to 1.5 periods when compressing by half
+    uint32_t _max_back_window_overlap;
+
+    // every detector is made up front so switching between them does not allocate. They analyse whole blocks
+    PitchDetector *_pitch_detectors[NPitchDetectorTypes] = {nullptr};
+    PitchDetector *_pitch_detector;
+    PitchDetectorType _pitch_detector_type;
+    // the first this many samples of _raw_buffer have already been pushed to _pitch_detector
+    uint32_t _n_detected = 0;
+
+    // estimates less confident than this are left out of the median
+    static constexpr float MinVoicedConfidence = 0.5f;
+    static constexpr uint32_t NSmoothedPeriods = 3;
+    // store the last estimated periods. the median will be used
+    VecDeque<int> _last_periods;
 
-    static constexpr uint32_t InputSampleRate = 44100;
+    // the period of the current block, smoothed over the last few
+    uint32_t _est_period();
 
-    static constexpr uint32_t MinFreqInd = MAX(MinFreqHz * SampleProcSize / InputSampleRate, 2); 
-    static constexpr uint32_t MaxFreqInd = MAX(MaxFreqHz * SampleProcSize / InputSampleRate, MinFreqInd * 2); 
 
-    // the amount of frames in _transformed_buffer that need to remain in case of overlapping future samples
-    static constexpr uint32_t MaxBackWindowOverlap = (1.0f / MinFreqHz * InputSampleRate) + 1;
+    //used to meld windows in the same sample of different length (peaks are not uniformly spaced)
+    uint32_t _next_right_window_overlap = 0;
 
-    // for finding fundemental frequency
-    // FFT _fft;
-    LPC<SampleProcSize, LPCSize> _lpc;
+    // grains are as long as the period, so their windows are interpolated from one for the longest period
+    const WindowTable *_grain_window;
 
-    // returns the index of the fundemental frequency (pitch) in an fft of samples
-    int _est_fund_frequency(const Complex *sample);
-    // store the last estimated pitches. the median will be used
-    VecDeque<int> _last_periods;
+    // the block being processed
+    std::vector<Complex> _samples;
 
+    // peaks are searched for from 4/5 of the shortest period on, so there can never be more than
+    // _sample_proc_size / (_min_period * 4 / 5) + 2 in a block
+    uint32_t _max_pitch_marks;
+    // pitch marks of the current block, found by _find_upcoming_peaks
+    std::vector<uint32_t> _pitch_marks;
+    uint32_t _n_pitch_marks = 0;
 
-    //used to meld windows in the same sample of different length (peaks are not uniformly spaced)
-    uint32_t _next_right_window_overlap = 0;
+    // sizes blocks, periods and detectors for the current sample rate
+    void _resize_for_rate();
 
-    // estimate the peaks in the upcoming sample
-    std::vector<uint32_t> _find_upcoming_peaks(const Complex *samples, const uint32_t est_period);
+    // estimate the peaks in the upcoming sample and store them in _pitch_marks
+    void _find_upcoming_peaks(const Complex *samples, const uint32_t est_period);
+    // reads the pitch marks of the current block from the followed alignment. false if there are none to follow
+    bool _follow_pitch_marks();
 
     // stretches the sample, and adds it to the transform buffer;
-    void _stretch_peaks_and_add(const Complex *samples, const std::vector<uint32_t> &est_peaks);
+    void _stretch_peaks_and_add(const Complex *samples, const uint32_t *pitch_marks, const uint32_t n_pitch_marks);
     
-
+    // windows samples [start, end) with the rising (left) or falling (right) half of a hann window
+    // and overlap-adds them straight onto the end of _transformed_buffer
+    void _add_grain(const Complex *samples, const uint32_t start, const uint32_t end, const bool rising, const uint32_t overlap_size);
 
 };
 
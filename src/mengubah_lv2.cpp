@@ -47,6 +47,14 @@ static LV2_Handle instantiate (const struct LV2_Descriptor *descriptor, double s
         new TimeStretchPitchShifter(new PSOLATimeStretcher(), 1),
     };
 
+    // sizes every window for the host's rate before any audio arrives
+    for (Effect *effect: plugin->pitch_shifters) {
+        effect->set_sample_rate((uint32_t) sample_rate);
+    }
+    for (Effect *effect: plugin->formant_shifters) {
+        effect->set_sample_rate((uint32_t) sample_rate);
+    }
+
     return plugin;
 }
 
@@ -0,0 +1,389 @@
+// Renders an audio file through pitch, formant and stretch effects as fast as they can run, and writes a wav.
+// mengu-render input output [options]
+// mengu-render --batch manifest [options]
+
+#include "offline/audiofile.h"
+#include "offline/batchrender.h"
+#include "offline/renderchain.h"
+#include "offline/segmentedrender.h"
+#include "offline/wavwriter.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace Mengu;
+
+static void print_usage() {
+    std::cout <<
+        "usage: mengu-render INPUT OUTPUT.wav [options]\n"
+        "       mengu-render --batch MANIFEST [options]\n"
+        "  -p, --pitch FACTOR          scale the pitch by FACTOR, from 0.5 to 2\n"
+        "      --pitch-shifter NAME    wsola (default), psola, pv or pvdr\n"
+        "      --pitch-mode NAME       resample (default) the stretched output, or direct, where wsola and pv shift\n"
+        "                              the pitch as they stretch\n"
+        "  -f, --formant FACTOR        scale the formants by FACTOR, from 0.5 to 2\n"
+        "  -s, --stretch FACTOR        scale the length by FACTOR, from 0.5 to 2\n"
+        "      --stretcher NAME        wsola (default), psola, pv, pvdr or ola\n"
+        "      --set STAGE.NAME=VALUE  set a property of the pitch, formant or stretch stage, e.g. stretch.window_preset=2\n"
+        "      --block SIZE            samples pushed through the effects at a time (default 1024)\n"
+        "      --channels N            mix the input to N channels, 0 to keep the file's (default 0)\n"
+        "      --unlinked              cut each channel on its own, rather than all where their mix is cut\n"
+        "      --channel-threads N     process the channels of each effect on up to N threads (default 1)\n"
+        "  -j, --threads N             render segments of the file on N threads, 0 for all of them (default 1)\n"
+        "      --segment SECONDS       length of the segments rendered on each thread (default picks one)\n"
+        "      --batch MANIFEST        render every file listed in MANIFEST, a file per thread. Each line is\n"
+        "                              INPUT OUTPUT.wav [options], with the effect options above on top of those\n"
+        "                              given here. Paths are relative to MANIFEST, and # starts a comment.\n"
+        "                              -j is then the number of files rendered at once (default all threads)\n"
+        "      --max-memory MB         keep the audio of files being rendered at once under MB (default 1024)\n"
+        "  -h, --help                  show this\n";
+}
+
+static float parse_float(const std::string &arg, const std::string &value) {
+    try {
+        size_t n_parsed = 0;
+        const float f = std::stof(value, &n_parsed);
+        if (n_parsed == value.size()) {
+            return f;
+        }
+    }
+    catch (const std::exception &) {}
+    throw std::runtime_error(arg + " expects a number, not " + value);
+}
+
+static RenderSettings::Property parse_property(const std::string &value) {
+    const size_t dot = value.find('.');
+    const size_t equals = value.find('=');
+    if (dot == std::string::npos || equals == std::string::npos || equals < dot) {
+        throw std::runtime_error("--set expects STAGE.NAME=VALUE, not " + value);
+    }
+
+    RenderSettings::Property property;
+    if (!find_stage(value.substr(0, dot), property.stage)) {
+        throw std::runtime_error("There is no stage " + value.substr(0, dot) + ". Stages are pitch, formant and stretch");
+    }
+    property.name = value.substr(dot + 1, equals - dot - 1);
+    property.value = parse_float("--set", value.substr(equals + 1));
+    return property;
+}
+
+// Sets the effect option arg in settings. false if arg is not one
+static bool parse_effect_option(const std::string &arg, const std::string &value, RenderSettings &settings) {
+    if (arg == "-p" || arg == "--pitch") {
+        settings.pitch_shift = parse_float(arg, value);
+    }
+    else if (arg == "--pitch-shifter") {
+        if (!find_pitch_shifter(value, settings.pitch_shifter)) {
+            throw std::runtime_error("There is no pitch shifter " + value);
+        }
+    }
+    else if (arg == "--pitch-mode") {
+        if (value != "resample" && value != "direct") {
+            throw std::runtime_error("--pitch-mode expects resample or direct, not " + value);
+        }
+        settings.direct_pitch_shift = value == "direct";
+    }
+    else if (arg == "-f" || arg == "--formant") {
+        settings.formant_shift = parse_float(arg, value);
+    }
+    else if (arg == "-s" || arg == "--stretch") {
+        settings.stretch = parse_float(arg, value);
+    }
+    else if (arg == "--stretcher") {
+        if (!find_stretcher(value, settings.stretcher)) {
+            throw std::runtime_error("There is no stretcher " + value);
+        }
+    }
+    else if (arg == "--set") {
+        settings.properties.push_back(parse_property(value));
+    }
+    else if (arg == "--block") {
+        settings.block_size = (uint32_t) parse_float(arg, value);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// throws for factors and properties the effects do not take, before any rendering starts
+static void check_settings(const RenderSettings &settings) {
+    RenderChain chain(settings);
+}
+
+// splits a manifest line at spaces, except within double quotes
+static std::vector<std::string> split_line(const std::string &line) {
+    std::vector<std::string> words;
+    std::string word;
+    bool in_word = false;
+    bool quoted = false;
+    for (char c: line) {
+        if (c == '"') {
+            quoted = !quoted;
+            in_word = true;
+        }
+        else if (c == '#' && !quoted) {
+            break;
+        }
+        else if ((c == ' ' || c == '\t' || c == '\r') && !quoted) {
+            if (in_word) {
+                words.push_back(word);
+                word.clear();
+                in_word = false;
+            }
+        }
+        else {
+            word += c;
+            in_word = true;
+        }
+    }
+    if (quoted) {
+        throw std::runtime_error("Unclosed quote in " + line);
+    }
+    if (in_word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+// the jobs of a manifest, each starting from the defaults
+static std::vector<BatchJob> read_manifest(const fs::path &manifest_path, const RenderSettings &defaults) {
+    std::ifstream manifest(manifest_path);
+    if (!manifest) {
+        throw std::runtime_error("Could not open " + manifest_path.string());
+    }
+    const fs::path directory = manifest_path.parent_path();
+
+    std::vector<BatchJob> jobs;
+    std::string line;
+    for (uint32_t line_n = 1; std::getline(manifest, line); line_n++) {
+        const std::vector<std::string> words = split_line(line);
+        if (words.empty()) {
+            continue;
+        }
+        try {
+            if (words.size() < 2) {
+                throw std::runtime_error("expected INPUT OUTPUT.wav [options]");
+            }
+            BatchJob job;
+            job.input = directory / words[0];
+            job.output = directory / words[1];
+            job.settings = defaults;
+            for (uint32_t i = 2; i < words.size(); i += 2) {
+                if (i + 1 >= words.size()) {
+                    throw std::runtime_error(words[i] + " expects a value");
+                }
+                if (!parse_effect_option(words[i], words[i + 1], job.settings)) {
+                    throw std::runtime_error("Unknown effect option " + words[i]);
+                }
+            }
+            check_settings(job.settings);
+            jobs.push_back(job);
+        }
+        catch (const std::exception &e) {
+            throw std::runtime_error(manifest_path.string() + ":" + std::to_string(line_n) + ": " + e.what());
+        }
+    }
+    return jobs;
+}
+
+// renders every job of the manifest and prints where the time went for each
+static int render_manifest(const fs::path &manifest_path, const RenderSettings &defaults, const BatchSettings &batch_settings) {
+    const std::vector<BatchJob> jobs = read_manifest(manifest_path, defaults);
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<BatchJobReport> reports = render_batch(jobs, batch_settings);
+    const double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double audio_seconds = 0.0;
+    double render_seconds = 0.0;
+    uint32_t n_failed = 0;
+    std::cout << std::fixed << std::setprecision(3)
+        << " job worker    audio     wait   decode    setup   render   encode      rtf  file\n";
+    for (uint64_t j = 0; j < jobs.size(); j++) {
+        const BatchJobReport &report = reports[j];
+        std::cout << std::setw(4) << j << std::setw(7) << report.worker;
+        if (!report.error.empty()) {
+            n_failed++;
+            std::cout << "  failed: " << report.error << "\n";
+            continue;
+        }
+        audio_seconds += report.audio_seconds;
+        render_seconds += report.render_seconds;
+        std::cout
+            << std::setw(9) << report.audio_seconds
+            << std::setw(9) << report.wait_seconds
+            << std::setw(9) << report.decode_seconds
+            << std::setw(9) << report.setup_seconds << (report.reused_chain ? "*" : " ")
+            << std::setw(8) << report.render_seconds
+            << std::setw(9) << report.encode_seconds
+            << std::setw(9) << (report.audio_seconds > 0.0 ? report.render_seconds / report.audio_seconds : 0.0)
+            << "  " << jobs[j].input.filename().string() << "\n";
+    }
+    // the real-time factors are of rendering alone, and the throughput is of everything, wall clock
+    std::cout << "* reused a chain from an earlier job\n"
+        << jobs.size() - n_failed << " of " << jobs.size() << " files rendered, "
+        << audio_seconds << "s of audio in " << wall_seconds << "s\n"
+        << "real-time factor " << std::setprecision(4) << (audio_seconds > 0.0 ? render_seconds / audio_seconds : 0.0)
+        << ", throughput " << std::setprecision(1) << (wall_seconds > 0.0 ? audio_seconds / wall_seconds : 0.0)
+        << "x playback speed" << std::endl;
+    return n_failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> paths;
+    RenderSettings settings;
+    SegmentSettings segment_settings;
+    segment_settings.n_threads = 1;
+    // files are rendered on a thread each rather than in segments, on every thread unless told otherwise
+    BatchSettings batch_settings;
+    std::string manifest_path;
+    // 0 keeps the file's
+    uint32_t n_channels = 0;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "-h" || arg == "--help") {
+                print_usage();
+                return 0;
+            }
+            if (arg.empty() || arg[0] != '-') {
+                paths.push_back(arg);
+                continue;
+            }
+            if (arg == "--unlinked") {
+                settings.link_channels = false;
+                continue;
+            }
+
+            if (i + 1 >= argc) {
+                throw std::runtime_error(arg + " expects a value");
+            }
+            const std::string value = argv[++i];
+            if (parse_effect_option(arg, value, settings)) {
+                continue;
+            }
+            if (arg == "-j" || arg == "--threads") {
+                segment_settings.n_threads = batch_settings.n_workers = (uint32_t) parse_float(arg, value);
+            }
+            else if (arg == "--segment") {
+                segment_settings.segment_seconds = parse_float(arg, value);
+            }
+            else if (arg == "--channels") {
+                n_channels = (uint32_t) parse_float(arg, value);
+            }
+            else if (arg == "--channel-threads") {
+                settings.channel_threads = (uint32_t) parse_float(arg, value);
+            }
+            else if (arg == "--batch") {
+                manifest_path = value;
+            }
+            else if (arg == "--max-memory") {
+                batch_settings.max_bytes_in_flight = (uint64_t) (parse_float(arg, value) * (1 << 20));
+            }
+            else {
+                throw std::runtime_error("Unknown option " + arg);
+            }
+        }
+        check_settings(settings);
+        if (!manifest_path.empty() && paths.empty()) {
+            batch_settings.n_channels = n_channels;
+            return render_manifest(manifest_path, settings, batch_settings);
+        }
+        if (paths.size() != 2 || !manifest_path.empty()) {
+            print_usage();
+            return 1;
+        }
+
+        using Clock = std::chrono::steady_clock;
+        const auto seconds_since = [] (Clock::time_point start) {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        };
+
+        // In one go, the input is read as it is rendered, straight from the file where it is a wav, and the output is
+        // written as it is rendered, so neither is ever all in memory. Segments are rendered out of order, so then the
+        // input is decoded up front and the output encoded once it is all rendered
+        const bool streamed = segment_settings.n_threads == 1;
+        auto start = Clock::now();
+        AudioData input;
+        std::unique_ptr<AudioSource> source;
+        std::unique_ptr<StreamingWavWriter> writer;
+        if (streamed) {
+            source.reset(open_audio_source(paths[0], n_channels));
+            input.sample_rate = source->get_sample_rate();
+            input.n_channels = source->get_n_channels();
+            writer.reset(new StreamingWavWriter(paths[1], input.sample_rate, input.n_channels));
+        }
+        else {
+            input = decode_audio_file(paths[0], n_channels);
+        }
+        const double decode_seconds = seconds_since(start);
+
+        AudioData output;
+        output.sample_rate = input.sample_rate;
+        output.n_channels = input.n_channels;
+
+        start = Clock::now();
+        uint64_t n_input_frames = input.n_frames();
+        if (streamed) {
+            render_sequential(settings, *source, *writer, n_input_frames);
+        }
+        else {
+            output.samples = render_segmented(
+                settings, segment_settings, input.samples.data(), input.n_frames(), input.sample_rate, input.n_channels
+            );
+        }
+        const double render_seconds = seconds_since(start);
+        if (n_input_frames == 0) {
+            if (streamed) {
+                writer.reset();
+                fs::remove(paths[1]);
+            }
+            throw std::runtime_error(paths[0] + " has no audio in it");
+        }
+        const double input_seconds = (double) n_input_frames / input.sample_rate;
+
+        start = Clock::now();
+        uint64_t n_output_frames = output.n_frames();
+        if (streamed) {
+            writer->close();
+            n_output_frames = writer->get_n_frames();
+        }
+        else {
+            encode_wav_file(paths[1], output);
+        }
+        const double encode_seconds = seconds_since(start);
+
+        // the real-time factor is how long rendering took for each second of input. Under 1 is faster than playback
+        std::cout << std::fixed << std::setprecision(3)
+            << "rendered " << input_seconds << "s of audio into " << (double) n_output_frames / input.sample_rate
+            << "s at " << input.sample_rate << "Hz"
+            << " in " << input.n_channels << (input.n_channels == 1 ? " channel\n" : " channels\n");
+        if (streamed) {
+            // rendering only waits on the disk when it gets a few buffers ahead of it
+            std::cout << "open " << decode_seconds << "s  render " << render_seconds << "s (reading and writing as it goes, "
+                << writer->get_blocked_seconds() << "s of it waiting on the disk)  finish writing " << encode_seconds << "s\n";
+        }
+        else {
+            std::cout << "decode " << decode_seconds << "s  render " << render_seconds << "s  encode " << encode_seconds << "s\n";
+        }
+        std::cout << std::setprecision(4)
+            << "real-time factor " << render_seconds / input_seconds
+            << " (" << std::setprecision(1) << input_seconds / render_seconds << "x playback speed)" << std::endl;
+    }
+    catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "offline/audiofile.h"
+#include "offline/mappedwav.h"
+#include "extras/miniaudio_split/miniaudio.h"
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace Mengu;
+
+// frames read from the decoder at a time
+static constexpr uint32_t DecodeChunkSize = 1 << 14;
+
+static ma_encoding_format get_encoding_format(const fs::path &file_path) {
+    const fs::path ext = file_path.extension();
+    if (ext == ".ogg") { return ma_encoding_format_vorbis; }
+    else if (ext == ".wav") { return ma_encoding_format_wav; }
+    else if (ext == ".mp3") { return ma_encoding_format_mp3; }
+    else { return ma_encoding_format_unknown; }
+}
+
+AudioFileDecoder::AudioFileDecoder(const fs::path &file_path, uint32_t n_channels) {
+    _decoder = new ma_decoder;
+    ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_f32, n_channels, 0);
+    // 0 decodes at the file's own rate
+    decoder_config.encodingFormat = get_encoding_format(file_path);
+
+    const ma_result result = ma_decoder_init_file(file_path.string().c_str(), &decoder_config, _decoder);
+    if (result != MA_SUCCESS) {
+        delete _decoder;
+        std::string err_msg ("Could not load ");
+        err_msg += file_path.string() + " with " + std::to_string(result);
+        throw std::runtime_error(err_msg);
+    }
+
+    ma_uint64 length_hint = 0;
+    if (ma_decoder_get_length_in_pcm_frames(_decoder, &length_hint) == MA_SUCCESS) {
+        _length_hint = length_hint;
+    }
+}
+
+AudioFileDecoder::~AudioFileDecoder() {
+    ma_decoder_uninit(_decoder);
+    delete _decoder;
+}
+
+uint32_t AudioFileDecoder::get_sample_rate() const {
+    return _decoder->outputSampleRate;
+}
+
+uint32_t AudioFileDecoder::get_n_channels() const {
+    return _decoder->outputChannels;
+}
+
+uint64_t AudioFileDecoder::read(float *output, uint64_t n_frames) {
+    // what was read counts even when the end or an error cuts it short
+    ma_uint64 n_read = 0;
+    ma_decoder_read_pcm_frames(_decoder, output, n_frames, &n_read);
+    return n_read;
+}
+
+bool AudioFileDecoder::seek(uint64_t frame) {
+    return ma_decoder_seek_to_pcm_frame(_decoder, frame) == MA_SUCCESS;
+}
+
+void AudioFileDecoder::read_all(AudioData &data) {
+    data.sample_rate = get_sample_rate();
+    data.n_channels = get_n_channels();
+    data.samples.reserve(data.samples.size() + _length_hint * data.n_channels);
+
+    uint64_t n_read = 0;
+    do {
+        const size_t start = data.samples.size();
+        data.samples.resize(start + (size_t) DecodeChunkSize * data.n_channels);
+        n_read = read(data.samples.data() + start, DecodeChunkSize);
+        data.samples.resize(start + n_read * data.n_channels);
+    } while (n_read > 0);
+}
+
+AudioSource *Mengu::open_audio_source(const fs::path &file_path, uint32_t n_channels) {
+    const fs::path ext = file_path.extension();
+    if (ext == ".wav" || ext == ".rf64" || ext == ".bw64") {
+        MappedWavFile *mapped = nullptr;
+        try {
+            mapped = new MappedWavFile(file_path);
+        }
+        catch (const std::runtime_error &) {
+            // in a format it does not map, which the decoder may still read
+        }
+        if (mapped != nullptr && (n_channels == 0 || mapped->get_n_channels() == n_channels)) {
+            return mapped;
+        }
+        delete mapped;
+    }
+    return new AudioFileDecoder(file_path, n_channels);
+}
+
+AudioData Mengu::decode_audio_file(const fs::path &file_path, uint32_t n_channels) {
+    AudioFileDecoder decoder(file_path, n_channels);
+    AudioData data;
+    decoder.read_all(data);
+    return data;
+}
+
+void Mengu::encode_wav_file(const fs::path &file_path, const AudioData &data) {
+    ma_encoder encoder;
+    ma_encoder_config encoder_config = ma_encoder_config_init(
+        ma_encoding_format_wav, ma_format_f32, data.n_channels, data.sample_rate
+    );
+
+    if (ma_encoder_init_file(file_path.string().c_str(), &encoder_config, &encoder) != MA_SUCCESS) {
+        throw std::runtime_error("Could not open " + file_path.string() + " to write to");
+    }
+
+    ma_uint64 n_written = 0;
+    const ma_result result = ma_encoder_write_pcm_frames(&encoder, data.samples.data(), data.n_frames(), &n_written);
+    ma_encoder_uninit(&encoder);
+
+    if (result != MA_SUCCESS || n_written != data.n_frames()) {
+        throw std::runtime_error("Could not write all of " + file_path.string());
+    }
+}
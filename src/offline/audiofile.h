@@ -0,0 +1,101 @@
+/**
+ * @file audiofile.h
+ * @brief Reads whole audio files into memory and writes them back out, for rendering offline
+ */
+#ifndef MENGU_AUDIO_FILE
+#define MENGU_AUDIO_FILE
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct ma_decoder;
+
+namespace Mengu {
+
+// Samples of a file, with the frames of each channel interleaved
+struct AudioData {
+    uint32_t sample_rate = 0;
+    uint32_t n_channels = 0;
+    std::vector<float> samples;
+
+    inline uint64_t n_frames() const {
+        return n_channels == 0 ? 0 : samples.size() / n_channels;
+    }
+    inline double seconds() const {
+        return sample_rate == 0 ? 0.0 : (double) n_frames() / sample_rate;
+    }
+};
+
+// Frames read a chunk at a time, as players and renders take them from files
+class AudioSource {
+public:
+    virtual ~AudioSource() {}
+
+    virtual uint32_t get_sample_rate() const = 0;
+    virtual uint32_t get_n_channels() const = 0;
+    // Frames in the source. Only a hint, as some formats can only estimate it. 0 if it cannot tell
+    virtual uint64_t get_length_hint() const {
+        return 0;
+    }
+
+    // reads up to n_frames interleaved frames into output, returning how many were read. 0 once it is all read
+    virtual uint64_t read(float *output, uint64_t n_frames) = 0;
+    // moves reading to frame. false if it could not
+    virtual bool seek(uint64_t frame) = 0;
+
+    // Reads like read, but hands over where the source already holds the frames rather than copying them, valid until
+    // it is next read, viewed or moved. nullptr, with none viewed, for sources that do not hold their frames as
+    // interleaved floats, and once there are none left. Those are read instead
+    virtual const float *view(uint64_t n_frames, uint64_t &n_viewed) {
+        (void) n_frames;
+        n_viewed = 0;
+        return nullptr;
+    }
+};
+
+// Decodes a .wav, .mp3 or .ogg a chunk at a time, at its own sample rate
+class AudioFileDecoder: public AudioSource {
+public:
+    // mixed to n_channels channels, 0 keeps the file's. Throws std::runtime_error if it cannot be opened
+    AudioFileDecoder(const fs::path &file_path, uint32_t n_channels = 1);
+    ~AudioFileDecoder();
+
+    AudioFileDecoder(const AudioFileDecoder &) = delete;
+    AudioFileDecoder &operator=(const AudioFileDecoder &) = delete;
+
+    virtual uint32_t get_sample_rate() const override;
+    virtual uint32_t get_n_channels() const override;
+    virtual uint64_t get_length_hint() const override {
+        return _length_hint;
+    }
+
+    // reads up to n_frames interleaved frames into output, returning how many were read. 0 once it is all read
+    virtual uint64_t read(float *output, uint64_t n_frames) override;
+    virtual bool seek(uint64_t frame) override;
+    // appends the rest of the file to data's samples, taking on its sample rate and channels
+    void read_all(AudioData &data);
+
+private:
+    ma_decoder *_decoder;
+    uint64_t _length_hint = 0;
+};
+
+// Opens a file to be read at its own sample rate, in n_channels channels (0 keeps the file's). Wavs already in that many
+// channels are mapped into memory with MappedWavFile, and anything else is decoded with AudioFileDecoder, which mixes it.
+// Throws std::runtime_error if it cannot be opened
+AudioSource *open_audio_source(const fs::path &file_path, uint32_t n_channels = 1);
+
+// Decodes a .wav, .mp3 or .ogg at its own sample rate, mixed to n_channels channels (0 keeps the file's).
+// Throws std::runtime_error if it cannot be read
+AudioData decode_audio_file(const fs::path &file_path, uint32_t n_channels = 1);
+
+// Writes 32 bit float samples, so that nothing louder than full scale is clipped.
+// Throws std::runtime_error if it cannot be written
+void encode_wav_file(const fs::path &file_path, const AudioData &data);
+
+} // namespace Mengu
+
+#endif
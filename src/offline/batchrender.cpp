@@ -0,0 +1,153 @@
+#include "offline/batchrender.h"
+#include "offline/audiofile.h"
+#include "offline/threadpool.h"
+#include "mengumath.h"
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace Mengu;
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The chains one worker has made, most recently used first
+class ChainCache {
+public:
+    ChainCache(uint32_t max_size): _max_size(max_size) {}
+
+    // a chain reset for a new signal at sample_rate, which is one that was used before if reused is set
+    RenderChain &get(const RenderSettings &settings, uint32_t n_channels, uint32_t sample_rate, bool &reused) {
+        reused = false;
+        for (auto it = _chains.begin(); it != _chains.end(); it++) {
+            if ((*it)->get_settings() == settings && (*it)->get_n_channels() == n_channels) {
+                _chains.splice(_chains.begin(), _chains, it);
+                reused = true;
+                break;
+            }
+        }
+        if (!reused) {
+            _chains.emplace_front(new RenderChain(settings, n_channels));
+            if (_chains.size() > _max_size) {
+                _chains.pop_back();
+            }
+            // set_sample_rate resets it as well, but a new chain has not set up its effects for a rate yet
+            _chains.front()->set_sample_rate(sample_rate);
+        }
+
+        RenderChain &chain = *_chains.front();
+        // only set again when the rate changes, as that sets up the effects' FFTs and filters again
+        if (chain.get_sample_rate() != sample_rate) {
+            chain.set_sample_rate(sample_rate);
+        }
+        else if (reused) {
+            chain.reset();
+        }
+        return chain;
+    }
+
+private:
+    const uint32_t _max_size;
+    std::list<std::unique_ptr<RenderChain>> _chains;
+};
+
+static void render_job(const BatchJob &job, uint32_t n_channels, ChainCache &chains, MemoryBudget &budget, BatchJobReport &report) {
+    auto start = Clock::now();
+    AudioFileDecoder decoder(job.input, n_channels);
+    report.decode_seconds = seconds_since(start);
+
+    start = Clock::now();
+    RenderChain &chain = chains.get(job.settings, decoder.get_n_channels(), decoder.get_sample_rate(), report.reused_chain);
+    report.setup_seconds = seconds_since(start);
+
+    // the length is only a hint, but close enough to hold back jobs by
+    const uint64_t length_hint = decoder.get_length_hint();
+    const uint64_t n_bytes = (length_hint + chain.output_size(length_hint)) * decoder.get_n_channels() * sizeof(float);
+    start = Clock::now();
+    budget.acquire(n_bytes);
+    report.wait_seconds = seconds_since(start);
+
+    try {
+        start = Clock::now();
+        AudioData input;
+        decoder.read_all(input);
+        report.decode_seconds += seconds_since(start);
+        report.audio_seconds = input.seconds();
+
+        start = Clock::now();
+        AudioData output;
+        output.sample_rate = input.sample_rate;
+        output.n_channels = input.n_channels;
+        output.samples.reserve(chain.output_size(input.n_frames()) * output.n_channels);
+        chain.push_signal(input.samples.data(), input.n_frames(), output.samples);
+        chain.finish(output.samples);
+        report.render_seconds = seconds_since(start);
+
+        // the input is done with, so others can have its share while this writes
+        input.samples = std::vector<float>();
+        start = Clock::now();
+        encode_wav_file(job.output, output);
+        report.encode_seconds = seconds_since(start);
+    }
+    catch (...) {
+        budget.release(n_bytes);
+        throw;
+    }
+    budget.release(n_bytes);
+}
+
+std::vector<BatchJobReport> Mengu::render_batch(const std::vector<BatchJob> &jobs, const BatchSettings &batch_settings) {
+    // throws for bad settings now rather than in every job that has them
+    for (uint64_t j = 0; j < jobs.size(); j++) {
+        bool checked = false;
+        for (uint64_t k = 0; k < j && !checked; k++) {
+            checked = jobs[k].settings == jobs[j].settings;
+        }
+        if (!checked) {
+            try {
+                RenderChain chain(jobs[j].settings);
+            }
+            catch (const std::exception &e) {
+                throw std::runtime_error(jobs[j].input.string() + ": " + e.what());
+            }
+        }
+    }
+
+    uint32_t n_workers = batch_settings.n_workers;
+    if (n_workers == 0) {
+        n_workers = MAX(std::thread::hardware_concurrency(), 1u);
+    }
+    n_workers = MAX(MIN((uint64_t) n_workers, (uint64_t) jobs.size()), (uint64_t) 1);
+
+    std::vector<BatchJobReport> reports(jobs.size());
+    MemoryBudget budget(batch_settings.max_bytes_in_flight);
+    std::vector<ChainCache> chain_caches;
+    for (uint32_t w = 0; w < n_workers; w++) {
+        chain_caches.emplace_back(MAX(batch_settings.max_chains_per_worker, 1u));
+    }
+
+    WorkStealingPool pool(n_workers);
+
+    for (uint64_t j = 0; j < jobs.size(); j++) {
+        pool.submit([&, j] (uint32_t worker_ind) {
+            BatchJobReport &report = reports[j];
+            report.worker = worker_ind;
+            try {
+                render_job(jobs[j], batch_settings.n_channels, chain_caches[worker_ind], budget, report);
+            }
+            catch (const std::exception &e) {
+                report.error = e.what();
+            }
+        });
+    }
+    pool.wait();
+    return reports;
+}
@@ -0,0 +1,61 @@
+/**
+ * @file batchrender.h
+ * @brief Renders many files at once, a file per worker of a thread pool
+ */
+#ifndef MENGU_BATCH_RENDER
+#define MENGU_BATCH_RENDER
+
+#include "offline/renderchain.h"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace Mengu {
+
+// a file to render and where the wav goes
+struct BatchJob {
+    fs::path input;
+    fs::path output;
+    RenderSettings settings;
+};
+
+struct BatchSettings {
+    // 0 uses every hardware thread
+    uint32_t n_workers = 0;
+    // files are decoded to this many channels. 0 keeps each file's own
+    uint32_t n_channels = 0;
+    // Decoded input and rendered output of the jobs in flight are kept under this many bytes,
+    // by holding back jobs until others are done. A job bigger than it all still runs once nothing else is held
+    uint64_t max_bytes_in_flight = (uint64_t) 1 << 30;
+    // Chains each worker keeps to reuse for later jobs with the same settings, so their effects
+    // are only set up once per worker. The least recently used goes first
+    uint32_t max_chains_per_worker = 4;
+};
+
+// how a job went, with where its time went
+struct BatchJobReport {
+    uint32_t worker = 0;
+    // whether the worker already had a chain for the job's settings
+    bool reused_chain = false;
+    double audio_seconds = 0.0;
+    // waiting for bytes in flight to go under the limit
+    double wait_seconds = 0.0;
+    double decode_seconds = 0.0;
+    // getting a chain ready, which is mostly making one when there was none to reuse
+    double setup_seconds = 0.0;
+    double render_seconds = 0.0;
+    double encode_seconds = 0.0;
+    // empty if it was rendered
+    std::string error;
+};
+
+// Renders every job, reporting each in the same order. A job that fails does not stop the rest.
+// Throws std::runtime_error for settings a RenderChain cannot be made from, naming the job's input, before rendering anything
+std::vector<BatchJobReport> render_batch(const std::vector<BatchJob> &jobs, const BatchSettings &batch_settings);
+
+} // namespace Mengu
+
+#endif
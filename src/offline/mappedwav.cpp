@@ -0,0 +1,281 @@
+#include "offline/mappedwav.h"
+#include "mengumath.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace Mengu;
+
+// wav headers are little endian
+static uint32_t read_le16(const uint8_t *bytes) {
+    return bytes[0] | (bytes[1] << 8);
+}
+
+static uint32_t read_le32(const uint8_t *bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+static uint64_t read_le64(const uint8_t *bytes) {
+    return read_le32(bytes) | ((uint64_t) read_le32(bytes + 4) << 32);
+}
+
+// the formats of the fmt chunk, or of the subformat of an extensible one
+static constexpr uint32_t WavePCM = 1;
+static constexpr uint32_t WaveFloat = 3;
+static constexpr uint32_t WaveExtensible = 0xFFFE;
+// sizes in RIFF chunks that RF64 gives in its ds64 chunk instead
+static constexpr uint32_t RF64Size = 0xFFFFFFFF;
+
+MappedWavFile::MappedWavFile(const fs::path &file_path) {
+    _read_header(file_path);
+    _file_size = fs::file_size(file_path);
+    // a file cut off while it was written says it has more than it does
+    _length = MIN(_length, (_file_size - MIN(_data_offset, _file_size)) / _frame_size);
+
+#ifdef _WIN32
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    _granularity = system_info.dwAllocationGranularity;
+
+    HANDLE file = CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Could not open " + file_path.string());
+    }
+    _file = file;
+    _mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (_mapping == nullptr) {
+        CloseHandle(file);
+        throw std::runtime_error("Could not map " + file_path.string());
+    }
+#else
+    _granularity = sysconf(_SC_PAGESIZE);
+    _file = open(file_path.c_str(), O_RDONLY);
+    if (_file < 0) {
+        throw std::runtime_error("Could not open " + file_path.string());
+    }
+#endif
+}
+
+MappedWavFile::~MappedWavFile() {
+    _unmap();
+#ifdef _WIN32
+    CloseHandle(_mapping);
+    CloseHandle(_file);
+#else
+    close(_file);
+#endif
+}
+
+void MappedWavFile::_read_header(const fs::path &file_path) {
+    std::ifstream file(file_path, std::ios::binary);
+    const std::string not_wav = file_path.string() + " is not a wav that can be mapped";
+    uint8_t riff[12];
+    if (!file.read((char *) riff, sizeof(riff))) {
+        throw std::runtime_error(not_wav);
+    }
+    const std::string riff_id((const char *) riff, 4);
+    const bool is_64 = riff_id == "RF64" || riff_id == "BW64";
+    if ((riff_id != "RIFF" && !is_64) || std::memcmp(riff + 8, "WAVE", 4) != 0) {
+        throw std::runtime_error(not_wav);
+    }
+
+    bool has_format = false;
+    uint64_t ds64_data_size = 0;
+    while (true) {
+        uint8_t chunk[8];
+        if (!file.read((char *) chunk, sizeof(chunk))) {
+            throw std::runtime_error(not_wav);
+        }
+        const std::string chunk_id((const char *) chunk, 4);
+        uint64_t chunk_size = read_le32(chunk + 4);
+        const uint64_t chunk_start = file.tellg();
+
+        if (chunk_id == "ds64") {
+            // the sizes of the riff and then the data chunk
+            uint8_t ds64[16];
+            if (chunk_size < sizeof(ds64) || !file.read((char *) ds64, sizeof(ds64))) {
+                throw std::runtime_error(not_wav);
+            }
+            ds64_data_size = read_le64(ds64 + 8);
+        }
+        else if (chunk_id == "fmt ") {
+            // the extensible format's subformat ends 40 bytes in
+            uint8_t format[40] = {};
+            if (chunk_size < 16 || !file.read((char *) format, MIN(chunk_size, (uint64_t) sizeof(format)))) {
+                throw std::runtime_error(not_wav);
+            }
+            uint32_t tag = read_le16(format);
+            if (tag == WaveExtensible && chunk_size >= sizeof(format)) {
+                tag = read_le16(format + 24);
+            }
+            _n_channels = read_le16(format + 2);
+            _sample_rate = read_le32(format + 4);
+            _frame_size = read_le16(format + 12);
+            const uint32_t bits = read_le16(format + 14);
+
+            if (tag == WavePCM && bits == 8) { _format = Unsigned8; }
+            else if (tag == WavePCM && bits == 16) { _format = Int16; }
+            else if (tag == WavePCM && bits == 24) { _format = Int24; }
+            else if (tag == WavePCM && bits == 32) { _format = Int32; }
+            else if (tag == WaveFloat && bits == 32) { _format = Float32; }
+            else if (tag == WaveFloat && bits == 64) { _format = Float64; }
+            else {
+                throw std::runtime_error(not_wav);
+            }
+            if (_n_channels == 0 || _sample_rate == 0 || _frame_size != _n_channels * bits / 8) {
+                throw std::runtime_error(not_wav);
+            }
+            has_format = true;
+        }
+        else if (chunk_id == "data") {
+            if (!has_format) {
+                throw std::runtime_error(not_wav);
+            }
+            if (is_64 && chunk_size == RF64Size) {
+                chunk_size = ds64_data_size;
+            }
+            _data_offset = chunk_start;
+            _length = chunk_size / _frame_size;
+            return;
+        }
+
+        // chunks are padded to even sizes
+        file.seekg(chunk_start + chunk_size + (chunk_size & 1));
+    }
+}
+
+uint32_t MappedWavFile::get_sample_rate() const {
+    return _sample_rate;
+}
+
+uint32_t MappedWavFile::get_n_channels() const {
+    return _n_channels;
+}
+
+uint64_t MappedWavFile::get_length_hint() const {
+    return _length;
+}
+
+uint64_t MappedWavFile::read(float *output, uint64_t n_frames) {
+    n_frames = MIN(n_frames, _length - _position);
+    for (uint64_t n_read = 0; n_read < n_frames;) {
+        const uint64_t n = MIN(n_frames - n_read, _max_window_frames());
+        const uint8_t *samples = _map(_data_offset + _position * _frame_size, n * _frame_size);
+        _convert(samples, output + n_read * _n_channels, n * _n_channels);
+        _position += n;
+        n_read += n;
+    }
+    return n_frames;
+}
+
+bool MappedWavFile::seek(uint64_t frame) {
+    _position = MIN(frame, _length);
+    return frame <= _length;
+}
+
+const float *MappedWavFile::view(uint64_t n_frames, uint64_t &n_viewed) {
+    n_viewed = MIN(MIN(n_frames, _length - _position), _max_window_frames());
+    if (_format != Float32 || _data_offset % sizeof(float) != 0 || n_viewed == 0) {
+        n_viewed = 0;
+        return nullptr;
+    }
+    const uint8_t *samples = _map(_data_offset + _position * _frame_size, n_viewed * _frame_size);
+    _position += n_viewed;
+    return (const float *) samples;
+}
+
+void MappedWavFile::_convert(const uint8_t *samples, float *output, uint64_t n_samples) const {
+    switch (_format) {
+        case Unsigned8:
+            for (uint64_t i = 0; i < n_samples; i++) {
+                output[i] = ((int32_t) samples[i] - 128) / 128.0f;
+            }
+            break;
+        case Int16:
+            for (uint64_t i = 0; i < n_samples; i++) {
+                int16_t sample;
+                std::memcpy(&sample, samples + 2 * i, sizeof(sample));
+                output[i] = sample / 32768.0f;
+            }
+            break;
+        case Int24:
+            for (uint64_t i = 0; i < n_samples; i++) {
+                const uint8_t *bytes = samples + 3 * i;
+                // shifted up and back down to carry the sign
+                const int32_t sample = (int32_t) ((bytes[0] << 8) | (bytes[1] << 16) | ((uint32_t) bytes[2] << 24)) >> 8;
+                output[i] = sample / 8388608.0f;
+            }
+            break;
+        case Int32:
+            for (uint64_t i = 0; i < n_samples; i++) {
+                int32_t sample;
+                std::memcpy(&sample, samples + 4 * i, sizeof(sample));
+                output[i] = sample / 2147483648.0f;
+            }
+            break;
+        case Float32:
+            std::memcpy(output, samples, n_samples * sizeof(float));
+            break;
+        case Float64:
+            for (uint64_t i = 0; i < n_samples; i++) {
+                double sample;
+                std::memcpy(&sample, samples + 8 * i, sizeof(sample));
+                output[i] = (float) sample;
+            }
+            break;
+    }
+}
+
+uint64_t MappedWavFile::_max_window_frames() const {
+    return (WindowSize - _granularity) / _frame_size;
+}
+
+const uint8_t *MappedWavFile::_map(uint64_t offset, uint64_t n_bytes) {
+    if (_window != nullptr && offset >= _window_offset && offset + n_bytes <= _window_offset + _window_size) {
+        return _window + (offset - _window_offset);
+    }
+    // only a window is mapped at a time, so what has been read is let go of as it slides on
+    _unmap();
+    _window_offset = offset - offset % _granularity;
+    _window_size = MIN(WindowSize, _file_size - _window_offset);
+
+#ifdef _WIN32
+    void *window = MapViewOfFile(_mapping, FILE_MAP_READ, (DWORD) (_window_offset >> 32), (DWORD) _window_offset, _window_size);
+    if (window == nullptr) {
+        throw std::runtime_error("Could not map a window of a wav");
+    }
+#else
+    void *window = mmap(nullptr, _window_size, PROT_READ, MAP_PRIVATE, _file, (off_t) _window_offset);
+    if (window == MAP_FAILED) {
+        throw std::runtime_error("Could not map a window of a wav");
+    }
+    // read ahead of where it is read, and drop pages behind it first
+    madvise(window, _window_size, MADV_SEQUENTIAL);
+#endif
+    _window = (const uint8_t *) window;
+    return _window + (offset - _window_offset);
+}
+
+void MappedWavFile::_unmap() {
+    if (_window == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(_window);
+#else
+    munmap((void *) _window, _window_size);
+#endif
+    _window = nullptr;
+}
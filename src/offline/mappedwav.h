@@ -0,0 +1,88 @@
+/**
+ * @file mappedwav.h
+ * @brief Reads .wav and RF64 files straight from memory mapped views of them, rather than decoding into buffers
+ */
+#ifndef MENGU_MAPPED_WAV
+#define MENGU_MAPPED_WAV
+
+#include "offline/audiofile.h"
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace Mengu {
+
+// A .wav, RF64 or BW64 file of 8, 16, 24 or 32 bit PCM, or 32 or 64 bit float samples, read through a window of it
+// mapped into memory. The window slides along as it is read, so however large the file, only a window's worth of it is
+// ever mapped in. 32 bit float files can be viewed where they are mapped without copying
+class MappedWavFile: public AudioSource {
+public:
+    // bytes of the file mapped at a time
+    static constexpr uint64_t WindowSize = 1 << 26;
+
+    // Throws std::runtime_error if it cannot be opened, or is not a wav of one of those formats
+    MappedWavFile(const fs::path &file_path);
+    ~MappedWavFile();
+
+    MappedWavFile(const MappedWavFile &) = delete;
+    MappedWavFile &operator=(const MappedWavFile &) = delete;
+
+    virtual uint32_t get_sample_rate() const override;
+    virtual uint32_t get_n_channels() const override;
+    // exact, as wav headers give it
+    virtual uint64_t get_length_hint() const override;
+
+    virtual uint64_t read(float *output, uint64_t n_frames) override;
+    virtual bool seek(uint64_t frame) override;
+    // for 32 bit float files whose samples are aligned as floats in the file, which most are
+    virtual const float *view(uint64_t n_frames, uint64_t &n_viewed) override;
+
+private:
+    enum SampleFormat {
+        Unsigned8,
+        Int16,
+        Int24,
+        Int32,
+        Float32,
+        Float64,
+    };
+    SampleFormat _format;
+    uint32_t _sample_rate;
+    uint32_t _n_channels;
+    // bytes per frame
+    uint32_t _frame_size;
+
+    // where the samples are in the file, in bytes
+    uint64_t _data_offset;
+    uint64_t _length;
+    uint64_t _position = 0;
+
+    // window offsets are multiples of this
+    uint64_t _granularity;
+    uint64_t _file_size;
+#ifdef _WIN32
+    void *_file = nullptr;
+    void *_mapping = nullptr;
+#else
+    int _file = -1;
+#endif
+    const uint8_t *_window = nullptr;
+    uint64_t _window_offset = 0;
+    uint64_t _window_size = 0;
+
+    // reads the format and where the samples are from the header, throwing if it is not a wav of a known format
+    void _read_header(const fs::path &file_path);
+    // converts n_samples samples of the file's format to floats
+    void _convert(const uint8_t *samples, float *output, uint64_t n_samples) const;
+    // most frames a window is sure to hold from wherever they start
+    uint64_t _max_window_frames() const;
+    // The n_bytes of the file from offset, sliding the window over them if they are not already in it.
+    // n_bytes may be no more than a window less the granularity
+    const uint8_t *_map(uint64_t offset, uint64_t n_bytes);
+    void _unmap();
+};
+
+} // namespace Mengu
+
+#endif
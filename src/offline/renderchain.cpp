@@ -0,0 +1,331 @@
+#include "offline/renderchain.h"
+#include "dsp/effect.h"
+#include "dsp/formantshifter.h"
+#include "dsp/pitchshifter.h"
+#include "dsp/timestretcher.h"
+#include "mengumath.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace Mengu;
+using namespace dsp;
+
+static const char *PitchShifterNames[] = {"wsola", "psola", "pv", "pvdr"};
+static const char *StretcherNames[] = {"wsola", "psola", "pv", "pvdr", "ola"};
+static const char *StageNames[] = {"pitch", "formant", "stretch"};
+
+static TimeStretcher *make_stretcher(RenderSettings::StretcherType type) {
+    switch (type) {
+        case RenderSettings::PSOLAStretcher:
+            return new PSOLATimeStretcher();
+        case RenderSettings::PhaseVocoderStretcher:
+            return new PhaseVocoderTimeStretcher(true);
+        case RenderSettings::PhaseVocoderDoneRightStretcher:
+            return new PhaseVocoderDoneRightTimeStretcher(true);
+        case RenderSettings::OLAStretcher:
+            return new OLATimeStretcher(1 << 11);
+        case RenderSettings::WSOLAStretcher:
+        default:
+            return new WSOLATimeStretcher();
+    }
+}
+
+// "Pitch Shift" and "pitch_shift" are the same property
+static std::string normalise_property_name(const std::string &name) {
+    std::string normalised = name;
+    for (char &c: normalised) {
+        c = c == ' ' ? '_' : std::tolower((unsigned char) c);
+    }
+    return normalised;
+}
+
+// Effects are only made for the values their controls can be set to. Far outside of them they can make the wrong
+// length, or never finish a window. Toggles and counters that do not declare a range take anything
+static void check_property_range(const EffectPropDesc &desc, float value, RenderSettings::Stage stage) {
+    if (desc.type == Toggle || !(desc.slider_data.max_value > desc.slider_data.min_value)) {
+        return;
+    }
+    if (!(value >= desc.slider_data.min_value && value <= desc.slider_data.max_value)) {
+        std::ostringstream err_msg;
+        err_msg << "The " << get_stage_name(stage) << " stage's " << normalise_property_name(desc.name) << " must be between "
+            << desc.slider_data.min_value << " and " << desc.slider_data.max_value << ", not " << value;
+        throw std::runtime_error(err_msg.str());
+    }
+}
+
+static void set_property_by_name(MultichannelEffect &effect, const RenderSettings::Property &property) {
+    const std::vector<EffectPropDesc> descs = effect.get_property_descs();
+    const std::string name = normalise_property_name(property.name);
+    for (uint32_t id = 0; id < descs.size(); id++) {
+        if (normalise_property_name(descs[id].name) == name) {
+            check_property_range(descs[id], property.value, property.stage);
+            EffectPropPayload payload {.type = descs[id].type};
+            if (descs[id].type == Toggle) {
+                payload.on = property.value != 0.0f;
+            }
+            else {
+                payload.value = property.value;
+            }
+            effect.set_property(id, payload);
+            return;
+        }
+    }
+
+    std::string err_msg = "The ";
+    err_msg += get_stage_name(property.stage);
+    err_msg += " stage has no property " + property.name + ". It has";
+    for (const EffectPropDesc &desc: descs) {
+        err_msg += " '" + normalise_property_name(desc.name) + "'";
+    }
+    throw std::runtime_error(err_msg);
+}
+
+RenderChain::RenderChain(const RenderSettings &settings, uint32_t n_channels):
+        _settings(settings), _n_channels(MAX(n_channels, 1u)) {
+    if (_settings.block_size == 0) {
+        throw std::runtime_error("Render block size must be positive");
+    }
+
+    if (_settings.pitch_shift != 1.0f) {
+        _effects[RenderSettings::PitchStage] = new MultichannelEffect(_n_channels, [this] () {
+            // pitch shifter types share their values with the stretchers they resample
+            TimeStretchPitchShifter *pitch_shifter = new TimeStretchPitchShifter(
+                make_stretcher((RenderSettings::StretcherType) _settings.pitch_shifter), 1
+            );
+            pitch_shifter->set_shift_factor(_settings.pitch_shift);
+            pitch_shifter->set_direct_pitch_shift(_settings.direct_pitch_shift);
+            return pitch_shifter;
+        }, _settings.link_channels);
+    }
+    if (_settings.formant_shift != 1.0f) {
+        _effects[RenderSettings::FormantStage] = new MultichannelEffect(_n_channels, [this] () {
+            LPCFormantShifter *formant_shifter = new LPCFormantShifter();
+            formant_shifter->set_property(0, EffectPropPayload {.type = Slider, .value = _settings.formant_shift});
+            return formant_shifter;
+        }, _settings.link_channels);
+    }
+    if (_settings.stretch != 1.0f) {
+        _effects[RenderSettings::StretchStage] = new MultichannelEffect(_n_channels, [this] () {
+            TimeStretcher *stretcher = make_stretcher(_settings.stretcher);
+            stretcher->set_stretch_factor(_settings.stretch);
+            return stretcher;
+        }, _settings.link_channels);
+    }
+
+    try {
+        // the first property of every stage is its factor
+        const float factors[RenderSettings::NStages] = {_settings.pitch_shift, _settings.formant_shift, _settings.stretch};
+        for (uint32_t stage = 0; stage < RenderSettings::NStages; stage++) {
+            if (_effects[stage] != nullptr) {
+                check_property_range(_effects[stage]->get_property_descs()[0], factors[stage], (RenderSettings::Stage) stage);
+            }
+        }
+        for (const RenderSettings::Property &property: _settings.properties) {
+            if (_effects[property.stage] == nullptr) {
+                throw std::runtime_error(
+                    std::string("Cannot set ") + property.name + " on the " + get_stage_name(property.stage) + " stage, as it is not run"
+                );
+            }
+            set_property_by_name(*_effects[property.stage], property);
+        }
+    }
+    catch (...) {
+        for (MultichannelEffect *effect: _effects) {
+            delete effect;
+        }
+        throw;
+    }
+
+    for (MultichannelEffect *effect: _effects) {
+        if (effect != nullptr) {
+            effect->set_n_threads(_settings.channel_threads);
+        }
+    }
+    _stage_inputs.resize(_n_channels);
+    _stage_outputs.resize(_n_channels);
+    _stage_input_ptrs.resize(_n_channels);
+    _stage_output_ptrs.resize(_n_channels);
+}
+
+RenderChain::~RenderChain() {
+    for (MultichannelEffect *effect: _effects) {
+        delete effect;
+    }
+}
+
+void RenderChain::set_sample_rate(uint32_t sample_rate) {
+    _sample_rate = sample_rate;
+    for (MultichannelEffect *effect: _effects) {
+        if (effect != nullptr) {
+            effect->set_sample_rate(sample_rate);
+        }
+    }
+    reset();
+}
+
+void RenderChain::reset() {
+    for (MultichannelEffect *effect: _effects) {
+        if (effect != nullptr) {
+            effect->reset();
+        }
+    }
+    _n_pushed = 0;
+    _n_output = 0;
+}
+
+uint64_t RenderChain::output_size(uint64_t size) const {
+    // the shifters keep their output as long as their input
+    if (_effects[RenderSettings::StretchStage] == nullptr) {
+        return size;
+    }
+    return (uint64_t) std::llround(size * (double) _settings.stretch);
+}
+
+void RenderChain::_reserve_blocks(std::vector<std::vector<Complex>> &blocks, std::vector<Complex *> &ptrs, size_t size) {
+    for (uint32_t c = 0; c < blocks.size(); c++) {
+        if (blocks[c].size() < size) {
+            blocks[c].resize(MAX(size, 2 * blocks[c].size()));
+        }
+        ptrs[c] = blocks[c].data();
+    }
+}
+
+void RenderChain::push_signal(const float *input, uint64_t size, std::vector<float> &output) {
+    const uint32_t block_size = _settings.block_size;
+    _reserve_blocks(_stage_inputs, _stage_input_ptrs, block_size);
+
+    for (uint64_t start = 0; start < size; start += block_size) {
+        const uint32_t n = MIN((uint64_t) block_size, size - start);
+        const float *frames = input + start * _n_channels;
+        for (uint32_t c = 0; c < _n_channels; c++) {
+            Complex *block = _stage_input_ptrs[c];
+            for (uint32_t i = 0; i < n; i++) {
+                block[i] = Complex(frames[i * _n_channels + c]);
+            }
+        }
+        _n_pushed += n;
+        _push_block(n, output);
+    }
+}
+
+void RenderChain::finish(std::vector<float> &output) {
+    const uint32_t block_size = _settings.block_size;
+    const uint64_t expected_size = output_size(_n_pushed);
+    const uint64_t max_flush_size = (uint64_t) MaxFlushSeconds * _sample_rate;
+
+    // silence is not counted as pushed, so it does not lengthen what is expected
+    uint64_t n_flushed = 0;
+    while (_n_output < expected_size && n_flushed < max_flush_size) {
+        _reserve_blocks(_stage_inputs, _stage_input_ptrs, block_size);
+        for (uint32_t c = 0; c < _n_channels; c++) {
+            std::fill(_stage_inputs[c].begin(), _stage_inputs[c].begin() + block_size, Complex(0.0f));
+        }
+        _push_block(block_size, output);
+        n_flushed += block_size;
+    }
+
+    if (_n_output > expected_size) {
+        const uint64_t excess = MIN(_n_output - expected_size, (uint64_t) output.size() / _n_channels);
+        output.resize(output.size() - excess * _n_channels);
+        _n_output -= excess;
+    }
+}
+
+void RenderChain::_push_block(uint32_t size, std::vector<float> &output) {
+    const uint32_t block_size = _settings.block_size;
+
+    uint32_t n = size;
+    for (uint32_t s = 0; s < RenderSettings::NStages; s++) {
+        MultichannelEffect *effect = _effects[s];
+        if (effect == nullptr || n == 0) {
+            continue;
+        }
+        effect->push_signal(_stage_input_ptrs.data(), n);
+
+        if (s == RenderSettings::StretchStage) {
+            // Stretchers make however much their input allows, so they are popped until they run dry.
+            // Pops pad with silence past what was made, so there must be room for a whole block
+            n = 0;
+            uint32_t n_popped = 0;
+            do {
+                _reserve_blocks(_stage_outputs, _stage_output_ptrs, n + block_size);
+                for (uint32_t c = 0; c < _n_channels; c++) {
+                    _stage_output_ptrs[c] = _stage_outputs[c].data() + n;
+                }
+                n_popped = effect->pop_transformed_signal(_stage_output_ptrs.data(), block_size);
+                n += n_popped;
+            } while (n_popped == block_size);
+        }
+        else {
+            // Shifters try to keep a steady amount queued, so they are popped by as much as was pushed.
+            // Popping more would only have them underrun and make up for it
+            _reserve_blocks(_stage_outputs, _stage_output_ptrs, n);
+            n = effect->pop_transformed_signal(_stage_output_ptrs.data(), n);
+        }
+        std::swap(_stage_inputs, _stage_outputs);
+        _reserve_blocks(_stage_inputs, _stage_input_ptrs, 0);
+    }
+
+    // a stage may have swapped out the block for one too small for the next push
+    _reserve_blocks(_stage_inputs, _stage_input_ptrs, block_size);
+
+    const size_t output_start = output.size();
+    output.resize(output_start + (size_t) n * _n_channels);
+    float *frames = output.data() + output_start;
+    for (uint32_t c = 0; c < _n_channels; c++) {
+        const Complex *block = _stage_input_ptrs[c];
+        for (uint32_t i = 0; i < n; i++) {
+            frames[i * _n_channels + c] = block[i].real();
+        }
+    }
+    _n_output += n;
+}
+
+const char *Mengu::get_pitch_shifter_name(RenderSettings::PitchShifterType type) {
+    return PitchShifterNames[type];
+}
+
+const char *Mengu::get_stretcher_name(RenderSettings::StretcherType type) {
+    return StretcherNames[type];
+}
+
+const char *Mengu::get_stage_name(RenderSettings::Stage stage) {
+    return StageNames[stage];
+}
+
+bool Mengu::find_pitch_shifter(const std::string &name, RenderSettings::PitchShifterType &type) {
+    for (uint32_t i = 0; i < sizeof(PitchShifterNames) / sizeof(PitchShifterNames[0]); i++) {
+        if (name == PitchShifterNames[i]) {
+            type = (RenderSettings::PitchShifterType) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Mengu::find_stretcher(const std::string &name, RenderSettings::StretcherType &type) {
+    for (uint32_t i = 0; i < sizeof(StretcherNames) / sizeof(StretcherNames[0]); i++) {
+        if (name == StretcherNames[i]) {
+            type = (RenderSettings::StretcherType) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Mengu::find_stage(const std::string &name, RenderSettings::Stage &stage) {
+    for (uint32_t i = 0; i < RenderSettings::NStages; i++) {
+        if (name == StageNames[i]) {
+            stage = (RenderSettings::Stage) i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,153 @@
+/**
+ * @file renderchain.h
+ * @brief Runs effects over whole signals as fast as they can be processed, rather than at playback speed
+ */
+#ifndef MENGU_RENDER_CHAIN
+#define MENGU_RENDER_CHAIN
+
+#include "dsp/common.h"
+#include "dsp/effect.h"
+#include "dsp/multichannel.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Mengu {
+
+// What a RenderChain is made of. Stages left at a factor of 1 are not run
+struct RenderSettings {
+    enum Stage {
+        PitchStage = 0,
+        FormantStage = 1,
+        StretchStage = 2,
+    };
+    static constexpr uint32_t NStages = 3;
+
+    // the stretcher that a TimeStretchPitchShifter resamples
+    enum PitchShifterType {
+        WSOLAPitchShifter = 0,
+        PSOLAPitchShifter = 1,
+        PhaseVocoderPitchShifter = 2,
+        PhaseVocoderDoneRightPitchShifter = 3,
+    };
+    enum StretcherType {
+        WSOLAStretcher = 0,
+        PSOLAStretcher = 1,
+        PhaseVocoderStretcher = 2,
+        PhaseVocoderDoneRightStretcher = 3,
+        OLAStretcher = 4,
+    };
+
+    PitchShifterType pitch_shifter = WSOLAPitchShifter;
+    float pitch_shift = 1.0f;
+    // pitch shifters whose stretcher can shift pitch itself have it do so, rather than resampling its output
+    bool direct_pitch_shift = false;
+    float formant_shift = 1.0f;
+    StretcherType stretcher = WSOLAStretcher;
+    float stretch = 1.0f;
+
+    // Set on a stage's effect after its factor, by the name in its property descs.
+    // Case and spaces against underscores are ignored
+    struct Property {
+        Stage stage;
+        std::string name;
+        float value;
+
+        bool operator==(const Property &) const = default;
+    };
+    std::vector<Property> properties;
+
+    // signals are pushed through the chain this much at a time, like a device callback would
+    uint32_t block_size = 1 << 10;
+
+    // Stages that support it cut every channel where they cut the channels mixed together,
+    // keeping the stereo image and only analysing once. Otherwise each channel is processed on its own
+    bool link_channels = true;
+    // channels of each stage are processed on up to this many threads
+    uint32_t channel_threads = 1;
+
+    // chains made from equal settings make the same output
+    bool operator==(const RenderSettings &) const = default;
+};
+
+// The pitch shifter, formant shifter and stretcher of some RenderSettings, one after the other, for a number of channels.
+// Shifters are pushed and popped a block at a time as they would be in playback, so their drift compensation
+// behaves as it does there. Output only counts what the effects actually made, so the silence they pad with
+// while filling up is left out
+class RenderChain {
+public:
+    // throws std::runtime_error for properties that the stages do not have, and factors or properties
+    // outside the range their stage's controls take
+    RenderChain(const RenderSettings &settings, uint32_t n_channels = 1);
+    ~RenderChain();
+
+    // resets the chain
+    void set_sample_rate(uint32_t sample_rate);
+    inline uint32_t get_sample_rate() const {
+        return _sample_rate;
+    }
+    inline uint32_t get_n_channels() const {
+        return _n_channels;
+    }
+
+    // Pushes size frames of input through every stage, appending what comes out the end to output.
+    // Frames of the channels are interleaved in both
+    void push_signal(const float *input, uint64_t size, std::vector<float> &output);
+
+    // Pushes silence until the output is as long as the pushed input should make it, then trims any excess
+    // from the end of output. Call once after the last push
+    void finish(std::vector<float> &output);
+
+    void reset();
+
+    // how many frames the chain makes from size pushed frames
+    uint64_t output_size(uint64_t size) const;
+
+    inline const RenderSettings &get_settings() const {
+        return _settings;
+    }
+
+    // nullptr for stages that are not run
+    inline dsp::MultichannelEffect *get_stage(RenderSettings::Stage stage) const {
+        return _effects[stage];
+    }
+
+private:
+    // finish gives up on effects that have not made enough after this many seconds of silence
+    static constexpr uint32_t MaxFlushSeconds = 10;
+
+    RenderSettings _settings;
+    uint32_t _n_channels;
+    uint32_t _sample_rate = dsp::Effect::DefaultSampleRate;
+
+    dsp::MultichannelEffect *_effects[RenderSettings::NStages] = {nullptr};
+
+    uint64_t _n_pushed = 0;
+    uint64_t _n_output = 0;
+
+    // the block of each channel going into and coming out of the current stage. Only ever grow
+    std::vector<std::vector<Complex>> _stage_inputs;
+    std::vector<std::vector<Complex>> _stage_outputs;
+    // where the blocks of each channel start
+    std::vector<Complex *> _stage_input_ptrs;
+    std::vector<Complex *> _stage_output_ptrs;
+
+    // grows the blocks of every channel to at least size
+    static void _reserve_blocks(std::vector<std::vector<Complex>> &blocks, std::vector<Complex *> &ptrs, size_t size);
+
+    // pushes the size frames in _stage_inputs through every stage
+    void _push_block(uint32_t size, std::vector<float> &output);
+};
+
+// names of the pitch shifters and stretchers, as the command line takes them
+const char *get_pitch_shifter_name(RenderSettings::PitchShifterType type);
+const char *get_stretcher_name(RenderSettings::StretcherType type);
+const char *get_stage_name(RenderSettings::Stage stage);
+// false if the name is not one of them
+bool find_pitch_shifter(const std::string &name, RenderSettings::PitchShifterType &type);
+bool find_stretcher(const std::string &name, RenderSettings::StretcherType &type);
+bool find_stage(const std::string &name, RenderSettings::Stage &stage);
+
+} // namespace Mengu
+
+#endif
@@ -0,0 +1,224 @@
+#include "offline/segmentedrender.h"
+#include "dsp/interpolation.h"
+#include "mengumath.h"
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace Mengu;
+using namespace dsp;
+
+// automatic segments are cut so that each thread gets about this many, so one slow segment does not hold up the rest
+static constexpr uint32_t SegmentsPerThread = 4;
+// but not so short that the pre-roll is most of the work, nor so long that a thread holds much output at once
+static constexpr float MinSegmentSeconds = 5.0f;
+static constexpr float MaxSegmentSeconds = 60.0f;
+// frames of a source pushed through at a time when rendering it as it is read
+static constexpr uint32_t SourceChunkSize = 1 << 16;
+
+std::vector<float> Mengu::render_sequential(const RenderSettings &settings, const float *input, uint64_t size,
+        uint32_t sample_rate, uint32_t n_channels) {
+    RenderChain chain(settings, n_channels);
+    chain.set_sample_rate(sample_rate);
+
+    std::vector<float> output;
+    output.reserve(chain.output_size(size) * chain.get_n_channels());
+    chain.push_signal(input, size, output);
+    chain.finish(output);
+    return output;
+}
+
+// Pushes what is left of source through a chain a chunk at a time. The output is kept in output, or with a writer, written
+// to it after each chunk and let go of. Only as much as the input so far should make is written, as finish trims the rest
+static void render_source(const RenderSettings &settings, AudioSource &source, uint64_t &size,
+        std::vector<float> &output, StreamingWavWriter *writer) {
+    const uint32_t n_channels = source.get_n_channels();
+    RenderChain chain(settings, n_channels);
+    chain.set_sample_rate(source.get_sample_rate());
+
+    // whole blocks, so the chain is pushed the same blocks as it would be from memory
+    const uint32_t block_size = MAX(settings.block_size, 1u);
+    const uint64_t chunk_size = (uint64_t) MAX(SourceChunkSize / block_size, 1u) * block_size;
+
+    if (writer == nullptr) {
+        output.reserve(chain.output_size(source.get_length_hint()) * n_channels);
+    }
+    std::vector<float> chunk;
+    size = 0;
+    uint64_t n_written = 0;
+    const auto write_ready = [&] (uint64_t n_ready) {
+        n_ready = MIN(n_ready - n_written, (uint64_t) output.size() / n_channels);
+        writer->write(output.data(), n_ready);
+        output.erase(output.begin(), output.begin() + n_ready * n_channels);
+        n_written += n_ready;
+    };
+    while (true) {
+        uint64_t n_read = 0;
+        const float *frames = source.view(chunk_size, n_read);
+        if (frames == nullptr) {
+            chunk.resize(chunk_size * n_channels);
+            n_read = source.read(chunk.data(), chunk_size);
+            frames = chunk.data();
+        }
+        if (n_read == 0) {
+            break;
+        }
+        chain.push_signal(frames, n_read, output);
+        size += n_read;
+        if (writer != nullptr) {
+            write_ready(chain.output_size(size));
+        }
+    }
+    chain.finish(output);
+    if (writer != nullptr) {
+        write_ready(n_written + output.size() / n_channels);
+    }
+}
+
+std::vector<float> Mengu::render_sequential(const RenderSettings &settings, AudioSource &source, uint64_t &size) {
+    std::vector<float> output;
+    render_source(settings, source, size, output, nullptr);
+    return output;
+}
+
+void Mengu::render_sequential(const RenderSettings &settings, AudioSource &source, StreamingWavWriter &writer, uint64_t &size) {
+    if (writer.get_n_channels() != source.get_n_channels()) {
+        throw std::runtime_error("A render is written in as many channels as its source");
+    }
+    std::vector<float> output;
+    render_source(settings, source, size, output, &writer);
+}
+
+std::vector<float> Mengu::render_segmented(const RenderSettings &settings, const SegmentSettings &segment_settings,
+        const float *input, uint64_t size, uint32_t sample_rate, uint32_t n_channels) {
+    n_channels = MAX(n_channels, 1u);
+    uint32_t n_threads = segment_settings.n_threads;
+    if (n_threads == 0) {
+        n_threads = MAX(std::thread::hardware_concurrency(), 1u);
+    }
+
+    const uint64_t preroll_size = (uint64_t) (segment_settings.preroll_seconds * sample_rate);
+    const uint64_t crossfade_size = (uint64_t) (segment_settings.crossfade_seconds * sample_rate);
+    uint64_t segment_size = (uint64_t) (segment_settings.segment_seconds * sample_rate);
+    if (segment_size == 0) {
+        segment_size = CLAMP(
+            size / ((uint64_t) n_threads * SegmentsPerThread),
+            (uint64_t) (MinSegmentSeconds * sample_rate),
+            (uint64_t) (MaxSegmentSeconds * sample_rate)
+        );
+    }
+    // a crossfade cannot reach past the segment after it
+    segment_size = MAX(segment_size, crossfade_size + 1);
+
+    const uint64_t n_segments = (size + segment_size - 1) / segment_size;
+    if (n_segments <= 1) {
+        return render_sequential(settings, input, size, sample_rate, n_channels);
+    }
+    n_threads = MIN((uint64_t) n_threads, n_segments);
+
+    // made up front so bad settings throw here rather than in a thread
+    std::vector<std::unique_ptr<RenderChain>> chains;
+    for (uint32_t t = 0; t < n_threads; t++) {
+        chains.emplace_back(new RenderChain(settings, n_channels));
+        chains.back()->set_sample_rate(sample_rate);
+    }
+
+    // where input positions land in the output
+    const RenderChain &lengths = *chains[0];
+    const auto out = [&lengths] (uint64_t position) {
+        return lengths.output_size(position);
+    };
+    // the output span of the crossfade at the start of a segment
+    const auto fade_size = [&] (uint64_t segment_start) {
+        return out(MIN(segment_start + crossfade_size, size)) - out(segment_start);
+    };
+
+    // frames are interleaved, so positions are scaled by n_channels to index samples
+    std::vector<float> output(out(size) * n_channels, 0.0f);
+    // What each segment rendered past its end, over the crossfade into the next.
+    // Mixed in once every segment is done, since the next segment writes the same span
+    std::vector<std::vector<float>> tails(n_segments);
+
+    std::atomic<uint64_t> next_segment {0};
+    std::vector<std::exception_ptr> errors(n_threads);
+
+    const auto render_segments = [&] (uint32_t thread_ind) {
+        RenderChain &chain = *chains[thread_ind];
+        std::vector<float> rendered;
+        try {
+            for (uint64_t k = next_segment++; k < n_segments; k = next_segment++) {
+                const uint64_t start = k * segment_size;
+                const uint64_t end = MIN(start + segment_size, size);
+                const uint64_t render_start = start - MIN(preroll_size, start);
+                const uint64_t render_end = MIN(end + crossfade_size + preroll_size, size);
+
+                rendered.resize(0);
+                chain.reset();
+                chain.push_signal(input + render_start * n_channels, render_end - render_start, rendered);
+                chain.finish(rendered);
+
+                // frame i of rendered is frame out(render_start) + i of output
+                const uint64_t rendered_start = out(render_start);
+                const auto rendered_at = [&] (uint64_t output_ind, uint32_t c) {
+                    const uint64_t i = output_ind - rendered_start;
+                    return i < rendered.size() / n_channels ? rendered[i * n_channels + c] : 0.0f;
+                };
+
+                const uint64_t out_start = out(start);
+                const uint64_t out_end = out(end);
+                const uint64_t fade_in_size = k == 0 ? 0 : fade_size(start);
+                for (uint64_t o = out_start; o < out_end; o++) {
+                    const uint64_t i = o - out_start;
+                    const float gain = i < fade_in_size ? hann_window((i + 0.5f) / fade_in_size) : 1.0f;
+                    for (uint32_t c = 0; c < n_channels; c++) {
+                        output[o * n_channels + c] = gain * rendered_at(o, c);
+                    }
+                }
+
+                if (k + 1 < n_segments) {
+                    std::vector<float> &tail = tails[k];
+                    const uint64_t tail_size = fade_size(end);
+                    tail.resize(tail_size * n_channels);
+                    for (uint64_t i = 0; i < tail_size; i++) {
+                        const float gain = 1.0f - hann_window((i + 0.5f) / tail_size);
+                        for (uint32_t c = 0; c < n_channels; c++) {
+                            tail[i * n_channels + c] = gain * rendered_at(out_end + i, c);
+                        }
+                    }
+                }
+            }
+        }
+        catch (...) {
+            errors[thread_ind] = std::current_exception();
+            // the other threads finish up without the rest
+            next_segment = n_segments;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < n_threads; t++) {
+        threads.emplace_back(render_segments, t);
+    }
+    render_segments(0);
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+    for (const std::exception_ptr &error: errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    for (uint64_t k = 0; k + 1 < n_segments; k++) {
+        const uint64_t tail_start = out((k + 1) * segment_size) * n_channels;
+        for (uint64_t i = 0; i < tails[k].size(); i++) {
+            output[tail_start + i] += tails[k][i];
+        }
+    }
+    return output;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file segmentedrender.h
+ * @brief Renders long signals on many threads, by cutting them into segments that are rendered separately
+ */
+#ifndef MENGU_SEGMENTED_RENDER
+#define MENGU_SEGMENTED_RENDER
+
+#include "offline/audiofile.h"
+#include "offline/renderchain.h"
+#include "offline/wavwriter.h"
+#include <cstdint>
+#include <vector>
+
+namespace Mengu {
+
+// How a signal is cut up for render_segmented
+struct SegmentSettings {
+    // 0 picks a length that gives each thread a few segments to balance out
+    float segment_seconds = 0.0f;
+    // Input rendered and thrown away either side of each segment, so the effects are warmed up when it starts
+    // and have caught up with it when it ends. Longer than any effect's frame and its drift compensation's reaction
+    float preroll_seconds = 1.0f;
+    // the seams between segments are crossfaded over this much
+    float crossfade_seconds = 0.05f;
+    // 0 uses every hardware thread
+    uint32_t n_threads = 0;
+};
+
+// Renders a signal the way a RenderChain would, as one chain per thread each taking segments in turn.
+// size counts frames of n_channels interleaved channels.
+// The output is as long as rendering it in one go. Away from the seams each segment is what one chain would make
+// after the pre-roll, so it only differs from rendering in one go by effect state older than that;
+// at the seams the neighbouring segments are crossfaded.
+// Throws std::runtime_error like RenderChain, or what a thread threw while rendering
+std::vector<float> render_segmented(const RenderSettings &settings, const SegmentSettings &segment_settings,
+        const float *input, uint64_t size, uint32_t sample_rate, uint32_t n_channels = 1);
+
+// Renders a signal in one go
+std::vector<float> render_sequential(const RenderSettings &settings, const float *input, uint64_t size,
+        uint32_t sample_rate, uint32_t n_channels = 1);
+
+// Renders what is left of a source in one go, pushing it through a chunk at a time as it is read, so it is never all in
+// memory at once. Chunks are viewed where the source can, rather than copied. size is set to how many frames were read
+std::vector<float> render_sequential(const RenderSettings &settings, AudioSource &source, uint64_t &size);
+
+// Renders what is left of a source in one go like the above, writing the output to writer as each chunk is rendered
+// rather than keeping it, so neither is ever all in memory. writer is left open.
+// Throws std::runtime_error like RenderChain, if writer has other channels than source, or if it could not write
+void render_sequential(const RenderSettings &settings, AudioSource &source, StreamingWavWriter &writer, uint64_t &size);
+
+} // namespace Mengu
+
+#endif
@@ -0,0 +1,156 @@
+#include "offline/threadpool.h"
+#include "mengumath.h"
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+using namespace Mengu;
+
+// which pool the current thread works for, so tasks submitting tasks can queue them on their own worker
+static thread_local const WorkStealingPool *current_pool = nullptr;
+static thread_local uint32_t current_worker_ind = 0;
+
+WorkStealingPool::WorkStealingPool(uint32_t n_workers) {
+    if (n_workers == 0) {
+        n_workers = MAX(std::thread::hardware_concurrency(), 1u);
+    }
+    for (uint32_t w = 0; w < n_workers; w++) {
+        _workers.emplace_back(new Worker);
+    }
+    for (uint32_t w = 0; w < n_workers; w++) {
+        _threads.emplace_back(&WorkStealingPool::_run_worker, this, w);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _task_queued.notify_all();
+    for (std::thread &thread: _threads) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(Task task) {
+    uint32_t worker_ind;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (current_pool == this) {
+            worker_ind = current_worker_ind;
+        }
+        else {
+            worker_ind = _next_worker;
+            _next_worker = (_next_worker + 1) % _workers.size();
+        }
+        // counted before it can be taken, so it cannot finish, and wait return, before it is counted
+        _n_queued++;
+        _n_unfinished++;
+    }
+
+    {
+        Worker &worker = *_workers[worker_ind];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    _task_queued.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _all_done.wait(lock, [this] () { return _n_unfinished == 0; });
+
+    std::exception_ptr error = std::move(_error);
+    _error = nullptr;
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+bool WorkStealingPool::_take(uint32_t worker_ind, Task &task) {
+    const uint32_t n_workers = _workers.size();
+    for (uint32_t i = 0; i < n_workers; i++) {
+        Worker &worker = *_workers[(worker_ind + i) % n_workers];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty()) {
+            continue;
+        }
+        // its own newest is likely still in cache. Others' oldest are the least likely to be taken back
+        if (i == 0) {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        }
+        else {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::_run_worker(uint32_t worker_ind) {
+    current_pool = this;
+    current_worker_ind = worker_ind;
+
+    Task task;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _task_queued.wait(lock, [this] () { return _n_queued > 0 || _stopping; });
+            if (_n_queued == 0) {
+                // stopping, with nothing left
+                return;
+            }
+        }
+        if (!_take(worker_ind, task)) {
+            // another worker got there first
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _n_queued--;
+        }
+
+        std::exception_ptr error;
+        try {
+            task(worker_ind);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        task = nullptr;
+
+        bool all_done;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (error && !_error) {
+                _error = error;
+            }
+            _n_unfinished--;
+            all_done = _n_unfinished == 0;
+        }
+        if (all_done) {
+            _all_done.notify_all();
+        }
+    }
+}
+
+MemoryBudget::MemoryBudget(uint64_t limit): _limit(limit) {}
+
+void MemoryBudget::acquire(uint64_t size) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _released.wait(lock, [this, size] () { return _held == 0 || _held + size <= _limit; });
+    _held += size;
+}
+
+void MemoryBudget::release(uint64_t size) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _held -= MIN(size, _held);
+    }
+    _released.notify_all();
+}
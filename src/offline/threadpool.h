@@ -0,0 +1,91 @@
+/**
+ * @file threadpool.h
+ * @brief Threads that take tasks from their own queues first, and steal from each other when theirs run out
+ */
+#ifndef MENGU_THREAD_POOL
+#define MENGU_THREAD_POOL
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Mengu {
+
+class WorkStealingPool {
+public:
+    // told which worker runs it, so it can use state kept per worker
+    typedef std::function<void(uint32_t worker_ind)> Task;
+
+    // 0 starts a worker for every hardware thread
+    WorkStealingPool(uint32_t n_workers = 0);
+    // runs what is still queued before joining the workers
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    inline uint32_t get_n_workers() const {
+        return _workers.size();
+    }
+
+    // Tasks submitted from a worker go on its own queue, where it takes the newest first.
+    // Others are dealt out to the workers in turn. Idle workers steal the oldest task of another's queue
+    void submit(Task task);
+
+    // Blocks until every submitted task has run.
+    // Rethrows the first exception a task threw since the last wait, after the rest have run
+    void wait();
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+
+    // guards everything below, and is what idle workers and wait sleep on
+    std::mutex _mutex;
+    std::condition_variable _task_queued;
+    std::condition_variable _all_done;
+    // tasks in the queues, and those plus what is running
+    uint64_t _n_queued = 0;
+    uint64_t _n_unfinished = 0;
+    uint32_t _next_worker = 0;
+    bool _stopping = false;
+    std::exception_ptr _error;
+
+    // takes the newest task of worker_ind's queue, or else the oldest of another's
+    bool _take(uint32_t worker_ind, Task &task);
+    void _run_worker(uint32_t worker_ind);
+};
+
+// Blocks acquirers while what they ask for would put the total held over a limit.
+// One acquirer can always go ahead when nothing is held, however much it asks for, so nothing waits forever
+class MemoryBudget {
+public:
+    MemoryBudget(uint64_t limit);
+
+    void acquire(uint64_t size);
+    void release(uint64_t size);
+
+    inline uint64_t get_limit() const {
+        return _limit;
+    }
+
+private:
+    const uint64_t _limit;
+    uint64_t _held = 0;
+    std::mutex _mutex;
+    std::condition_variable _released;
+};
+
+} // namespace Mengu
+
+#endif
@@ -0,0 +1,262 @@
+#include "offline/wavwriter.h"
+#include "mengumath.h"
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace Mengu;
+
+// the largest size a RIFF header can give, past which the file is made RF64
+static constexpr uint64_t MaxRIFFSize = 0xFFFFFFFF;
+// what RF64 gives as the sizes in RIFF chunks, which it keeps in its ds64 chunk instead
+static constexpr uint32_t RF64Size = 0xFFFFFFFF;
+static constexpr uint32_t WaveFloat = 3;
+
+// wav headers are little endian
+static void write_le(uint8_t *bytes, uint64_t value, uint32_t n_bytes) {
+    for (uint32_t i = 0; i < n_bytes; i++) {
+        bytes[i] = (uint8_t) (value >> (8 * i));
+    }
+}
+
+StreamingWavWriter::StreamingWavWriter(const fs::path &file_path, uint32_t sample_rate, uint32_t n_channels,
+        uint64_t buffer_size, uint32_t n_buffers): _file_path(file_path), _sample_rate(sample_rate) {
+    _n_channels = MAX(n_channels, 1u);
+    // the header takes the start of the first buffer, so it needs room for samples after it
+    _buffer_size = MAX((buffer_size + BlockAlignment - 1) / BlockAlignment * BlockAlignment, 2 * BlockAlignment);
+    n_buffers = MAX(n_buffers, 2u);
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(file_path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Could not open " + file_path.string() + " to write to");
+    }
+    _file = file;
+#else
+    _file = open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (_file < 0) {
+        throw std::runtime_error("Could not open " + file_path.string() + " to write to");
+    }
+#endif
+
+    for (uint32_t i = 0; i < n_buffers; i++) {
+        _buffers.push_back((uint8_t *) ::operator new(_buffer_size, std::align_val_t(BlockAlignment)));
+        // touched now, so write does not fault their pages in the first time round
+        std::memset(_buffers.back(), 0, _buffer_size);
+    }
+    _filled.assign(n_buffers, 0);
+    // with no sizes yet. They are filled in once it is closed
+    _make_header(_buffers[0], 0);
+    _filled[0] = BlockAlignment;
+
+    _thread = std::thread(&StreamingWavWriter::_run, this);
+}
+
+StreamingWavWriter::~StreamingWavWriter() {
+    try {
+        close();
+    }
+    catch (const std::exception &) {}
+    for (uint8_t *buffer: _buffers) {
+        ::operator delete(buffer, std::align_val_t(BlockAlignment));
+    }
+}
+
+void StreamingWavWriter::write(const float *frames, uint64_t n_frames) {
+    if (_closed) {
+        throw std::runtime_error(_file_path.string() + " is already closed");
+    }
+    const uint8_t *bytes = (const uint8_t *) frames;
+    uint64_t n_left = n_frames * _n_channels * sizeof(float);
+    while (n_left > 0) {
+        uint64_t &filled = _filled[_fill_ind];
+        const uint64_t n = MIN(n_left, _buffer_size - filled);
+        std::memcpy(_buffers[_fill_ind] + filled, bytes, n);
+        filled += n;
+        bytes += n;
+        n_left -= n;
+        _n_bytes += n;
+        if (filled == _buffer_size) {
+            _queue_buffer();
+        }
+    }
+}
+
+void StreamingWavWriter::close() {
+    if (_closed) {
+        return;
+    }
+    _closed = true;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_filled[_fill_ind] > 0) {
+            _n_full++;
+        }
+        _closing = true;
+    }
+    _queued.notify_one();
+    _thread.join();
+
+    // the sizes are only known now
+    if (!_error) {
+        try {
+            uint8_t header[BlockAlignment];
+            _make_header(header, get_n_frames());
+            _write_file(0, header, BlockAlignment);
+        }
+        catch (const std::exception &) {
+            _error = std::current_exception();
+        }
+    }
+    _close_file();
+    _rethrow_error();
+}
+
+void StreamingWavWriter::_make_header(uint8_t *header, uint64_t n_frames) const {
+    const uint32_t frame_size = sizeof(float) * _n_channels;
+    const uint64_t data_size = n_frames * frame_size;
+    const uint64_t riff_size = BlockAlignment - 8 + data_size;
+    const bool is_64 = riff_size > MaxRIFFSize;
+
+    std::memset(header, 0, BlockAlignment);
+    std::memcpy(header, is_64 ? "RF64" : "RIFF", 4);
+    write_le(header + 4, is_64 ? RF64Size : riff_size, 4);
+    std::memcpy(header + 8, "WAVE", 4);
+
+    // room for the ds64 chunk RF64 keeps its sizes in, left as junk while they fit in the RIFF header
+    std::memcpy(header + 12, is_64 ? "ds64" : "JUNK", 4);
+    write_le(header + 16, 28, 4);
+    if (is_64) {
+        // and then the length of a table of other chunks' sizes, of which there are none
+        write_le(header + 20, riff_size, 8);
+        write_le(header + 28, data_size, 8);
+        write_le(header + 36, n_frames, 8);
+    }
+
+    std::memcpy(header + 48, "fmt ", 4);
+    write_le(header + 52, 16, 4);
+    write_le(header + 56, WaveFloat, 2);
+    write_le(header + 58, _n_channels, 2);
+    write_le(header + 60, _sample_rate, 4);
+    write_le(header + 64, (uint64_t) _sample_rate * frame_size, 4);
+    write_le(header + 68, frame_size, 2);
+    write_le(header + 70, 32, 2);
+
+    // padding, so the samples start BlockAlignment in
+    std::memcpy(header + 72, "JUNK", 4);
+    write_le(header + 76, BlockAlignment - 72 - 16, 4);
+
+    std::memcpy(header + BlockAlignment - 8, "data", 4);
+    write_le(header + BlockAlignment - 4, is_64 ? RF64Size : data_size, 4);
+}
+
+void StreamingWavWriter::_queue_buffer() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _n_full++;
+    _queued.notify_one();
+    // the disk has fallen behind, so rendering waits for it rather than buffering more
+    if (_n_full == _buffers.size()) {
+        const auto start = std::chrono::steady_clock::now();
+        _written.wait(lock, [this] () { return _n_full < _buffers.size(); });
+        _blocked_time += std::chrono::steady_clock::now() - start;
+        _n_blocked++;
+    }
+    const std::exception_ptr error = _error;
+    lock.unlock();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    _fill_ind = (_fill_ind + 1) % _buffers.size();
+    _filled[_fill_ind] = 0;
+}
+
+void StreamingWavWriter::_run() {
+    uint64_t offset = 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _queued.wait(lock, [this] () { return _n_full > 0 || _closing; });
+        if (_n_full == 0) {
+            return;
+        }
+        // once writing has failed the rest are let go of unwritten, so write never waits on them
+        const bool failed = (bool) _error;
+        lock.unlock();
+
+        std::exception_ptr error;
+        if (!failed) {
+            try {
+                _write_file(offset, _buffers[_write_ind], _filled[_write_ind]);
+            }
+            catch (const std::exception &) {
+                error = std::current_exception();
+            }
+        }
+        offset += _filled[_write_ind];
+        _write_ind = (_write_ind + 1) % _buffers.size();
+
+        lock.lock();
+        if (error) {
+            _error = error;
+        }
+        _n_full--;
+        _written.notify_one();
+    }
+}
+
+void StreamingWavWriter::_write_file(uint64_t offset, const uint8_t *bytes, uint64_t n_bytes) {
+    while (n_bytes > 0) {
+#ifdef _WIN32
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = (DWORD) offset;
+        overlapped.OffsetHigh = (DWORD) (offset >> 32);
+        DWORD n = 0;
+        if (!WriteFile((HANDLE) _file, bytes, (DWORD) MIN(n_bytes, (uint64_t) 1 << 30), &n, &overlapped) || n == 0) {
+            throw std::runtime_error("Could not write to " + _file_path.string());
+        }
+#else
+        const ssize_t n = pwrite(_file, bytes, n_bytes, (off_t) offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error("Could not write to " + _file_path.string());
+        }
+#endif
+        offset += n;
+        bytes += n;
+        n_bytes -= n;
+    }
+}
+
+void StreamingWavWriter::_close_file() {
+#ifdef _WIN32
+    const bool closed = CloseHandle((HANDLE) _file);
+#else
+    // some file systems only report failed writes here
+    const bool closed = ::close(_file) == 0;
+#endif
+    if (!closed && !_error) {
+        _error = std::make_exception_ptr(std::runtime_error("Could not write to " + _file_path.string()));
+    }
+}
+
+void StreamingWavWriter::_rethrow_error() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_error) {
+        std::rethrow_exception(_error);
+    }
+}
@@ -0,0 +1,116 @@
+/**
+ * @file wavwriter.h
+ * @brief Writes rendered audio to a .wav as it is made, from a thread of its own so rendering does not wait on the disk
+ */
+#ifndef MENGU_WAV_WRITER
+#define MENGU_WAV_WRITER
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace Mengu {
+
+// Writes 32 bit float frames to a .wav a buffer at a time. Frames written are copied into the buffer being filled, and
+// full ones are written out to the file on the writer's own thread. Writing only blocks when every buffer is still
+// waiting on the disk, so a disk that falls behind holds rendering back rather than letting buffers pile up.
+// Files that grow past what a RIFF header can hold, 4GB, are made RF64
+class StreamingWavWriter {
+public:
+    // Buffers are aligned in memory to this, and so are the offsets they are written at in the file, as disks and page
+    // caches are. The header is padded out to it
+    static constexpr uint64_t BlockAlignment = 4096;
+    // bytes written to the file at a time
+    static constexpr uint64_t DefaultBufferSize = 1 << 22;
+    // one being filled while the others are written
+    static constexpr uint32_t DefaultNBuffers = 3;
+
+    // n_channels interleaved channels. buffer_size is rounded up to a multiple of BlockAlignment.
+    // Throws std::runtime_error if it cannot be opened
+    StreamingWavWriter(const fs::path &file_path, uint32_t sample_rate, uint32_t n_channels,
+        uint64_t buffer_size = DefaultBufferSize, uint32_t n_buffers = DefaultNBuffers);
+    // closes it if it has not been, ignoring errors. Call close to hear of them
+    ~StreamingWavWriter();
+
+    StreamingWavWriter(const StreamingWavWriter &) = delete;
+    StreamingWavWriter &operator=(const StreamingWavWriter &) = delete;
+
+    // Copies n_frames interleaved frames in, blocking while every other buffer is waiting to be written.
+    // Throws std::runtime_error if an earlier buffer could not be written
+    void write(const float *frames, uint64_t n_frames);
+    // Writes out what is left and the sizes in the header, and closes the file.
+    // Throws std::runtime_error if any of it could not be written
+    void close();
+
+    inline uint32_t get_n_channels() const {
+        return _n_channels;
+    }
+    // frames written so far
+    inline uint64_t get_n_frames() const {
+        return _n_bytes / (sizeof(float) * _n_channels);
+    }
+    // how long write spent blocked on the disk, and how many times it was
+    inline double get_blocked_seconds() const {
+        return std::chrono::duration<double>(_blocked_time).count();
+    }
+    inline uint32_t get_n_blocked() const {
+        return _n_blocked;
+    }
+
+private:
+    fs::path _file_path;
+    uint32_t _sample_rate;
+    uint32_t _n_channels;
+#ifdef _WIN32
+    void *_file = nullptr;
+#else
+    int _file = -1;
+#endif
+    bool _closed = false;
+
+    uint64_t _buffer_size;
+    // aligned to BlockAlignment, filled in turn
+    std::vector<uint8_t *> _buffers;
+    // bytes filled of each
+    std::vector<uint64_t> _filled;
+    // the buffer being filled, and the next the thread writes
+    uint32_t _fill_ind = 0;
+    uint32_t _write_ind = 0;
+    // bytes of samples written, which the header is not counted in
+    uint64_t _n_bytes = 0;
+
+    std::chrono::steady_clock::duration _blocked_time {0};
+    uint32_t _n_blocked = 0;
+
+    std::thread _thread;
+    // guards everything below
+    std::mutex _mutex;
+    std::condition_variable _queued;
+    std::condition_variable _written;
+    // buffers handed to the thread that it has not finished writing
+    uint32_t _n_full = 0;
+    bool _closing = false;
+    // what stopped the thread writing, thrown by the next write or close
+    std::exception_ptr _error;
+
+    // the header of a file of n_frames frames, BlockAlignment bytes long
+    void _make_header(uint8_t *header, uint64_t n_frames) const;
+    // hands the buffer being filled to the thread and waits for the next one to be free
+    void _queue_buffer();
+    // writes full buffers in turn until closed
+    void _run();
+    void _write_file(uint64_t offset, const uint8_t *bytes, uint64_t n_bytes);
+    void _close_file();
+    void _rethrow_error();
+};
+
+} // namespace Mengu
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ * @file bucketqueue.h
+ * @brief A max priority queue for small integer priorities. Values are kept in a bucket per priority,
+ *  so pushing only has to find its place in a (usually short) bucket and popping only has to skip past empty buckets
+ */
+#ifndef MENGA_BUCKETQUEUE
+#define MENGA_BUCKETQUEUE
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Mengu {
+
+// Values of the same priority are popped in last-in-first-out order, 
+// or largest first if they are pushed with a comparison.
+// Storage is allocated by resize(), so pushing and popping never allocate
+template<class T>
+class BucketQueue {
+public:
+    BucketQueue() {}
+    BucketQueue(uint32_t n_buckets, uint32_t capacity) {
+        resize(n_buckets, capacity);
+    }
+
+    // priorities must be less than n_buckets, and at most capacity values may be pushed between clears
+    void resize(uint32_t n_buckets, uint32_t capacity) {
+        _heads.resize(n_buckets);
+        _nodes.resize(capacity);
+        clear();
+    }
+
+    void clear() {
+        std::fill(_heads.begin(), _heads.end(), NoNode);
+        _n_used = 0;
+        _size = 0;
+        _top = 0;
+    }
+
+    inline void push(const T &value, uint32_t priority) {
+        _link_node(value, priority, &_heads[priority]);
+    }
+
+    // Keeps the bucket sorted by less, so a full ordering costs only the length of the bucket.
+    // That is linear in what is already in it, so push what many values share without one
+    template<class Less>
+    inline void push(const T &value, uint32_t priority, Less less) {
+        uint32_t *link = &_heads[priority];
+        while (*link != NoNode && less(value, _nodes[*link].value)) {
+            link = &_nodes[*link].next;
+        }
+        _link_node(value, priority, link);
+    }
+
+    // removes and returns a value with the highest priority. The queue must not be empty
+    inline T pop() {
+        while (_heads[_top] == NoNode) {
+            _top -= 1;
+        }
+        const Node &node = _nodes[_heads[_top]];
+        _heads[_top] = node.next;
+        _size -= 1;
+        return node.value;
+    }
+
+    inline uint32_t size() const {
+        return _size;
+    }
+
+    inline bool empty() const {
+        return _size == 0;
+    }
+
+private:
+    static constexpr uint32_t NoNode = UINT32_MAX;
+
+    // each bucket is a singly linked list through _nodes
+    struct Node {
+        T value;
+        uint32_t next;
+    };
+
+    std::vector<uint32_t> _heads;
+    std::vector<Node> _nodes;
+
+    // nodes are not reused until the next clear
+    uint32_t _n_used = 0;
+    uint32_t _size = 0;
+    // no bucket above this is occupied
+    uint32_t _top = 0;
+
+    // inserts a new node where link points
+    inline void _link_node(const T &value, uint32_t priority, uint32_t *link) {
+        _nodes[_n_used] = Node {.value = value, .next = *link};
+        *link = _n_used;
+        _n_used += 1;
+        _size += 1;
+        _top = priority > _top ? priority : _top;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,109 @@
+/**
+ * @file spscqueue.h
+ * @brief A fixed-size ring buffer that one thread can push to while another pops from it, without locking.
+ *  For handing audio between a device callback and a thread of its own
+ */
+#ifndef MENGA_SPSC_QUEUE
+#define MENGA_SPSC_QUEUE
+
+#include <atomic>
+#include <cstdint>
+
+namespace Mengu {
+
+template<class T>
+class SPSCQueue {
+private:
+    T *_data = nullptr;
+    // capacity - 1, as the capacity is a power of 2
+    uint32_t _mask = 0;
+
+    // Counts of everything ever popped and pushed, which wrap around. Each is only written by its own end.
+    // Kept on separate cache lines so the ends do not keep taking the line from each other
+    alignas(64) std::atomic<uint32_t> _n_popped {0};
+    alignas(64) std::atomic<uint32_t> _n_pushed {0};
+
+public:
+    SPSCQueue() {}
+    SPSCQueue(uint32_t capacity) {
+        resize(capacity);
+    }
+    ~SPSCQueue() {
+        delete[] _data;
+    }
+
+    SPSCQueue(const SPSCQueue &) = delete;
+    SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+    // Rounds capacity up to a power of 2 and empties the queue.
+    // Neither end may be in use, as with clear
+    void resize(uint32_t capacity) {
+        uint32_t new_capacity = 1;
+        while (new_capacity < capacity) {
+            new_capacity <<= 1;
+        }
+        if (new_capacity != _mask + 1 || _data == nullptr) {
+            delete[] _data;
+            _data = new T[new_capacity];
+            _mask = new_capacity - 1;
+        }
+        clear();
+    }
+
+    void clear() {
+        _n_popped.store(0, std::memory_order_relaxed);
+        _n_pushed.store(0, std::memory_order_relaxed);
+    }
+
+    inline uint32_t capacity() const {
+        return _data == nullptr ? 0 : _mask + 1;
+    }
+
+    // Exact from the popping end. From the pushing end, only ever more than there are
+    inline uint32_t size() const {
+        return _n_pushed.load(std::memory_order_acquire) - _n_popped.load(std::memory_order_acquire);
+    }
+    // Exact from the pushing end. From the popping end, only ever less than there is
+    inline uint32_t space() const {
+        return capacity() - size();
+    }
+
+    // Pushes as many of the n items as fit, returning how many that was. Only call from one thread at a time
+    uint32_t push(const T *items, uint32_t n) {
+        const uint32_t n_pushed = _n_pushed.load(std::memory_order_relaxed);
+        const uint32_t n_popped = _n_popped.load(std::memory_order_acquire);
+        const uint32_t space = capacity() - (n_pushed - n_popped);
+        n = n < space ? n : space;
+        for (uint32_t i = 0; i < n; i++) {
+            _data[(n_pushed + i) & _mask] = items[i];
+        }
+        _n_pushed.store(n_pushed + n, std::memory_order_release);
+        return n;
+    }
+
+    // Pops up to n items into items, returning how many there were. Only call from one thread at a time
+    uint32_t pop(T *items, uint32_t n) {
+        const uint32_t n_popped = _n_popped.load(std::memory_order_relaxed);
+        const uint32_t n_pushed = _n_pushed.load(std::memory_order_acquire);
+        const uint32_t size = n_pushed - n_popped;
+        n = n < size ? n : size;
+        for (uint32_t i = 0; i < n; i++) {
+            items[i] = _data[(n_popped + i) & _mask];
+        }
+        _n_popped.store(n_popped + n, std::memory_order_release);
+        return n;
+    }
+
+    // Pops up to n items without reading them, returning how many there were. From the popping end, as with pop
+    uint32_t drop(uint32_t n) {
+        const uint32_t n_popped = _n_popped.load(std::memory_order_relaxed);
+        const uint32_t size = _n_pushed.load(std::memory_order_acquire) - n_popped;
+        n = n < size ? n : size;
+        _n_popped.store(n_popped + n, std::memory_order_release);
+        return n;
+    }
+};
+
+};
+
+#endif
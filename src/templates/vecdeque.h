@@ -184,6 +184,14 @@ public:
         }
     }
 
+    // elements i onwards that are next to each other in memory, up to the end of the queue.
+    // Any after those carry on from the start of the storage
+    inline T *contiguous_from(const uint32_t i, uint32_t &n_contiguous) {
+        const uint32_t start = (_front + i) % _capacity;
+        n_contiguous = MIN(_size - i, _capacity - start);
+        return _data + start;
+    }
+
     //// Operators
     inline T &operator[](int i) {
         if (_size == 0) {
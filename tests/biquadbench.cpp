@@ -0,0 +1,152 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "dsp/filter.h"
+#include "mengumath.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// A cascade of biquads over a lone channel a block at a time, and over many channels a register at a time,
+// against running BiquadFilters one after the other. Errors are from the same filters run in double precision.
+// The high pass's poles sit close to 1, so its intermediaries grow into the thousands and even float BiquadFilters drift
+
+static constexpr uint32_t SignalSize = 1 << 16;
+static constexpr uint32_t NRuns = 20;
+// filtered in pieces this size, like an effect's frames, so state is carried between them
+static constexpr uint32_t FrameSize = 1000;
+
+// the K-weighting stages at 48kHz
+static constexpr BiquadCoefficients Stages[2] = {
+    {-1.69065929318241f, 0.73248077421585f, 1.53512485958697f, -2.69169618940638f, 1.19839281085285f},
+    {-1.99004745483398f, 0.99007225036621f, 1.0f, -2.0f, 1.0f},
+};
+
+static std::vector<float> make_signal(uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+    std::vector<float> signal(SignalSize);
+    for (uint32_t i = 0; i < SignalSize; i++) {
+        signal[i] = 0.5f * std::sin(0.01f * i) + noise(rng);
+    }
+    return signal;
+}
+
+static std::vector<double> filter_exact(const std::vector<float> &input) {
+    double m1s[2] = {0.0};
+    double m2s[2] = {0.0};
+    std::vector<double> output(input.size());
+    for (uint32_t i = 0; i < input.size(); i++) {
+        double x = input[i];
+        for (uint32_t s = 0; s < 2; s++) {
+            const double m = x - (double) Stages[s].a1 * m1s[s] - (double) Stages[s].a2 * m2s[s];
+            x = Stages[s].b0 * m + Stages[s].b1 * m1s[s] + Stages[s].b2 * m2s[s];
+            m2s[s] = m1s[s];
+            m1s[s] = m;
+        }
+        output[i] = x;
+    }
+    return output;
+}
+
+static std::vector<float> filter_biquads(const std::vector<float> &input) {
+    BiquadFilter first(Stages[0].a1, Stages[0].a2, Stages[0].b0, Stages[0].b1, Stages[0].b2);
+    BiquadFilter second(Stages[1].a1, Stages[1].a2, Stages[1].b0, Stages[1].b1, Stages[1].b2);
+    std::vector<float> output(input.size());
+    for (uint32_t start = 0; start < input.size(); start += FrameSize) {
+        const uint32_t n = MIN(FrameSize, (uint32_t) input.size() - start);
+        first.transform(input.data() + start, output.data() + start, n);
+        second.transform(output.data() + start, output.data() + start, n);
+    }
+    return output;
+}
+
+static double max_error(const std::vector<double> &exact, const std::vector<float> &output) {
+    double worst = 0.0;
+    for (uint32_t i = 0; i < exact.size(); i++) {
+        worst = MAX(worst, std::abs(exact[i] - output[i]));
+    }
+    return worst;
+}
+
+// times f over the whole signal, in ns per sample of each channel
+template<class F>
+static double time_ns(F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t run = 0; run < NRuns; run++) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / NRuns / SignalSize;
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(2);
+
+    const std::vector<float> input = make_signal(1);
+    const std::vector<double> exact = filter_exact(input);
+
+    std::cout << "-- one channel (ns per sample)" << std::endl;
+    {
+        std::vector<float> biquad_output;
+        const double biquad_ns = time_ns([&]() {
+            biquad_output = filter_biquads(input);
+        });
+
+        BiquadCascade cascade;
+        cascade.set_stages(Stages, 2);
+        std::vector<float> output(SignalSize);
+        const double block_ns = time_ns([&]() {
+            cascade.reset();
+            for (uint32_t start = 0; start < SignalSize; start += FrameSize) {
+                const uint32_t n = MIN(FrameSize, SignalSize - start);
+                cascade.transform(input.data() + start, output.data() + start, n);
+            }
+        });
+        std::cout << "BiquadFilters " << std::setw(6) << biquad_ns
+            << std::setprecision(6) << "  error " << max_error(exact, biquad_output) << std::setprecision(2) << std::endl;
+        std::cout << "block cascade " << std::setw(6) << block_ns
+            << std::setprecision(6) << "  error " << max_error(exact, output) << std::setprecision(2) << std::endl;
+    }
+
+    std::cout << "-- many channels (ns per sample of each channel)" << std::endl;
+    for (uint32_t n_channels: {2u, 4u, 7u, 16u}) {
+        std::vector<std::vector<float>> inputs;
+        std::vector<std::vector<double>> exacts;
+        std::vector<std::vector<float>> outputs(n_channels, std::vector<float>(SignalSize));
+        for (uint32_t c = 0; c < n_channels; c++) {
+            inputs.push_back(make_signal(c + 1));
+            exacts.push_back(filter_exact(inputs.back()));
+        }
+
+        BiquadCascade cascade(n_channels);
+        cascade.set_stages(Stages, 2);
+        std::vector<const float *> input_ptrs(n_channels);
+        std::vector<float *> output_ptrs(n_channels);
+        const double lanes_ns = time_ns([&]() {
+            cascade.reset();
+            for (uint32_t start = 0; start < SignalSize; start += FrameSize) {
+                const uint32_t n = MIN(FrameSize, SignalSize - start);
+                for (uint32_t c = 0; c < n_channels; c++) {
+                    input_ptrs[c] = inputs[c].data() + start;
+                    output_ptrs[c] = outputs[c].data() + start;
+                }
+                cascade.transform(input_ptrs.data(), output_ptrs.data(), n);
+            }
+        }) / n_channels;
+
+        double worst = 0.0;
+        for (uint32_t c = 0; c < n_channels; c++) {
+            worst = MAX(worst, max_error(exacts[c], outputs[c]));
+        }
+        std::cout << "channels " << std::setw(2) << n_channels
+            << "  lanes cascade " << std::setw(6) << lanes_ns
+            << std::setprecision(6) << "  error " << worst
+            << std::setprecision(2) << std::endl;
+    }
+}
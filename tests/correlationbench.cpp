@@ -0,0 +1,233 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "dsp/common.h"
+#include "dsp/correlation.h"
+#include "dsp/linalg.h"
+#include "mengumath.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// Compares the direct and FFT cross-correlation searches over the window and search sizes used by the stretchers
+
+struct BenchCase {
+    const char *name;
+    int length;
+    int n_lags;
+};
+
+static std::vector<Complex> make_signal(uint32_t size, uint32_t seed) {
+    std::vector<Complex> signal(size);
+    std::srand(seed);
+    for (uint32_t i = 0; i < size; i++) {
+        float noise = (float) std::rand() / RAND_MAX - 0.5f;
+        signal[i] = std::sin(MATH_TAU * i / 97.0f) + 0.5f * std::sin(MATH_TAU * i / 13.0f) + 0.2f * noise;
+    }
+    return signal;
+}
+
+// average time of a call in microseconds
+template<class F>
+static double time_us(F f, uint32_t n_iters) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < n_iters; i++) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / n_iters;
+}
+
+int main() {
+    const BenchCase cases[] = {
+        {"WSOLA (overlap 128, search 102)", 1 << 9 >> 2, (1 << 9) / 5},
+        {"OLA 1024 (overlap 204, search 512)", 1024 / 5, 1024 / 2},
+        {"OLA 2048 (overlap 409, search 1024)", 2048 / 5, 2048 / 2},
+        {"Long (overlap 1024, search 1024)", 1024, 1024},
+    };
+
+    std::cout << std::fixed << std::setprecision(2);
+
+    bool all_match = true;
+    for (const BenchCase &bench: cases) {
+        const int span = bench.length + bench.n_lags;
+        std::vector<Complex> s1 = make_signal(bench.length, 1);
+        std::vector<Complex> s2 = make_signal(span, 2);
+
+        CrossCorrelator correlator(span);
+
+        // make sure both methods agree
+        std::vector<float> direct(bench.n_lags);
+        std::vector<float> fft(bench.n_lags);
+        correlator.set_method(CrossCorrelator::Direct);
+        correlator.correlate(s1.data(), s2.data(), bench.length, bench.n_lags, direct.data());
+        correlator.set_method(CrossCorrelator::FFTBased);
+        correlator.correlate(s1.data(), s2.data(), bench.length, bench.n_lags, fft.data());
+
+        float max_corr = 0.0f;
+        float max_err = 0.0f;
+        for (int k = 0; k < bench.n_lags; k++) {
+            max_corr = MAX(max_corr, std::abs(direct[k]));
+            max_err = MAX(max_err, std::abs(direct[k] - fft[k]));
+        }
+        const float rel_err = max_err / max_corr;
+        all_match &= rel_err < 1e-3f;
+
+        const uint32_t n_iters = MAX(100, 20000000 / (bench.length * bench.n_lags));
+        volatile int sink = 0;
+
+        const double t_brute = time_us([&] () {
+            sink = sink + Mengu::dsp::find_max_correlation(s1.data(), s2.data(), bench.length, bench.n_lags);
+        }, n_iters);
+
+        correlator.set_method(CrossCorrelator::Direct);
+        const double t_direct = time_us([&] () {
+            sink = sink + correlator.find_max_correlation(s1.data(), s2.data(), bench.length, bench.n_lags);
+        }, n_iters);
+
+        correlator.set_method(CrossCorrelator::FFTBased);
+        const double t_fft = time_us([&] () {
+            sink = sink + correlator.find_max_correlation(s1.data(), s2.data(), bench.length, bench.n_lags);
+        }, n_iters);
+
+        correlator.set_method(CrossCorrelator::Auto);
+        const double t_auto = time_us([&] () {
+            sink = sink + correlator.find_max_correlation(s1.data(), s2.data(), bench.length, bench.n_lags);
+        }, n_iters);
+
+        std::cout << bench.name << "\n"
+                  << "    brute force:  " << t_brute << " us\n"
+                  << "    direct:       " << t_direct << " us\n"
+                  << "    fft:          " << t_fft << " us\n"
+                  << "    auto (" << (correlator.uses_fft(bench.length, bench.n_lags) ? "fft" : "direct") << "): "
+                  << t_auto << " us\n"
+                  << "    fft relative error: " << std::scientific << rel_err << std::fixed << "\n";
+    }
+
+    // Coarse-to-fine search at the WSOLA sizes. Reports how far off the decimated lag is from the full-rate search
+    const char *measure_names[] = {"cross-correlation", "normalised cross-correlation", "AMDF"};
+    const int length = (1 << 9) / 4;
+    const int n_lags = (1 << 9) / 5;
+    const uint32_t n_trials = 200;
+    std::vector<Complex> s = make_signal(length * 64 + n_lags, 3);
+    CrossCorrelator correlator(length + n_lags);
+
+    std::cout << "Coarse-to-fine search (overlap " << length << ", search " << n_lags << ")\n";
+    for (int measure = CrossCorrelation; measure <= AMDF; measure++) {
+        std::cout << "  " << measure_names[measure] << "\n";
+        for (uint32_t decimation = 1; decimation <= 8; decimation *= 2) {
+            float total_lag_error = 0.0f;
+            for (uint32_t trial = 0; trial < n_trials; trial++) {
+                const Complex *s1 = s.data() + trial * 17;
+                const Complex *s2 = s.data() + trial * 17 + length / 2;
+                int exact = correlator.find_best_lag(s1, s2, length, n_lags, (SimilarityMeasure) measure, 1);
+                int coarse = correlator.find_best_lag(s1, s2, length, n_lags, (SimilarityMeasure) measure, decimation);
+                total_lag_error += std::abs(exact - coarse);
+            }
+
+            volatile int sink = 0;
+            const double t = time_us([&] () {
+                sink = sink + correlator.find_best_lag(s.data(), s.data() + 7, length, n_lags, (SimilarityMeasure) measure, decimation);
+            }, 5000);
+
+            std::cout << "    decimation " << decimation << ": " << t << " us, mean lag error " 
+                      << total_lag_error / n_trials << " samples\n";
+        }
+    }
+
+    // OLA searches with the middle of the overlap weighted most, with each measure. s1 is a quieter copy of part of s2,
+    // away from a louder stretch of it. Measures that are not swayed by loudness should find the copy, at the full rate
+    // and decimated. Cross-correlation favours loud parts, so it is only reported
+    {
+        const int ola_length = 1024 / 5;
+        const int ola_lags = 1024 / 2;
+        const int planted_lag = 317;
+        std::vector<Complex> s2(ola_length + ola_lags);
+        std::srand(5);
+        float smoothed = 0.0f;
+        for (Complex &sample: s2) {
+            // noise low passed a little, so neighbouring lags are close but no two are alike
+            smoothed = 0.7f * smoothed + 0.3f * ((float) std::rand() / RAND_MAX - 0.5f);
+            sample = smoothed;
+        }
+        for (int i = 0; i < ola_length; i++) {
+            s2[i] *= 8.0f;
+        }
+        std::vector<Complex> s1(ola_length);
+        for (int i = 0; i < ola_length; i++) {
+            s1[i] = 0.5f * s2[planted_lag + i];
+        }
+        CrossCorrelator ola_correlator(ola_length + ola_lags);
+
+        std::cout << "Quad weighted OLA search (overlap " << ola_length << ", search " << ola_lags << ")\n";
+        for (int measure = CrossCorrelation; measure <= AMDF; measure++) {
+            for (uint32_t decimation: {1u, 4u}) {
+                const int lag = ola_correlator.find_best_lag(s1.data(), s2.data(), ola_length, ola_lags,
+                                                             (SimilarityMeasure) measure, decimation, true);
+                volatile int sink = 0;
+                const double t = time_us([&] () {
+                    sink = sink + ola_correlator.find_best_lag(s1.data(), s2.data(), ola_length, ola_lags,
+                                                               (SimilarityMeasure) measure, decimation, true);
+                }, 2000);
+                const bool found = lag == planted_lag || measure == CrossCorrelation;
+                all_match &= found;
+                std::cout << "  " << measure_names[measure] << ", decimation " << decimation << ": " << t << " us, lag "
+                          << lag << (found ? "" : " (WRONG)") << "\n";
+            }
+        }
+    }
+
+    // Vectorised kernels against the plain template loop
+    std::cout << "SIMD kernels (" << simd_kernel_name() << ")\n";
+    for (int size: {128, 512, 2048}) {
+        std::vector<float> a(size + 128);
+        std::vector<float> b(size + 128);
+        std::vector<Complex> signal = make_signal(size + 128, 4);
+        for (int i = 0; i < size + 128; i++) {
+            a[i] = signal[i].real();
+            b[i] = signal[(i * 7) % (size + 128)].real();
+        }
+
+        const float template_total = dot<float>(a.data(), b.data(), size);
+        const float simd_total = dot((const float *) a.data(), (const float *) b.data(), size);
+        const bool dot_match = std::abs(template_total - simd_total) <= 1e-4f * (std::abs(template_total) + size);
+        all_match &= dot_match;
+
+        const uint32_t n_iters = 20000000 / size;
+        volatile float sink = 0.0f;
+        const double t_template = time_us([&] () {
+            sink = sink + dot<float>(a.data(), b.data(), size);
+        }, n_iters);
+        const double t_simd = time_us([&] () {
+            sink = sink + dot((const float *) a.data(), (const float *) b.data(), size);
+        }, n_iters);
+        const double t_squares = time_us([&] () {
+            sink = sink + sum_squares(a.data(), size);
+        }, n_iters);
+
+        std::vector<float> lags(128);
+        const double t_sliding = time_us([&] () {
+            sliding_dot(a.data(), b.data(), size, 128, lags.data());
+            sink = sink + lags[0];
+        }, n_iters / 128 + 1);
+        const double t_sliding_template = time_us([&] () {
+            for (int k = 0; k < 128; k++) {
+                lags[k] = dot<float>(a.data(), b.data() + k, size);
+            }
+            sink = sink + lags[0];
+        }, n_iters / 128 + 1);
+
+        std::cout << "  size " << size << (dot_match ? "" : " (MISMATCH)") << "\n"
+                  << "    dot template: " << t_template * 1000.0 << " ns, simd: " << t_simd * 1000.0 << " ns\n"
+                  << "    sum_squares:  " << t_squares * 1000.0 << " ns\n"
+                  << "    128 lags template: " << t_sliding_template << " us, sliding_dot: " << t_sliding << " us\n";
+    }
+
+    std::cout << (all_match ? "All methods match" : "Methods DIFFER") << std::endl;
+    return all_match ? 0 : 1;
+}
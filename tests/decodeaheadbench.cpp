@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "audioplayers/Decodeaheadreader.h"
+#include "offline/audiofile.h"
+
+using namespace Mengu;
+
+// How long an audio callback takes to get its frames when it reads the source itself, against reading what a
+// DecodeAheadReader decoded ahead. The source stalls now and then, as disks and codecs do, so read directly, those
+// stalls land on the callback and it misses its deadline. Through the reader, callbacks should only copy.
+// Each frame of the source is its own index, so what is read can be checked frame for frame, including after a seek
+
+static constexpr uint32_t SampleRate = 44100;
+static constexpr uint32_t PlaySeconds = 4;
+static constexpr uint32_t BufferSize = 256;
+// how often the source stalls, and for how long
+static constexpr uint32_t StallEvery = SampleRate / 4;
+static constexpr uint32_t StallMs = 30;
+
+// a mono source that counts up, which stalls every StallEvery frames read
+class StallingSource: public AudioSource {
+public:
+    uint64_t length;
+
+    StallingSource(uint64_t n_frames): length(n_frames) {}
+
+    virtual uint32_t get_sample_rate() const override {
+        return SampleRate;
+    }
+    virtual uint32_t get_n_channels() const override {
+        return 1;
+    }
+
+    virtual uint64_t read(float *output, uint64_t n_frames) override {
+        n_frames = std::min(n_frames, length - _position);
+        if ((_position + n_frames) / StallEvery != _position / StallEvery) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(StallMs));
+        }
+        for (uint64_t i = 0; i < n_frames; i++) {
+            output[i] = (float) (_position + i);
+        }
+        _position += n_frames;
+        return n_frames;
+    }
+
+    virtual bool seek(uint64_t frame) override {
+        _position = std::min(frame, length);
+        return true;
+    }
+
+private:
+    uint64_t _position = 0;
+};
+
+struct CallbackCost {
+    double mean_us;
+    double p99_us;
+    double worst_us;
+    // callbacks that took longer than the buffer lasts
+    uint32_t n_late;
+};
+
+// Calls read every BufferSize frames' worth of time for PlaySeconds, like a device would, timing each call.
+// Calls seek_at once, after half of them
+static CallbackCost play(const std::function<uint32_t(float *, uint32_t)> &read, const std::function<void()> &seek_at) {
+    using clock = std::chrono::steady_clock;
+    const uint32_t n_callbacks = PlaySeconds * SampleRate / BufferSize;
+    const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>((double) BufferSize / SampleRate));
+    std::vector<float> output(BufferSize);
+    std::vector<double> costs;
+    costs.reserve(n_callbacks);
+
+    uint32_t n_late = 0;
+    auto next = clock::now();
+    for (uint32_t i = 0; i < n_callbacks; i++) {
+        if (i == n_callbacks / 2) {
+            seek_at();
+        }
+        std::this_thread::sleep_until(next);
+        const auto start = clock::now();
+        read(output.data(), BufferSize);
+        const auto end = clock::now();
+        costs.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        n_late += end - start > period ? 1 : 0;
+        next += period;
+    }
+
+    std::sort(costs.begin(), costs.end());
+    double total = 0.0;
+    for (double cost: costs) {
+        total += cost;
+    }
+    return {total / costs.size(), costs[costs.size() * 99 / 100], costs.back(), n_late};
+}
+
+static void print_cost(const char *name, const CallbackCost &cost) {
+    std::cout << name
+        << "  mean " << std::setw(7) << cost.mean_us << "us"
+        << "  p99 " << std::setw(7) << cost.p99_us << "us"
+        << "  worst " << std::setw(8) << cost.worst_us << "us"
+        << "  late " << cost.n_late;
+}
+
+// Checks frames read count up from where they started, or from the seek once they jump to it.
+// Returns how many broke from that
+struct Checker {
+    uint64_t next = 0;
+    uint64_t seek_frame = 0;
+    bool seeked = false;
+    uint32_t n_wrong = 0;
+
+    void check(const float *frames, uint32_t n) {
+        for (uint32_t i = 0; i < n; i++) {
+            const uint64_t frame = (uint64_t) frames[i];
+            if (seeked && frame == seek_frame) {
+                seeked = false;
+                next = frame;
+            }
+            n_wrong += frame != next ? 1 : 0;
+            next = frame + 1;
+        }
+    }
+};
+
+int main() {
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "buffer " << BufferSize << " (" << 1e6 * BufferSize / SampleRate << "us), source stalls "
+        << StallMs << "ms every " << StallEvery << " frames" << std::endl;
+
+    const uint64_t length = 2 * PlaySeconds * SampleRate;
+    const uint64_t seek_frame = length - SampleRate;
+
+    {
+        StallingSource source(length);
+        Checker checker;
+        const CallbackCost cost = play([&] (float *output, uint32_t n_frames) {
+            const uint32_t n_read = source.read(output, n_frames);
+            checker.check(output, n_read);
+            return n_read;
+        }, [&] () {
+            source.seek(seek_frame);
+            checker.seek_frame = seek_frame;
+            checker.seeked = true;
+        });
+        print_cost("direct    ", cost);
+        std::cout << "  wrong frames " << checker.n_wrong << std::endl;
+    }
+
+    {
+        StallingSource source(length);
+        DecodeAheadReader reader;
+        reader.start(&source);
+        Checker checker;
+        uint32_t n_empty_after_seek = 0;
+        bool seeked = false;
+        const CallbackCost cost = play([&] (float *output, uint32_t n_frames) {
+            const uint32_t n_read = reader.read(output, n_frames);
+            checker.check(output, n_read);
+            n_empty_after_seek += seeked && checker.seeked && n_read == 0 ? 1 : 0;
+            return n_read;
+        }, [&] () {
+            // from another thread, as a GUI would
+            checker.seek_frame = seek_frame;
+            checker.seeked = true;
+            seeked = true;
+            std::thread([&] () { reader.seek(seek_frame); }).join();
+        });
+        reader.stop();
+        print_cost("read ahead", cost);
+        std::cout << "  wrong frames " << checker.n_wrong << "  underruns " << reader.get_n_underruns()
+            << "  empty reads after seek " << n_empty_after_seek << std::endl;
+    }
+}
@@ -0,0 +1,94 @@
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dsp/common.h"
+#include "dsp/pitchshifter.h"
+#include "dsp/timestretcher.h"
+#include "mengumath.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// How much output TimeStretchPitchShifter keeps queued, and how often it runs dry, for each stretcher.
+// The fill should settle around the target, with no underruns once it has
+
+static constexpr uint32_t SampleRate = 44100;
+static constexpr uint32_t NSeconds = 20;
+// the first seconds are the stretchers filling up, so are counted separately
+static constexpr uint32_t NWarmupSeconds = 2;
+
+static TimeStretcher *make_stretcher(uint32_t ind) {
+    switch (ind) {
+        case 0: return new WSOLATimeStretcher();
+        case 1: return new PhaseVocoderTimeStretcher();
+        case 2: return new PhaseVocoderDoneRightTimeStretcher();
+        default: return new PSOLATimeStretcher();
+    }
+}
+static const std::string StretcherNames[] = {"WSOLA", "PhaseVocoder", "PhaseVocoderDoneRight", "PSOLA"};
+
+static void measure(uint32_t stretcher_ind, float shift_factor, uint32_t block_size) {
+    TimeStretchPitchShifter shifter(make_stretcher(stretcher_ind), 1);
+    shifter.set_sample_rate(SampleRate);
+    shifter.set_shift_factor(shift_factor);
+
+    std::vector<Complex> input(block_size);
+    std::vector<Complex> output(block_size);
+    uint32_t t = 0;
+
+    const uint32_t n_blocks = NSeconds * SampleRate / block_size;
+    const uint32_t n_warmup_blocks = NWarmupSeconds * SampleRate / block_size;
+    uint32_t n_warmup_underruns = 0;
+    float min_fill = INFINITY;
+    float max_fill = -INFINITY;
+    double total_fill = 0.0;
+    for (uint32_t block = 0; block < n_blocks; block++) {
+        // a 200Hz tone with a few harmonics
+        for (Complex &x: input) {
+            x = 0.0f;
+            for (int h = 1; h <= 6; h++) {
+                x += std::sin(MATH_TAU * 200 * h * t / SampleRate) / h;
+            }
+            t++;
+        }
+
+        shifter.push_signal(input.data(), block_size);
+        shifter.pop_transformed_signal(output.data(), block_size);
+
+        const TimeStretchPitchShifter::DriftMetrics metrics = shifter.get_drift_metrics();
+        if (block < n_warmup_blocks) {
+            n_warmup_underruns = metrics.n_underruns;
+            continue;
+        }
+        min_fill = MIN(min_fill, metrics.fill);
+        max_fill = MAX(max_fill, metrics.fill);
+        total_fill += metrics.fill;
+    }
+
+    const TimeStretchPitchShifter::DriftMetrics metrics = shifter.get_drift_metrics();
+    std::cout << std::setw(22) << StretcherNames[stretcher_ind]
+        << " shift " << std::setprecision(1) << shift_factor << std::setprecision(0)
+        << " block " << std::setw(4) << block_size
+        << "  underruns " << std::setw(3) << metrics.n_underruns - n_warmup_underruns
+        << " (warmup " << n_warmup_underruns << ")"
+        << "  fill mean " << std::setw(6) << total_fill / (n_blocks - n_warmup_blocks)
+        << " min " << std::setw(6) << min_fill
+        << " max " << std::setw(6) << max_fill
+        << "  correction " << std::setprecision(3) << metrics.correction << std::setprecision(0)
+        << std::endl;
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(0);
+    for (uint32_t block_size: {128u, 512u}) {
+        for (float shift_factor: {0.7f, 1.0f, 1.5f, 2.0f}) {
+            for (uint32_t stretcher_ind = 0; stretcher_ind < 4; stretcher_ind++) {
+                measure(stretcher_ind, shift_factor, block_size);
+            }
+        }
+    }
+}
@@ -0,0 +1,152 @@
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "dsp/common.h"
+#include "dsp/fastmath.h"
+#include "mengumath.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// Checks the fast phase vocoder math against the standard library on the ranges the stretchers use,
+// and times the array versions over one window of bins
+
+// error bounds stated in fastmath.h
+static constexpr double Atan2Bound = 3e-6;
+static constexpr double SinCosBound = 2e-7;
+static constexpr double WrapBound = 1e-6;
+// phases are at most this large before being wrapped
+static constexpr float MaxPhase = 8192.0f;
+
+// average time of a call in microseconds
+template<class F>
+static double time_us(F f, uint32_t n_iters) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < n_iters; i++) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / n_iters;
+}
+
+int main() {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    double atan2_err = 0.0;
+    double sincos_err = 0.0;
+    double wrap_err = 0.0;
+    for (uint32_t i = 0; i < 1000000; i++) {
+        const float y = unit(rng) * (i % 3 == 0 ? 1000.0f : 1.0f);
+        const float x = unit(rng);
+        atan2_err = MAX(atan2_err, std::abs(fast_atan2(y, x) - std::atan2((double) y, (double) x)));
+
+        const float phase = unit(rng) * MaxPhase;
+        float s, c;
+        fast_sincos(phase, s, c);
+        sincos_err = MAX(sincos_err, std::abs(s - std::sin((double) phase)));
+        sincos_err = MAX(sincos_err, std::abs(c - std::cos((double) phase)));
+
+        // compare on the circle so that +-pi are the same
+        const double wrapped = fast_wrap_phase(phase);
+        const double exact = std::remainder((double) phase, MATH_TAU);
+        wrap_err = MAX(wrap_err, std::abs(std::sin(wrapped) - std::sin(exact)) + std::abs(std::cos(wrapped) - std::cos(exact)));
+        wrap_err = std::abs(wrapped) <= MATH_PI + 1e-3 ? wrap_err : 1.0;
+    }
+
+    // one window of bins, as in PhaseVocoderTimeStretcher
+    const uint32_t n_bins = 1 << 10;
+    std::vector<Complex> freqs(n_bins);
+    std::vector<float> mags(n_bins);
+    std::vector<float> phases(n_bins);
+    for (uint32_t i = 0; i < n_bins; i++) {
+        freqs[i] = Complex(unit(rng), unit(rng));
+        mags[i] = std::abs(unit(rng));
+        phases[i] = unit(rng) * MaxPhase;
+    }
+    std::vector<float> out(n_bins);
+    std::vector<Complex> out_freqs(n_bins);
+
+    // the array versions have their own vectorised paths, so check them too
+    fast_arg(freqs.data(), out.data(), n_bins);
+    for (uint32_t i = 0; i < n_bins; i++) {
+        atan2_err = MAX(atan2_err, std::abs(out[i] - std::arg(std::complex<double>(freqs[i]))));
+    }
+    fast_polar(mags.data(), phases.data(), out_freqs.data(), n_bins);
+    for (uint32_t i = 0; i < n_bins; i++) {
+        // mags are at most 1, so this is also the error of sin and cos
+        sincos_err = MAX(sincos_err, std::abs(std::complex<double>(out_freqs[i]) - std::polar((double) mags[i], (double) phases[i])));
+    }
+    fast_wrap_phase(phases.data(), out.data(), n_bins);
+    for (uint32_t i = 0; i < n_bins; i++) {
+        const double exact = std::remainder((double) phases[i], MATH_TAU);
+        wrap_err = MAX(wrap_err, std::abs(std::sin(out[i]) - std::sin(exact)) + std::abs(std::cos(out[i]) - std::cos(exact)));
+    }
+
+    // phases that round from exactly half a turn or quarter turn, where rounding halves away from zero and to even differ.
+    // The array versions should agree with the scalar ones on them
+    std::vector<float> halves;
+    for (int k = -20; k < 20; k++) {
+        for (const float scale: {(float) (1.0 / MATH_TAU), (float) (2.0 / MATH_PI)}) {
+            float phase = (k + 0.5f) / scale;
+            for (int ulps = 0; ulps < 4 && phase * scale != k + 0.5f; ulps++) {
+                phase = std::nextafter(phase, phase * scale < k + 0.5f ? INFINITY : -INFINITY);
+            }
+            halves.push_back(phase);
+        }
+    }
+    std::vector<float> ones(halves.size(), 1.0f);
+    std::vector<float> wrapped_halves(halves.size());
+    std::vector<Complex> polar_halves(halves.size());
+    fast_wrap_phase(halves.data(), wrapped_halves.data(), halves.size());
+    fast_polar(ones.data(), halves.data(), polar_halves.data(), halves.size());
+    bool paths_agree = true;
+    for (uint32_t i = 0; i < halves.size(); i++) {
+        paths_agree = paths_agree && wrapped_halves[i] == fast_wrap_phase(halves[i])
+            && polar_halves[i] == fast_polar(1.0f, halves[i]);
+    }
+    std::cout << "array and scalar versions " << (paths_agree ? "agree" : "DIFFER") << " on halves\n";
+
+    const bool all_within = atan2_err < Atan2Bound && sincos_err < SinCosBound && wrap_err < WrapBound && paths_agree;
+
+    std::cout << std::scientific << std::setprecision(2)
+              << "max error atan2:  " << atan2_err << " (bound " << Atan2Bound << ")\n"
+              << "max error sincos: " << sincos_err << " (bound " << SinCosBound << ")\n"
+              << "max error wrap:   " << wrap_err << " (bound " << WrapBound << ")\n";
+
+
+    const uint32_t n_iters = 20000;
+    const double t_arg = time_us([&] () {
+        for (uint32_t i = 0; i < n_bins; i++) { out[i] = std::arg(freqs[i]); }
+    }, n_iters);
+    const double t_fast_arg = time_us([&] () {
+        fast_arg(freqs.data(), out.data(), n_bins);
+    }, n_iters);
+    const double t_polar = time_us([&] () {
+        for (uint32_t i = 0; i < n_bins; i++) { out_freqs[i] = std::polar(mags[i], phases[i]); }
+    }, n_iters);
+    const double t_fast_polar = time_us([&] () {
+        fast_polar(mags.data(), phases.data(), out_freqs.data(), n_bins);
+    }, n_iters);
+    const double t_wrap = time_us([&] () {
+        for (uint32_t i = 0; i < n_bins; i++) { out[i] = fposmod(phases[i] + MATH_PI, MATH_TAU) - MATH_PI; }
+    }, n_iters);
+    const double t_fast_wrap = time_us([&] () {
+        fast_wrap_phase(phases.data(), out.data(), n_bins);
+    }, n_iters);
+
+    std::cout << std::fixed << std::setprecision(2)
+              << n_bins << " bins\n"
+              << "    std::arg:   " << t_arg << " us, fast_arg:        " << t_fast_arg << " us\n"
+              << "    std::polar: " << t_polar << " us, fast_polar:      " << t_fast_polar << " us\n"
+              << "    fposmod:    " << t_wrap << " us, fast_wrap_phase: " << t_fast_wrap << " us\n";
+
+    std::cout << (all_within ? "All errors within bounds" : "Errors EXCEED bounds") << std::endl;
+    return all_within ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dsp/common.h"
+#include "dsp/pitchshifter.h"
+#include "dsp/timestretcher.h"
+#include "mengumath.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// TimeStretchPitchShifter with the stretcher shifting the pitch itself, against resampling its stretched output.
+// Both should land a tone on the same pitch, about as cleanly, and the direct path should cost less
+
+static constexpr uint32_t SampleRate = 44100;
+static constexpr uint32_t BlockSize = 512;
+static constexpr uint32_t NBlocks = 400;
+// the first blocks are the stretchers filling up
+static constexpr uint32_t NWarmupBlocks = 100;
+static constexpr float ToneHz = 220.0f;
+
+static TimeStretcher *make_stretcher(uint32_t ind) {
+    switch (ind) {
+        case 0: return new WSOLATimeStretcher();
+        case 1: return new PhaseVocoderTimeStretcher();
+        default: return new PhaseVocoderDoneRightTimeStretcher();
+    }
+}
+static const std::string StretcherNames[] = {"WSOLA", "PhaseVocoder", "PhaseVocoderDoneRight"};
+
+// Splices and phase resets make the output incoherent over long stretches, so tones are fitted to short frames
+static constexpr uint32_t FitFrameSize = 1 << 11;
+
+// least squares fit of a sine of freq to each frame. Returns the fitted power, and adds what was left over to residual
+static double fit_tone(const std::vector<float> &signal, double freq, double *residual = nullptr) {
+    double fitted = 0.0;
+    for (uint32_t start = 0; start + FitFrameSize <= signal.size(); start += FitFrameSize) {
+        double cc = 0.0, ss = 0.0, cs = 0.0, xc = 0.0, xs = 0.0, xx = 0.0;
+        for (uint32_t i = 0; i < FitFrameSize; i++) {
+            const double c = std::cos(MATH_TAU * freq * i / SampleRate);
+            const double s = std::sin(MATH_TAU * freq * i / SampleRate);
+            const double x = signal[start + i];
+            cc += c * c; ss += s * s; cs += c * s;
+            xc += x * c; xs += x * s; xx += x * x;
+        }
+        const double det = cc * ss - cs * cs;
+        const double a = (xc * ss - xs * cs) / det;
+        const double b = (xs * cc - xc * cs) / det;
+        const double frame_fitted = a * xc + b * xs;
+        fitted += frame_fitted;
+        if (residual) {
+            *residual += xx - frame_fitted;
+        }
+    }
+    return fitted;
+}
+
+struct Result {
+    // frequency that fits the output best, to the nearest half Hz
+    float peak_hz;
+    // power of the shifted tone over everything else, in dB
+    double purity_db;
+    uint32_t n_underruns;
+    double ns_per_sample;
+};
+
+static Result measure(uint32_t stretcher_ind, float shift_factor, bool direct) {
+    TimeStretchPitchShifter shifter(make_stretcher(stretcher_ind), 1);
+    shifter.set_sample_rate(SampleRate);
+    shifter.set_direct_pitch_shift(direct);
+    shifter.set_shift_factor(shift_factor);
+
+    std::vector<Complex> input(BlockSize);
+    std::vector<Complex> output(BlockSize);
+    std::vector<float> recorded;
+    uint32_t t = 0;
+    uint32_t n_warmup_underruns = 0;
+    double total_ns = 0.0;
+
+    for (uint32_t block = 0; block < NBlocks; block++) {
+        for (Complex &x: input) {
+            x = 0.5f * std::sin(MATH_TAU * ToneHz * t / SampleRate);
+            t++;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        shifter.push_signal(input.data(), BlockSize);
+        shifter.pop_transformed_signal(output.data(), BlockSize);
+        auto end = std::chrono::steady_clock::now();
+
+        if (block < NWarmupBlocks) {
+            n_warmup_underruns = shifter.get_drift_metrics().n_underruns;
+            continue;
+        }
+        total_ns += std::chrono::duration<double, std::nano>(end - start).count();
+        for (const Complex &x: output) {
+            recorded.push_back(x.real());
+        }
+    }
+
+    Result result;
+    const float expected_hz = ToneHz * shift_factor;
+    double peak_power = 0.0;
+    for (float freq = expected_hz - 20.0f; freq <= expected_hz + 20.0f; freq += 0.5f) {
+        const double power = fit_tone(recorded, freq);
+        if (power > peak_power) {
+            peak_power = power;
+            result.peak_hz = freq;
+        }
+    }
+
+    double residual = 0.0;
+    const double tone = fit_tone(recorded, expected_hz, &residual);
+    result.purity_db = 10.0 * std::log10(tone / MAX(residual, 1e-12));
+
+    result.n_underruns = shifter.get_drift_metrics().n_underruns - n_warmup_underruns;
+    result.ns_per_sample = total_ns / ((NBlocks - NWarmupBlocks) * (double) BlockSize);
+    return result;
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(1);
+    for (float shift_factor: {0.7f, 1.5f, 2.0f}) {
+        std::cout << "-- shift " << shift_factor << ", expecting " << ToneHz * shift_factor << "Hz" << std::endl;
+        for (uint32_t stretcher_ind = 0; stretcher_ind < 3; stretcher_ind++) {
+            for (bool direct: {false, true}) {
+                const Result result = measure(stretcher_ind, shift_factor, direct);
+                std::cout << std::setw(22) << StretcherNames[stretcher_ind]
+                    << (direct ? "  direct   " : "  resampled")
+                    << "  peak " << std::setw(6) << result.peak_hz << "Hz"
+                    << "  purity " << std::setw(5) << result.purity_db << "dB"
+                    << "  underruns " << std::setw(2) << result.n_underruns
+                    << "  cost " << std::setw(6) << result.ns_per_sample << "ns/sample" << std::endl;
+            }
+        }
+    }
+}
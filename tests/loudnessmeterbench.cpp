@@ -0,0 +1,130 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dsp/loudness.h"
+#include "mengumath.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// LoudnessMeter on the stereo sine cases of EBU Tech 3341 (loudness) and 3342 (loudness range).
+// Readings should land within the tolerances those give, and feeding a block should cost the same
+// in the last minute of a long program as in the first
+
+static constexpr uint32_t SampleRate = 48000;
+static constexpr uint32_t BlockSize = 512;
+static constexpr float ToneHz = 1000.0f;
+
+// seconds of a 1kHz tone in both channels, at a level in dBFS
+typedef std::vector<std::pair<float, float>> Program;
+
+struct Reading {
+    float momentary;
+    float short_term;
+    float integrated;
+    float range;
+    // mean cost of a block in the first and last minute, for programs over two minutes
+    double first_minute_block_ns;
+    double last_minute_block_ns;
+};
+
+static Reading measure(const Program &program) {
+    LoudnessMeter meter(SampleRate, 2);
+    std::vector<float> left(BlockSize);
+    std::vector<float> right(BlockSize);
+    const float *inputs[2] = {left.data(), right.data()};
+
+    uint32_t total_seconds = 0;
+    for (const auto &[seconds, level]: program) {
+        total_seconds += seconds;
+    }
+    const uint64_t last_minute_start = (uint64_t) MAX(total_seconds, 60u) * SampleRate - 60 * SampleRate;
+
+    uint64_t t = 0;
+    double first_minute_ns = 0.0;
+    double last_minute_ns = 0.0;
+    uint64_t n_first_minute_blocks = 0;
+    uint64_t n_last_minute_blocks = 0;
+    for (const auto &[seconds, level]: program) {
+        const float amp = std::pow(10.0f, level / 20.0f);
+        const uint32_t n_samples = seconds * SampleRate;
+        for (uint32_t start = 0; start < n_samples; start += BlockSize) {
+            const uint32_t n = MIN(BlockSize, n_samples - start);
+            for (uint32_t i = 0; i < n; i++) {
+                left[i] = right[i] = amp * std::sin((float) (MATH_TAU * ToneHz * (t % SampleRate) / SampleRate));
+                t++;
+            }
+            auto block_start = std::chrono::steady_clock::now();
+            meter.push_signal(inputs, n);
+            auto block_end = std::chrono::steady_clock::now();
+
+            const double ns = std::chrono::duration<double, std::nano>(block_end - block_start).count();
+            if (t <= 60 * SampleRate) {
+                first_minute_ns += ns;
+                n_first_minute_blocks++;
+            }
+            else if (t > last_minute_start) {
+                last_minute_ns += ns;
+                n_last_minute_blocks++;
+            }
+        }
+    }
+    const bool timed = total_seconds > 120;
+    return {
+        meter.get_momentary(), meter.get_short_term(), meter.get_integrated(), meter.get_loudness_range(),
+        timed ? first_minute_ns / n_first_minute_blocks : 0.0,
+        timed ? last_minute_ns / n_last_minute_blocks : 0.0
+    };
+}
+
+struct Case {
+    std::string name;
+    Program program;
+    // NAN where the case does not say
+    float expected_integrated;
+    float expected_range;
+};
+
+static std::string expected(float value) {
+    if (std::isnan(value)) {
+        return "-";
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2) << value;
+    return out.str();
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(2);
+    const std::vector<Case> cases = {
+        {"3341 #1 -23dBFS", {{20, -23}}, -23.0f, 0.0f},
+        {"3341 #2 -33dBFS", {{20, -33}}, -33.0f, 0.0f},
+        {"3341 #3 relative gate", {{10, -36}, {60, -23}, {10, -36}}, -23.0f, NAN},
+        {"3341 #4 both gates", {{10, -72}, {10, -36}, {60, -23}, {10, -36}, {10, -72}}, -23.0f, NAN},
+        {"3342 #1 range 10", {{20, -20}, {20, -30}}, NAN, 10.0f},
+        {"3342 #2 range 5", {{20, -20}, {20, -15}}, NAN, 5.0f},
+        {"3342 #3 range 20", {{20, -40}, {20, -20}}, NAN, 20.0f},
+        {"an hour at -23dBFS", {{3600, -23}}, -23.0f, 0.0f},
+    };
+
+    for (const Case &c: cases) {
+        const Reading reading = measure(c.program);
+        std::cout << std::setw(22) << c.name
+            << "  M " << std::setw(6) << reading.momentary
+            << "  S " << std::setw(6) << reading.short_term
+            << "  I " << std::setw(6) << reading.integrated << " (expect " << expected(c.expected_integrated) << ")"
+            << "  LRA " << std::setw(5) << reading.range << " (expect " << expected(c.expected_range) << ")";
+        if (reading.first_minute_block_ns > 0.0) {
+            std::cout << "  ns per block first minute " << std::setw(7) << reading.first_minute_block_ns
+                << " last " << std::setw(7) << reading.last_minute_block_ns;
+        }
+        std::cout << std::endl;
+    }
+}
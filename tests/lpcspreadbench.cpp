@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "dsp/common.h"
+#include "dsp/effect.h"
+#include "dsp/formantshifter.h"
+#include "mengumath.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// What each push and pop of the LPC formant shifter costs, with the work of its frames done all at once in the pop that
+// needs them, against spread over the pops before. All at once, most pops only copy and one in every hop does a whole
+// frame, so the worst pop is many times the mean. Spread, the worst should come down to a slice of a frame.
+// Spreading only changes when the work is done, so what is popped should be the same, after the frame and hop of
+// silence that spread output starts with. Overlaps are crossfaded a run of the output queue at a time, and runs split
+// where the queue wraps, which moves with the silence, so samples can round an ulp apart. All at once, the shifter pops nothing until each frame is in, which
+// leaves gaps in what a device would play, counted as short pops
+
+static constexpr uint32_t SampleRate = 44100;
+static constexpr uint32_t SignalSeconds = 20;
+// the frame and hop of the formant shifter at SampleRate
+static constexpr uint32_t ProcSize = 1 << 11;
+static constexpr uint32_t HopSize = ProcSize * 4 / 5;
+
+// sung syllables gliding around a few notes, with some breath noise
+static std::vector<Complex> make_signal() {
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+    std::vector<Complex> signal(SignalSeconds * SampleRate);
+    double phase = 0.0;
+    for (uint32_t i = 0; i < signal.size(); i++) {
+        const double t = (double) i / SampleRate;
+        const double f0 = 150.0 * std::pow(2.0, std::sin(0.3 * t) * 0.5);
+        phase += MATH_TAU * f0 / SampleRate;
+        const float envelope = 0.5f * (1.0f - std::cos(MATH_TAU * 1.5 * t));
+        float x = 0.0f;
+        for (int h = 1; h <= 10; h++) {
+            x += std::sin(h * phase) / h;
+        }
+        signal[i] = 0.2f * envelope * x + noise(rng);
+    }
+    return signal;
+}
+
+struct Run {
+    std::vector<float> output;
+    double mean_us;
+    double p99_us;
+    double worst_us;
+    // pops that came up short of the block
+    uint32_t n_short;
+};
+
+// pushes and pops the signal block_size at a time, like a device callback would, timing each
+static Run run(const std::vector<Complex> &signal, uint32_t block_size, bool spread) {
+    LPCFormantShifter shifter;
+    shifter.set_sample_rate(SampleRate);
+    shifter.set_property(0, EffectPropPayload {.type = Slider, .value = 1.3f});
+    shifter.set_spread_work(spread);
+
+    Run result;
+    result.n_short = 0;
+    std::vector<double> costs;
+    std::vector<Complex> block(block_size);
+    for (uint32_t start = 0; start + block_size <= signal.size(); start += block_size) {
+        const auto t0 = std::chrono::steady_clock::now();
+        shifter.push_signal(signal.data() + start, block_size);
+        const uint32_t n = shifter.pop_transformed_signal(block.data(), block_size);
+        const auto t1 = std::chrono::steady_clock::now();
+        costs.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+        for (uint32_t i = 0; i < n; i++) {
+            result.output.push_back(block[i].real());
+        }
+        result.n_short += n < block_size ? 1 : 0;
+    }
+
+    std::sort(costs.begin(), costs.end());
+    double total = 0.0;
+    for (double cost: costs) {
+        total += cost;
+    }
+    result.mean_us = total / costs.size();
+    result.p99_us = costs[costs.size() * 99 / 100];
+    result.worst_us = costs.back();
+    return result;
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(1);
+    const std::vector<Complex> signal = make_signal();
+
+    for (uint32_t block_size: {64u, 128u, 256u, 512u}) {
+        std::cout << "-- blocks of " << block_size << " (" << 1e6 * block_size / SampleRate << "us)" << std::endl;
+
+        Run at_once, spread;
+        for (bool is_spread: {false, true}) {
+            Run r = run(signal, block_size, is_spread);
+            std::cout << (is_spread ? "spread " : "at once")
+                << "  mean " << std::setw(6) << r.mean_us << "us"
+                << "  p99 " << std::setw(6) << r.p99_us << "us"
+                << "  worst " << std::setw(7) << r.worst_us << "us"
+                << "  worst/mean " << std::setw(6) << r.worst_us / r.mean_us
+                << "  short pops " << r.n_short << std::endl;
+            (is_spread ? spread : at_once) = std::move(r);
+        }
+
+        const uint32_t delay = ProcSize + HopSize;
+        const float tolerance = 1e-6f;
+        uint32_t n_different = 0;
+        uint32_t n_compared = 0;
+        for (uint32_t i = 0; i < at_once.output.size() && i + delay < spread.output.size(); i++) {
+            n_different += std::abs(at_once.output[i] - spread.output[i + delay]) > tolerance ? 1 : 0;
+            n_compared++;
+        }
+        std::cout << "spread is the same after its silence: " << (n_different == 0 ? "yes" : "NO")
+            << " (" << n_different << " of " << n_compared << " samples differ)" << std::endl;
+    }
+}
@@ -0,0 +1,103 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "dsp/common.h"
+#include "dsp/fft.h"
+#include "dsp/loudness.h"
+#include "dsp/singletons.h"
+#include "mengumath.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// LUFS_freq with cached K-weighting tables, against working the weights out on every call.
+// Then measuring the loudness correction from spectra, against filtering both frames in time.
+// The corrections should roughly agree; the time domain filters carry state between frames, the spectra do not
+
+static constexpr uint32_t SampleRate = 44100;
+static constexpr uint32_t FrameSize = 1 << 11;
+static constexpr uint32_t NRuns = 2000;
+
+template<class F>
+static double time_ns(F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t run = 0; run < NRuns; run++) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / NRuns;
+}
+
+// harmonics of f0 over some noise, at a level
+static std::vector<Complex> make_frame(float f0, float level, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+    std::vector<Complex> frame(FrameSize);
+    for (uint32_t i = 0; i < FrameSize; i++) {
+        float x = noise(rng);
+        for (int h = 1; h <= 6; h++) {
+            x += std::sin(MATH_TAU * f0 * h * i / SampleRate) / h;
+        }
+        frame[i] = level * x;
+    }
+    return frame;
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(2);
+    const FFT &fft = Singletons::get_singleton()->get_fft(FrameSize);
+
+    std::cout << "-- LUFS_freq of a " << FrameSize << " spectrum (ns per call)" << std::endl;
+    {
+        const std::vector<Complex> frame = make_frame(220.0f, 0.5f, 1);
+        std::vector<Complex> freqs(FrameSize);
+        fft.transform(frame.data(), freqs.data());
+
+        float uncached = 0.0f;
+        float cached = 0.0f;
+        const double uncached_ns = time_ns([&]() {
+            uncached = LUFS_freq(freqs.data(), LUFS_freq_weights(FrameSize, SampleRate).data(), FrameSize);
+        });
+        const double cached_ns = time_ns([&]() {
+            cached = LUFS_freq(freqs.data(), FrameSize, SampleRate);
+        });
+        std::cout << "weights every call " << std::setw(9) << uncached_ns << "  " << uncached << " LUFS" << std::endl;
+        std::cout << "cached weights     " << std::setw(9) << cached_ns << "  " << cached << " LUFS" << std::endl;
+    }
+
+    std::cout << "-- correction to match a frame's loudness (ns per frame)" << std::endl;
+    for (float f0: {110.0f, 440.0f, 1760.0f}) {
+        // the raw frame is an octave up and quieter, like a shifted frame
+        const std::vector<Complex> raw = make_frame(f0 * 2.0f, 0.2f, 2);
+        const std::vector<Complex> reference = make_frame(f0, 0.5f, 3);
+        std::vector<Complex> raw_freqs(FrameSize);
+        std::vector<Complex> reference_freqs(FrameSize);
+        fft.transform(raw.data(), raw_freqs.data());
+        fft.transform(reference.data(), reference_freqs.data());
+
+        // measures the correction from the first sample it scales
+        LoudnessNormalizer<Complex, FrameSize> time_normalizer;
+        time_normalizer.set_sample_rate(SampleRate);
+        std::vector<Complex> scaled(FrameSize);
+        const double time_ns_per_frame = time_ns([&]() {
+            time_normalizer.normalize(raw.data(), reference.data(), scaled.data());
+        });
+        const float time_correction = std::abs(scaled[FrameSize / 2] / raw[FrameSize / 2]);
+
+        SpectralLoudnessNormalizer spectral_normalizer;
+        spectral_normalizer.set_format(FrameSize, SampleRate);
+        float spectral_correction = 0.0f;
+        const double spectral_ns_per_frame = time_ns([&]() {
+            spectral_correction = spectral_normalizer.get_correction(raw_freqs.data(), reference_freqs.data(), FrameSize / 2);
+        });
+
+        std::cout << "f0 " << std::setw(7) << f0
+            << "  time " << std::setw(8) << time_ns_per_frame << " (x" << time_correction << ")"
+            << "  spectral " << std::setw(8) << spectral_ns_per_frame << " (x" << spectral_correction << ")" << std::endl;
+    }
+}
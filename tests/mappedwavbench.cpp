@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "offline/audiofile.h"
+#include "offline/mappedwav.h"
+#include "offline/renderchain.h"
+#include "offline/segmentedrender.h"
+#include "mengumath.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace Mengu;
+
+// What reading a large wav costs in time and resident memory, mapped through MappedWavFile against decoded whole into
+// memory. Mapped, only a window of the file is in at once, so the peak should grow by about a window, not the file.
+// Small files of every format it maps, in RIFF and RF64, are checked sample for sample, and a render streamed from a
+// mapped file is checked against rendering the same frames from memory
+
+static constexpr uint32_t SampleRate = 44100;
+// a float mono file this large, in MB
+static constexpr uint32_t LargeFileMB = 256;
+
+struct Format {
+    const char *name;
+    uint32_t tag;
+    uint32_t bits;
+    uint32_t n_channels;
+    bool rf64;
+    bool extensible;
+    // a chunk of this many bytes before the data, which leaves it unaligned when it is odd or not a multiple of 4
+    uint32_t junk_size;
+};
+
+static void put_le(std::vector<uint8_t> &bytes, uint64_t value, uint32_t n_bytes) {
+    for (uint32_t i = 0; i < n_bytes; i++) {
+        bytes.push_back((uint8_t) (value >> (8 * i)));
+    }
+}
+
+// the header of a wav of n_frames in format, up to where its samples start
+static std::vector<uint8_t> make_header(const Format &format, uint64_t n_frames) {
+    const uint32_t frame_size = format.n_channels * format.bits / 8;
+    const uint64_t data_size = n_frames * frame_size;
+    const uint32_t fmt_size = format.extensible ? 40 : 16;
+
+    std::vector<uint8_t> bytes;
+    const auto put_id = [&] (const char *id) {
+        for (uint32_t i = 0; i < 4; i++) {
+            bytes.push_back((uint8_t) id[i]);
+        }
+    };
+    put_id(format.rf64 ? "RF64" : "RIFF");
+    // filled in at the end
+    put_le(bytes, 0, 4);
+    put_id("WAVE");
+    if (format.rf64) {
+        put_id("ds64");
+        put_le(bytes, 28, 4);
+        // riff and data sizes, the sample count and an empty table
+        put_le(bytes, 0, 8);
+        put_le(bytes, data_size, 8);
+        put_le(bytes, n_frames, 8);
+        put_le(bytes, 0, 4);
+    }
+    put_id("fmt ");
+    put_le(bytes, fmt_size, 4);
+    put_le(bytes, format.extensible ? 0xFFFE : format.tag, 2);
+    put_le(bytes, format.n_channels, 2);
+    put_le(bytes, SampleRate, 4);
+    put_le(bytes, SampleRate * frame_size, 4);
+    put_le(bytes, frame_size, 2);
+    put_le(bytes, format.bits, 2);
+    if (format.extensible) {
+        // the size of the rest, the valid bits, the channel mask and the subformat, whose first 2 bytes are the tag
+        put_le(bytes, 22, 2);
+        put_le(bytes, format.bits, 2);
+        put_le(bytes, 0, 4);
+        put_le(bytes, format.tag, 2);
+        const uint8_t guid_rest[14] = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+        bytes.insert(bytes.end(), guid_rest, guid_rest + sizeof(guid_rest));
+    }
+    if (format.junk_size > 0) {
+        put_id("junk");
+        put_le(bytes, format.junk_size, 4);
+        bytes.resize(bytes.size() + format.junk_size + (format.junk_size & 1), 0);
+    }
+    put_id("data");
+    put_le(bytes, format.rf64 ? 0xFFFFFFFF : data_size, 4);
+
+    const uint64_t riff_size = bytes.size() - 8 + data_size;
+    for (uint32_t i = 0; i < 4; i++) {
+        bytes[4 + i] = format.rf64 ? 0xFF : (uint8_t) (riff_size >> (8 * i));
+    }
+    return bytes;
+}
+
+// samples of x, all k/128 so every format holds them exactly
+static void encode(const Format &format, const std::vector<float> &x, std::vector<uint8_t> &bytes) {
+    for (float sample: x) {
+        const int32_t k = (int32_t) std::lround(sample * 128.0f);
+        if (format.tag == 3 && format.bits == 32) {
+            uint32_t bits;
+            std::memcpy(&bits, &sample, sizeof(bits));
+            put_le(bytes, bits, 4);
+        }
+        else if (format.tag == 3) {
+            const double wide = sample;
+            uint64_t bits;
+            std::memcpy(&bits, &wide, sizeof(bits));
+            put_le(bytes, bits, 8);
+        }
+        else if (format.bits == 8) {
+            put_le(bytes, (uint32_t) (k + 128), 1);
+        }
+        else {
+            // k scaled up to the top of the sample
+            put_le(bytes, (uint64_t) ((int64_t) k << (format.bits - 8)), format.bits / 8);
+        }
+    }
+}
+
+static void write_file(const std::filesystem::path &path, const std::vector<uint8_t> &bytes) {
+    FILE *file = std::fopen(path.string().c_str(), "wb");
+    std::fwrite(bytes.data(), 1, bytes.size(), file);
+    std::fclose(file);
+}
+
+static double peak_rss_mb() {
+#ifdef _WIN32
+    return 0.0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(3);
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / "mengu_mappedwavbench";
+    std::filesystem::create_directories(dir);
+    bool all_ok = true;
+
+    // every format reads back exactly, a few frames at a time, and again from the middle
+    const std::vector<Format> formats = {
+        {"pcm u8 mono", 1, 8, 1, false, false, 0},
+        {"pcm 16 stereo", 1, 16, 2, false, false, 0},
+        {"pcm 24 stereo extensible", 1, 24, 2, false, true, 0},
+        {"pcm 32 mono rf64", 1, 32, 1, true, false, 0},
+        {"float 32 stereo", 3, 32, 2, false, false, 0},
+        {"float 32 mono unaligned", 3, 32, 1, false, false, 3},
+        {"float 64 mono rf64", 3, 64, 1, true, false, 0},
+    };
+    for (const Format &format: formats) {
+        const uint64_t n_frames = 10007;
+        std::vector<float> x(n_frames * format.n_channels);
+        for (uint64_t i = 0; i < x.size(); i++) {
+            x[i] = (int32_t) ((i * 37) % 256 - 128) / 128.0f;
+        }
+        std::vector<uint8_t> bytes = make_header(format, n_frames);
+        encode(format, x, bytes);
+        const std::filesystem::path path = dir / "format.wav";
+        write_file(path, bytes);
+
+        MappedWavFile file(path);
+        std::vector<float> read(x.size());
+        uint64_t n_read = 0;
+        while (true) {
+            const uint64_t n = file.read(read.data() + n_read * format.n_channels, MIN((uint64_t) 999, n_frames - n_read));
+            if (n == 0) {
+                break;
+            }
+            n_read += n;
+        }
+        bool same = n_read == n_frames && file.get_n_channels() == format.n_channels && read == x;
+
+        file.seek(n_frames / 2);
+        std::vector<float> rest(x.size());
+        n_read = file.read(rest.data(), n_frames);
+        same = same && n_read == n_frames - n_frames / 2
+            && std::equal(rest.begin(), rest.begin() + n_read * format.n_channels, x.begin() + n_frames / 2 * format.n_channels);
+
+        std::cout << std::left << std::setw(26) << format.name << std::right << (same ? "reads the same" : "DIFFERS") << std::endl;
+        all_ok = all_ok && same;
+    }
+
+    // a render streamed from the file, viewed or read, is the same as rendering what was read from memory
+    {
+        RenderSettings settings;
+        settings.pitch_shift = 1.3f;
+        settings.formant_shift = 1.2f;
+        // not a whole number of blocks to a chunk of the source
+        settings.block_size = 1000;
+        for (const Format &format: {Format {"float 32 mono", 3, 32, 1, false, false, 0}, Format {"pcm 16 stereo", 1, 16, 2, false, false, 0}}) {
+            const uint64_t n_frames = 10 * SampleRate;
+            std::vector<float> x(n_frames * format.n_channels);
+            for (uint64_t i = 0; i < x.size(); i++) {
+                const double t = (double) (i / format.n_channels) / SampleRate;
+                x[i] = std::lround(96.0 * std::sin(MATH_TAU * (220.0 + 110.0 * (i % format.n_channels)) * t)) / 128.0f;
+            }
+            std::vector<uint8_t> bytes = make_header(format, n_frames);
+            encode(format, x, bytes);
+            const std::filesystem::path path = dir / "render.wav";
+            write_file(path, bytes);
+
+            MappedWavFile file(path);
+            uint64_t n_streamed = 0;
+            const std::vector<float> streamed = render_sequential(settings, file, n_streamed);
+            const std::vector<float> from_memory = render_sequential(settings, x.data(), n_frames, SampleRate, format.n_channels);
+            const bool same = n_streamed == n_frames && streamed == from_memory;
+            std::cout << "render of " << std::left << std::setw(16) << format.name << std::right
+                << (same ? "streamed is the same as from memory" : "streamed DIFFERS from memory") << std::endl;
+            all_ok = all_ok && same;
+        }
+    }
+
+    // a large file read through, mapped and then decoded whole
+    {
+        const Format format {"float 32 mono", 3, 32, 1, false, false, 0};
+        const uint64_t n_frames = (uint64_t) LargeFileMB * (1 << 20) / sizeof(float);
+        const std::filesystem::path path = dir / "large.wav";
+        {
+            FILE *file = std::fopen(path.string().c_str(), "wb");
+            const std::vector<uint8_t> header = make_header(format, n_frames);
+            std::fwrite(header.data(), 1, header.size(), file);
+            std::vector<float> chunk(1 << 20);
+            for (uint64_t start = 0; start < n_frames; start += chunk.size()) {
+                for (uint64_t i = 0; i < chunk.size(); i++) {
+                    chunk[i] = (float) std::sin(0.01 * (start + i));
+                }
+                std::fwrite(chunk.data(), sizeof(float), chunk.size(), file);
+            }
+            std::fclose(file);
+        }
+        std::cout << "-- " << LargeFileMB << "MB float wav, " << (double) n_frames / SampleRate / 60.0 << " minutes" << std::endl;
+
+        using Clock = std::chrono::steady_clock;
+        const double base_rss = peak_rss_mb();
+        auto start = Clock::now();
+        double mapped_sum = 0.0;
+        {
+            MappedWavFile file(path);
+            uint64_t n_viewed = 0;
+            while (const float *frames = file.view(1 << 16, n_viewed)) {
+                for (uint64_t i = 0; i < n_viewed; i++) {
+                    mapped_sum += frames[i];
+                }
+            }
+        }
+        const double mapped_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        const double mapped_rss = peak_rss_mb();
+
+        start = Clock::now();
+        double decoded_sum = 0.0;
+        {
+            const AudioData data = decode_audio_file(path, 1);
+            for (float sample: data.samples) {
+                decoded_sum += sample;
+            }
+        }
+        const double decoded_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        const double decoded_rss = peak_rss_mb();
+
+        std::cout << std::setprecision(1)
+            << "mapped   " << std::setw(6) << mapped_seconds * 1e3 << "ms  peak resident +" << std::setw(6) << mapped_rss - base_rss << "MB" << std::endl
+            << "decoded  " << std::setw(6) << decoded_seconds * 1e3 << "ms  peak resident +" << std::setw(6) << decoded_rss - mapped_rss << "MB" << std::endl;
+        const bool same = mapped_sum == decoded_sum;
+        std::cout << "sums " << (same ? "match" : "DIFFER") << std::endl;
+        all_ok = all_ok && same;
+    }
+
+    std::filesystem::remove_all(dir);
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dsp/common.h"
+#include "mengumath.h"
+#include "offline/renderchain.h"
+
+using namespace Mengu;
+
+// Stereo rendered with the channels linked, against each channel cut on its own.
+// The input is two sources panned apart, one of them reaching the right a little later than the left.
+// Linked channels are cut in the same places, so the level difference and delay between them should follow the input,
+// where channels cut on their own drift apart by up to a window. Linking also only analyses the mix, once.
+// A signal with the same thing in both channels should come out linked exactly as it does in mono
+
+static constexpr uint32_t SampleRate = 44100;
+static constexpr uint32_t SignalSeconds = 20;
+// the right channel hears the first source this much later
+static constexpr int SourceDelay = 12;
+// frames that the channels are compared over
+static constexpr uint32_t FrameSize = 1 << 12;
+// delays between the channels searched for, either way
+static constexpr int MaxDelay = 48;
+// frames quieter than this are not compared
+static constexpr float SilenceDb = -45.0f;
+
+// a sung note gliding about, with some breath noise
+static std::vector<float> make_voice(double base_hz, double glide_hz, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0.0f, 0.005f);
+    std::vector<float> voice(SignalSeconds * SampleRate);
+    double phase = 0.0;
+    for (uint32_t i = 0; i < voice.size(); i++) {
+        const double t = (double) i / SampleRate;
+        const double f0 = base_hz * std::pow(2.0, 0.4 * std::sin(MATH_TAU * glide_hz * t));
+        phase += MATH_TAU * f0 / SampleRate;
+        const float envelope = 0.5f * (1.0f - std::cos(MATH_TAU * 0.7 * t));
+        float x = 0.0f;
+        for (int h = 1; h <= 8; h++) {
+            x += std::sin(h * phase) / h;
+        }
+        voice[i] = 0.25f * envelope * x + noise(rng);
+    }
+    return voice;
+}
+
+// interleaved stereo
+static std::vector<float> make_stereo() {
+    const std::vector<float> first = make_voice(180.0, 0.21, 1);
+    const std::vector<float> second = make_voice(310.0, 0.13, 2);
+    std::vector<float> stereo(2 * first.size());
+    for (uint32_t i = 0; i < first.size(); i++) {
+        const float delayed = i >= SourceDelay ? first[i - SourceDelay] : 0.0f;
+        stereo[2 * i] = 0.8f * first[i] + 0.15f * second[i];
+        stereo[2 * i + 1] = 0.6f * delayed + 0.3f * second[i];
+    }
+    return stereo;
+}
+
+static float to_db(float power) {
+    return 10.0f * std::log10(MAX(power, 1e-12f));
+}
+
+struct Image {
+    // level of the left over the right, in dB
+    float level_difference;
+    // how much later the right is than the left, in samples
+    int delay;
+    float power;
+};
+
+// the stereo image of the frame of interleaved stereo starting at frame start
+static Image measure_image(const std::vector<float> &stereo, uint64_t start) {
+    float left_power = 0.0f;
+    float right_power = 0.0f;
+    for (uint32_t i = 0; i < FrameSize; i++) {
+        left_power += stereo[2 * (start + i)] * stereo[2 * (start + i)];
+        right_power += stereo[2 * (start + i) + 1] * stereo[2 * (start + i) + 1];
+    }
+
+    int best_delay = 0;
+    float best_correlation = -1e30f;
+    for (int delay = -MaxDelay; delay <= MaxDelay; delay++) {
+        float correlation = 0.0f;
+        for (int i = MaxDelay; i < (int) FrameSize - MaxDelay; i++) {
+            correlation += stereo[2 * (start + i)] * stereo[2 * (start + i + delay) + 1];
+        }
+        if (correlation > best_correlation) {
+            best_correlation = correlation;
+            best_delay = delay;
+        }
+    }
+    return {to_db(left_power) - to_db(right_power), best_delay, (left_power + right_power) / (2 * FrameSize)};
+}
+
+struct ImageError {
+    // mean over frames of how far the level difference is from the input's, in dB
+    float level_difference_db;
+    // frames whose delay is more than a sample off what the input frame's should become
+    float delay_off_fraction;
+};
+
+// Compares the image of each output frame with the input frame it was made from.
+// Stretching keeps the delay between the channels, where resampling to shift the pitch scales it
+static ImageError compare_images(const std::vector<float> &input, const std::vector<float> &output,
+        float stretch, float pitch_shift) {
+    ImageError error {0.0f, 0.0f};
+    uint32_t n_frames = 0;
+    for (uint64_t out_start = FrameSize; out_start + 2 * FrameSize <= output.size() / 2; out_start += FrameSize) {
+        const uint64_t in_start = out_start / stretch;
+        if (in_start + FrameSize + MaxDelay > input.size() / 2) {
+            break;
+        }
+        const Image in = measure_image(input, in_start);
+        const Image out = measure_image(output, out_start);
+        if (to_db(in.power) < SilenceDb || to_db(out.power) < SilenceDb) {
+            continue;
+        }
+        error.level_difference_db += std::abs(in.level_difference - out.level_difference);
+        error.delay_off_fraction += std::abs(out.delay - in.delay / pitch_shift) > 1.0f ? 1.0f : 0.0f;
+        n_frames++;
+    }
+    error.level_difference_db /= MAX(n_frames, 1u);
+    error.delay_off_fraction /= MAX(n_frames, 1u);
+    return error;
+}
+
+template<class F>
+static double time_s(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static std::vector<float> render(const RenderSettings &settings, const std::vector<float> &input, uint32_t n_channels) {
+    RenderChain chain(settings, n_channels);
+    chain.set_sample_rate(SampleRate);
+    std::vector<float> output;
+    chain.push_signal(input.data(), input.size() / n_channels, output);
+    chain.finish(output);
+    return output;
+}
+
+struct Case {
+    std::string name;
+    RenderSettings settings;
+};
+
+static RenderSettings make_settings(float pitch, float formant, float stretch,
+        RenderSettings::PitchShifterType pitch_shifter, RenderSettings::StretcherType stretcher) {
+    RenderSettings settings;
+    settings.pitch_shift = pitch;
+    settings.formant_shift = formant;
+    settings.stretch = stretch;
+    settings.pitch_shifter = pitch_shifter;
+    settings.stretcher = stretcher;
+    return settings;
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(3);
+    const std::vector<float> stereo = make_stereo();
+    const Image input_image = measure_image(stereo, SampleRate);
+    std::cout << SignalSeconds << "s of stereo, right " << input_image.delay << " samples late" << std::endl;
+
+    // the left channel in both
+    std::vector<float> mono(stereo.size() / 2), dual_mono(stereo.size());
+    for (uint32_t i = 0; i < mono.size(); i++) {
+        mono[i] = dual_mono[2 * i] = dual_mono[2 * i + 1] = stereo[2 * i];
+    }
+
+    const std::vector<Case> cases = {
+        {"wsola pitch x1.4", make_settings(1.4f, 1.0f, 1.0f, RenderSettings::WSOLAPitchShifter, RenderSettings::WSOLAStretcher)},
+        {"psola pitch x0.8", make_settings(0.8f, 1.0f, 1.0f, RenderSettings::PSOLAPitchShifter, RenderSettings::WSOLAStretcher)},
+        {"wsola stretch x1.3", make_settings(1.0f, 1.0f, 1.3f, RenderSettings::WSOLAPitchShifter, RenderSettings::WSOLAStretcher)},
+        {"psola stretch x0.8", make_settings(1.0f, 1.0f, 0.8f, RenderSettings::WSOLAPitchShifter, RenderSettings::PSOLAStretcher)},
+        {"pv stretch x1.2", make_settings(1.0f, 1.0f, 1.2f, RenderSettings::WSOLAPitchShifter, RenderSettings::PhaseVocoderStretcher)},
+        {"formant x1.2", make_settings(1.0f, 1.2f, 1.0f, RenderSettings::WSOLAPitchShifter, RenderSettings::WSOLAStretcher)},
+    };
+
+    for (const Case &c: cases) {
+        const RenderChain probe(c.settings, 2);
+        bool linkable = false;
+        for (uint32_t s = 0; s < RenderSettings::NStages; s++) {
+            const dsp::MultichannelEffect *stage = probe.get_stage((RenderSettings::Stage) s);
+            linkable = linkable || (stage != nullptr && stage->is_linked());
+        }
+
+        std::cout << "-- " << c.name << (linkable ? "" : "  (cannot be linked)") << std::endl;
+        for (bool link: {true, false}) {
+            RenderSettings settings = c.settings;
+            settings.link_channels = link;
+            std::vector<float> output;
+            const double seconds = time_s([&]() { output = render(settings, stereo, 2); });
+            const ImageError error = compare_images(stereo, output, c.settings.stretch, c.settings.pitch_shift);
+
+            settings.channel_threads = 2;
+            std::vector<float> threaded_output;
+            const double threaded_seconds = time_s([&]() { threaded_output = render(settings, stereo, 2); });
+
+            std::cout << (link ? "linked  " : "unlinked")
+                << "  " << std::setw(6) << seconds << "s"
+                << " (2 threads " << std::setw(6) << threaded_seconds << "s, "
+                << (threaded_output == output ? "same" : "DIFFERENT") << ")"
+                << "  level difference off by " << std::setw(5) << error.level_difference_db << " dB"
+                << ", delay off in " << std::setw(5) << 100.0f * error.delay_off_fraction << "% of frames" << std::endl;
+        }
+
+        // with the same in both channels, linked channels cut their mix, which is what mono cuts
+        const std::vector<float> mono_output = render(c.settings, mono, 1);
+        const std::vector<float> dual_output = render(c.settings, dual_mono, 2);
+        bool same = dual_output.size() == 2 * mono_output.size();
+        for (uint32_t i = 0; same && i < mono_output.size(); i++) {
+            same = dual_output[2 * i] == mono_output[i] && dual_output[2 * i + 1] == mono_output[i];
+        }
+        std::cout << "same in both channels comes out as in mono: " << (same ? "yes" : "NO") << std::endl;
+    }
+}
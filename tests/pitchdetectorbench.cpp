@@ -0,0 +1,193 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "dsp/common.h"
+#include "dsp/pitchdetector.h"
+#include "mengumath.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// Accuracy, confidence and cost of each pitch detector at the sizes PSOLATimeStretcher uses
+
+static constexpr uint32_t SampleRate = 44100;
+static constexpr uint32_t WindowSize = 1 << 11;
+static constexpr uint32_t MinPeriod = SampleRate / 800;
+static constexpr uint32_t MaxPeriod = SampleRate / 50;
+
+// estimates further than this from the true period (in semitones) are octave or gross errors
+static constexpr float GrossErrorSemitones = 1.0f;
+
+// average time of a call in microseconds
+template<class F>
+static double time_us(F f, uint32_t n_iters) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < n_iters; i++) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / n_iters;
+}
+
+// a tone with falling harmonics and a slight vibrato, plus white noise
+static std::vector<Complex> make_tone(float freq, float noise_level, bool missing_fundamental, uint32_t size, uint32_t seed) {
+    std::vector<Complex> signal(size);
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0.0f, noise_level);
+    double phase = 0.0;
+    for (uint32_t i = 0; i < size; i++) {
+        const double inst_freq = freq * (1.0 + 0.003 * std::sin(MATH_TAU * 5.0 * i / SampleRate));
+        phase += MATH_TAU * inst_freq / SampleRate;
+        float x = 0.0f;
+        for (int h = missing_fundamental ? 2 : 1; h <= 8 && h * freq < SampleRate / 2; h++) {
+            x += std::sin(h * phase) / h;
+        }
+        signal[i] = 0.5f * x + noise(rng);
+    }
+    return signal;
+}
+
+struct Accuracy {
+    uint32_t n_estimates = 0;
+    uint32_t n_gross_errors = 0;
+    double total_cents_error = 0.0;
+    double total_confidence = 0.0;
+};
+
+// estimates once per block, comparing with the vibrato-free period
+static void measure(PitchDetector *detector, const std::vector<Complex> &signal, float freq, uint32_t hop, Accuracy &acc) {
+    detector->reset();
+    const float true_period = (float) SampleRate / freq;
+    detector->push_signal(signal.data(), WindowSize);
+    for (uint32_t pos = WindowSize; pos + hop <= signal.size(); pos += hop) {
+        detector->push_signal(signal.data() + pos, hop);
+        const PitchEstimate est = detector->estimate();
+
+        acc.n_estimates += 1;
+        acc.total_confidence += est.confidence;
+        const float semitones = est.period > 0.0f ? 12.0f * std::abs(std::log2(est.period / true_period)) : INFINITY;
+        if (semitones > GrossErrorSemitones) {
+            acc.n_gross_errors += 1;
+        } 
+        else {
+            acc.total_cents_error += 100.0f * semitones;
+        }
+    }
+}
+
+int main() {
+    const char *detector_names[NPitchDetectorTypes] = {"MPM", "YIN", "SRH"};
+    const float freqs[] = {70.0f, 98.0f, 131.0f, 196.0f, 262.0f, 392.0f, 523.0f, 740.0f};
+    const uint32_t signal_size = SampleRate;
+
+    struct Condition {
+        const char *name;
+        float noise_level;
+        bool missing_fundamental;
+    };
+    const Condition conditions[] = {
+        {"clean", 0.0f, false},
+        {"noisy (~15 dB SNR)", 0.07f, false},
+        {"missing fundamental", 0.0f, true},
+    };
+
+    std::cout << std::fixed << std::setprecision(2);
+
+    bool all_pass = true;
+    PitchDetector *detectors[NPitchDetectorTypes];
+    for (uint32_t type = 0; type < NPitchDetectorTypes; type++) {
+        detectors[type] = make_pitch_detector((PitchDetectorType) type, WindowSize, MinPeriod, MaxPeriod);
+    }
+
+    for (const Condition &condition: conditions) {
+        std::cout << condition.name << "\n";
+        for (uint32_t type = 0; type < NPitchDetectorTypes; type++) {
+            Accuracy acc;
+            for (uint32_t i = 0; i < sizeof(freqs) / sizeof(freqs[0]); i++) {
+                std::vector<Complex> signal = make_tone(freqs[i], condition.noise_level, condition.missing_fundamental, signal_size, i + 1);
+                measure(detectors[type], signal, freqs[i], 512, acc);
+            }
+            const float gross_rate = (float) acc.n_gross_errors / acc.n_estimates;
+            const uint32_t n_good = acc.n_estimates - acc.n_gross_errors;
+            std::cout << "    " << detector_names[type] << ": " << 100.0f * gross_rate << "% gross errors, "
+                      << (n_good > 0 ? acc.total_cents_error / n_good : 0.0) << " cents mean error, "
+                      << acc.total_confidence / acc.n_estimates << " mean confidence\n";
+
+            // the time-domain detectors should be dependable on plain voiced input
+            if (type != SRHPitchDetector && !condition.missing_fundamental && condition.noise_level == 0.0f) {
+                all_pass &= gross_rate < 0.02f;
+            }
+        }
+    }
+
+    // confidence should tell noise apart from voiced input
+    std::cout << "white noise\n";
+    std::vector<Complex> noise(signal_size);
+    std::mt19937 rng(7);
+    std::normal_distribution<float> white(0.0f, 0.3f);
+    for (Complex &x: noise) {
+        x = white(rng);
+    }
+    for (uint32_t type = 0; type < NPitchDetectorTypes; type++) {
+        Accuracy acc;
+        measure(detectors[type], noise, 100.0f, 512, acc);
+        std::cout << "    " << detector_names[type] << ": " << acc.total_confidence / acc.n_estimates << " mean confidence\n";
+    }
+
+    // incremental updates must agree with computing the lag sums from scratch
+    std::cout << "incremental updates\n";
+    std::vector<Complex> tone = make_tone(147.0f, 0.02f, false, signal_size, 11);
+    for (uint32_t type = MPMPitchDetector; type <= YINPitchDetector; type++) {
+        PitchDetector *incremental = make_pitch_detector((PitchDetectorType) type, WindowSize, MinPeriod, MaxPeriod);
+        PitchDetector *from_scratch = make_pitch_detector((PitchDetectorType) type, WindowSize, MinPeriod, MaxPeriod);
+        float max_diff = 0.0f;
+        for (uint32_t pos = 0; pos + 64 <= signal_size; pos += 64) {
+            incremental->push_signal(tone.data() + pos, 64);
+            const PitchEstimate a = incremental->estimate();
+            if (pos >= WindowSize && pos % 4096 == 0) {
+                from_scratch->reset();
+                from_scratch->push_signal(tone.data() + pos + 64 - WindowSize, WindowSize);
+                const PitchEstimate b = from_scratch->estimate();
+                max_diff = MAX(max_diff, std::abs(a.period - b.period));
+            }
+        }
+        const bool match = max_diff < 0.05f;
+        all_pass &= match;
+        std::cout << "    " << detector_names[type] << ": max period difference " << max_diff << " samples" 
+                  << (match ? "" : " (MISMATCH)") << "\n";
+        delete incremental;
+        delete from_scratch;
+    }
+
+    // cost per estimate depending on how many samples arrived since the last one
+    std::cout << "cost per estimate (window " << WindowSize << ", periods " << MinPeriod << " to " << MaxPeriod << ")\n";
+    for (uint32_t hop: {32u, 128u, 512u, WindowSize}) {
+        std::cout << "  hop " << hop << "\n";
+        for (uint32_t type = 0; type < NPitchDetectorTypes; type++) {
+            PitchDetector *detector = detectors[type];
+            detector->reset();
+            uint32_t pos = 0;
+            volatile float sink = 0.0f;
+            const uint32_t n_iters = MAX(50, 20 * WindowSize / hop);
+            const double t = time_us([&] () {
+                detector->push_signal(tone.data() + pos, hop);
+                sink = sink + detector->estimate().period;
+                pos = (pos + hop) % (signal_size - WindowSize);
+            }, n_iters);
+            std::cout << "    " << detector_names[type] << ": " << t << " us (" 
+                      << 1e6 * hop / SampleRate / t << "x real time)\n";
+        }
+    }
+
+    for (PitchDetector *detector: detectors) {
+        delete detector;
+    }
+
+    std::cout << (all_pass ? "All detectors pass" : "Detectors FAIL") << std::endl;
+    return all_pass ? 0 : 1;
+}
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dsp/common.h"
+#include "dsp/fft.h"
+#include "dsp/interpolation.h"
+#include "dsp/timestretcher.h"
+#include "mengumath.h"
+#include "templates/bucketqueue.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// Compares the heap and the bucket queue used to order phase propagation in PhaseVocoderDoneRightTimeStretcher,
+// both on their own and by the audio each produces
+
+// average time of a call in microseconds
+template<class F>
+static double time_us(F f, uint32_t n_iters) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < n_iters; i++) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / n_iters;
+}
+
+// the magnitude spectra of the two outputs must differ by less than this
+static constexpr double MinSpectralSNRdB = 20.0;
+
+// same quantisation as the stretcher. 1/8 octave buckets over 40 octaves
+static constexpr uint32_t NBuckets = 40 << 3;
+static uint32_t bucket_of(float mag, uint32_t max_key) {
+    uint32_t bits;
+    std::memcpy(&bits, &mag, sizeof(bits));
+    const uint32_t below_max = max_key - MIN(bits >> 20, max_key);
+    return NBuckets - 1 - MIN(below_max, NBuckets - 1);
+}
+
+static std::vector<Complex> make_signal(uint32_t size) {
+    std::vector<Complex> signal(size);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> noise(-0.05f, 0.05f);
+    for (uint32_t i = 0; i < size; i++) {
+        // a vibrato-ish voice with a few harmonics
+        const float f0 = 180.0f + 20.0f * std::sin(MATH_TAU * i / 22050.0f);
+        float x = 0.0f;
+        for (int h = 1; h <= 6; h++) {
+            x += std::sin(MATH_TAU * f0 * h * i / 44100.0f) / h;
+        }
+        signal[i] = 0.4f * x + noise(rng);
+    }
+    return signal;
+}
+
+static std::vector<Complex> stretch(PhaseVocoderDoneRightTimeStretcher &stretcher, const std::vector<Complex> &input, double &time_taken_us) {
+    const uint32_t block_size = 512;
+    std::vector<Complex> output;
+    std::vector<Complex> block(block_size);
+    time_taken_us = 0.0;
+    for (uint32_t i = 0; i + block_size <= input.size(); i += block_size) {
+        stretcher.push_signal(input.data() + i, block_size);
+        auto start = std::chrono::steady_clock::now();
+        const uint32_t n_popped = stretcher.pop_transformed_signal(block.data(), block_size);
+        time_taken_us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        output.insert(output.end(), block.begin(), block.begin() + n_popped);
+    }
+    return output;
+}
+
+// How far the short-time magnitude spectrum of b is below its difference from a's, in dB.
+// Phase vocoders keep running phases, so the waveforms drift apart even when they sound the same
+static double spectral_snr_db(const std::vector<Complex> &a, const std::vector<Complex> &b) {
+    const uint32_t window_size = 1024;
+    FFT fft(window_size);
+    std::vector<Complex> a_window(window_size);
+    std::vector<Complex> b_window(window_size);
+    std::vector<Complex> a_freqs(window_size);
+    std::vector<Complex> b_freqs(window_size);
+
+    double signal_power = 0.0;
+    double diff_power = 0.0;
+    for (uint32_t start = 0; start + window_size <= MIN(a.size(), b.size()); start += window_size / 2) {
+        for (uint32_t i = 0; i < window_size; i++) {
+            const float w = hann_window((float) i / window_size);
+            a_window[i] = w * a[start + i];
+            b_window[i] = w * b[start + i];
+        }
+        fft.transform(a_window.data(), a_freqs.data());
+        fft.transform(b_window.data(), b_freqs.data());
+        for (uint32_t i = 0; i < window_size / 2; i++) {
+            const double a_mag = std::abs(a_freqs[i]);
+            const double b_mag = std::abs(b_freqs[i]);
+            signal_power += a_mag * a_mag;
+            diff_power += (a_mag - b_mag) * (a_mag - b_mag);
+        }
+    }
+    return 10.0 * std::log10(signal_power / (diff_power + 1e-20));
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(2);
+    bool all_pass = true;
+
+    // Queues on their own: push every bin of a frame, then pop them all, as the first stage of the propagation does
+    std::mt19937 rng(2);
+    std::exponential_distribution<float> mag_dist(1.0f);
+    for (uint32_t n_bins: {128u, 256u, 1024u}) {
+        std::vector<float> mags(n_bins);
+        for (float &mag: mags) {
+            // squared magnitudes spread over several orders of magnitude, like a real spectrum
+            mag = std::pow(mag_dist(rng), 4.0f);
+        }
+        const float max_mag = *std::max_element(mags.begin(), mags.end());
+        uint32_t max_key;
+        std::memcpy(&max_key, &max_mag, sizeof(max_key));
+        max_key >>= 20;
+
+        const auto cmp = [&mags] (uint32_t a, uint32_t b) { return mags[a] < mags[b]; };
+        std::vector<uint32_t> heap(n_bins);
+        BucketQueue<uint32_t> buckets(NBuckets, n_bins);
+        std::vector<uint32_t> popped(n_bins);
+
+        volatile uint32_t sink = 0;
+        const double t_heap = time_us([&] () {
+            for (uint32_t i = 0; i < n_bins; i++) {
+                heap[i] = i;
+            }
+            std::make_heap(heap.begin(), heap.end(), cmp);
+            for (uint32_t size = n_bins; size > 0; size--) {
+                std::pop_heap(heap.begin(), heap.begin() + size, cmp);
+                sink = sink + heap[size - 1];
+            }
+        }, 20000);
+        const double t_buckets = time_us([&] () {
+            buckets.clear();
+            for (uint32_t i = 0; i < n_bins; i++) {
+                buckets.push(i, bucket_of(mags[i], max_key), cmp);
+            }
+            for (uint32_t i = 0; i < n_bins; i++) {
+                popped[i] = buckets.pop();
+            }
+            sink = sink + popped[0];
+        }, 20000);
+
+        // sorted buckets give exactly the heap's order
+        bool ordered = true;
+        for (uint32_t i = 1; i < n_bins; i++) {
+            ordered &= mags[popped[i]] <= mags[popped[i - 1]];
+        }
+        all_pass &= ordered;
+
+        std::cout << n_bins << " bins: heap " << t_heap << " us, buckets " << t_buckets << " us" 
+                  << (ordered ? "" : " (OUT OF ORDER)") << "\n";
+    }
+
+    // A near silent frame, where all but the loudest bin fall in the lowest bucket. Sorting that bucket as it is pushed
+    // is quadratic, so the stretcher leaves it unsorted
+    {
+        const uint32_t n_bins = 1024;
+        std::vector<float> mags(n_bins);
+        for (float &mag: mags) {
+            // over 120 dB below the loudest
+            mag = 1e-14f * mag_dist(rng);
+        }
+        mags[n_bins / 2] = 1.0f;
+        uint32_t max_key;
+        std::memcpy(&max_key, &mags[n_bins / 2], sizeof(max_key));
+        max_key >>= 20;
+
+        const auto cmp = [&mags] (uint32_t a, uint32_t b) { return mags[a] < mags[b]; };
+        BucketQueue<uint32_t> buckets(NBuckets, n_bins);
+        volatile uint32_t sink = 0;
+        const auto push_all = [&] (bool sort_lowest) {
+            buckets.clear();
+            for (uint32_t i = 0; i < n_bins; i++) {
+                const uint32_t bucket = bucket_of(mags[i], max_key);
+                if (bucket == 0 && !sort_lowest) {
+                    buckets.push(i, bucket);
+                }
+                else {
+                    buckets.push(i, bucket, cmp);
+                }
+            }
+        };
+        const auto pop_all = [&] () {
+            for (uint32_t i = 0; i < n_bins; i++) {
+                sink = sink + buckets.pop();
+            }
+        };
+        const double t_sorted = time_us([&] () { push_all(true); pop_all(); }, 200);
+        const double t_unsorted = time_us([&] () { push_all(false); pop_all(); }, 200);
+
+        // the loudest still comes out first
+        push_all(false);
+        const bool loudest_first = buckets.pop() == n_bins / 2;
+        all_pass &= loudest_first;
+
+        std::cout << "near silent " << n_bins << " bins: lowest bucket sorted " << t_sorted << " us, unsorted "
+                  << t_unsorted << " us" << (loudest_first ? "" : " (LOUDEST NOT FIRST)") << "\n";
+    }
+
+    // Both queues through the whole stretcher. Ordering differences only change which neighbour a phase is 
+    // propagated from, so the outputs should sound the same
+    const std::vector<Complex> input = make_signal(44100 * 4);
+    const char *preset_names[] = {"voice", "standard", "music"};
+    for (int preset = PhaseVocoderTimeStretcher::VoiceWindow; preset <= PhaseVocoderTimeStretcher::MusicWindow; preset++) {
+        for (float stretch_factor: {0.75f, 1.5f}) {
+            PhaseVocoderDoneRightTimeStretcher heap_stretcher(false, (PhaseVocoderTimeStretcher::WindowPreset) preset, 
+                                                              PhaseVocoderDoneRightTimeStretcher::HeapPropagationQueue);
+            PhaseVocoderDoneRightTimeStretcher bucket_stretcher(false, (PhaseVocoderTimeStretcher::WindowPreset) preset, 
+                                                                PhaseVocoderDoneRightTimeStretcher::BucketPropagationQueue);
+            heap_stretcher.set_stretch_factor(stretch_factor);
+            bucket_stretcher.set_stretch_factor(stretch_factor);
+
+            double t_heap, t_buckets;
+            const std::vector<Complex> heap_out = stretch(heap_stretcher, input, t_heap);
+            const std::vector<Complex> bucket_out = stretch(bucket_stretcher, input, t_buckets);
+
+            const double snr_db = spectral_snr_db(heap_out, bucket_out);
+            const bool equivalent = heap_out.size() == bucket_out.size() && snr_db > MinSpectralSNRdB;
+            bool identical = heap_out.size() == bucket_out.size();
+            for (uint32_t i = 0; identical && i < heap_out.size(); i++) {
+                identical = heap_out[i] == bucket_out[i];
+            }
+            all_pass &= equivalent || identical;
+
+            std::cout << preset_names[preset] << " window, stretch " << stretch_factor 
+                      << ": heap " << t_heap / 1000.0 << " ms, buckets " << t_buckets / 1000.0 << " ms, "
+                      << (identical ? "identical output" : "spectral difference " + std::to_string(snr_db) + " dB below signal")
+                      << (equivalent || identical ? "" : " (TOO DIFFERENT)") << "\n";
+        }
+    }
+
+    std::cout << (all_pass ? "Bucket queue matches the heap" : "Bucket queue DIFFERS from the heap") << std::endl;
+    return all_pass ? 0 : 1;
+}
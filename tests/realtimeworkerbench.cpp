@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audioplayers/Realtimeworker.h"
+#include "dsp/common.h"
+#include "dsp/effect.h"
+#include "dsp/formantshifter.h"
+#include "dsp/pitchshifter.h"
+#include "dsp/timestretcher.h"
+#include "mengumath.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace Mengu;
+using namespace dsp;
+
+// How long a device callback takes when it runs the effect itself, against when a RealTimeWorker has run it ahead.
+// Effects that process a frame at a time do all of it in whichever callback completes the frame, so inline,
+// the worst callback is many times the mean, and small buffers miss their deadline. With the worker, callbacks
+// only copy, so the worst should be near the mean, with no xruns as long as the worker keeps up on average.
+// The device is played from a thread at a real time priority above the worker's, as devices' own threads are.
+// Without one, the worker can take the core in the middle of a callback, which a real device would not let it
+
+static constexpr uint32_t SampleRate = 44100;
+static constexpr uint32_t PlaySeconds = 2;
+
+// sung syllables gliding around a few notes, with some breath noise
+static std::vector<float> make_signal() {
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+    std::vector<float> signal(PlaySeconds * SampleRate);
+    double phase = 0.0;
+    for (uint32_t i = 0; i < signal.size(); i++) {
+        const double t = (double) i / SampleRate;
+        const double f0 = 150.0 * std::pow(2.0, std::sin(0.3 * t) * 0.5);
+        phase += MATH_TAU * f0 / SampleRate;
+        const float envelope = 0.5f * (1.0f - std::cos(MATH_TAU * 1.5 * t));
+        float x = 0.0f;
+        for (int h = 1; h <= 10; h++) {
+            x += std::sin(h * phase) / h;
+        }
+        signal[i] = 0.2f * envelope * x + noise(rng);
+    }
+    return signal;
+}
+
+struct CallbackCost {
+    double mean_us;
+    double p99_us;
+    double worst_us;
+    // callbacks that took longer than the buffer lasts, or came up short of output
+    uint64_t n_xruns;
+};
+
+// above the worker, which runs 10 above the lowest
+static bool set_device_priority() {
+#ifdef _WIN32
+    return false;
+#else
+    sched_param param {};
+    param.sched_priority = MIN(sched_get_priority_min(SCHED_FIFO) + 20, sched_get_priority_max(SCHED_FIFO));
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#endif
+}
+
+// Calls callback every buffer_size frames' worth of time for PlaySeconds, like a device would,
+// timing each call. Returns the cost and how many calls took longer than a buffer
+static CallbackCost play_on_this_thread(const std::function<void(float *, uint32_t)> &callback, uint32_t buffer_size) {
+    using clock = std::chrono::steady_clock;
+    const uint32_t n_callbacks = PlaySeconds * SampleRate / buffer_size;
+    const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>((double) buffer_size / SampleRate));
+    std::vector<float> output(buffer_size);
+    std::vector<double> costs;
+    costs.reserve(n_callbacks);
+
+    uint64_t n_late = 0;
+    auto next = clock::now();
+    for (uint32_t i = 0; i < n_callbacks; i++) {
+        std::this_thread::sleep_until(next);
+        const auto start = clock::now();
+        callback(output.data(), buffer_size);
+        const auto end = clock::now();
+        costs.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        n_late += end - start > period ? 1 : 0;
+        next += period;
+    }
+
+    std::sort(costs.begin(), costs.end());
+    double total = 0.0;
+    for (double cost: costs) {
+        total += cost;
+    }
+    return {total / costs.size(), costs[costs.size() * 99 / 100], costs.back(), n_late};
+}
+
+// plays on a thread of the device's priority
+static CallbackCost play(const std::function<void(float *, uint32_t)> &callback, uint32_t buffer_size, bool &real_time) {
+    CallbackCost cost;
+    std::thread device([&] () {
+        real_time = set_device_priority();
+        cost = play_on_this_thread(callback, buffer_size);
+    });
+    device.join();
+    return cost;
+}
+
+struct Case {
+    std::string name;
+    std::function<Effect *()> make_effect;
+};
+
+int main() {
+    std::cout << std::fixed << std::setprecision(1);
+    const std::vector<float> signal = make_signal();
+
+    const std::vector<Case> cases = {
+        {"lpc formant x1.2", [] () {
+            Effect *effect = new LPCFormantShifter();
+            effect->set_property(0, EffectPropPayload {.type = Slider, .value = 1.2f});
+            return effect;
+        }},
+        {"pvdr pitch x1.3", [] () {
+            TimeStretchPitchShifter *effect = new TimeStretchPitchShifter(new PhaseVocoderDoneRightTimeStretcher(true), 1);
+            effect->set_shift_factor(1.3f);
+            return (Effect *) effect;
+        }},
+        {"wsola pitch x1.3", [] () {
+            TimeStretchPitchShifter *effect = new TimeStretchPitchShifter(new WSOLATimeStretcher(), 1);
+            effect->set_shift_factor(1.3f);
+            return (Effect *) effect;
+        }},
+    };
+
+    for (const Case &c: cases) {
+        std::cout << "-- " << c.name << std::endl;
+        for (uint32_t buffer_size: {64u, 256u}) {
+            const double period_us = 1e6 * buffer_size / SampleRate;
+            std::cout << "buffer " << buffer_size << " (" << period_us << "us)" << std::endl;
+
+            for (bool use_worker: {false, true}) {
+                Effect *effect = c.make_effect();
+                effect->set_sample_rate(SampleRate);
+                std::vector<Complex> samples;
+                uint64_t position = 0;
+                // the signal through the effect, looped
+                auto render = [&] (float *output, uint32_t n_frames) {
+                    samples.resize(n_frames);
+                    for (uint32_t i = 0; i < n_frames; i++) {
+                        samples[i] = signal[(position + i) % signal.size()];
+                    }
+                    position += n_frames;
+                    effect->push_signal(samples.data(), n_frames);
+                    effect->pop_transformed_signal(samples.data(), n_frames);
+                    for (uint32_t i = 0; i < n_frames; i++) {
+                        output[i] = samples[i].real();
+                    }
+                };
+
+                CallbackCost cost;
+                bool device_real_time = false;
+                RealTimeWorker worker;
+                if (use_worker) {
+                    worker.start([&] (const float *, float *output, uint32_t n_frames) {
+                        render(output, n_frames);
+                    }, 0, 1);
+                    // let it fill up, as it would before the device started
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                    cost = play([&] (float *output, uint32_t n_frames) {
+                        worker.process(nullptr, output, n_frames);
+                    }, buffer_size, device_real_time);
+                    cost.n_xruns += worker.get_n_xruns();
+                    worker.stop();
+                }
+                else {
+                    samples.reserve(buffer_size);
+                    cost = play(render, buffer_size, device_real_time);
+                }
+
+                std::cout << (use_worker ? "worker" : "inline")
+                    << "  mean " << std::setw(7) << cost.mean_us << "us"
+                    << "  p99 " << std::setw(7) << cost.p99_us << "us"
+                    << "  worst " << std::setw(7) << cost.worst_us << "us"
+                    << "  worst/mean " << std::setw(6) << cost.worst_us / MAX(cost.mean_us, 1e-3)
+                    << "  xruns " << cost.n_xruns;
+                std::cout << "  device " << (device_real_time ? "real time" : "normal");
+                if (use_worker) {
+                    std::cout << ", worker " << (worker.is_real_time() ? "real time" : "normal");
+                }
+                std::cout << std::endl;
+                delete effect;
+            }
+        }
+    }
+
+    std::cout << "-- 3 input channels, with the worker stalled until input is dropped" << std::endl;
+    {
+        const uint32_t n_channels = 3;
+        const uint32_t buffer_size = 100;
+        // each frame holds its channel numbers, so a frame that starts on another channel has slipped
+        std::vector<float> input(buffer_size * n_channels);
+        for (uint32_t i = 0; i < input.size(); i++) {
+            input[i] = (float) (i % n_channels);
+        }
+        std::vector<float> output(buffer_size);
+        uint64_t n_slipped = 0;
+        uint64_t n_blocks = 0;
+        RealTimeWorker worker;
+        worker.start([&] (const float *block_input, float *block_output, uint32_t n_frames) {
+            if (n_blocks++ == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            }
+            for (uint32_t i = 0; i < n_frames * n_channels; i++) {
+                n_slipped += block_input[i] != (float) (i % n_channels) ? 1 : 0;
+            }
+            std::fill(block_output, block_output + n_frames, 0.0f);
+        }, n_channels, 1);
+        // a second of callbacks, at the pace a device would make them
+        const auto period = std::chrono::microseconds(1000000 * buffer_size / SampleRate);
+        auto next = std::chrono::steady_clock::now();
+        for (uint32_t c = 0; c < SampleRate / buffer_size; c++) {
+            std::this_thread::sleep_until(next);
+            worker.process(input.data(), output.data(), buffer_size);
+            next += period;
+        }
+        worker.stop();
+        std::cout << "xruns " << worker.get_n_xruns() << ", samples in the wrong channel " << n_slipped << std::endl;
+    }
+}
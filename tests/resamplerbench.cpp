@@ -0,0 +1,207 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "dsp/common.h"
+#include "dsp/linalg.h"
+#include "dsp/sampling.h"
+#include "mengumath.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// Quality and cost of PolyphaseResampler, against plain linear interpolation (what LinearResampler does
+// before its lowpass) at the stretch factors TimeStretchPitchShifter uses
+
+static constexpr uint32_t SampleRate = 44100;
+static constexpr uint32_t BlockSize = 512;
+static constexpr uint32_t SignalSize = SampleRate * 2;
+
+static std::vector<float> make_sine(float freq, uint32_t size) {
+    std::vector<float> signal(size);
+    for (uint32_t i = 0; i < size; i++) {
+        signal[i] = std::sin(MATH_TAU * freq * i / SampleRate);
+    }
+    return signal;
+}
+
+// resamples in blocks, like the pitch shifter does
+static std::vector<float> polyphase_resample(PolyphaseResampler &resampler, const std::vector<float> &input) {
+    std::vector<float> output;
+    std::vector<float> block(resampler.max_output_size(BlockSize));
+    for (uint32_t pos = 0; pos + BlockSize <= input.size(); pos += BlockSize) {
+        const uint32_t n = resampler.process(input.data() + pos, BlockSize, block.data());
+        output.insert(output.end(), block.begin(), block.begin() + n);
+    }
+    return output;
+}
+
+static std::vector<float> linear_resample(const std::vector<float> &input, float stretch_factor) {
+    std::vector<float> output;
+    for (double t = 0.0; t + 1 < input.size(); t += stretch_factor) {
+        const uint32_t i = (uint32_t) t;
+        output.push_back(lerp(input[i], input[i + 1], (float) (t - i)));
+    }
+    return output;
+}
+
+// error against the exact resampled sine, in dB below the signal. Output sample m is input time m * stretch_factor - delay
+static double snr_db(const std::vector<float> &output, float freq, float stretch_factor, float delay) {
+    double signal = 0.0;
+    double error = 0.0;
+    // skip the filter warming up
+    for (uint32_t m = 256; m < output.size(); m++) {
+        const double t = m * (double) stretch_factor - delay;
+        const double expected = std::sin(MATH_TAU * freq * t / SampleRate);
+        signal += expected * expected;
+        error += (output[m] - expected) * (output[m] - expected);
+    }
+    return 10.0 * std::log10(signal / error);
+}
+
+// level of the output relative to a full-scale input, in dB. For tones that should have been filtered out
+static double level_db(const std::vector<float> &output) {
+    double total = 0.0;
+    for (uint32_t m = 256; m < output.size(); m++) {
+        total += output[m] * output[m];
+    }
+    return 10.0 * std::log10(total / (output.size() - 256) / 0.5);
+}
+
+template<class F>
+static double time_ns_per_output(F f, uint32_t n_outputs, uint32_t n_iters) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < n_iters; i++) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (n_iters * (double) n_outputs);
+}
+
+int main() {
+    const float stretch_factors[] = {0.5f, 0.8f, 1.0f, 1.25f, 2.0f};
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "-- SNR of a resampled 1kHz / 5kHz sine (dB, higher is better)" << std::endl;
+    for (float freq: {1000.0f, 5000.0f}) {
+        const std::vector<float> sine = make_sine(freq, SignalSize);
+        for (float stretch_factor: stretch_factors) {
+            PolyphaseResampler resampler(stretch_factor);
+            const std::vector<float> poly = polyphase_resample(resampler, sine);
+            const std::vector<float> lin = linear_resample(sine, stretch_factor);
+            std::cout << freq << "Hz stretch " << std::setw(4) << stretch_factor
+                << "  polyphase " << std::setw(6) << snr_db(poly, freq, stretch_factor, resampler.latency())
+                << "  linear " << std::setw(6) << snr_db(lin, freq, stretch_factor, 0.0f) << std::endl;
+        }
+    }
+
+    std::cout << "-- level of a tone above the output nyquist (dB, lower is better)" << std::endl;
+    for (float stretch_factor: {1.25f, 2.0f}) {
+        // between the output's nyquist and the input's
+        const float freq = 0.5f * SampleRate * (1.0f + 1.0f / stretch_factor) / 2.0f;
+        const std::vector<float> sine = make_sine(freq, SignalSize);
+        PolyphaseResampler resampler(stretch_factor);
+        std::cout << std::setw(7) << freq << "Hz stretch " << std::setw(4) << stretch_factor
+            << "  polyphase " << std::setw(6) << level_db(polyphase_resample(resampler, sine))
+            << "  linear " << std::setw(6) << level_db(linear_resample(sine, stretch_factor)) << std::endl;
+    }
+
+    std::cout << "-- gliding the stretch factor from 1 to 1.5 over a second" << std::endl;
+    {
+        // a constant must stay constant, and the number of outputs must follow the average factor
+        const std::vector<float> ones(SignalSize, 1.0f);
+        PolyphaseResampler resampler(1.0f);
+        resampler.set_stretch_factor(1.5f, SampleRate);
+        const std::vector<float> output = polyphase_resample(resampler, ones);
+        float worst = 0.0f;
+        for (uint32_t m = resampler.latency() * 2; m < output.size(); m++) {
+            worst = MAX(worst, std::abs(output[m] - 1.0f));
+        }
+        std::cout << "outputs " << output.size() << " (expected about "
+            << (uint32_t) (SampleRate + (SignalSize - 1.25f * SampleRate) / 1.5f) << ")"
+            << std::setprecision(7) << "  worst dc error " << worst << std::setprecision(2) << std::endl;
+    }
+
+    std::cout << "-- gliding from 1.5 back to 1, then passing through" << std::endl;
+    {
+        // a ramp passed through comes out as whole steps of one, which filtering would not keep exactly
+        std::vector<float> ramp(SignalSize);
+        for (uint32_t i = 0; i < SignalSize; i++) {
+            ramp[i] = (float) i;
+        }
+        PolyphaseResampler resampler(1.5f);
+        resampler.set_stretch_factor(1.0f, SampleRate / 2);
+        // ignored
+        resampler.set_stretch_factor(0.0f);
+        resampler.set_stretch_factor(-1.0f);
+        resampler.set_stretch_factor(NAN);
+        const std::vector<float> output = polyphase_resample(resampler, ramp);
+        uint32_t first_passed = 0;
+        for (uint32_t m = 1; m < output.size(); m++) {
+            if (output[m] - output[m - 1] != 1.0f) {
+                first_passed = m;
+            }
+        }
+        std::cout << "passes through from output " << first_passed << " (glide ends at " << SampleRate / 2 << "), factor "
+            << resampler.get_stretch_factor() << std::endl;
+    }
+
+    std::cout << "-- gliding from another thread while processing" << std::endl;
+    {
+        // like a slider being dragged. No block may output more than max_output_size said it could
+        const std::vector<float> sine = make_sine(1000.0f, BlockSize);
+        PolyphaseResampler resampler(1.0f);
+        std::atomic<bool> done = false;
+        std::thread setter([&] () {
+            for (uint32_t i = 0; !done; i++) {
+                resampler.set_stretch_factor(i % 2 == 0 ? 0.5f : 2.0f, i % 3 == 0 ? 0 : BlockSize / 2);
+            }
+        });
+        std::vector<float> output;
+        uint32_t n_overflows = 0;
+        for (uint32_t i = 0; i < 20000; i++) {
+            const uint32_t max_output = resampler.max_output_size(BlockSize);
+            output.resize(max_output);
+            n_overflows += resampler.process(sine.data(), BlockSize, output.data()) > max_output;
+        }
+        done = true;
+        setter.join();
+        std::cout << "blocks over max_output_size " << n_overflows << std::endl;
+    }
+
+    std::cout << "-- cost (ns per output sample)" << std::endl;
+    {
+        const std::vector<float> sine = make_sine(1000.0f, BlockSize);
+        std::vector<Complex> csine(sine.begin(), sine.end());
+        for (float stretch_factor: stretch_factors) {
+            PolyphaseResampler resampler(stretch_factor);
+            std::vector<float> output(resampler.max_output_size(BlockSize));
+            std::vector<Complex> coutput(output.size());
+            const uint32_t n_outputs = BlockSize / stretch_factor;
+
+            const double poly_ns = time_ns_per_output(
+                [&] () { resampler.process(sine.data(), BlockSize, output.data()); }, n_outputs, 2000);
+            const double complex_ns = time_ns_per_output(
+                [&] () { resampler.process(csine.data(), BlockSize, coutput.data()); }, n_outputs, 2000);
+            const double lin_ns = time_ns_per_output(
+                [&] () { linear_resample(sine, stretch_factor); }, n_outputs, 2000);
+
+            std::cout << "stretch " << std::setw(4) << stretch_factor
+                << "  polyphase " << std::setw(5) << poly_ns
+                << "  polyphase (complex) " << std::setw(5) << complex_ns
+                << "  linear " << std::setw(5) << lin_ns << std::endl;
+        }
+        // alternates between two cutoffs so every call redesigns. This is on the thread setting the factor
+        PolyphaseResampler resampler(1.0f);
+        float stretch_factor = 1.0f;
+        std::cout << "redesigning the filter: " << time_ns_per_output(
+            [&] () { stretch_factor = 3.0f - stretch_factor; resampler.set_stretch_factor(stretch_factor); }, 1, 100) / 1000.0
+            << "us" << std::endl;
+    }
+    std::cout << "kernels: " << simd_kernel_name() << std::endl;
+}
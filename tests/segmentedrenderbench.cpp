@@ -0,0 +1,227 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dsp/common.h"
+#include "dsp/fft.h"
+#include "dsp/singletons.h"
+#include "mengumath.h"
+#include "offline/renderchain.h"
+#include "offline/segmentedrender.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// Rendering a long signal in segments on many threads, against rendering it in one go.
+// Segments only differ from the one go by what the effects remember from before their pre-roll, so the
+// level and spectrum of each frame should barely move, except a little at the seams where they are crossfaded.
+// Speedup is bounded by the hardware threads, and by the pre-roll rendered on top of each segment
+
+static constexpr uint32_t SampleRate = 44100;
+static constexpr uint32_t SignalSeconds = 180;
+// frames that the outputs are compared over
+static constexpr uint32_t FrameSize = 1 << 12;
+// frames quieter than this are not compared
+static constexpr float SilenceDb = -50.0f;
+// the signal is also rendered in one go with this much silence in front of it, to see how much that alone changes
+static constexpr uint32_t DelaySize = 441;
+
+// sung syllables gliding around a few notes, with some breath noise
+static std::vector<float> make_signal() {
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+    std::vector<float> signal(SignalSeconds * SampleRate);
+    double phase = 0.0;
+    for (uint32_t i = 0; i < signal.size(); i++) {
+        const double t = (double) i / SampleRate;
+        const double f0 = 150.0 * std::pow(2.0, std::sin(0.3 * t) * 0.5 + 0.05 * std::sin(MATH_TAU * 5.0 * t));
+        phase += MATH_TAU * f0 / SampleRate;
+        // syllables about 3 a second
+        const float envelope = 0.5f * (1.0f - std::cos(MATH_TAU * 1.5 * t));
+        float x = 0.0f;
+        for (int h = 1; h <= 10; h++) {
+            x += std::sin(h * phase) / h;
+        }
+        signal[i] = 0.2f * envelope * x + noise(rng);
+    }
+    return signal;
+}
+
+static float to_db(float power) {
+    return 10.0f * std::log10(MAX(power, 1e-12f));
+}
+
+// log spaced bands the spectra are compared in, so that what lies between harmonics does not count
+static constexpr uint32_t NBands = 24;
+static constexpr float LowestBandHz = 50.0f;
+static constexpr float HighestBandHz = 16000.0f;
+// bands quieter than the loudest by this are not compared
+static constexpr float BandRangeDb = 40.0f;
+
+struct Deviation {
+    // largest difference in level of a frame, in dB
+    float max_level_db;
+    // mean over bands of the difference in their level, for the frame where it is largest, in dB
+    float max_spectral_db;
+};
+
+static void band_levels(const Complex *freqs, float *levels) {
+    for (uint32_t band = 0; band < NBands; band++) {
+        const float low_hz = LowestBandHz * std::pow(HighestBandHz / LowestBandHz, (float) band / NBands);
+        const float high_hz = LowestBandHz * std::pow(HighestBandHz / LowestBandHz, (float) (band + 1) / NBands);
+        float power = 0.0f;
+        for (uint32_t k = low_hz * FrameSize / SampleRate; k < MIN((uint32_t) (high_hz * FrameSize / SampleRate), FrameSize / 2); k++) {
+            power += std::norm(freqs[k]);
+        }
+        levels[band] = to_db(power);
+    }
+}
+
+// compares the frames of two outputs. Frames are split by whether they touch a seam
+static void compare(const std::vector<float> &a, const std::vector<float> &b, double seam_spacing, uint32_t seam_width,
+        Deviation &at_seams, Deviation &elsewhere) {
+    const FFT &fft = Singletons::get_singleton()->get_fft(FrameSize);
+    std::vector<Complex> frame_a(FrameSize), frame_b(FrameSize), freqs_a(FrameSize), freqs_b(FrameSize);
+    float levels_a[NBands], levels_b[NBands];
+    at_seams = elsewhere = {0.0f, 0.0f};
+
+    for (uint64_t start = 0; start + FrameSize <= MIN(a.size(), b.size()); start += FrameSize) {
+        float power_a = 0.0f;
+        float power_b = 0.0f;
+        for (uint32_t i = 0; i < FrameSize; i++) {
+            frame_a[i] = a[start + i];
+            frame_b[i] = b[start + i];
+            power_a += a[start + i] * a[start + i];
+            power_b += b[start + i] * b[start + i];
+        }
+        if (to_db(power_a / FrameSize) < SilenceDb) {
+            continue;
+        }
+        fft.transform(frame_a.data(), freqs_a.data());
+        fft.transform(frame_b.data(), freqs_b.data());
+        band_levels(freqs_a.data(), levels_a);
+        band_levels(freqs_b.data(), levels_b);
+
+        float loudest = levels_a[0];
+        for (uint32_t band = 1; band < NBands; band++) {
+            loudest = MAX(loudest, levels_a[band]);
+        }
+        float spectral = 0.0f;
+        uint32_t n_bands = 0;
+        for (uint32_t band = 0; band < NBands; band++) {
+            if (levels_a[band] > loudest - BandRangeDb) {
+                spectral += std::abs(levels_a[band] - levels_b[band]);
+                n_bands++;
+            }
+        }
+        spectral /= MAX(n_bands, 1u);
+        const float level = std::abs(to_db(power_a) - to_db(power_b));
+
+        // the nearest seam, if there are any
+        bool touches_seam = false;
+        if (seam_spacing > 0.0) {
+            const double seam = std::round((start + FrameSize / 2) / seam_spacing) * seam_spacing;
+            touches_seam = seam > 0.0 && std::abs(seam - (start + FrameSize / 2)) < FrameSize / 2 + seam_width;
+        }
+        Deviation &deviation = touches_seam ? at_seams : elsewhere;
+        deviation.max_level_db = MAX(deviation.max_level_db, level);
+        deviation.max_spectral_db = MAX(deviation.max_spectral_db, spectral);
+    }
+}
+
+template<class F>
+static double time_s(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+struct Case {
+    std::string name;
+    RenderSettings settings;
+};
+
+static RenderSettings make_settings(float pitch, float formant, float stretch,
+        RenderSettings::PitchShifterType pitch_shifter, RenderSettings::StretcherType stretcher) {
+    RenderSettings settings;
+    settings.pitch_shift = pitch;
+    settings.formant_shift = formant;
+    settings.stretch = stretch;
+    settings.pitch_shifter = pitch_shifter;
+    settings.stretcher = stretcher;
+    return settings;
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << SignalSeconds << "s signal, " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    const std::vector<float> input = make_signal();
+
+    const std::vector<Case> cases = {
+        {"wsola pitch x1.5", make_settings(1.5f, 1.0f, 1.0f, RenderSettings::WSOLAPitchShifter, RenderSettings::WSOLAStretcher)},
+        {"pv pitch x0.8", make_settings(0.8f, 1.0f, 1.0f, RenderSettings::PhaseVocoderPitchShifter, RenderSettings::WSOLAStretcher)},
+        {"formant x1.3", make_settings(1.0f, 1.3f, 1.0f, RenderSettings::WSOLAPitchShifter, RenderSettings::WSOLAStretcher)},
+        {"wsola stretch x1.25", make_settings(1.0f, 1.0f, 1.25f, RenderSettings::WSOLAPitchShifter, RenderSettings::WSOLAStretcher)},
+        {"pv stretch x0.8", make_settings(1.0f, 1.0f, 0.8f, RenderSettings::WSOLAPitchShifter, RenderSettings::PhaseVocoderStretcher)},
+        {"all three", make_settings(1.2f, 0.9f, 1.1f, RenderSettings::WSOLAPitchShifter, RenderSettings::WSOLAStretcher)},
+    };
+
+    for (const Case &c: cases) {
+        std::vector<float> sequential;
+        const double sequential_s = time_s([&]() {
+            sequential = render_sequential(c.settings, input.data(), input.size(), SampleRate);
+        });
+        std::cout << "-- " << c.name << "  in one go " << sequential_s << "s" << std::endl;
+
+        // How much rendering in one go differs from itself, when the effects start a little earlier in the signal.
+        // Segments cannot do better than this
+        {
+            std::vector<float> delayed_input(DelaySize, 0.0f);
+            delayed_input.insert(delayed_input.end(), input.begin(), input.end());
+            std::vector<float> delayed = render_sequential(c.settings, delayed_input.data(), delayed_input.size(), SampleRate);
+            const RenderChain lengths(c.settings);
+            delayed.erase(delayed.begin(), delayed.begin() + lengths.output_size(DelaySize));
+
+            Deviation unused, deviation;
+            compare(sequential, delayed, 0.0, 0, unused, deviation);
+            std::cout << "started " << DelaySize << " samples early"
+                << "  dB off level " << std::setw(5) << deviation.max_level_db
+                << " spectrum " << std::setw(5) << deviation.max_spectral_db << std::endl;
+        }
+
+        for (uint32_t n_threads: {2u, 4u, 16u}) {
+            SegmentSettings segment_settings;
+            segment_settings.n_threads = n_threads;
+            std::vector<float> segmented;
+            const double segmented_s = time_s([&]() {
+                segmented = render_segmented(c.settings, segment_settings, input.data(), input.size(), SampleRate);
+            });
+
+            // the segment length render_segmented picks, and how much more it renders for the pre-rolls
+            const double segment_seconds = CLAMP((double) SignalSeconds / (n_threads * 4), 5.0, 60.0);
+            const double extra_work = 2.0 * segment_settings.preroll_seconds / segment_seconds;
+            const double seam_spacing = segment_seconds * SampleRate * c.settings.stretch;
+
+            Deviation at_seams, elsewhere;
+            compare(sequential, segmented, seam_spacing, segment_settings.crossfade_seconds * SampleRate * c.settings.stretch,
+                at_seams, elsewhere);
+
+            std::cout << "threads " << std::setw(2) << n_threads
+                << "  " << std::setw(6) << segmented_s << "s"
+                << "  speedup " << std::setw(5) << sequential_s / segmented_s
+                << " (at most " << std::setw(5) << MIN(n_threads, std::thread::hardware_concurrency()) / (1.0 + extra_work) << ")"
+                << "  length " << (segmented.size() == sequential.size() ? "same" : "DIFFERENT")
+                << "  dB off at seams level " << std::setw(5) << at_seams.max_level_db
+                << " spectrum " << std::setw(5) << at_seams.max_spectral_db
+                << ", elsewhere level " << std::setw(5) << elsewhere.max_level_db
+                << " spectrum " << std::setw(5) << elsewhere.max_spectral_db << std::endl;
+        }
+    }
+}
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "mengumath.h"
+#include "offline/mappedwav.h"
+#include "offline/renderchain.h"
+#include "offline/segmentedrender.h"
+#include "offline/wavwriter.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace Mengu;
+
+// What writing rendered blocks out costs the thread rendering them, written straight to the file as each is rendered
+// against handed to a StreamingWavWriter. Each block takes some work to render first, which the writer's thread writes
+// alongside, so it should take about as long as the longer of the two rather than both. Rendering here outruns the
+// disk, so the writer has to hold it back, and its peak memory should grow by its buffers, not the file.
+// What is written is read back frame for frame, through buffers small enough to wrap many times
+// in odd sized blocks, and a disk that is full should be reported rather than hang. A render written as it is made
+// should be the same as one kept in memory, including stretches that make more than they keep
+
+static constexpr uint32_t SampleRate = 44100;
+static constexpr uint32_t NChannels = 2;
+static constexpr uint32_t BlockSize = 1024;
+// more than most machines let the page cache hold unwritten, so the disk does fall behind
+static constexpr uint32_t FileMB = 3072;
+
+static double peak_rss_mb() {
+#ifdef _WIN32
+    return 0.0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+// stands in for the effects, as some work on each block before it is written
+static void render_block(std::vector<float> &block, uint64_t block_ind) {
+    for (uint32_t i = 0; i < block.size(); i++) {
+        block[i] = 0.5f * block[i] + 1e-6f * (float) ((block_ind + i) % 1000);
+    }
+}
+
+struct WriteCost {
+    double seconds;
+    double worst_us;
+    double rss_mb;
+};
+
+// renders and writes n_blocks blocks, with write taking each block, timing how long write held each up
+template <typename Write>
+static WriteCost render_and_write(uint64_t n_blocks, Write write) {
+    using Clock = std::chrono::steady_clock;
+    std::vector<float> block(BlockSize * NChannels, 0.0f);
+    const double base_rss = peak_rss_mb();
+    double worst_us = 0.0;
+    const auto start = Clock::now();
+    for (uint64_t b = 0; b < n_blocks; b++) {
+        render_block(block, b);
+        const auto write_start = Clock::now();
+        write(block);
+        worst_us = std::max(worst_us, std::chrono::duration<double, std::micro>(Clock::now() - write_start).count());
+    }
+    return {std::chrono::duration<double>(Clock::now() - start).count(), worst_us, peak_rss_mb() - base_rss};
+}
+
+static void print_cost(const char *name, const WriteCost &cost) {
+    std::cout << name << std::setw(8) << cost.seconds * 1e3 << "ms  worst write " << std::setw(8) << cost.worst_us
+        << "us  peak resident +" << std::setw(6) << cost.rss_mb << "MB";
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(1);
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / "mengu_wavwriterbench";
+    std::filesystem::create_directories(dir);
+    const std::filesystem::path path = dir / "out.wav";
+    bool all_ok = true;
+
+    // read back the same, through two small buffers that wrap many times, written in blocks that never fill one evenly
+    for (uint32_t n_channels: {1u, 3u}) {
+        const uint64_t n_frames = 100003;
+        std::vector<float> x(n_frames * n_channels);
+        for (uint64_t i = 0; i < x.size(); i++) {
+            x[i] = (float) i;
+        }
+        {
+            StreamingWavWriter writer(path, SampleRate, n_channels, 3 * StreamingWavWriter::BlockAlignment, 2);
+            for (uint64_t start = 0, size = 1; start < n_frames; start += size, size = size * 3 % 997 + 1) {
+                writer.write(x.data() + start * n_channels, std::min(size, n_frames - start));
+            }
+            writer.close();
+        }
+        MappedWavFile file(path);
+        std::vector<float> read(x.size());
+        const uint64_t n_read = file.read(read.data(), n_frames);
+        const bool same = n_read == n_frames && file.get_n_channels() == n_channels
+            && file.get_sample_rate() == SampleRate && read == x;
+        std::cout << n_channels << " channels " << (same ? "read back the same" : "read back DIFFERENT") << std::endl;
+        all_ok = all_ok && same;
+    }
+
+#ifdef __linux__
+    // every write to /dev/full fails, which should be thrown, not wait forever on buffers that are never written
+    {
+        bool thrown = false;
+        try {
+            StreamingWavWriter writer("/dev/full", SampleRate, NChannels, 2 * StreamingWavWriter::BlockAlignment, 2);
+            std::vector<float> block(BlockSize * NChannels, 0.0f);
+            for (uint32_t b = 0; b < 1000; b++) {
+                writer.write(block.data(), BlockSize);
+            }
+            writer.close();
+        }
+        catch (const std::exception &e) {
+            thrown = true;
+            std::cout << "a full disk is thrown: " << e.what() << std::endl;
+        }
+        if (!thrown) {
+            std::cout << "a full disk was NOT thrown" << std::endl;
+        }
+        all_ok = all_ok && thrown;
+    }
+#endif
+
+    // phase vocoders make output in whole hops, past what the chain keeps of it
+    {
+        const uint32_t render_rate = 48000;
+        const uint64_t n_frames = 3 * render_rate;
+        const std::filesystem::path input_path = dir / "render_in.wav";
+        {
+            std::vector<float> x(n_frames * NChannels);
+            for (uint64_t i = 0; i < x.size(); i++) {
+                const double t = (double) (i / NChannels) / render_rate;
+                x[i] = 0.5f * (float) std::sin(MATH_TAU * (220.0 + 110.0 * (i % NChannels)) * t);
+            }
+            StreamingWavWriter writer(input_path, render_rate, NChannels);
+            writer.write(x.data(), n_frames);
+            writer.close();
+        }
+
+        const struct {
+            RenderSettings::StretcherType stretcher;
+            float stretch;
+            const char *name;
+        } stretches[] = {
+            {RenderSettings::PhaseVocoderStretcher, 0.5f, "pv x0.5"},
+            {RenderSettings::PhaseVocoderDoneRightStretcher, 0.6f, "pvdr x0.6"},
+        };
+        for (const auto &stretch: stretches) {
+            RenderSettings settings;
+            settings.stretcher = stretch.stretcher;
+            settings.stretch = stretch.stretch;
+
+            uint64_t n_read = 0;
+            MappedWavFile kept_source(input_path);
+            const std::vector<float> kept = render_sequential(settings, kept_source, n_read);
+            {
+                MappedWavFile written_source(input_path);
+                StreamingWavWriter writer(path, render_rate, NChannels);
+                render_sequential(settings, written_source, writer, n_read);
+                writer.close();
+            }
+            MappedWavFile file(path);
+            std::vector<float> written(file.get_length_hint() * NChannels);
+            written.resize(file.read(written.data(), file.get_length_hint()) * NChannels);
+            const bool same = written == kept;
+            std::cout << "render of " << stretch.name << " written " << written.size() / NChannels << " frames, kept "
+                << kept.size() / NChannels << (same ? ", the same" : ", DIFFERENT") << std::endl;
+            all_ok = all_ok && same;
+        }
+    }
+
+    const uint64_t n_blocks = (uint64_t) FileMB * (1 << 20) / (BlockSize * NChannels * sizeof(float));
+    std::cout << "-- " << FileMB << "MB of " << BlockSize << " frame blocks in " << NChannels << " channels" << std::endl;
+
+    {
+        const WriteCost cost = render_and_write(n_blocks, [&] (std::vector<float> &) {});
+        print_cost("render only ", cost);
+        std::cout << std::endl;
+    }
+
+    // how files were written before, a block at a time to a stdio file
+    {
+        FILE *file = std::fopen(path.string().c_str(), "wb");
+        const WriteCost cost = render_and_write(n_blocks, [&] (std::vector<float> &block) {
+            std::fwrite(block.data(), sizeof(float), block.size(), file);
+        });
+        std::fclose(file);
+        print_cost("fwrite      ", cost);
+        std::cout << std::endl;
+    }
+
+    {
+        StreamingWavWriter writer(path, SampleRate, NChannels);
+        WriteCost cost = render_and_write(n_blocks, [&] (std::vector<float> &block) {
+            writer.write(block.data(), BlockSize);
+        });
+        const auto close_start = std::chrono::steady_clock::now();
+        writer.close();
+        cost.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - close_start).count();
+        print_cost("wav writer  ", cost);
+        std::cout << "  blocked " << writer.get_n_blocked() << " times for " << writer.get_blocked_seconds() * 1e3 << "ms"
+            << std::endl;
+
+        const bool whole = MappedWavFile(path).get_length_hint() == n_blocks * BlockSize;
+        std::cout << "written " << (whole ? "whole" : "SHORT") << std::endl;
+        all_ok = all_ok && whole;
+    }
+
+    std::filesystem::remove_all(dir);
+    return all_ok ? 0 : 1;
+}
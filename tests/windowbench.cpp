@@ -0,0 +1,85 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "dsp/common.h"
+#include "dsp/interpolation.h"
+#include "dsp/linalg.h"
+#include "dsp/singletons.h"
+#include "mengumath.h"
+#include "templates/vecdeque.h"
+
+using namespace Mengu;
+using namespace dsp;
+
+// Overlap-adding with tabulated windows, against evaluating the window function for every sample.
+// Tables made for the overlap size should match it to float precision, and other sizes closely
+
+static constexpr uint32_t FrameSize = 1 << 9;
+static constexpr uint32_t NFrames = 2000;
+
+static std::vector<Complex> make_frame(uint32_t size, float freq) {
+    std::vector<Complex> frame(size);
+    for (uint32_t i = 0; i < size; i++) {
+        frame[i] = Complex(std::sin(freq * i), std::cos(freq * i));
+    }
+    return frame;
+}
+
+// pushes NFrames frames overlapping by overlap_size, and leaves the output in queue
+template<class W>
+static double mix_frames_ns(VecDeque<Complex> &queue, const std::vector<Complex> &frame, uint32_t overlap_size, const W &window) {
+    queue.resize(0);
+    queue.resize(overlap_size, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t f = 0; f < NFrames; f++) {
+        mix_and_extend(queue, frame, overlap_size, window);
+        // keep the queue from growing, like an effect being popped
+        queue.pop_front_many(nullptr, frame.size() - overlap_size);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / NFrames;
+}
+
+static float max_difference(const VecDeque<Complex> &a, const VecDeque<Complex> &b) {
+    float worst = 0.0f;
+    for (uint32_t i = 0; i < MIN(a.size(), b.size()); i++) {
+        worst = MAX(worst, std::abs(a.data()[i] - b.data()[i]));
+    }
+    return worst;
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(2);
+    const std::vector<Complex> frame = make_frame(FrameSize, 0.05f);
+    const WindowTable &table = Singletons::get_singleton()->get_window_table(hann_window, 112);
+
+    std::cout << "-- mix_and_extend of a " << FrameSize << " frame (ns per frame), table made for 112" << std::endl;
+    for (uint32_t overlap_size: {112u, 64u, 300u}) {
+        VecDeque<Complex> by_function;
+        VecDeque<Complex> by_table;
+        const double function_ns = mix_frames_ns(by_function, frame, overlap_size, hann_window);
+        const double table_ns = mix_frames_ns(by_table, frame, overlap_size, table);
+        std::cout << "overlap " << std::setw(3) << overlap_size
+            << "  function " << std::setw(6) << function_ns
+            << "  table " << std::setw(6) << table_ns
+            << std::setprecision(7) << "  max difference " << max_difference(by_function, by_table)
+            << std::setprecision(2) << std::endl;
+    }
+
+    std::cout << "-- compile time table" << std::endl;
+    {
+        constexpr std::array<float, 65> hann_table = make_hann_window_table<64>(0.5);
+        constexpr std::array<float, 65> hamming_table = make_hann_window_table<64>(25.0 / 46.0);
+        float worst = 0.0f;
+        for (uint32_t i = 0; i <= 64; i++) {
+            worst = MAX(worst, std::abs(hann_table[i] - hann_window(i / 64.0f)));
+            worst = MAX(worst, std::abs(hamming_table[i] - hamming_window(i / 64.0f)));
+        }
+        std::cout << std::setprecision(9) << "max difference " << worst << std::setprecision(2) << std::endl;
+    }
+    std::cout << "kernels: " << simd_kernel_name() << std::endl;
+}